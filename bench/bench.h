@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stddef.h>
+
+/* Benchmarks are plain functions which print their
+ * own results through `report`. They are registered
+ * in `bench/main.c`. */
+typedef void (*BenchFn)(void);
+
+/* Monotonic time in seconds. */
+double now(void);
+
+/* Print a benchmark result line. `bytes` may be `0`
+ * if there is no meaningful data size. */
+void report(const char* name, double secs, size_t nitems, const char* items, size_t bytes);
+
+/* Write `len` bytes of `cnt` to a new temporary source file.
+ * `fn` must be a template ending in `XXXXXX.vm`. */
+void write_tmp(char* fn, const char* cnt, size_t len);
+
+#ifndef BENCH_RUNS
+// Each benchmark reports the best of this many runs.
+#define BENCH_RUNS 5
+#endif  // BENCH_RUNS
+
+#endif  // _BENCH_H_
@@ -0,0 +1,65 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+
+extern void bench_scan(void);
+extern void bench_st(void);
+extern void bench_vm(void);
+
+static struct {
+  const char* name;
+  BenchFn fn;
+} benches[] = {
+  { "scan", bench_scan },
+  { "st", bench_st },
+  { "vm", bench_vm },
+  { NULL, NULL },
+};
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void report(const char* name, double secs, size_t nitems, const char* items, size_t bytes) {
+  printf("%-24s %10.3f ms  %12.0f %s/s", name, secs * 1e3, nitems / secs, items);
+  if (bytes > 0)
+    printf("  %9.1f MB/s", bytes / secs / 1e6);
+  printf("\n");
+}
+
+void write_tmp(char* fn, const char* cnt, size_t len) {
+  int fd = mkstemps(fn, 3);
+  assert(fd != -1);
+  size_t nwritten = 0;
+  while (nwritten < len) {
+    ssize_t res = write(fd, cnt + nwritten, len - nwritten);
+    assert(res > 0);
+    nwritten += res;
+  }
+  close(fd);
+}
+
+/* Run all benchmarks or only those named on the command line. */
+int main(int argc, const char* argv[]) {
+  /* Loads must scan and parse every time, not
+   * read whatever is in the user's cache. */
+  setenv("HVME_NO_CACHE", "1", 1);
+
+  for (int i = 0; benches[i].name != NULL; i++) {
+    int run = argc <= 1;
+    for (int j = 1; j < argc; j++) {
+      if (strcmp(argv[j], benches[i].name) == 0)
+        run = 1;
+    }
+    if (run)
+      benches[i].fn();
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include "bench.h"
+
+#include "../src/scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#ifndef BENCH_SCAN_SIZE
+// Size of the generated source file in bytes.
+#define BENCH_SCAN_SIZE (32lu << 20)
+#endif  // BENCH_SCAN_SIZE
+
+/* Generate VM code which looks like compiled Jack:
+ * functions, memory access, calls, labels and comments. */
+static char* gen_source(size_t size, size_t* len) {
+  static const char* lines[] = {
+    "// Comment line as emitted by the reference compiler\n",
+    "function Main.doSomething 4\n",
+    "\tpush argument 0\n",
+    "\tpush constant 17\n",
+    "\tadd\n",
+    "\tpop local 2\n",
+    "\tpush local 2\n",
+    "\tpush that 0\n",
+    "\tpop pointer 1\n",
+    "\tcall Memory.alloc 1\n",
+    "label WHILE_EXP0\n",
+    "\tpush static 3  // trailing comment\n",
+    "\tnot\n",
+    "\tif-goto WHILE_END0\n",
+    "\tgoto WHILE_EXP0\n",
+    "\tpush temp 0\n",
+    "\treturn\n",
+  };
+  size_t nlines = sizeof(lines) / sizeof(lines[0]);
+
+  char* src = (char*) malloc (size + 64);
+  assert(src != NULL);
+  size_t off = 0;
+  for (size_t i = 0; off < size; i++) {
+    size_t llen = strlen(lines[i % nlines]);
+    memcpy(src + off, lines[i % nlines], llen);
+    off += llen;
+  }
+  *len = off;
+  return src;
+}
+
+void bench_scan(void) {
+  size_t len;
+  char* src = gen_source(BENCH_SCAN_SIZE, &len);
+  char fn[] = "/tmp/vmbenchXXXXXX.vm";
+  write_tmp(fn, src, len);
+  free(src);
+
+  double best = 0;
+  size_t ntokens = 0;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    SymPool* syms = new_pool();
+    Tokens tokens = new_tokens(fn, syms);
+    double start = now();
+    int res = scan(&tokens);
+    double secs = now() - start;
+    assert(res == SCAN_OK);
+    ntokens = tokens.idx;
+    del_tokens(tokens);
+    del_pool(syms);
+    if (run == 0 || secs < best)
+      best = secs;
+  }
+
+  report("scan", best, ntokens, "tokens", len);
+  unlink(fn);
+}
@@ -0,0 +1,63 @@
+#include "bench.h"
+
+#include "../src/st.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#ifndef BENCH_ST_SYMS
+// Number of symbols in the table. Far more
+// than even a large Jack program defines.
+#define BENCH_ST_SYMS 200000lu
+#endif  // BENCH_ST_SYMS
+
+void bench_st(void) {
+  SymPool* syms = new_pool();
+  SymId* ids = (SymId*) malloc (BENCH_ST_SYMS * sizeof(SymId));
+  assert(ids != NULL);
+  for (size_t i = 0; i < BENCH_ST_SYMS; i++) {
+    char ident[32];
+    snprintf(ident, sizeof(ident), "Class%zu.WHILE_EXP%zu", i / 16, i % 16);
+    ids[i] = intern_str(syms, ident);
+  }
+
+  double best_insert = 0;
+  double best_lookup = 0;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    SymbolTable st = new_st();
+
+    double start = now();
+    for (size_t i = 0; i < BENCH_ST_SYMS; i++) {
+      InsertResult res = insert_st(&st, mk_key(ids[i], SBT_LABEL), mk_lbval(i));
+      assert(res == INRES_OK);
+      (void) res;
+    }
+    double secs = now() - start;
+    if (run == 0 || secs < best_insert)
+      best_insert = secs;
+
+    // Look up in a different order than inserted.
+    start = now();
+    size_t sum = 0;
+    for (size_t i = 0; i < BENCH_ST_SYMS; i++) {
+      SymVal val;
+      SymKey key = mk_key(ids[(i * 7919) % BENCH_ST_SYMS], SBT_LABEL);
+      GetResult res = get_st(st, &key, &val);
+      assert(res == GTRES_OK);
+      (void) res;
+      sum += val.inst_addr;
+    }
+    secs = now() - start;
+    if (run == 0 || secs < best_lookup)
+      best_lookup = secs;
+    assert(sum == BENCH_ST_SYMS * (BENCH_ST_SYMS - 1) / 2);
+
+    del_st(st);
+  }
+
+  report("st insert", best_insert, BENCH_ST_SYMS, "symbols", 0);
+  report("st lookup", best_lookup, BENCH_ST_SYMS, "symbols", 0);
+  free(ids);
+  del_pool(syms);
+}
@@ -0,0 +1,68 @@
+#include "bench.h"
+
+#include "../src/prog.h"
+#include "../src/exec.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#ifndef BENCH_VM_RUNS
+// Runs of the program per measurement.
+#define BENCH_VM_RUNS 100000lu
+#endif  // BENCH_VM_RUNS
+
+// A short program which writes a static and the heap.
+static const char* src =
+  "function Sys.init 0\n"
+  "push constant 1\n"
+  "pop static 0\n"
+  "push constant 1000\n"
+  "pop pointer 0\n"
+  "push constant 5\n"
+  "pop this 3\n"
+  "push constant 0\n"
+  "return\n";
+
+void bench_vm(void) {
+  char fn[] = "/tmp/XXXXXX.vm";
+  write_tmp(fn, src, strlen(src));
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert(prog != NULL);
+
+  double best_reset = 0;
+  double best_new = 0;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    VmState* vm = new_vm(prog);
+    double start = now();
+    for (size_t i = 0; i < BENCH_VM_RUNS; i++) {
+      reset_vm(vm);
+      int res = exec_prog(vm);
+      assert(res == 0);
+      (void) res;
+    }
+    double secs = now() - start;
+    if (run == 0 || secs < best_reset)
+      best_reset = secs;
+    del_vm(vm);
+
+    // A new state for each run instead.
+    start = now();
+    for (size_t i = 0; i < BENCH_VM_RUNS; i++) {
+      vm = new_vm(prog);
+      int res = exec_prog(vm);
+      assert(res == 0);
+      (void) res;
+      del_vm(vm);
+    }
+    secs = now() - start;
+    if (run == 0 || secs < best_new)
+      best_new = secs;
+  }
+
+  report("vm reset + run", best_reset, BENCH_VM_RUNS, "runs", 0);
+  report("vm new + run", best_new, BENCH_VM_RUNS, "runs", 0);
+  del_prog(prog);
+  unlink(fn);
+}
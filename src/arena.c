@@ -0,0 +1,102 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlk {
+  ArenaBlk* prev;  /* previously filled block. */
+  size_t len;  /* number of usable bytes in `data`. */
+  size_t used;  /* number of bytes handed out from `data`. */
+  max_align_t data[];
+};
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+static inline size_t align_up(size_t size) {
+  return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/* Address right after the last allocation in `blk`. */
+static inline char* blk_top(ArenaBlk* blk) {
+  return (char*) blk->data + blk->used;
+}
+
+Arena new_arena(void) {
+  return (Arena) { .blk = NULL };
+}
+
+void del_arena(Arena arena) {
+  ArenaBlk* blk = arena.blk;
+  while (blk != NULL) {
+    ArenaBlk* prev = blk->prev;
+    free(blk);
+    blk = prev;
+  }
+}
+
+/* Start a new block which can hold at least `size` bytes.
+ * Blocks are `calloc`ed and memory past `used` is kept zero
+ * (see `arena_grow`), so allocations never need a `memset`. */
+static void push_blk(Arena* arena, size_t size) {
+  size_t len = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+  ArenaBlk* blk = (ArenaBlk*) calloc (1, sizeof(ArenaBlk) + len);
+  assert(blk != NULL);
+  blk->prev = arena->blk;
+  blk->len = len;
+  blk->used = 0;
+  arena->blk = blk;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+  assert(arena != NULL);
+
+  size = align_up(size);
+  if (arena->blk == NULL || arena->blk->len - arena->blk->used < size)
+    push_blk(arena, size);
+
+  void* ptr = blk_top(arena->blk);
+  arena->blk->used += size;
+  return ptr;
+}
+
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+  assert(arena != NULL);
+
+  if (ptr == NULL)
+    return arena_alloc(arena, new_size);
+
+  old_size = align_up(old_size);
+  new_size = align_up(new_size);
+  ArenaBlk* blk = arena->blk;
+
+  /* Is `ptr` the most recent allocation? */
+  if (blk != NULL && (char*) ptr + old_size == blk_top(blk)) {
+    size_t start = blk->used - old_size;
+    if (new_size <= old_size) {
+      /* Give the tail back and keep the zero invariant. */
+      memset((char*) ptr + new_size, 0, old_size - new_size);
+      blk->used = start + new_size;
+      return ptr;
+    } else if (blk->len - start >= new_size) {
+      blk->used = start + new_size;
+      return ptr;
+    }
+  }
+
+  if (new_size <= old_size)
+    return ptr;
+
+  void* moved = arena_alloc(arena, new_size);
+  memcpy(moved, ptr, old_size);
+  return moved;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+  assert(s != NULL);
+
+  size_t len = strlen(s);
+  char* copy = (char*) arena_alloc(arena, len + 1);
+  memcpy(copy, s, len);  // Null-terminator is already set.
+  return copy;
+}
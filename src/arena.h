@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#ifndef ARENA_BLOCK_SIZE
+#  ifdef UNIT_TESTS
+// Small blocks so that tests hit the block
+// switching and oversized allocation paths.
+#    define ARENA_BLOCK_SIZE 0x100
+#  else
+#    define ARENA_BLOCK_SIZE 0x10000
+#  endif  // UNIT_TESTS
+#endif  // ARENA_BLOCK_SIZE
+
+typedef struct ArenaBlk ArenaBlk;
+
+/* Bump allocator for data which lives exactly as long as
+ * its owner (e.g. everything loaded into a `ProgramImage`).
+ * Nothing is freed individually; `del_arena` releases
+ * all allocations at once. */
+typedef struct {
+  ArenaBlk* blk;  /* current block; older blocks are chained behind it. */
+} Arena;
+
+Arena new_arena(void);
+
+/* Free all memory allocated from `arena`. */
+void del_arena(Arena arena);
+
+/* Allocate `size` zero-initialized bytes aligned
+ * for any type. Never returns `NULL`. */
+void* arena_alloc(Arena* arena, size_t size);
+
+/* Resize an allocation made by `arena_alloc`. If `ptr` is
+ * the most recent allocation it's grown or shrunk in place.
+ * Otherwise growing copies it to a new location and shrinking
+ * does nothing. New bytes are zero. `ptr` may be `NULL`
+ * if `old_size` is `0`. */
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+/* Copy a null-terminated string into `arena`. */
+char* arena_strdup(Arena* arena, const char* s);
+
+#endif  // _ARENA_H_
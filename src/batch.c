@@ -0,0 +1,278 @@
+#include "batch.h"
+#include "exec.h"
+#include "input.h"
+#include "msg.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BATCH_OK 0
+#define BATCH_ERR 1
+
+// One run of the program.
+typedef struct {
+  char* name;  /* Name of the input inside the input directory. */
+  int ok;
+  char* out;  /* Captured output unless it's written to a file. */
+  size_t out_len;
+  MsgCapture errors;  /* Messages printed by the run. */
+} Case;
+
+// Runs shared between the workers of `run_batch`.
+typedef struct {
+  ProgramImage* prog;
+  BatchOpts opts;
+  Case* cases;
+  unsigned int ncases;
+  atomic_uint next;  /* Index of the next case to run. */
+  int files_root;  /* `opts.files_dir` or `-1`. */
+} Batch;
+
+// `dir/name` followed by `ext`. Free it after use.
+static char* join_path(const char* dir, const char* name, const char* ext) {
+  size_t dir_len = strlen(dir);
+  size_t name_len = strlen(name);
+  size_t ext_len = strlen(ext);
+  char* path = (char*) malloc (dir_len + name_len + ext_len + 2);
+  assert(path != NULL);
+  memcpy(path, dir, dir_len);
+  path[dir_len] = '/';
+  memcpy(path + dir_len + 1, name, name_len);
+  memcpy(path + dir_len + 1 + name_len, ext, ext_len + 1);
+  return path;
+}
+
+static int cmp_cases(const void* a, const void* b) {
+  return strcmp(((const Case*) a)->name, ((const Case*) b)->name);
+}
+
+/* Find the inputs in `dir`: all regular files whose names
+ * don't start with a dot, sorted by name. Returns `NULL` and
+ * prints an error if the directory can't be read. */
+static Case* find_cases(const char* dir, unsigned int* ncases) {
+  DIR* d = opendir(dir);
+  if (d == NULL) {
+    errf("can't read directory `%s`", dir);
+    return NULL;
+  }
+
+  Case* cases = NULL;
+  unsigned int len = 0;
+  unsigned int cap = 0;
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    struct stat sb;
+    char* path = join_path(dir, ent->d_name, "");
+    int is_reg = stat(path, &sb) == 0 && S_ISREG(sb.st_mode);
+    free(path);
+    if (!is_reg)
+      continue;
+
+    if (len == cap) {
+      cap = cap == 0 ? 16 : cap * 2;
+      cases = (Case*) realloc (cases, cap * sizeof(Case));
+      assert(cases != NULL);
+    }
+    cases[len++] = (Case) { .name=strdup(ent->d_name) };
+    assert(cases[len - 1].name != NULL);
+  }
+  closedir(d);
+
+  if (len == 0) {
+    errf("directory `%s` doesn't contain any inputs", dir);
+    return NULL;
+  }
+
+  qsort(cases, len, sizeof(Case), cmp_cases);
+  *ncases = len;
+  return cases;
+}
+
+/* Run the program once with the input `c`. Everything it
+ * prints to stderr is captured in `c->errors`. */
+static void run_case(Batch* batch, VmState* vm, Case* c) {
+  begin_capture(&c->errors);
+
+  char* in_fn = join_path(batch->opts.in_dir, c->name, "");
+  char* out_fn = batch->opts.out_dir != NULL
+    ? join_path(batch->opts.out_dir, c->name, ".out")
+    : NULL;
+
+  int fd = open(in_fn, O_RDONLY);
+  FILE* stream = out_fn != NULL
+    ? fopen(out_fn, "w")
+    : open_memstream(&c->out, &c->out_len);
+  if (fd == -1) {
+    errf("can't read input `%s`", in_fn);
+  } else if (stream == NULL) {
+    errf("can't write output `%s`", out_fn);
+  } else {
+    Input in = new_input(fd);
+    Output* out = new_output(stream);
+    vm->in = &in;
+    vm->out = out;
+
+    c->ok = exec_prog(vm) == 0;
+    /* End the output with a newline like a single run would. */
+    if (out->last != '\n' && out->last != '\0')
+      out_char(out, '\n');
+
+    reset_vm(vm);
+    del_output(out);
+    del_input(&in);
+  }
+
+  if (stream != NULL && fclose(stream) != 0) {
+    errf("can't write output `%s`", out_fn);
+    c->ok = 0;
+  }
+  if (fd != -1)
+    close(fd);
+  free(out_fn);
+  free(in_fn);
+
+  end_capture(&c->errors);
+}
+
+static void* batch_worker(void* arg) {
+  Batch* batch = (Batch*) arg;
+
+  /* Each worker runs all its cases with one state. */
+  VmState* vm = new_vm(batch->prog);
+  vm->host.access = batch->files_root != -1 ? HOST_BENEATH : HOST_NOWHERE;
+  vm->host.root = batch->files_root;
+  unsigned int i;
+  while ((i = atomic_fetch_add(&batch->next, 1)) < batch->ncases)
+    run_case(batch, vm, &batch->cases[i]);
+  del_vm(vm);
+
+  return NULL;
+}
+
+static void out_str(Output* out, const char* s) {
+  out_bytes(out, s, strlen(s));
+}
+
+/* Print the `len` bytes at `s` as a JSON string. */
+static void out_json_str(Output* out, const char* s, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+
+  out_char(out, '"');
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char) s[i];
+    if (c == '"' || c == '\\') {
+      out_char(out, '\\');
+      out_char(out, (char) c);
+    } else if (c == '\n') {
+      out_str(out, "\\n");
+    } else if (c == '\t') {
+      out_str(out, "\\t");
+    } else if (c < 0x20 || c == 0x7f) {
+      char esc[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+      out_bytes(out, esc, sizeof(esc));
+    } else {
+      out_char(out, (char) c);
+    }
+  }
+  out_char(out, '"');
+}
+
+static void print_summary(const Case* cases, unsigned int ncases) {
+  Output* out = std_output();
+
+  out_char(out, '[');
+  for (unsigned int i = 0; i < ncases; i++) {
+    const Case* c = &cases[i];
+    out_str(out, i == 0 ? "\n  {\"input\": " : ",\n  {\"input\": ");
+    out_json_str(out, c->name, strlen(c->name));
+    out_str(out, c->ok ? ", \"ok\": true" : ", \"ok\": false");
+    out_str(out, ", \"stdout\": ");
+    out_json_str(out, c->out, c->out_len);
+    out_str(out, ", \"stderr\": ");
+    out_json_str(out, c->errors.buf, c->errors.len);
+    out_char(out, '}');
+  }
+  out_str(out, "\n]\n");
+  flush_out(out);
+}
+
+/* Write the messages of the failed case `c` to `NAME.err`. */
+static void write_errors(const char* out_dir, const Case* c) {
+  char* err_fn = join_path(out_dir, c->name, ".err");
+  FILE* f = fopen(err_fn, "w");
+  int res = f != NULL
+    && fwrite(c->errors.buf, 1, c->errors.len, f) == c->errors.len;
+  if (f != NULL && fclose(f) != 0)
+    res = 0;
+  if (!res)
+    errf("can't write `%s`", err_fn);
+  free(err_fn);
+}
+
+int run_batch(ProgramImage* prog, BatchOpts opts) {
+  assert(prog != NULL);
+  assert(opts.in_dir != NULL);
+
+  Batch batch = { .prog=prog, .opts=opts, .files_root=-1 };
+  if (opts.files_dir != NULL) {
+    batch.files_root = open(opts.files_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (batch.files_root == -1) {
+      errf("can't open directory `%s`", opts.files_dir);
+      return BATCH_ERR;
+    }
+  }
+  batch.cases = find_cases(opts.in_dir, &batch.ncases);
+  if (batch.cases == NULL) {
+    if (batch.files_root != -1)
+      close(batch.files_root);
+    return BATCH_ERR;
+  }
+  atomic_init(&batch.next, 0);
+
+  unsigned int nworkers = opts.njobs < batch.ncases ? opts.njobs : batch.ncases;
+  pthread_t* threads = (pthread_t*) calloc (nworkers + 1, sizeof(pthread_t));
+  assert(threads != NULL);
+
+  /* The calling thread is a worker as well. If a thread
+   * can't be started, the others just get more runs. */
+  unsigned int nthreads = 0;
+  for (unsigned int w = 1; w < nworkers; w++) {
+    if (pthread_create(&threads[nthreads], NULL, batch_worker, &batch) == 0)
+      nthreads++;
+  }
+  batch_worker(&batch);
+  for (unsigned int t = 0; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+  free(threads);
+  if (batch.files_root != -1)
+    close(batch.files_root);
+
+  if (opts.out_dir == NULL)
+    print_summary(batch.cases, batch.ncases);
+
+  int res = BATCH_OK;
+  for (unsigned int i = 0; i < batch.ncases; i++) {
+    Case* c = &batch.cases[i];
+    if (!c->ok) {
+      res = BATCH_ERR;
+      if (opts.out_dir != NULL)
+        write_errors(opts.out_dir, c);
+    }
+    drop_capture(&c->errors);
+    free(c->out);
+    free(c->name);
+  }
+  free(batch.cases);
+
+  return res;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "prog.h"
+
+/* Running one loaded program against many inputs (`--batch`).
+ * Each regular file in the input directory is the input of one
+ * run. Runs share the program and have a `VmState`, input and
+ * output of their own, so they are spread over worker threads. */
+
+typedef struct {
+  const char* in_dir;  /* Directory of input files. */
+  /* Directory to write `NAME.out` (the output) and, if the run
+   * failed, `NAME.err` (the error messages) to for each input
+   * `NAME`. If `NULL`, a JSON summary is printed instead. */
+  const char* out_dir;
+  unsigned int njobs;  /* Runs at the same time. */
+  /* Directory the runs may open files in (see `HostFiles`).
+   * If `NULL`, they can't open any files. */
+  const char* files_dir;
+} BatchOpts;
+
+/* Run `prog` once for each input in `opts.in_dir`. The JSON summary
+ * is an array with an object `{"input", "ok", "stdout", "stderr"}`
+ * for each input in the order of their names. `prog` must be loaded
+ * completely (not lazily or pipelined). Returns `0` if every run
+ * succeeded. */
+int run_batch(ProgramImage* prog, BatchOpts opts);
+
+#endif  // _BATCH_H_
@@ -0,0 +1,177 @@
+#include "cache.h"
+#include "image.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline int make_dir(const char* dir) {
+  return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+/* Write the cache directory to `dir` and create it if
+ * it doesn't exist. Returns `0` if there is none. */
+static int cache_dir(char* dir, size_t len) {
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  int n;
+
+  /* Relative paths in `XDG_CACHE_HOME` are invalid and must be ignored. */
+  if (xdg != NULL && xdg[0] == '/') {
+    n = snprintf(dir, len, "%s", xdg);
+  } else if (home != NULL && home[0] != '\0') {
+    n = snprintf(dir, len, "%s/.cache", home);
+  } else {
+    return 0;
+  }
+  if (n < 0 || (size_t) n >= len || !make_dir(dir))
+    return 0;
+
+  size_t dir_len = (size_t) n;
+  n = snprintf(dir + dir_len, len - dir_len, "/hvme");
+  return n > 0 && (size_t) n < len - dir_len && make_dir(dir);
+}
+
+char* cache_entry(const char* src, size_t len) {
+  assert(src != NULL);
+
+  const char* disable = getenv(CACHE_DISABLE);
+  if (disable != NULL && disable[0] != '\0')
+    return NULL;
+
+  uint64_t hash = image_hash((const unsigned char*) src, len);
+
+  char dir[PATH_MAX];
+  if (!cache_dir(dir, sizeof(dir)))
+    return NULL;
+
+  /* The format version and instruction size are part of
+   * the name so that different builds of hvme sharing a
+   * cache don't keep replacing each other's entries. */
+  char path[PATH_MAX];
+  int n = snprintf(path, sizeof(path), "%s/%016" PRIx64 "-%zx-v%d-%zu" IMAGE_EXT,
+    dir, hash, len, IMAGE_VERSION, sizeof(Inst));
+  if (n < 0 || (size_t) n >= sizeof(path))
+    return NULL;
+
+  return strdup(path);
+}
+
+int cache_load(const char* entry, const char* src, size_t len,
+               File* file, Arena* arena, SymPool* syms) {
+  assert(entry != NULL);
+  assert(src != NULL);
+  assert(file != NULL);
+  assert(file->filename != NULL);
+  assert(arena != NULL);
+
+  /* Entries keep the source they were made from. It
+   * must match, not just hash to the same name. */
+  if (read_file_image(entry, src, len, file, arena, syms) != IMAGE_OK)
+    return CACHE_MISS;
+
+  /* Pruning goes by the modification time. */
+  utimensat(AT_FDCWD, entry, NULL, 0);
+  return CACHE_HIT;
+}
+
+typedef struct {
+  char name[NAME_MAX + 1];
+  off_t size;
+  struct timespec mtime;
+} CachedFile;
+
+static int older_first(const void* a, const void* b) {
+  const struct timespec* x = &((const CachedFile*) a)->mtime;
+  const struct timespec* y = &((const CachedFile*) b)->mtime;
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  if (x->tv_nsec != y->tv_nsec)
+    return x->tv_nsec < y->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/* Remove the entries in `dir` which this build of hvme can't
+ * use and the least recently used ones beyond `max_size` bytes.
+ * Half-written entries of other processes aren't touched. */
+void prune_cache(const char* dir, uint64_t max_size) {
+  DIR* d = opendir(dir);
+  if (d == NULL)
+    return;
+  int dfd = dirfd(d);
+
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), "-v%d-%zu" IMAGE_EXT, IMAGE_VERSION, sizeof(Inst));
+  size_t suffix_len = strlen(suffix);
+
+  CachedFile* files = NULL;
+  size_t nfiles = 0;
+  size_t cap = 0;
+  uint64_t total = 0;
+  struct dirent* de;
+  while ((de = readdir(d)) != NULL) {
+    size_t name_len = strlen(de->d_name);
+    if (name_len <= sizeof(IMAGE_EXT) - 1
+        || strcmp(de->d_name + name_len - (sizeof(IMAGE_EXT) - 1), IMAGE_EXT) != 0)
+      continue;
+    if (name_len < suffix_len
+        || strcmp(de->d_name + name_len - suffix_len, suffix) != 0) {
+      // An entry of another format or build.
+      unlinkat(dfd, de->d_name, 0);
+      continue;
+    }
+
+    struct stat sb;
+    if (fstatat(dfd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(sb.st_mode))
+      continue;
+    if (nfiles == cap) {
+      cap = cap == 0 ? 64 : cap * 2;
+      files = (CachedFile*) realloc (files, cap * sizeof(CachedFile));
+      assert(files != NULL);
+    }
+    CachedFile* f = &files[nfiles++];
+    memcpy(f->name, de->d_name, name_len + 1);
+    f->size = sb.st_size;
+    f->mtime = sb.st_mtim;
+    total += (uint64_t) sb.st_size;
+  }
+
+  if (total > max_size) {
+    qsort(files, nfiles, sizeof(CachedFile), older_first);
+    for (size_t i = 0; i < nfiles && total > max_size; i++) {
+      if (unlinkat(dfd, files[i].name, 0) == 0)
+        total -= (uint64_t) files[i].size;
+    }
+  }
+
+  free(files);
+  closedir(d);
+}
+
+void cache_store(const char* entry, const char* src, size_t len,
+                 const File* file, const SymPool* syms) {
+  assert(entry != NULL);
+  assert(src != NULL);
+  assert(file != NULL);
+
+  if (write_file_image(file, syms, src, len, entry) == IMAGE_ERR)
+    return;
+
+  /* Loading a program stores many entries at once,
+   * possibly on many threads. Pruning once is enough. */
+  static atomic_flag pruned = ATOMIC_FLAG_INIT;
+  if (!atomic_flag_test_and_set(&pruned)) {
+    char dir[PATH_MAX];
+    if (cache_dir(dir, sizeof(dir)))
+      prune_cache(dir, CACHE_MAX_SIZE);
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include "prog.h"
+
+/* On-disk cache of loaded source files. Each entry is a
+ * single-file image (see `image.h`) named after a hash of
+ * the source's contents and the image format, so unchanged
+ * files are read back instead of being scanned and parsed.
+ * Entries keep a copy of their source and are only used if
+ * it matches the file byte by byte, so two sources with the
+ * same hash never share an entry.
+ *
+ * Entries live in `$XDG_CACHE_HOME/hvme` (or `~/.cache/hvme`).
+ * Setting `HVME_NO_CACHE` to anything turns the cache off.
+ *
+ * Using an entry marks it as recently used. Once per process,
+ * after the first entry is written, entries of other image
+ * formats are removed, and the least recently used entries
+ * are removed until the rest fit into `CACHE_MAX_SIZE`. */
+
+#define CACHE_DISABLE "HVME_NO_CACHE"
+
+#ifndef CACHE_MAX_SIZE
+#  define CACHE_MAX_SIZE (256ul << 20)
+#endif  // CACHE_MAX_SIZE
+
+#define CACHE_MISS 0
+#define CACHE_HIT 1
+
+/* Path of the entry for the source of `len` bytes at `src`
+ * or `NULL` if the cache is off. The path must be freed with
+ * `free`. */
+char* cache_entry(const char* src, size_t len);
+
+/* Read `file` from `entry` allocating from `arena` and
+ * interning its identifiers into `syms`. `file->filename`
+ * must already be set. It's a miss unless the entry was
+ * made from the `len` bytes at `src`. */
+int cache_load(const char* entry, const char* src, size_t len,
+               File* file, Arena* arena, SymPool* syms);
+
+/* Store `file`, whose identifiers are in `syms`, and the
+ * `len` bytes at `src` it was parsed from as `entry`. Failing
+ * to do so isn't an error. */
+void cache_store(const char* entry, const char* src, size_t len,
+                 const File* file, const SymPool* syms);
+
+#endif  // _CACHE_H_
@@ -3,6 +3,7 @@
 #include "st.h"
 #include "msg.h"
 #include "parse.h"
+#include "input.h"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -11,90 +12,133 @@
 
 #define BIT16_LIMIT 65535
 
-/* Execution error return location. */
-static jmp_buf exec_env;
+/* Execution error return location of the
+ * program the current thread executes. */
+static _Thread_local jmp_buf* exec_env = NULL;
+
+/* State the current thread executes. Instructions of images
+ * don't point to their filename (see `image.h`), so errors
+ * take it from the file that's running. */
+static _Thread_local const VmState* exec_vm = NULL;
+
+static inline Pos exec_pos(Pos pos) {
+  if (pos.filename == NULL)
+    pos.filename = exec_vm->file->filename;
+  return pos;
+}
 
 /* Errors (some of them are used more than once so
  * they are defined here to avoid different spelling
- * of the same error or something similar). */
+ * of the same error or something similar). The
+ * instructions named in address errors never
+ * contain identifiers. */
 
-#define STACK_UNDERFLOW_ERROR(pos) { \
-  perr((pos), "stack underflow");    \
-  longjmp(exec_env, EXEC_ERR);       \
+#define STACK_UNDERFLOW_ERROR(pos) {      \
+  perr(exec_pos(pos), "stack underflow"); \
+  longjmp(*exec_env, EXEC_ERR);           \
 }
-#define POINTER_SEGMENT_ERROR(addr, pos) {        \
-  perrf((pos), "can't access pointer segment at " \
-       "`%lu` (max. index is 1)", (addr));        \
-  longjmp(exec_env, EXEC_ERR);                    \
+#define POINTER_SEGMENT_ERROR(addr, pos) {                \
+  perrf(exec_pos(pos), "can't access pointer segment at " \
+       "`%lu` (max. index is 1)", (addr));                \
+  longjmp(*exec_env, EXEC_ERR);                           \
 }
-#define HEAP_ADDR_OVERFLOW_ERROR(instp, addr) { \
-  INST_STR(inst_str_buf, (instp));         \
-  perrf((instp)->pos, "address overflow: " \
-        "`%s` tries to access heap at %lu", \
-        inst_str_buf, (addr));             \
-  longjmp(exec_env, EXEC_ERR);             \
+#define HEAP_ADDR_OVERFLOW_ERROR(instp, addr) {      \
+  INST_STR(inst_str_buf, NULL, (instp));             \
+  perrf(exec_pos((instp)->pos), "address overflow: " \
+        "`%s` tries to access heap at %lu",          \
+        inst_str_buf, (addr));                       \
+  longjmp(*exec_env, EXEC_ERR);                      \
 }
 #define STACK_ADDR_OVERFLOW_ERROR(instp, addr, max_addr) { \
-  INST_STR(inst_str_buf, (instp));                         \
-  perrf((instp)->pos, "stack address overflow: "           \
+  INST_STR(inst_str_buf, NULL, (instp));                   \
+  perrf(exec_pos((instp)->pos), "stack address overflow: " \
         "`%s` tries to access stack "                      \
        "at %lu (limit is at %lu)",                         \
         inst_str_buf, (addr), (max_addr));                 \
-  longjmp(exec_env, EXEC_ERR);                             \
-}
-#define SEG_OVERFLOW_ERROR(instp, offset) {                 \
-  INST_STR(inst_str_buf, (instp));                          \
-  perrf((instp)->pos, "address overflow in `%s`: "          \
-        "segment has %lu entries", inst_str_buf, (offset)); \
-  longjmp(exec_env, EXEC_ERR);                              \
-}
-#define ADD_OVERFLOW_ERROR(x, y, sum, pos) {           \
-  perrf((pos), "addition overflow: %d + %d = %d > %d", \
-    (x), (y), (sum), BIT16_LIMIT);                     \
-  longjmp(exec_env, EXEC_ERR);                         \
-}
-#define SUB_UNDERFLOW_ERROR(x, y, pos) {                  \
-  int diff = (int) (x) - (int) (y);                       \
-  perrf((pos), "subtraction underflow: %d - %d = %d < 0", \
-    (x), (y), diff);                                      \
-  longjmp(exec_env, EXEC_ERR);                            \
-}
-#define CTRL_FLOW_ERROR(ident, pos) {                 \
-  if (strcmp((ident), "Sys.init") == 0) {             \
-    perr((pos), "can't jump to function `Sys.init`; " \
-    "Write it!");                                     \
-  } else {                                            \
-    perrf((pos), "can't jump to %s",                  \
-      (ident));                                       \
-  }                                                   \
-  longjmp(exec_env, EXEC_ERR);                        \
-}
-#define NARGS_ERROR(nargs, sp, pos) {                           \
-  perrf((pos), "given number of stack arguments (%d) is wrong." \
-    " There are only %lu elements on the stack!",               \
-    (nargs), (sp));                                             \
-  longjmp(exec_env, EXEC_ERR);                                  \
-}
-#define READ_IO_ERROR(pos) {               \
-  perr((pos), "system read failed."); \
-  longjmp(exec_env, EXEC_ERR);             \
-}
-#define DEF_ERR(key, pos) {                        \
-  perrf((pos), "can't jump to %s %s because it's " \
-    "defined multiple times",                      \
-    key_type_name((key).type), (key).ident);       \
-  longjmp(exec_env, EXEC_ERR);                     \
-}
-#define READ_NUM_CHAR_ERROR(pos) {             \
-  perr((pos), "invalid input, `Sys.read_num` " \
-    "only accepts digits.");                   \
-  longjmp(exec_env, EXEC_ERR);                 \
-}
-#define READ_NUM_OVERFLOW_ERROR(pos, num) {               \
-  perrf((pos), "number %d read by `Sys.read_num` "        \
-    "is too large. The limit is %d", (num), BIT16_LIMIT); \
-  longjmp(exec_env, EXEC_ERR);                            \
+  longjmp(*exec_env, EXEC_ERR);                            \
+}
+#define SEG_OVERFLOW_ERROR(instp, offset) {                  \
+  INST_STR(inst_str_buf, NULL, (instp));                     \
+  perrf(exec_pos((instp)->pos), "address overflow in `%s`: " \
+        "segment has %lu entries", inst_str_buf, (offset));  \
+  longjmp(*exec_env, EXEC_ERR);                              \
+}
+#define ADD_OVERFLOW_ERROR(x, y, sum, pos) {                   \
+  perrf(exec_pos(pos), "addition overflow: %d + %d = %d > %d", \
+    (x), (y), (sum), BIT16_LIMIT);                             \
+  longjmp(*exec_env, EXEC_ERR);                                \
+}
+#define SUB_UNDERFLOW_ERROR(x, y, pos) {                          \
+  int diff = (int) (x) - (int) (y);                               \
+  perrf(exec_pos(pos), "subtraction underflow: %d - %d = %d < 0", \
+    (x), (y), diff);                                              \
+  longjmp(*exec_env, EXEC_ERR);                                   \
+}
+#define CTRL_FLOW_ERROR(ident, pos) {                         \
+  if (strcmp((ident), "Sys.init") == 0) {                     \
+    perr(exec_pos(pos), "can't jump to function `Sys.init`; " \
+    "Write it!");                                             \
+  } else {                                                    \
+    perrf(exec_pos(pos), "can't jump to %s",                  \
+      (ident));                                               \
+  }                                                           \
+  longjmp(*exec_env, EXEC_ERR);                               \
+}
+#define NARGS_ERROR(nargs, sp, pos) {                                   \
+  perrf(exec_pos(pos), "given number of stack arguments (%d) is wrong." \
+    " There are only %lu elements on the stack!",                       \
+    (nargs), (sp));                                                     \
+  longjmp(*exec_env, EXEC_ERR);                                         \
+}
+#define READ_IO_ERROR(pos) {                  \
+  perr(exec_pos(pos), "system read failed."); \
+  longjmp(*exec_env, EXEC_ERR);               \
+}
+#define READ_NUM_CHAR_ERROR(pos) {                     \
+  perr(exec_pos(pos), "invalid input, `Sys.read_num` " \
+    "only accepts digits.");                           \
+  longjmp(*exec_env, EXEC_ERR);                        \
+}
+#define READ_NUM_OVERFLOW_ERROR(pos, num) {                \
+  perrf(exec_pos(pos), "number %d read by `Sys.read_num` " \
+    "is too large. The limit is %d", (num), BIT16_LIMIT);  \
+  longjmp(*exec_env, EXEC_ERR);                            \
+}
+
+#define FILE_HANDLE_ERROR(pos, handle) {                            \
+  perrf(exec_pos(pos), "no file is open with handle %d", (handle)); \
+  longjmp(*exec_env, EXEC_ERR);                                     \
+}
+#define FILE_MODE_ERROR(pos, mode) {                          \
+  perrf(exec_pos(pos), "invalid mode %d to open a file. "     \
+    "Use 0 to read, 1 to write and 2 to append", (mode));     \
+  longjmp(*exec_env, EXEC_ERR);                               \
+}
+#define FILE_ACCESS_ERROR(pos, handle, reading) {                   \
+  perrf(exec_pos(pos), "the file with handle %d isn't open for %s", \
+    (handle), (reading) ? "reading" : "writing");                   \
+  longjmp(*exec_env, EXEC_ERR);                                     \
+}
+#define WRITE_IO_ERROR(pos) {                  \
+  perr(exec_pos(pos), "system write failed."); \
+  longjmp(*exec_env, EXEC_ERR);                \
 }
+#define BUDGET_ERROR(pos, budget) {                            \
+  perrf(exec_pos(pos), "instruction budget of %lu is used up", \
+    (unsigned long) (budget));                                 \
+  longjmp(*exec_env, EXEC_BUDGET);                             \
+}
+#define TIMEOUT_ERROR(pos) {                  \
+  perr(exec_pos(pos), "time limit exceeded"); \
+  longjmp(*exec_env, EXEC_TIMEOUT);           \
+}
+#define STOPPED_ERROR(pos) {                  \
+  perr(exec_pos(pos), "the run was stopped"); \
+  longjmp(*exec_env, EXEC_STOPPED);           \
+}
+
+/* Instructions between checks of the deadline and `stop`. */
+#define DEADLINE_STEPS 0x10000
 
 void exec_pop(Inst inst, Stack* stack, Heap* heap, Memory* mem) {
   assert(stack != NULL);
@@ -144,6 +188,7 @@ void exec_pop(Inst inst, Stack* stack, Heap* heap, Memory* mem) {
       if (offset < MEM_STAT_SIZE) {
         if (!spop(stack, &mem->_static[offset]))
           STACK_UNDERFLOW_ERROR(inst.pos);
+        mem->dirty = 1;
       } else {
         SEG_OVERFLOW_ERROR(&inst, MEM_STAT_SIZE);
       }
@@ -156,7 +201,7 @@ void exec_pop(Inst inst, Stack* stack, Heap* heap, Memory* mem) {
       }
       break;
     case THIS:
-      if (offset + heap->_this <= MEM_HEAP_SIZE) {
+      if (offset + heap->_this < MEM_HEAP_SIZE) {
         // If we land here, then `offset + heap->_this` fits
         // a `uint16_t`.
         Word val;
@@ -167,7 +212,7 @@ void exec_pop(Inst inst, Stack* stack, Heap* heap, Memory* mem) {
       }
       break;
     case THAT:
-      if (offset + heap->that <= MEM_HEAP_SIZE) {
+      if (offset + heap->that < MEM_HEAP_SIZE) {
         Word val;
         if (!spop(stack, &val)) STACK_UNDERFLOW_ERROR(inst.pos);
         heap_set(*heap, (Addr)(offset + heap->that), val);
@@ -190,6 +235,7 @@ void exec_pop(Inst inst, Stack* stack, Heap* heap, Memory* mem) {
       if (offset < MEM_TEMP_SIZE) {
         if (!spop(stack, &mem->tmp[offset]))
           STACK_UNDERFLOW_ERROR(inst.pos);
+        mem->dirty = 1;
       } else {
         SEG_OVERFLOW_ERROR(&inst, MEM_TEMP_SIZE)
       }
@@ -246,14 +292,14 @@ void exec_push(Inst inst, Stack* stack, Heap* heap, Memory* mem) {
       spush(stack, (Word) inst.mem.offset);  // `Word` is `uint16_t`.
       return;
     case THIS:
-      if (offset + heap->_this <= MEM_HEAP_SIZE) {
+      if (offset + heap->_this < MEM_HEAP_SIZE) {
         spush(stack, heap_get(*heap, (Addr)(offset + heap->_this)));
       } else {
         HEAP_ADDR_OVERFLOW_ERROR(&inst, offset + heap->_this);        
       }
       break;
     case THAT:
-      if (offset + heap->that <= MEM_HEAP_SIZE) {
+      if (offset + heap->that < MEM_HEAP_SIZE) {
         spush(stack, heap_get(*heap, (Addr)(offset + heap->that)));
       } else {
         HEAP_ADDR_OVERFLOW_ERROR(&inst, offset + heap->that);        
@@ -424,78 +470,65 @@ static inline void exec_gt(Stack* stack, Pos pos) {
 }
 
 /* Get the currently active file */
-#define active_file(prog) (prog->files[prog->fi])
+#define active_file(vm) (*vm->file)
 
 /* Get current instruction */
-#define active_inst(prog) (prog->files[prog->fi].insts.cell[prog->files[prog->fi].ei])
+#define active_inst(vm) (active_file(vm).insts.cell[vm->ei])
+
+static inline Input* vm_in(const VmState* vm) {
+  return vm->in != NULL ? vm->in : std_input();
+}
+
+static inline Output* vm_out(const VmState* vm) {
+  return vm->out != NULL ? vm->out : std_output();
+}
 
 #define JMP_OK 1
 #define JMP_ERR 0
-#define JMP_MULT_DEF -1
-
-static int jump_to(Program* prog, SymKey key, SymVal* val) {
-  assert(prog != NULL);
+// The function or its file couldn't be loaded. The parser printed why.
+#define JMP_LOAD_ERR -1
+
+/* Labels are local to their file. Functions are looked
+ * up in the program's index of all functions and are
+ * parsed first if their file is loaded lazily. */
+static int jump_to(VmState* vm, SymKey key, SymVal* val) {
+  assert(vm != NULL);
   assert(val != NULL);
 
-  GetResult get_res = get_st(active_file(prog).st, &key, val);
-
-  if (get_res == GTRES_OK) {
-    /* Change instruction in active file. */
-    active_file(prog).ei = val->inst_addr - 1;
-    return JMP_OK;
-  } else {
-    unsigned int prev_fi = prog->fi;
-    unsigned int next_ei_buf = 0;
-    unsigned int next_fi_buf = 0;
-    unsigned int ndefs = 0;
-    for (unsigned int next_fi = 0; next_fi < prog->nfiles; next_fi++) {
-      /* Don't re-check the active file. */
-      if (prev_fi != next_fi) {
-        if (get_st(prog->files[next_fi].st, &key, val) == GTRES_OK) {
-          /* Copy new position values for later. */
-          next_fi_buf = next_fi;
-          next_ei_buf = val->inst_addr - 1;
-          /* Continue if we just found the first definition
-           * or break if there are multiple definitions. */
-          ndefs++;
-          if (ndefs > 1) break;
-        }
+  if (key.type == SBT_FUNC) {
+    if (get_st(vm->prog->funcs, &key, val) != GTRES_OK) {
+      /* Its file may still be loading. */
+      switch (await_func(vm->prog, key, val)) {
+        case AWAIT_MISSING:
+          return JMP_ERR;
+        case AWAIT_ERR:
+          return JMP_LOAD_ERR;
       }
     }
-
-    /* How many definitions did we find? */
-    switch (ndefs) {
-      case 0:
-        /* The function doesn't exist anywhere. */
-        return JMP_ERR;
-      case 1:
-        /* We found the one definition we need.
-         * Go there! */
-        prog->fi             = next_fi_buf;
-        active_file(prog).ei = next_ei_buf;
-        return JMP_OK;
-      default:
-        /* There is more than one definition. */
-        return JMP_MULT_DEF;
-    }
+    if (val->inst_addr >= LAZY_ADDR && !load_func(vm->prog, key, val))
+      return JMP_LOAD_ERR;
+    vm->fi = val->fi;
+    vm->file = &vm->prog->files[vm->fi];
+  } else if (get_st(active_file(vm).st, &key, val) != GTRES_OK) {
+    return JMP_ERR;
   }
+
+  vm->ei = val->inst_addr - 1;
+  return JMP_OK;
 }
 
-static inline void exec_goto(Program* prog, Pos pos) {
-  assert(prog != NULL);
+static inline void exec_goto(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
   SymVal val;
   SymKey key = mk_key(
-    active_file(prog).insts.cell[active_file(prog).ei].ident,
+    active_file(vm).insts.cell[vm->ei].ident,
     SBT_LABEL
   );
 
-  switch (jump_to(prog, key, &val)) {
+  switch (jump_to(vm, key, &val)) {
     case JMP_ERR:
-      CTRL_FLOW_ERROR(key.ident, pos);
-      break;
-    case JMP_MULT_DEF:
-      DEF_ERR(key, pos);
+      CTRL_FLOW_ERROR(sym_name(vm->prog->syms, key.ident), pos);
       break;
     default:
       /* Else: everything went well. */
@@ -503,11 +536,11 @@ static inline void exec_goto(Program* prog, Pos pos) {
   }
 }
 
-static inline void exec_if_goto(Program* prog, Pos pos) {
-  assert(prog != NULL);
+static inline void exec_if_goto(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
   Word val;
-  if (!spop(&prog->stack, &val))
+  if (!spop(&vm->stack, &val))
     STACK_UNDERFLOW_ERROR(pos);
 
   /* Jump if topmost value is true. */
@@ -515,19 +548,15 @@ static inline void exec_if_goto(Program* prog, Pos pos) {
   if (val != FALSE) {
     SymVal val;
     SymKey key = mk_key(
-      active_file(prog).insts.cell[active_file(prog).ei].ident,
+      active_file(vm).insts.cell[vm->ei].ident,
       SBT_LABEL
     );
 
     /* `val` is restored on error. */
-    switch (jump_to(prog, key, &val)) {
+    switch (jump_to(vm, key, &val)) {
       case JMP_ERR:
-        prog->stack.sp ++;
-        CTRL_FLOW_ERROR(key.ident, pos);
-        break;
-      case JMP_MULT_DEF:
-        prog->stack.sp ++;
-        DEF_ERR(key, pos);
+        vm->stack.sp ++;
+        CTRL_FLOW_ERROR(sym_name(vm->prog->syms, key.ident), pos);
         break;
       default:
         /* Else: everything went well. */
@@ -536,28 +565,51 @@ static inline void exec_if_goto(Program* prog, Pos pos) {
   }
 }
 
-static inline void exec_call(Program* prog, Pos pos) {
-  assert(prog != NULL);
+/* Continue in the next function of a lazily loaded file. */
+static inline void exec_func_end(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  SymVal val;
+  SymKey key = mk_key(
+    active_file(vm).insts.cell[vm->ei].ident,
+    SBT_FUNC
+  );
+
+  switch (jump_to(vm, key, &val)) {
+    case JMP_ERR:
+      CTRL_FLOW_ERROR(sym_name(vm->prog->syms, key.ident), pos);
+      break;
+    case JMP_LOAD_ERR:
+      longjmp(*exec_env, EXEC_ERR);
+      break;
+    default:
+      /* Else: everything went well. */
+      break;
+  }
+}
+
+static inline void exec_call(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
-  const char* ident = active_file(prog).insts.cell[active_file(prog).ei].ident;
-  Word nargs = active_file(prog).insts.cell[active_file(prog).ei].nargs;
-  Stack* stack = &prog->stack;
-  Heap* heap = &prog->heap;
+  SymId ident = active_file(vm).insts.cell[vm->ei].ident;
+  Word nargs = active_file(vm).insts.cell[vm->ei].nargs;
+  Stack* stack = &vm->stack;
+  Heap* heap = &vm->heap;
 
-  Addr ret_ei = active_file(prog).ei;
-  Addr ret_fi = prog->fi;
+  Addr ret_ei = vm->ei;
+  Addr ret_fi = vm->fi;
 
   if (nargs > stack->sp)
     NARGS_ERROR(nargs, stack->sp, pos);
 
   SymVal val;
   SymKey key = mk_key(ident, SBT_FUNC);
-  switch (jump_to(prog, key, &val)) {
+  switch (jump_to(vm, key, &val)) {
     case JMP_ERR:
-      CTRL_FLOW_ERROR(key.ident, pos);
+      CTRL_FLOW_ERROR(sym_name(vm->prog->syms, key.ident), pos);
       break;
-    case JMP_MULT_DEF:
-      DEF_ERR(key, pos);
+    case JMP_LOAD_ERR:
+      longjmp(*exec_env, EXEC_ERR);
       break;
     default:
       /* Else: everything went well. */
@@ -596,14 +648,14 @@ static inline void exec_call(Program* prog, Pos pos) {
     spush(stack, 0);
 
   // Now we're ready to jump to the start of the function.
-  active_file(prog).ei = val.inst_addr - 1;
+  vm->ei = val.inst_addr - 1;
 }
 
-void exec_ret(Program* prog, Pos pos) {
-  assert(prog != NULL);
+void exec_ret(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
-  Stack* stack = &prog->stack;
-  Heap* heap = &prog->heap;
+  Stack* stack = &vm->stack;
+  Heap* heap = &vm->heap;
 
   // `LCL` always points to the stack position
   // right after all of the caller's segments
@@ -642,96 +694,106 @@ void exec_ret(Program* prog, Pos pos) {
 
   /* Jump ! */
 
-  prog->fi = ret_fi;
+  vm->fi = ret_fi;
+  vm->file = &vm->prog->files[vm->fi];
   // Don't subtract here (see `exec_call` and `exec_goto`)!
-  prog->files[prog->fi].ei = ret_ei;
+  vm->ei = ret_ei;
 }
 
-static inline void exec_builtin_print_char(Stack* stack, Pos pos) {
-  assert(stack != NULL);
+static inline void exec_builtin_print_char(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
   Word val;
-  if (!spop(stack, &val))
+  if (!spop(&vm->stack, &val))
     STACK_UNDERFLOW_ERROR(pos);
 
-  hvme_fprintf(stdout, "%c", (char) val);
+  out_char(vm_out(vm), (char) val);
 }
 
-static inline void exec_builtin_print_num(Stack* stack, Pos pos) {
-  assert(stack != NULL);
+static inline void exec_builtin_print_num(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
   Word val;
-  if (!spop(stack, &val))
+  if (!spop(&vm->stack, &val))
     STACK_UNDERFLOW_ERROR(pos);
 
-  hvme_fprintf(stdout, "%d", val);
+  out_num(vm_out(vm), val);
 }
 
-static inline void exec_builtin_print_str(Program* prog, Pos pos) {
-  assert(prog != NULL);
+static inline void exec_builtin_print_str(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
   Addr str_start;
-  if (!spop(&prog->stack, (Word*) &str_start))
+  if (!spop(&vm->stack, (Word*) &str_start))
     STACK_UNDERFLOW_ERROR(pos);
   Word nchars;
-  if (!spop(&prog->stack, &nchars))
+  if (!spop(&vm->stack, &nchars))
     STACK_UNDERFLOW_ERROR(pos);
 
-  for (Addr i = 0; i < nchars; i++) {
-    hvme_fprintf(stdout, "%c",
-      (char) heap_get(prog->heap, str_start + i));
+  if ((size_t) str_start + nchars > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) str_start + nchars);
+
+  /* Narrow the words right into the output buffer. */
+  Output* out = vm_out(vm);
+  const Word* src = vm->heap.mem + str_start;
+  size_t left = nchars;
+  while (left > 0) {
+    size_t len = left;
+    char* dst = out_space(out, &len);
+    narrow_words(dst, src, len);
+    out_commit(out, len);
+    src += len;
+    left -= len;
   }
 }
 
-static inline void exec_builtin_read_char(Stack* stack) {
-  assert(stack != NULL);
+static inline void exec_builtin_read_char(VmState* vm) {
+  assert(vm != NULL);
 
-  Word ch = getchar();
-  spush(stack, ch);
+  flush_out(vm_out(vm));
+  Word ch = (Word) in_char(vm_in(vm));
+  spush(&vm->stack, ch);
 }
 
-static inline void exec_builtin_read_num(Stack* stack, Pos pos) {
-  assert(stack != NULL);
+static inline void exec_builtin_read_num(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
+  flush_out(vm_out(vm));
   unsigned int num_buf;
-  int res = scanf("%u", &num_buf);
-  if (res == EOF) {
+  int res = in_num(vm_in(vm), &num_buf);
+  if (res == IN_EOF) {
     READ_IO_ERROR(pos);
-  } else if (res == 0) {
+  } else if (res == IN_NOT_NUM) {
     // Input was invalid and nothing was read.
     // This consumes the rest of the line.
-    char c = fgetc(stdin);
-    while (c != '\n') {
-      c = fgetc(stdin);
-    }
+    in_skip_line(vm_in(vm));
     READ_NUM_CHAR_ERROR(pos);
   }
 
   if (num_buf > BIT16_LIMIT) {
     READ_NUM_OVERFLOW_ERROR(pos, num_buf);
   } else {
-    spush(stack, (Word) num_buf);
+    spush(&vm->stack, (Word) num_buf);
   }
 }
 
-static inline void exec_builtin_read_str(Program* prog, Pos pos) {
-  assert(prog != NULL);
+static inline void exec_builtin_read_str(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
   Word heap_addr;
-  if (!spop(&prog->stack, &heap_addr))
+  if (!spop(&vm->stack, &heap_addr))
     STACK_UNDERFLOW_ERROR(pos);
 
-  char* buf = NULL;
-  size_t len = 0;
+  const char* buf;
   ssize_t nread_buf = 0;
 
-  if ((nread_buf = getline(&buf, &len, stdin)) == -1) {
-    free(buf);
+  flush_out(vm_out(vm));
+  if ((nread_buf = in_line(vm_in(vm), &buf)) == IN_EOF) {
     READ_IO_ERROR(pos);
   }
 
-  // Cast is OK because `-1` was checked.
-  // `getline` always includes the delimiter ('\n')
+  // Cast is OK because `IN_EOF` was checked.
+  // `in_line` always includes the delimiter ('\n')
   // which we want to remove. This means that while
   // the minimum number of characters will be one, we
   // have to decrease it by one.
@@ -740,111 +802,315 @@ static inline void exec_builtin_read_str(Program* prog, Pos pos) {
   size_t nread = nread_buf - 1;
 
   if (heap_addr + nread > MEM_HEAP_SIZE) {
-    free(buf);
-    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(prog), heap_addr + nread);
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), heap_addr + nread);
   }
 
   /* `memcpy` doesn't work here because we read
    * `char`s which we must store as `Word`s. */
-  for (unsigned int i = 0; i < nread; i++) {
-    prog->heap.mem[heap_addr + i] = (Word) buf[i];
+  widen_chars(vm->heap.mem + heap_addr, buf, nread);
+  heap_touch(vm->heap, heap_addr, nread);
+
+  spush(&vm->stack, (Word) nread);
+}
+
+/* The bulk memory builtins check the whole range they
+ * touch once up front. After that they work on plain
+ * `Word` arrays in loops the compiler can vectorize. */
+
+/* Pop the three `(addr, addr_or_val, n)` operands
+ * shared by all bulk memory builtins. */
+static inline void pop_mem_args(Stack* stack, Pos pos, Word* a, Word* b, Word* n) {
+  assert(stack != NULL);
+
+  if (!spop(stack, n))
+    STACK_UNDERFLOW_ERROR(pos);
+  if (!spop(stack, b))
+    STACK_UNDERFLOW_ERROR(pos);
+  if (!spop(stack, a))
+    STACK_UNDERFLOW_ERROR(pos);
+}
+
+static inline void exec_builtin_mem_copy(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  Word dst, src, n;
+  pop_mem_args(&vm->stack, pos, &dst, &src, &n);
+
+  if ((size_t) src + n > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) src + n);
+  if ((size_t) dst + n > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) dst + n);
+
+  /* `memmove` because the ranges may overlap. */
+  memmove(vm->heap.mem + dst, vm->heap.mem + src, n * sizeof(Word));
+  heap_touch(vm->heap, dst, n);
+}
+
+static inline void exec_builtin_mem_fill(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  Word dst, val, n;
+  pop_mem_args(&vm->stack, pos, &dst, &val, &n);
+
+  if ((size_t) dst + n > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) dst + n);
+
+  Word* restrict p = vm->heap.mem + dst;
+  for (size_t i = 0; i < n; i++)
+    p[i] = val;
+  heap_touch(vm->heap, dst, n);
+}
+
+/* Number of words compared per step in `exec_builtin_mem_cmp`. */
+#define MEM_CMP_CHUNK 16
+
+static inline void exec_builtin_mem_cmp(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  Word a, b, n;
+  pop_mem_args(&vm->stack, pos, &a, &b, &n);
+
+  if ((size_t) a + n > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) a + n);
+  if ((size_t) b + n > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) b + n);
+
+  const Word* pa = vm->heap.mem + a;
+  const Word* pb = vm->heap.mem + b;
+
+  /* Skip over equal chunks without branching on each
+   * word. The inner loop has no early exit so it
+   * can be vectorized. */
+  size_t i = 0;
+  for (; i + MEM_CMP_CHUNK <= n; i += MEM_CMP_CHUNK) {
+    Word diff = 0;
+    for (size_t j = 0; j < MEM_CMP_CHUNK; j++)
+      diff |= pa[i + j] ^ pb[i + j];
+    if (diff != 0)
+      break;
+  }
+  /* Find the exact word in the differing chunk or the tail. */
+  while (i < n && pa[i] == pb[i])
+    i++;
+
+  if (i == n) {
+    spush(&vm->stack, 0);
+  } else {
+    spush(&vm->stack, pa[i] < pb[i] ? TRUE : 1);
   }
+}
+
+static inline void exec_builtin_file_open(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  Word nchars, addr, mode;
+  pop_mem_args(&vm->stack, pos, &nchars, &addr, &mode);
+
+  if ((size_t) addr + nchars > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) addr + nchars);
+  if (mode != HOST_READ && mode != HOST_WRITE && mode != HOST_APPEND)
+    FILE_MODE_ERROR(pos, mode);
+
+  char* path = (char*) malloc (nchars + 1);
+  assert(path != NULL);
+  narrow_words(path, vm->heap.mem + addr, nchars);
+  path[nchars] = '\0';
+
+  /* Names with a null character can't be opened. */
+  int handle = strlen(path) == nchars
+    ? host_open(&vm->host, path, mode)
+    : HOST_ERR;
+  free(path);
+
+  spush(&vm->stack, handle == HOST_ERR ? TRUE : (Word) handle);
+}
+
+/* Pop the arguments of the block builtins and get the file. */
+static inline HostFile* pop_block_args(VmState* vm, Pos pos, int reading, Word* addr, Word* n) {
+  Word handle;
+  pop_mem_args(&vm->stack, pos, &handle, addr, n);
+
+  if ((size_t) *addr + *n > MEM_HEAP_SIZE)
+    HEAP_ADDR_OVERFLOW_ERROR(&active_inst(vm), (size_t) *addr + *n);
+  HostFile* file = host_file(&vm->host, handle);
+  if (file == NULL)
+    FILE_HANDLE_ERROR(pos, handle);
+  if ((file->mode == HOST_READ) != reading)
+    FILE_ACCESS_ERROR(pos, handle, reading);
+
+  return file;
+}
+
+static inline void exec_builtin_file_read_block(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  Word addr, n;
+  HostFile* file = pop_block_args(vm, pos, 1, &addr, &n);
+
+  size_t nread = host_read(file, vm->heap.mem + addr, n);
+  heap_touch(vm->heap, addr, nread);
+  spush(&vm->stack, (Word) nread);
+}
+
+static inline void exec_builtin_file_write_block(VmState* vm, Pos pos) {
+  assert(vm != NULL);
 
-  free(buf);
+  Word addr, n;
+  HostFile* file = pop_block_args(vm, pos, 0, &addr, &n);
 
-  spush(&prog->stack, (Word) nread);
+  if (host_write(file, vm->heap.mem + addr, n) == HOST_ERR)
+    WRITE_IO_ERROR(pos);
 }
 
-int exec_prog(Program* prog) {
-  assert(prog != NULL);
+static inline void exec_builtin_file_close(VmState* vm, Pos pos) {
+  assert(vm != NULL);
+
+  Word handle;
+  if (!spop(&vm->stack, &handle))
+    STACK_UNDERFLOW_ERROR(pos);
+
+  if (host_file(&vm->host, handle) == NULL)
+    FILE_HANDLE_ERROR(pos, handle);
+  if (host_close(&vm->host, handle) == HOST_ERR)
+    WRITE_IO_ERROR(pos);
+}
 
-  int arrive = setjmp(exec_env);
-  if (arrive == EXEC_ERR)
-    return EXEC_ERR;
+/* Called when `vm->steps` ran out: stop the run if it reached
+ * a limit, otherwise hand out the next steps. Without limits,
+ * that's so many that it's never called again. */
+static void check_limits(VmState* vm) {
+  if (vm->budget != 0 && vm->granted == vm->budget)
+    BUDGET_ERROR(active_inst(vm).pos, vm->budget);
+  if (vm->deadline != 0 && now_ns() >= vm->deadline)
+    TIMEOUT_ERROR(active_inst(vm).pos);
+  if (vm->stop != NULL && atomic_load_explicit(vm->stop, memory_order_relaxed))
+    STOPPED_ERROR(active_inst(vm).pos);
+
+  uint64_t steps = vm->deadline != 0 || vm->stop != NULL
+    ? DEADLINE_STEPS
+    : UINT64_MAX;
+  if (vm->budget != 0 && vm->budget - vm->granted < steps)
+    steps = vm->budget - vm->granted;
+  vm->steps = steps;
+  vm->granted += steps;
+}
 
+/* Run the instructions of `vm`. Errors jump to `exec_env`. */
+static int exec_insts(VmState* vm) {
   /* Reaching the end of any file is enough to end execution.
    * `insts.idx` points to the next unused instruction field
    * in the instruction buffer from parsing. Thus it can be
    * used here as the number of instructions in the buffer. */
 
-  for (; active_file(prog).ei < active_file(prog).insts.idx; active_file(prog).ei ++) {
-    switch(active_inst(prog).code) {
+  for (; vm->ei < active_file(vm).insts.idx; vm->ei ++) {
+    if (vm->steps == 0)
+      check_limits(vm);
+    vm->steps--;
+
+    switch(active_inst(vm).code) {
       case POP:
         exec_pop(
-          active_inst(prog),
-          &prog->stack,
-          &prog->heap,
-          &active_file(prog).mem
+          active_inst(vm),
+          &vm->stack,
+          &vm->heap,
+          &vm->mem[vm->fi]
         );
         break;
       case PUSH:
         exec_push(
-          active_inst(prog),
-          &prog->stack,
-          &prog->heap,
-          &active_file(prog).mem
+          active_inst(vm),
+          &vm->stack,
+          &vm->heap,
+          &vm->mem[vm->fi]
         );
         break;
       case ADD:
-        exec_add(&prog->stack, active_inst(prog).pos);
+        exec_add(&vm->stack, active_inst(vm).pos);
         break;
       case SUB:
-        exec_sub(&prog->stack, active_inst(prog).pos);
+        exec_sub(&vm->stack, active_inst(vm).pos);
         break;
       case NEG:
-        exec_neg(&prog->stack, active_inst(prog).pos);
+        exec_neg(&vm->stack, active_inst(vm).pos);
         break;
       case AND:
-        exec_and(&prog->stack, active_inst(prog).pos);
+        exec_and(&vm->stack, active_inst(vm).pos);
         break;
       case OR:
-        exec_or(&prog->stack, active_inst(prog).pos);
+        exec_or(&vm->stack, active_inst(vm).pos);
         break;
       case NOT:
-        exec_not(&prog->stack, active_inst(prog).pos);
+        exec_not(&vm->stack, active_inst(vm).pos);
         break;
       case EQ:
-        exec_eq(&prog->stack, active_inst(prog).pos);
+        exec_eq(&vm->stack, active_inst(vm).pos);
         break;
       case LT:
-        exec_lt(&prog->stack, active_inst(prog).pos);
+        exec_lt(&vm->stack, active_inst(vm).pos);
         break;
       case GT:
-        exec_gt(&prog->stack, active_inst(prog).pos);
+        exec_gt(&vm->stack, active_inst(vm).pos);
         break;
       case GOTO:
-        exec_goto(prog, active_inst(prog).pos);
+        exec_goto(vm, active_inst(vm).pos);
         break;
       case IF_GOTO:
-        exec_if_goto(prog, active_inst(prog).pos);
+        exec_if_goto(vm, active_inst(vm).pos);
         break;
       case CALL:
-        exec_call(prog, active_inst(prog).pos);
+        exec_call(vm, active_inst(vm).pos);
         break;
       case RET:
-        exec_ret(prog, active_inst(prog).pos);
+        exec_ret(vm, active_inst(vm).pos);
         break;
       case BUILTIN_PRINT_CHAR:
-        exec_builtin_print_char(&prog->stack, active_inst(prog).pos);
+        exec_builtin_print_char(vm, active_inst(vm).pos);
         break;
       case BUILTIN_PRINT_NUM:
-        exec_builtin_print_num(&prog->stack, active_inst(prog).pos);
+        exec_builtin_print_num(vm, active_inst(vm).pos);
         break;
       case BUILTIN_PRINT_STR:
-        exec_builtin_print_str(prog, active_inst(prog).pos);
+        exec_builtin_print_str(vm, active_inst(vm).pos);
         break;
       case BUILTIN_READ_CHAR:
-        exec_builtin_read_char(&prog->stack);
+        exec_builtin_read_char(vm);
         break;
       case BUILTIN_READ_NUM:
-        exec_builtin_read_num(&prog->stack, active_inst(prog).pos);
+        exec_builtin_read_num(vm, active_inst(vm).pos);
         break;
       case BUILTIN_READ_STR:
-        exec_builtin_read_str(prog, active_inst(prog).pos);
+        exec_builtin_read_str(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_MEM_COPY:
+        exec_builtin_mem_copy(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_MEM_FILL:
+        exec_builtin_mem_fill(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_MEM_CMP:
+        exec_builtin_mem_cmp(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_FILE_OPEN:
+        exec_builtin_file_open(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_FILE_READ_BLOCK:
+        exec_builtin_file_read_block(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_FILE_WRITE_BLOCK:
+        exec_builtin_file_write_block(vm, active_inst(vm).pos);
+        break;
+      case BUILTIN_FILE_CLOSE:
+        exec_builtin_file_close(vm, active_inst(vm).pos);
+        break;
+      case FUNC_END:
+        /* After the last function the file ends. */
+        if (active_inst(vm).ident == SYM_NONE)
+          return 0;
+        exec_func_end(vm, active_inst(vm).pos);
         break;
       default: {
-        INST_STR(str, &active_inst(prog));
-        perrf(active_inst(prog).pos,
+        INST_STR(str, vm->prog->syms, &active_inst(vm));
+        perrf(exec_pos(active_inst(vm).pos),
           "invalid inststruction `%s`; programmer mistake", str);
         return EXEC_ERR;
       }
@@ -853,3 +1119,46 @@ int exec_prog(Program* prog) {
 
   return 0;
 }
+
+int exec_prog(VmState* vm) {
+  assert(vm != NULL);
+
+  /* Programs on other threads have their own return location
+   * and output. Restore the ones from before when done. */
+  jmp_buf env;
+  jmp_buf* prev_env = exec_env;
+  const VmState* prev_vm = exec_vm;
+  exec_env = &env;
+  exec_vm = vm;
+  Output* prev_out = use_output(vm_out(vm));
+
+  /* `setjmp` returns the error code of the `longjmp`. */
+  int ret;
+  switch (setjmp(env)) {
+    case 0:
+      ret = exec_insts(vm);
+      break;
+    case EXEC_BUDGET:
+      ret = EXEC_BUDGET;
+      break;
+    case EXEC_TIMEOUT:
+      ret = EXEC_TIMEOUT;
+      break;
+    case EXEC_STOPPED:
+      ret = EXEC_STOPPED;
+      break;
+    default:
+      ret = EXEC_ERR;
+      break;
+  }
+
+  /* A pipelined program fails like it would have if all its files
+   * had been loaded first, even if the broken ones weren't needed. */
+  if (!finish_load(vm->prog) && (ret == 0 || ret == EXEC_ERR))
+    ret = EXEC_LOAD_ERR;
+
+  use_output(prev_out);
+  exec_env = prev_env;
+  exec_vm = prev_vm;
+  return ret;
+}
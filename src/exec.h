@@ -6,10 +6,17 @@
 #include "prog.h"
 
 #define EXEC_ERR -1
+#define EXEC_BUDGET -2  /* The run used up its instruction budget. */
+#define EXEC_TIMEOUT -3  /* The run went on past its deadline. */
+#define EXEC_STOPPED -4  /* The run was stopped (see `VmState.stop`). */
+#define EXEC_LOAD_ERR -5  /* A file of a pipelined program has errors. They were printed. */
 
-// Execute the program. Returns
-// `0` on success and `EXEC_ERR` if
-// an error arises during execution.
-int exec_prog(Program* program);
+// Execute the program from where `vm` is. Returns
+// `0` on success and `EXEC_ERR` if an error arises
+// during execution, or `EXEC_BUDGET` or `EXEC_TIMEOUT`
+// if it hits a limit set by `limit_vm` and `EXEC_STOPPED`
+// if it's stopped from another thread. Call
+// `reset_vm` to run it again.
+int exec_prog(VmState* vm);
 
 #endif  // _EXEC_H_
@@ -0,0 +1,168 @@
+#include "host.h"
+#include "prog.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef HOST_BUF_SIZE
+#  ifdef UNIT_TESTS
+#    define HOST_BUF_SIZE 0x10
+#  else
+#    define HOST_BUF_SIZE 0x10000
+#  endif  // UNIT_TESTS
+#endif  // HOST_BUF_SIZE
+
+/* Open `path` like `open` but only beneath the directory `root`.
+ * The kernel checks every step of the path, so no symbolic link
+ * or `..` can lead out of it. Fails on kernels without `openat2`. */
+static int open_beneath(int root, const char* path, int flags) {
+  struct open_how how = {
+    .flags=(uint64_t) flags,
+    .mode=(flags & O_CREAT) ? 0644 : 0,
+    .resolve=RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+  };
+  return (int) syscall(SYS_openat2, root, path, &how, sizeof(how));
+}
+
+int host_open(HostFiles* files, const char* path, int mode) {
+  assert(files != NULL);
+  assert(path != NULL);
+
+  unsigned int handle = 0;
+  while (handle < HOST_MAX_FILES && files->open[handle] != NULL)
+    handle++;
+  if (handle == HOST_MAX_FILES)
+    return HOST_ERR;
+
+  int flags;
+  switch (mode) {
+    case HOST_READ:
+      flags = O_RDONLY;
+      break;
+    case HOST_WRITE:
+      flags = O_WRONLY | O_CREAT | O_TRUNC;
+      break;
+    case HOST_APPEND:
+      flags = O_WRONLY | O_CREAT | O_APPEND;
+      break;
+    default:
+      return HOST_ERR;
+  }
+  int fd;
+  if (files->access == HOST_BENEATH)
+    fd = open_beneath(files->root, path, flags | O_CLOEXEC);
+  else if (files->access == HOST_ANYWHERE)
+    fd = open(path, flags | O_CLOEXEC, 0644);
+  else
+    fd = -1;
+  if (fd == -1)
+    return HOST_ERR;
+
+  HostFile* file = (HostFile*) calloc (1, sizeof(HostFile));
+  assert(file != NULL);
+  file->fd = fd;
+  file->mode = mode;
+  if (mode == HOST_READ) {
+    file->in = new_input(fd);
+  } else {
+    file->out = (char*) malloc (HOST_BUF_SIZE);
+    assert(file->out != NULL);
+  }
+
+  files->open[handle] = file;
+  return (int) handle;
+}
+
+HostFile* host_file(HostFiles* files, unsigned int handle) {
+  assert(files != NULL);
+
+  return handle < HOST_MAX_FILES ? files->open[handle] : NULL;
+}
+
+size_t host_read(HostFile* file, uint16_t* dst, size_t n) {
+  assert(file != NULL);
+  assert(file->mode == HOST_READ);
+
+  size_t nread = 0;
+  while (nread < n) {
+    const char* data;
+    size_t len = in_block(&file->in, &data, n - nread);
+    if (len == 0)
+      break;
+    widen_chars(dst + nread, data, len);
+    nread += len;
+  }
+  return nread;
+}
+
+/* Write all `len` bytes at `buf` to `fd`. */
+static int write_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t nwritten = write(fd, buf, len);
+    if (nwritten == -1) {
+      if (errno == EINTR)
+        continue;
+      return HOST_ERR;
+    }
+    buf += nwritten;
+    len -= (size_t) nwritten;
+  }
+  return HOST_OK;
+}
+
+static int host_flush(HostFile* file) {
+  int res = write_all(file->fd, file->out, file->out_len);
+  file->out_len = 0;
+  return res;
+}
+
+int host_write(HostFile* file, const uint16_t* src, size_t n) {
+  assert(file != NULL);
+  assert(file->mode != HOST_READ);
+
+  while (n > 0) {
+    if (file->out_len == HOST_BUF_SIZE && host_flush(file) == HOST_ERR)
+      return HOST_ERR;
+    size_t len = HOST_BUF_SIZE - file->out_len;
+    if (len > n)
+      len = n;
+    narrow_words(file->out + file->out_len, src, len);
+    file->out_len += len;
+    src += len;
+    n -= len;
+  }
+  return HOST_OK;
+}
+
+int host_close(HostFiles* files, unsigned int handle) {
+  HostFile* file = host_file(files, handle);
+  assert(file != NULL);
+
+  int res = HOST_OK;
+  if (file->mode == HOST_READ) {
+    del_input(&file->in);
+  } else {
+    res = host_flush(file);
+    free(file->out);
+  }
+  if (close(file->fd) == -1)
+    res = HOST_ERR;
+  free(file);
+  files->open[handle] = NULL;
+
+  return res;
+}
+
+void host_close_all(HostFiles* files) {
+  assert(files != NULL);
+
+  for (unsigned int handle = 0; handle < HOST_MAX_FILES; handle++) {
+    if (files->open[handle] != NULL)
+      host_close(files, handle);
+  }
+}
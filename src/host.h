@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include "input.h"
+
+#include <stdint.h>
+
+/* Files on the host opened by the running program (see
+ * `Sys.file_open`). Reads go through an `Input`, so regular
+ * files are mapped. Writes are collected in a buffer and
+ * written in large blocks. */
+
+#define HOST_MAX_FILES 16
+
+// File modes.
+#define HOST_READ 0
+#define HOST_WRITE 1  /* Create or truncate. */
+#define HOST_APPEND 2  /* Create or append. */
+
+#define HOST_ERR -1
+#define HOST_OK 0
+
+typedef struct {
+  int fd;
+  int mode;
+  Input in;  /* Unused unless `mode` is `HOST_READ`. */
+  char* out;  /* Buffered writes. */
+  size_t out_len;
+} HostFile;
+
+// Which files the program may open.
+#define HOST_ANYWHERE 0  /* Any file (the default). */
+#define HOST_NOWHERE 1  /* None at all. */
+#define HOST_BENEATH 2  /* Only files beneath the directory `root`. */
+
+// Open files by their handle.
+typedef struct {
+  HostFile* open[HOST_MAX_FILES];
+  int access;  /* One of `HOST_ANYWHERE`, `HOST_NOWHERE` and `HOST_BENEATH`. */
+  /* Directory relative paths start at for `HOST_BENEATH`. Paths
+   * that lead out of it (absolute ones, `..` or symbolic links)
+   * are refused. It's borrowed, not closed. */
+  int root;
+} HostFiles;
+
+/* Open `path` in `mode` and return its handle. Returns `HOST_ERR`
+ * if it can't be opened, `files->access` doesn't allow it or all
+ * handles are used. */
+int host_open(HostFiles* files, const char* path, int mode);
+
+/* The file with `handle` or `NULL` if it isn't open. */
+HostFile* host_file(HostFiles* files, unsigned int handle);
+
+/* Read up to `n` characters into `dst`, one per word. Returns
+ * how many were read, which is less than `n` at the end. */
+size_t host_read(HostFile* file, uint16_t* dst, size_t n);
+
+/* Write the low bytes of the `n` words at `src`. */
+int host_write(HostFile* file, const uint16_t* src, size_t n);
+
+/* Write what's buffered and close the file. The handle is
+ * freed even if that fails. */
+int host_close(HostFiles* files, unsigned int handle);
+
+void host_close_all(HostFiles* files);
+
+#endif  // _HOST_H_
@@ -2,29 +2,407 @@
 #include "msg.h"
 #include "prog.h"
 #include "exec.h"
+#include "image.h"
+#include "batch.h"
+#include "serve.h"
+#include "input.h"
 
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Upper limit for `-j`.
+#define MAX_JOBS 256
+#define MAX_JOBS_STR "256"
+
+#define USAGE \
+  "Usage: hvme [OPTIONS] FILE|DIR|IMAGE...\n" \
+  "\n" \
+  "  -j N             Load (or run a batch or serve) on N threads\n" \
+  "  --lazy           Parse each function when it's first called\n" \
+  "  --pipeline       Start running while files are still loading\n" \
+  "  --async-output   Write output on a separate thread\n" \
+  "  --files DIR      Only let programs open files in DIR\n" \
+  "  --compile -o F   Write the program to the image F\n" \
+  "  --batch DIR      Run once for each input file in DIR\n" \
+  "                   (with -o OUT, write the results to OUT)\n" \
+  "  --serve SOCK     Run the programs for clients of SOCK\n" \
+  "  --client SOCK    Send one run to the server at SOCK\n" \
+  "                   (with --budget N and --timeout MS)\n" \
+  "  --help           Print this text\n" \
+  "\n" \
+  "Loaded files are cached in $XDG_CACHE_HOME/hvme (or ~/.cache/hvme).\n" \
+  "Set HVME_NO_CACHE=1 to turn the cache off.\n"
+
+/* Parse the number of jobs in `-j N` or `-jN`. Returns
+ * the number of arguments used or `0` if there is no
+ * `-j` option and `-1` if the number is invalid. */
+static int parse_jobs(int argc, const char* argv[], unsigned int* njobs) {
+  if (argc < 1 || strncmp(argv[0], "-j", 2) != 0)
+    return 0;
+
+  int nused = 1;
+  const char* num = argv[0] + 2;
+  if (*num == '\0') {
+    if (argc < 2)
+      return -1;
+    num = argv[1];
+    nused = 2;
+  }
+
+  char* end;
+  long n = strtol(num, &end, 10);
+  if (*num == '\0' || *end != '\0' || n < 1 || n > MAX_JOBS)
+    return -1;
+
+  *njobs = (unsigned int) n;
+  return nused;
+}
+
+/* Parse the number `num` of option `opt` into `*val`. Returns
+ * `0` and prints an error if it isn't a number up to `max`. */
+static int parse_limit(const char* opt, const char* num,
+                       unsigned long long max, unsigned long long* val) {
+  char* end;
+  errno = 0;
+  unsigned long long n = strtoull(num, &end, 10);
+  if (*num < '0' || *num > '9' || *end != '\0' || errno != 0 || n > max) {
+    errf("`%s` expects a number up to %llu", opt, max);
+    return 0;
+  }
+  *val = n;
+  return 1;
+}
+
+/* Load the program made of the files (or the image) in `argv`. */
+static ProgramImage* load_prog(int argc, const char* argv[], LoadOpts opts) {
+  if (argc == 1 && is_image_fn(argv[0]))
+    return load_image(argv[0]);
+
+  /* Directories are programs made of all their `.vm` files. */
+  unsigned int nfn;
+  char** fn = find_sources(argc, argv, &nfn);
+  if (fn == NULL)
+    return NULL;
+  ProgramImage* prog = make_prog_opts(nfn, (const char**) fn, opts);
+  del_sources(fn, nfn);
+  if (prog == NULL)
+    hvme_fputs("Failed to compile source.", stderr);
+  return prog;
+}
+
+/* Stops the server when `SIGINT` or `SIGTERM` arrive. They are
+ * blocked in all other threads so that they are only seen here. */
+static void* wait_for_signal(void* arg) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  int sig;
+  sigwait(&set, &sig);
+  stop_server((Server*) arg);
+  return NULL;
+}
+
+/* `--serve`: Each file, directory or image in `argv`
+ * is a program of its own, named like the argument. */
+static int serve(const char* path, int argc, const char* argv[], LoadOpts opts,
+                 const char* files_dir) {
+  ServeProg* progs = (ServeProg*) calloc ((size_t) argc, sizeof(ServeProg));
+  assert(progs != NULL);
+  int res = 0;
+  int nprogs = 0;
+  for (; nprogs < argc; nprogs++) {
+    progs[nprogs].id = argv[nprogs];
+    for (int i = 0; i < nprogs; i++) {
+      if (strcmp(argv[i], argv[nprogs]) == 0) {
+        errf("`%s` is given more than once", argv[i]);
+        res = 1;
+      }
+    }
+    /* Requests share a whole program. */
+    LoadOpts prog_opts = { .njobs=opts.njobs, .lazy=0, .pipeline=0 };
+    progs[nprogs].prog = res == 0 ? load_prog(1, &argv[nprogs], prog_opts) : NULL;
+    if (progs[nprogs].prog == NULL) {
+      res = 1;
+      break;
+    }
+  }
+
+  Server* srv = res == 0
+    ? new_server(path, progs, (unsigned int) nprogs, opts.njobs, files_dir)
+    : NULL;
+  if (srv != NULL) {
+    sigset_t set, prev;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, &prev);
+    pthread_t sig_thread;
+    int waiting = pthread_create(&sig_thread, NULL, wait_for_signal, srv) == 0;
+
+    run_server(srv);
+
+    /* The server can also stop because it failed. */
+    if (waiting) {
+      pthread_kill(sig_thread, SIGTERM);
+      pthread_join(sig_thread, NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    del_server(srv);
+  } else {
+    res = 1;
+  }
+
+  for (int i = 0; i < nprogs; i++)
+    del_prog(progs[i].prog);
+  free(progs);
+  return res;
+}
+
+/* `--client`: Run the program `id` on the server at `path`
+ * with stdin as input and print its output and errors. */
+static int client(const char* path, const char* id,
+                  unsigned long long budget, unsigned long long timeout_ms) {
+  /* Read all of stdin first. */
+  char* in_buf = NULL;
+  size_t in_len = 0;
+  const char* data;
+  size_t nread;
+  while ((nread = in_block(std_input(), &data, (size_t) -1)) > 0) {
+    in_buf = (char*) realloc (in_buf, in_len + nread);
+    assert(in_buf != NULL);
+    memcpy(in_buf + in_len, data, nread);
+    in_len += nread;
+  }
+
+  int fd = connect_server(path);
+  if (fd == -1) {
+    errf("can't connect to a server at `%s`", path);
+    free(in_buf);
+    return 1;
+  }
+
+  RunRequest req = {
+    .id=id, .budget=budget, .timeout_ms=(unsigned int) timeout_ms,
+    .in=in_buf, .in_len=in_len,
+  };
+  RunResult res;
+  int ok = request_run(fd, &req, &res);
+  close(fd);
+  free(in_buf);
+  if (!ok)
+    return 1;
+
+  out_bytes(std_output(), res.out, res.out_len);
+  flush_out(std_output());
+  if (res.err_len > 0)
+    hvme_fputs(res.err, stderr);
+  int status = res.status;
+  del_result(&res);
+  return status == RUN_OK ? 0 : 1;
+}
 
 int run_hvme(int argc, const char* argv[]) {
-  if (argc <= 1) {
-    err("Can't execute 0 files!");
+  LoadOpts opts = { .njobs=1, .lazy=0, .pipeline=0 };
+  int compile = 0;  // `--compile`: write an image instead of running.
+  int async_output = 0;  // `--async-output`
+  const char* batch_dir = NULL;  // `--batch DIR`
+  const char* files_dir = NULL;  // `--files DIR`
+  const char* out_fn = NULL;  // `-o FILE`: the image or the batch's output directory.
+  const char* serve_path = NULL;  // `--serve SOCK`
+  const char* client_path = NULL;  // `--client SOCK`
+  unsigned long long budget = 0;  // `--budget N`
+  unsigned long long timeout_ms = 0;  // `--timeout MS`
+
+  argc--;
+  argv++;
+  while (argc > 0) {
+    int nused;
+    if (strcmp(argv[0], "--help") == 0) {
+      hvme_fputs(USAGE, stdout);
+      return 0;
+    } else if (strcmp(argv[0], "--compile") == 0) {
+      compile = 1;
+      nused = 1;
+    } else if (strcmp(argv[0], "--lazy") == 0) {
+      opts.lazy = 1;
+      nused = 1;
+    } else if (strcmp(argv[0], "--async-output") == 0) {
+      async_output = 1;
+      nused = 1;
+    } else if (strcmp(argv[0], "--pipeline") == 0) {
+      opts.pipeline = 1;
+      nused = 1;
+    } else if (strcmp(argv[0], "--batch") == 0) {
+      if (argc < 2) {
+        err("`--batch` expects a directory of inputs");
+        return 1;
+      }
+      batch_dir = argv[1];
+      nused = 2;
+    } else if (strcmp(argv[0], "--files") == 0) {
+      if (argc < 2) {
+        err("`--files` expects the directory programs may open files in");
+        return 1;
+      }
+      files_dir = argv[1];
+      nused = 2;
+    } else if (strcmp(argv[0], "--serve") == 0
+               || strcmp(argv[0], "--client") == 0) {
+      if (argc < 2) {
+        errf("`%s` expects the path of a socket", argv[0]);
+        return 1;
+      }
+      if (argv[0][2] == 's')
+        serve_path = argv[1];
+      else
+        client_path = argv[1];
+      nused = 2;
+    } else if (strcmp(argv[0], "--budget") == 0
+               || strcmp(argv[0], "--timeout") == 0) {
+      int is_budget = argv[0][2] == 'b';
+      if (argc < 2
+          || !parse_limit(argv[0], argv[1], is_budget ? UINT64_MAX : UINT_MAX,
+                          is_budget ? &budget : &timeout_ms))
+        return 1;
+      nused = 2;
+    } else if (strcmp(argv[0], "-o") == 0) {
+      if (argc < 2) {
+        err("`-o` expects the name of the image or directory to write");
+        return 1;
+      }
+      out_fn = argv[1];
+      nused = 2;
+    } else {
+      nused = parse_jobs(argc, argv, &opts.njobs);
+      if (nused == -1) {
+        err("`-j` expects a number of jobs between 1 and " MAX_JOBS_STR);
+        return 1;
+      } else if (nused == 0) {
+        break;  // First source file.
+      }
+    }
+    argc -= nused;
+    argv += nused;
+  }
+
+  if (compile + (batch_dir != NULL) + (serve_path != NULL) + (client_path != NULL) > 1) {
+    err("only one of `--compile`, `--batch`, `--serve` and `--client` can be used");
     return 1;
-  } else {
-    Program* prog = make_prog(argc - 1, argv + 1);
-    if (prog == NULL) {
-      hvme_fputs("Failed to compile source.", stderr);
+  }
+
+  if (files_dir != NULL && (compile || client_path != NULL)) {
+    err("`--files` can't be used with `--compile` or `--client`");
+    return 1;
+  }
+
+  if (client_path == NULL && (budget != 0 || timeout_ms != 0)) {
+    err("`--budget` and `--timeout` can only be used with `--client`");
+    return 1;
+  }
+
+  if (client_path != NULL) {
+    if (argc != 1) {
+      err("`--client` expects the ID of one program");
       return 1;
     }
+    return client(client_path, argv[0], budget, timeout_ms);
+  }
+
+  if (compile && out_fn == NULL) {
+    err("`--compile` and `-o FILE` must be used together");
+    return 1;
+  }
 
-    int ret = exec_prog(prog);
+  if (!compile && batch_dir == NULL && out_fn != NULL) {
+    err("`-o` can only be used with `--compile` or `--batch`");
+    return 1;
+  }
+
+  if (opts.lazy && opts.pipeline) {
+    err("`--lazy` and `--pipeline` can't be used together");
+    return 1;
+  }
+
+  if (argc == 0) {
+    err(compile ? "Can't compile 0 files!" : "Can't execute 0 files!");
+    hvme_fputs(USAGE, stderr);
+    return 1;
+  }
+
+  if (serve_path != NULL)
+    return serve(serve_path, argc, argv, opts, files_dir);
+
+  /* Images contain whole programs and batches share
+   * a whole program between all runs. */
+  if (compile || batch_dir != NULL) {
+    opts.lazy = 0;
+    opts.pipeline = 0;
+  }
+  ProgramImage* prog = load_prog(argc, argv, opts);
+  if (prog == NULL)
+    return 1;
+
+  if (compile) {
+    int res = write_image(prog, out_fn);
     del_prog(prog);
+    return res == IMAGE_OK ? 0 : 1;
+  }
 
-    /* If `ret != 0` we have an error and
-     * the output will already be formatted
-     * correctly. */
-    if (ret == 0) clean_stdout();
-    
-    return ret;
+  if (batch_dir != NULL) {
+    BatchOpts batch = {
+      .in_dir=batch_dir, .out_dir=out_fn, .njobs=opts.njobs, .files_dir=files_dir,
+    };
+    int res = run_batch(prog, batch);
+    del_prog(prog);
+    return res;
   }
+
+  /* Single runs can open any file unless `--files` is given. */
+  int files_root = -1;
+  if (files_dir != NULL) {
+    files_root = open(files_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (files_root == -1) {
+      errf("can't open directory `%s`", files_dir);
+      del_prog(prog);
+      return 1;
+    }
+  }
+
+  if (async_output)
+    start_out_thread(std_output());
+  VmState* vm = new_vm(prog);
+  if (files_root != -1) {
+    vm->host.access = HOST_BENEATH;
+    vm->host.root = files_root;
+  }
+  int ret = exec_prog(vm);
+  if (ret == EXEC_LOAD_ERR) {
+    hvme_fputs("Failed to compile source.", stderr);
+    ret = 1;
+  }
+  del_vm(vm);
+  del_prog(prog);
+  if (files_root != -1)
+    close(files_root);
+
+  /* If `ret != 0` we have an error and
+   * the output will already be formatted
+   * correctly. Just make sure it's written. */
+  if (ret == 0)
+    clean_stdout();
+  else
+    flush_out(std_output());
+  stop_out_thread(std_output());
+
+  return ret;
 }
@@ -0,0 +1,572 @@
+#include "image.h"
+
+#include "intern.h"
+#include "msg.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Alignment of the instructions in the image.
+#define IMAGE_ALIGN 16
+
+int is_image_fn(const char* fn) {
+  assert(fn != NULL);
+
+  size_t len = strlen(fn);
+  size_t ext_len = strlen(IMAGE_EXT);
+  return len > ext_len && strcmp(fn + len - ext_len, IMAGE_EXT) == 0;
+}
+
+static inline uint64_t rotl64(uint64_t x, int n) {
+  return (x << n) | (x >> (64 - n));
+}
+
+uint64_t image_hash(const unsigned char* data, size_t len) {
+  /* Eight bytes at a time. Each word is mixed into all
+   * bits of the state before the next one is added. */
+  uint64_t hash = 0x243f6a8885a308d3ull ^ len;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = rotl64(hash ^ word, 29) * 0x9e3779b97f4a7c15ull;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data + i, len - i);
+  hash = rotl64(hash ^ tail, 29) * 0x9e3779b97f4a7c15ull;
+
+  // murmur3 finalizer
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+void seal_image(unsigned char* buf, size_t size) {
+  assert(buf != NULL);
+  assert(size >= sizeof(ImageHeader));
+
+  ImageHeader* hdr = (ImageHeader*) buf;
+  hdr->size = size;
+  hdr->checksum = image_hash(buf + sizeof(ImageHeader), size - sizeof(ImageHeader));
+}
+
+static inline int has_ident(const Inst* inst) {
+  return inst->code == GOTO || inst->code == IF_GOTO || inst->code == CALL
+    || (inst->code == FUNC_END && inst->ident != SYM_NONE);
+}
+
+static inline size_t align_up(size_t off) {
+  return (off + IMAGE_ALIGN - 1) & ~((size_t) IMAGE_ALIGN - 1);
+}
+
+/* Numbers the identifiers written to an image
+ * in the order they are first used. */
+typedef struct {
+  uint32_t* idx;  // Indexed by `SymId`. `0` if not numbered yet.
+  SymId* ids;  // Indexed by the number.
+  uint32_t n;
+} NameMap;
+
+static uint32_t name_idx(NameMap* map, SymId id) {
+  if (map->idx[id] == 0) {
+    map->idx[id] = ++map->n;
+    map->ids[map->n] = id;
+  }
+  return map->idx[id];
+}
+
+/* Lay out the image of `nfiles` files in a new buffer
+ * and set `size_out` to its length. The `src_len` bytes
+ * at `src` are kept at the end if `src` isn't `NULL`. */
+static unsigned char* build_image(
+  const File* files,
+  unsigned int nfiles,
+  const SymPool* syms,
+  const char* src,
+  size_t src_len,
+  size_t* size_out
+) {
+  assert(files != NULL);
+  assert(size_out != NULL);
+
+  /* Find the identifiers and count everything. */
+
+  SymId max_id = 0;
+  size_t nsyms = 0;
+  size_t ninsts = 0;
+  for (unsigned int fi = 0; fi < nfiles; fi++) {
+    const File* file = &files[fi];
+    for (size_t i = 0; i < file->st.len; i++) {
+      if (file->st.cell[i].key.type != SBT_UNUSED) {
+        nsyms++;
+        if (file->st.cell[i].key.ident > max_id)
+          max_id = file->st.cell[i].key.ident;
+      }
+    }
+    for (size_t i = 0; i < file->insts.idx; i++) {
+      if (has_ident(&file->insts.cell[i]) && file->insts.cell[i].ident > max_id)
+        max_id = file->insts.cell[i].ident;
+    }
+    ninsts += file->insts.idx;
+  }
+
+  NameMap names = {
+    .idx = (uint32_t*) calloc (max_id + 1, sizeof(uint32_t)),
+    .ids = (SymId*) calloc (max_id + 1, sizeof(SymId)),
+    .n = 0,
+  };
+  assert(names.idx != NULL);
+  assert(names.ids != NULL);
+  for (unsigned int fi = 0; fi < nfiles; fi++) {
+    const File* file = &files[fi];
+    for (size_t i = 0; i < file->st.len; i++) {
+      if (file->st.cell[i].key.type != SBT_UNUSED)
+        name_idx(&names, file->st.cell[i].key.ident);
+    }
+    for (size_t i = 0; i < file->insts.idx; i++) {
+      if (has_ident(&file->insts.cell[i]))
+        name_idx(&names, file->insts.cell[i].ident);
+    }
+  }
+
+  size_t strs_len = 0;
+  for (uint32_t i = 1; i <= names.n; i++)
+    strs_len += strlen(sym_name(syms, names.ids[i])) + 1;
+  for (unsigned int fi = 0; fi < nfiles; fi++)
+    strs_len += strlen(files[fi].filename) + 1;
+
+  /* Lay out the sections. */
+
+  size_t names_off = sizeof(ImageHeader);
+  size_t files_off = names_off + (names.n + 1) * sizeof(ImageName);
+  size_t syms_off = files_off + nfiles * sizeof(ImageFile);
+  size_t insts_off = align_up(syms_off + nsyms * sizeof(ImageSym));
+  size_t strs_off = insts_off + ninsts * sizeof(Inst);
+  size_t src_off = strs_off + strs_len;
+  size_t size = src_off + (src == NULL ? 0 : src_len);
+
+  unsigned char* buf = (unsigned char*) calloc (size, 1);
+  assert(buf != NULL);
+
+  ImageName* img_names = (ImageName*) (buf + names_off);
+  for (uint32_t i = 1; i <= names.n; i++) {
+    const char* name = sym_name(syms, names.ids[i]);
+    size_t len = strlen(name);
+    memcpy(buf + strs_off, name, len);
+    img_names[i] = (ImageName) { .off=strs_off, .len=len };
+    strs_off += len + 1;
+  }
+
+  ImageFile* img_files = (ImageFile*) (buf + files_off);
+  for (unsigned int fi = 0; fi < nfiles; fi++) {
+    const File* file = &files[fi];
+
+    size_t fn_len = strlen(file->filename);
+    memcpy(buf + strs_off, file->filename, fn_len);
+    img_files[fi] = (ImageFile) {
+      .filename=strs_off,
+      .ei=file->ei,
+      .syms=syms_off,
+      .nsyms=0,
+      .insts=insts_off,
+      .ninsts=file->insts.idx,
+    };
+    strs_off += fn_len + 1;
+
+    for (size_t i = 0; i < file->st.len; i++) {
+      const Symbol* sym = &file->st.cell[i];
+      if (sym->key.type == SBT_UNUSED)
+        continue;
+      ((ImageSym*) (buf + syms_off))[img_files[fi].nsyms++] = (ImageSym) {
+        .name=name_idx(&names, sym->key.ident),
+        .type=sym->key.type,
+        .inst_addr=sym->val.inst_addr + file->st.offset,
+        .nlocals=sym->val.nlocals,
+      };
+    }
+    syms_off += img_files[fi].nsyms * sizeof(ImageSym);
+
+    Inst* insts = (Inst*) (buf + insts_off);
+    memcpy(insts, file->insts.cell, file->insts.idx * sizeof(Inst));
+    for (size_t i = 0; i < file->insts.idx; i++) {
+      insts[i].pos.filename = NULL;
+      if (has_ident(&insts[i]))
+        insts[i].ident = name_idx(&names, insts[i].ident);
+    }
+    insts_off += file->insts.idx * sizeof(Inst);
+  }
+
+  ImageHeader* hdr = (ImageHeader*) buf;
+  memcpy(hdr->magic, IMAGE_MAGIC, sizeof(hdr->magic));
+  hdr->version = IMAGE_VERSION;
+  hdr->inst_size = sizeof(Inst);
+  hdr->nfiles = nfiles;
+  hdr->nnames = names.n;
+  hdr->stat_size = MEM_STAT_SIZE;
+  hdr->tmp_size = MEM_TEMP_SIZE;
+  if (src != NULL) {
+    memcpy(buf + src_off, src, src_len);
+    hdr->src = src_off;
+    hdr->src_len = src_len;
+  }
+  seal_image(buf, size);
+
+  free(names.idx);
+  free(names.ids);
+
+  *size_out = size;
+  return buf;
+}
+
+/* Write the image to a temporary file next to `fn` and move
+ * it into place. Readers never see a half-written image. */
+static int save_image(
+  const File* files,
+  unsigned int nfiles,
+  const SymPool* syms,
+  const char* src,
+  size_t src_len,
+  const char* fn
+) {
+  size_t size;
+  unsigned char* buf = build_image(files, nfiles, syms, src, src_len, &size);
+
+  size_t fn_len = strlen(fn);
+  char* tmp_fn = (char*) malloc (fn_len + sizeof(".XXXXXX"));
+  assert(tmp_fn != NULL);
+  memcpy(tmp_fn, fn, fn_len);
+  memcpy(tmp_fn + fn_len, ".XXXXXX", sizeof(".XXXXXX"));
+
+  int res = IMAGE_ERR;
+  int fd = mkstemp(tmp_fn);
+  if (fd != -1) {
+    size_t nwritten = 0;
+    while (nwritten < size) {
+      ssize_t n = write(fd, buf + nwritten, size - nwritten);
+      if (n <= 0)
+        break;
+      nwritten += n;
+    }
+    /* `mkstemp` creates the file as `0600`. */
+    fchmod(fd, 0644);
+    if (close(fd) == 0 && nwritten == size && rename(tmp_fn, fn) == 0)
+      res = IMAGE_OK;
+    else
+      unlink(tmp_fn);
+  }
+
+  free(tmp_fn);
+  free(buf);
+  return res;
+}
+
+int write_image(const ProgramImage* prog, const char* fn) {
+  assert(prog != NULL);
+  assert(fn != NULL);
+
+  if (save_image(prog->files, prog->nfiles, prog->syms, NULL, 0, fn) == IMAGE_ERR) {
+    errf("can't write image `%s`", fn);
+    return IMAGE_ERR;
+  }
+  return IMAGE_OK;
+}
+
+int write_file_image(const File* file, const SymPool* syms,
+                     const char* src, size_t src_len, const char* fn) {
+  assert(file != NULL);
+  assert(src != NULL);
+  assert(fn != NULL);
+
+  return save_image(file, 1, syms, src, src_len, fn);
+}
+
+/* Whether `n` elements of `elem_size` at `off` are inside
+ * an image of `size` bytes and properly aligned. */
+static inline int in_image(size_t size, uint64_t off, uint64_t n, size_t elem_size) {
+  return off <= size
+    && off % sizeof(uint64_t) == 0
+    && n <= (size - off) / elem_size;
+}
+
+// Whether there's a null-terminated string at `off`.
+static inline int is_str(const char* map, size_t size, uint64_t off, uint64_t len) {
+  return off < size && len < size - off && map[off + len] == '\0';
+}
+
+/* Map the image `fn` read-only. Returns `NULL` if it can't be
+ * mapped and sets `problem` if it isn't a valid image. */
+static char* map_image(const char* fn, size_t* size_out, const char** problem) {
+  *problem = NULL;
+
+  int fd = open(fn, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  struct stat sb;
+  if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(ImageHeader)) {
+    close(fd);
+    *problem = "is not an hvme image";
+    return NULL;
+  }
+  size_t size = (size_t) sb.st_size;
+
+  /* Nothing in the mapping is ever written, so
+   * its pages stay shared with the page cache. */
+  char* map = (char*) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  const ImageHeader* hdr = (const ImageHeader*) map;
+  if (memcmp(hdr->magic, IMAGE_MAGIC, sizeof(hdr->magic)) != 0) {
+    *problem = "is not an hvme image";
+  } else if (hdr->version != IMAGE_VERSION
+    || hdr->inst_size != sizeof(Inst)
+    || hdr->stat_size != MEM_STAT_SIZE
+    || hdr->tmp_size != MEM_TEMP_SIZE) {
+    *problem = "was compiled by a different version of hvme. Compile it again";
+  } else if (hdr->size != size
+    || hdr->checksum != image_hash((unsigned char*) map + sizeof(ImageHeader),
+      size - sizeof(ImageHeader))) {
+    *problem = "is corrupt (checksum mismatch)";
+  } else if (hdr->nfiles == 0
+    || !in_image(size, sizeof(ImageHeader), hdr->nnames + 1ull, sizeof(ImageName))
+    || !in_image(size, sizeof(ImageHeader) + (hdr->nnames + 1ull) * sizeof(ImageName),
+      hdr->nfiles, sizeof(ImageFile))) {
+    *problem = "is corrupt";
+  }
+
+  if (*problem != NULL) {
+    munmap(map, size);
+    return NULL;
+  }
+
+  *size_out = size;
+  return map;
+}
+
+/* Intern the names in the image into `syms` once. `ids` maps
+ * the indices stored in the image to their IDs. Returns `NULL`
+ * if a name is out of place. */
+static SymId* read_names(const char* map, size_t size, Arena* arena, SymPool* syms) {
+  const ImageHeader* hdr = (const ImageHeader*) map;
+  const ImageName* names = (const ImageName*) (map + sizeof(ImageHeader));
+
+  SymId* ids = (SymId*) arena_alloc(arena, (hdr->nnames + 1ull) * sizeof(SymId));
+  for (uint32_t i = 1; i <= hdr->nnames; i++) {
+    if (!is_str(map, size, names[i].off, names[i].len))
+      return NULL;
+    ids[i] = intern(syms, map + names[i].off, names[i].len);
+  }
+  return ids;
+}
+
+/* Whether `inst` can be run. Its name, if it has one,
+ * must be one of the `nnames` in the image. */
+static int valid_inst(const Inst* inst, uint32_t nnames) {
+  if (inst->pos.filename != NULL)
+    return 0;
+
+  switch (inst->code) {
+    case PUSH:
+    case POP:
+      return ARG <= inst->mem.seg && inst->mem.seg <= TMP;
+    case GOTO:
+    case IF_GOTO:
+    case CALL:
+      return inst->ident != SYM_NONE && inst->ident <= nnames;
+    case FUNC_END:
+      return inst->ident <= nnames;
+    case ADD: case SUB: case NEG:
+    case AND: case OR: case NOT:
+    case EQ: case GT: case LT:
+    case RET:
+      return 1;
+    default:
+      return BUILTIN_PRINT_CHAR <= inst->code && inst->code <= BUILTIN_FILE_CLOSE;
+  }
+}
+
+/* Read file `fi` of the image at `map` into `file`. Its
+ * instructions stay in the image and still name their
+ * identifiers by index. `file->filename` is taken from
+ * the image unless it's set already. Returns `IMAGE_ERR`
+ * if anything is out of place. */
+static int read_file(
+  const char* map,
+  size_t size,
+  const SymId* ids,
+  unsigned int fi,
+  File* file,
+  Arena* arena
+) {
+  const ImageHeader* hdr = (const ImageHeader*) map;
+  const ImageName* names = (const ImageName*) (map + sizeof(ImageHeader));
+  const ImageFile* img = &((const ImageFile*) (names + hdr->nnames + 1))[fi];
+
+  if (img->filename >= size
+    || memchr(map + img->filename, '\0', size - img->filename) == NULL
+    || !in_image(size, img->syms, img->nsyms, sizeof(ImageSym))
+    || !in_image(size, img->insts, img->ninsts, sizeof(Inst))
+    || img->ei > img->ninsts)
+    return IMAGE_ERR;
+
+  if (file->filename == NULL)
+    file->filename = (char*) map + img->filename;
+  file->st = new_arena_st(arena);
+  file->ei = img->ei;
+
+  const ImageSym* syms = (const ImageSym*) (map + img->syms);
+  for (size_t i = 0; i < img->nsyms; i++) {
+    if (syms[i].name == 0 || syms[i].name > hdr->nnames
+      || (syms[i].type != SBT_LABEL && syms[i].type != SBT_FUNC)
+      || syms[i].inst_addr > img->ninsts
+      || syms[i].nlocals > UINT16_MAX)
+      return IMAGE_ERR;
+
+    SymKey key = mk_key(ids[syms[i].name], (SymKeyType) syms[i].type);
+    SymVal val = syms[i].type == SBT_FUNC
+      ? mk_fnval(syms[i].inst_addr, syms[i].nlocals)
+      : mk_lbval(syms[i].inst_addr);
+    if (insert_st(&file->st, key, val) == INRES_EXISTS)
+      return IMAGE_ERR;
+  }
+
+  /* The mapping is read-only. Nothing writes to
+   * the instructions of a loaded program. */
+  Inst* insts = (Inst*) (map + img->insts);
+  for (size_t i = 0; i < img->ninsts; i++) {
+    if (!valid_inst(&insts[i], hdr->nnames))
+      return IMAGE_ERR;
+  }
+
+  file->insts = (Insts) {
+    .idx=img->ninsts,
+    .len=img->ninsts,
+    .cell=insts,
+    .filename=file->filename,
+    .arena=arena,  // Not on the heap.
+  };
+
+  return IMAGE_OK;
+}
+
+ProgramImage* load_image(const char* fn) {
+  assert(fn != NULL);
+
+  size_t size;
+  const char* problem;
+  char* map = map_image(fn, &size, &problem);
+  if (map == NULL) {
+    if (problem == NULL)
+      errf("can't open image `%s`", fn);
+    else
+      errf("image `%s` %s", fn, problem);
+    return NULL;
+  }
+
+  ProgramImage* prog =
+    (ProgramImage*) calloc (1, sizeof(ProgramImage));
+  assert(prog != NULL);
+
+  prog->arena = new_arena();
+  prog->syms = new_pool();
+  prog->image = map;
+  prog->image_size = size;
+
+  const ImageHeader* hdr = (const ImageHeader*) map;
+  prog->files = (File*) arena_alloc(&prog->arena, hdr->nfiles * sizeof(File));
+  prog->funcs = new_arena_st(&prog->arena);
+
+  /* The pool is new, so the names get the IDs `1`, `2` and
+   * so on. They're the indices in the instructions unless
+   * a name is in the image twice. */
+  SymId* ids = read_names(map, size, &prog->arena, prog->syms);
+  int res = ids == NULL ? IMAGE_ERR : IMAGE_OK;
+  for (uint32_t i = 1; res == IMAGE_OK && i <= hdr->nnames; i++) {
+    if (ids[i] != i)
+      res = IMAGE_ERR;
+  }
+  for (unsigned int fi = 0; res == IMAGE_OK && fi < hdr->nfiles; fi++) {
+    File* file = &prog->files[fi];
+    res = read_file(map, size, ids, fi, file, &prog->arena);
+    prog->nfiles++;
+
+    /* Enter the file's functions into the program's index. */
+    for (size_t i = 0; res == IMAGE_OK && i < file->st.len; i++) {
+      Symbol sym = file->st.cell[i];
+      if (sym.key.type != SBT_FUNC)
+        continue;
+      sym.val.fi = fi;
+      if (insert_st(&prog->funcs, sym.key, sym.val) == INRES_EXISTS)
+        res = IMAGE_ERR;
+    }
+  }
+
+  if (res == IMAGE_ERR) {
+    errf("image `%s` is corrupt", fn);
+    del_prog(prog);
+    return NULL;
+  }
+
+  return prog;
+}
+
+int read_file_image(const char* fn, const char* src, size_t src_len,
+                    File* file, Arena* arena, SymPool* syms) {
+  assert(fn != NULL);
+  assert(src != NULL);
+  assert(file != NULL);
+  assert(arena != NULL);
+  assert(syms != NULL);
+
+  size_t size;
+  const char* problem;
+  char* map = map_image(fn, &size, &problem);
+  if (map == NULL)
+    return IMAGE_ERR;
+
+  /* The name of a cache entry is only a hash of the source, so
+   * the source it was made from is compared byte by byte. */
+  const ImageHeader* hdr = (const ImageHeader*) map;
+  if (hdr->src_len != src_len
+    || hdr->src < sizeof(ImageHeader)
+    || hdr->src > size
+    || src_len > size - hdr->src
+    || memcmp(map + hdr->src, src, src_len) != 0) {
+    munmap(map, size);
+    return IMAGE_ERR;
+  }
+
+  int res = IMAGE_ERR;
+  SymId* ids = read_names(map, size, arena, syms);
+  if (ids != NULL
+    && hdr->nfiles == 1
+    && read_file(map, size, ids, 0, file, arena) == IMAGE_OK) {
+    /* The file must outlive the mapping. Its names are
+     * in a pool shared with other files, so they're
+     * given their IDs in the copy. */
+    Inst* cell = (Inst*) arena_alloc(arena, file->insts.idx * sizeof(Inst));
+    memcpy(cell, file->insts.cell, file->insts.idx * sizeof(Inst));
+    for (size_t i = 0; i < file->insts.idx; i++) {
+      cell[i].pos.filename = file->filename;
+      if (has_ident(&cell[i]))
+        cell[i].ident = ids[cell[i].ident];
+    }
+    file->insts.cell = cell;
+    res = IMAGE_OK;
+  }
+
+  munmap(map, size);
+  return res;
+}
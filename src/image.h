@@ -0,0 +1,124 @@
+#pragma once
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include "prog.h"
+
+#include <stdint.h>
+
+/* Precompiled program images (`.hvmc`). An image holds a
+ * loaded and linked program: the instructions of every file
+ * (with their source positions), each file's symbols and the
+ * layout of the static memory. Running an image maps it into
+ * memory and executes the instructions in place, so nothing
+ * has to be scanned or parsed again.
+ *
+ * Images are only meant to be run by the hvme build that wrote
+ * them. The header contains a format version and the size of
+ * an instruction, and the rest of the file is covered by a
+ * checksum. Images that don't match are rejected. */
+
+// Bump this whenever the image layout, `Inst` or `InstCode` changes.
+#define IMAGE_VERSION 4
+
+#define IMAGE_EXT ".hvmc"
+
+#define IMAGE_ERR 0
+#define IMAGE_OK 1
+
+/* Layout of an image. All offsets are in bytes from the start
+ * of the file. Sections follow each other in this order:
+ *
+ *   ImageHeader
+ *   ImageName[nnames + 1]  (index `0` is unused like `SYM_NONE`)
+ *   ImageFile[nfiles]
+ *   ImageSym[...]          (the symbols of each file in turn)
+ *   Inst[...]              (the instructions of each file in turn)
+ *   names and filenames    (null-terminated)
+ *   source                 (single-file images in the cache only)
+ *
+ * Instructions are stored as `Inst`s with `pos.filename` cleared
+ * and `ident` set to the index of its name. Names are interned in
+ * order into the pool of a new program, so the indices are its
+ * IDs and the instructions run straight from the read-only mapping.
+ * Errors take the filename from the file that's running. */
+
+#define IMAGE_MAGIC "HVMC"
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint32_t inst_size;  // `sizeof(Inst)` of the writer.
+  uint32_t nfiles;
+  uint32_t nnames;
+  // Size of each file's static and temp segment in words.
+  uint32_t stat_size;
+  uint32_t tmp_size;
+  uint64_t size;  // Size of the whole image.
+  uint64_t checksum;  // Checksum of everything after the header.
+  // Source a single-file image was made from (`0` if not kept).
+  uint64_t src;
+  uint64_t src_len;
+} ImageHeader;
+
+typedef struct {
+  uint64_t off;
+  uint64_t len;
+} ImageName;
+
+typedef struct {
+  uint64_t filename;  // Offset of the null-terminated filename.
+  uint64_t ei;  // Execution index to start at.
+  uint64_t syms;  // Offset of the file's symbols.
+  uint64_t nsyms;
+  uint64_t insts;  // Offset of the file's instructions.
+  uint64_t ninsts;
+} ImageFile;
+
+typedef struct {
+  uint32_t name;
+  uint32_t type;  // `SymKeyType`
+  uint64_t inst_addr;  // At most the file's `ninsts`.
+  uint32_t nlocals;
+  uint32_t pad;
+} ImageSym;
+
+/* Hash of `len` bytes at `data`. Used as the checksum of
+ * images. Not meant to withstand deliberate collisions. */
+uint64_t image_hash(const unsigned char* data, size_t len);
+
+/* Set the size and checksum in the header of the
+ * image of `size` bytes at `buf`. */
+void seal_image(unsigned char* buf, size_t size);
+
+// Whether `fn` names an image (by its extension).
+int is_image_fn(const char* fn);
+
+/* Write `prog` to the image file `fn`. The file is
+ * replaced at once, never partly written. Returns
+ * `IMAGE_ERR` if the file can't be written. */
+int write_image(const ProgramImage* prog, const char* fn);
+
+/* Write an image of the single `file`, whose identifiers
+ * are in `syms`, to `fn`. The `src_len` bytes at `src` it
+ * was loaded from are kept in the image. Prints nothing.
+ * Returns `IMAGE_ERR` on failure. */
+int write_file_image(const File* file, const SymPool* syms,
+                     const char* src, size_t src_len, const char* fn);
+
+/* Read the single-file image `fn` into `file`, allocating from
+ * `arena` and interning the names into `syms`. `file->filename`
+ * must already be set; the image's instructions are given this
+ * filename. Prints nothing. Returns `IMAGE_ERR` if `fn` isn't a
+ * valid single-file image or wasn't made from the `src_len`
+ * bytes at `src`. */
+int read_file_image(const char* fn, const char* src, size_t src_len,
+                    File* file, Arena* arena, SymPool* syms);
+
+/* Map the image `fn` into memory and return the program it
+ * contains. Returns `NULL` and prints an error if the file
+ * isn't a valid image for this build of hvme. */
+ProgramImage* load_image(const char* fn);
+
+#endif  // _IMAGE_H_
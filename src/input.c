@@ -0,0 +1,232 @@
+#include "input.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef IN_BUF_SIZE
+#  ifdef UNIT_TESTS
+// Small so that tests hit refilling and growing.
+#    define IN_BUF_SIZE 0x10
+#  else
+#    define IN_BUF_SIZE 0x10000
+#  endif  // UNIT_TESTS
+#endif  // IN_BUF_SIZE
+
+Input new_input(int fd) {
+  return (Input) { .fd=fd, .buf=NULL };
+}
+
+Input new_mem_input(const char* buf, size_t len) {
+  assert(buf != NULL || len == 0);
+  return (Input) {
+    .fd=-1, .buf=(char*) buf, .cap=len, .end=len,
+    .eof=1, .ready=1, .borrowed=1,
+  };
+}
+
+void del_input(Input* in) {
+  assert(in != NULL);
+
+  if (in->mapped)
+    munmap(in->buf, in->cap);
+  else if (!in->borrowed)
+    free(in->buf);
+  *in = new_input(in->fd);
+}
+
+Input* std_input(void) {
+  static Input in = { .fd=STDIN_FILENO, .buf=NULL };
+  return &in;
+}
+
+/* Map the input if it's a regular file. Otherwise
+ * allocate the buffer it's read into. */
+static void in_setup(Input* in) {
+  in->ready = 1;
+
+  struct stat sb;
+  off_t off = lseek(in->fd, 0, SEEK_CUR);
+  if (fstat(in->fd, &sb) == 0 && S_ISREG(sb.st_mode)
+      && off >= 0 && off < sb.st_size) {
+    char* map = (char*) mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, sb.st_size, MADV_SEQUENTIAL);
+      in->buf = map;
+      in->cap = in->end = (size_t) sb.st_size;
+      in->pos = (size_t) off;
+      in->eof = 1;
+      in->mapped = 1;
+      return;
+    }
+  }
+
+  in->cap = IN_BUF_SIZE;
+  in->buf = (char*) malloc (in->cap);
+  assert(in->buf != NULL);
+}
+
+/* Read more input after what's unread. Returns `0` at the end. */
+static int in_fill(Input* in) {
+  if (!in->ready) {
+    in_setup(in);
+    if (in->pos < in->end)
+      return 1;
+  }
+  if (in->eof)
+    return 0;
+
+  /* Keep the unread part in one piece. */
+  if (in->pos > 0) {
+    memmove(in->buf, in->buf + in->pos, in->end - in->pos);
+    in->end -= in->pos;
+    in->pos = 0;
+  }
+  if (in->end == in->cap) {
+    in->cap *= 2;
+    in->buf = (char*) realloc (in->buf, in->cap);
+    assert(in->buf != NULL);
+  }
+
+  ssize_t nread;
+  do {
+    nread = read(in->fd, in->buf + in->end, in->cap - in->end);
+  } while (nread == -1 && errno == EINTR);
+  if (nread <= 0) {
+    in->eof = 1;
+    return 0;
+  }
+  in->end += (size_t) nread;
+  return 1;
+}
+
+/* Next character without reading it or `IN_EOF`. */
+static inline int in_peek(Input* in) {
+  if (in->pos == in->end && !in_fill(in))
+    return IN_EOF;
+  return (unsigned char) in->buf[in->pos];
+}
+
+int in_char(Input* in) {
+  assert(in != NULL);
+
+  int c = in_peek(in);
+  if (c != IN_EOF)
+    in->pos++;
+  return c;
+}
+
+static inline int is_space(int c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline int is_digit(int c) {
+  return c >= '0' && c <= '9';
+}
+
+int in_num(Input* in, unsigned int* num) {
+  assert(in != NULL);
+  assert(num != NULL);
+
+  int c;
+  while (is_space(c = in_peek(in)))
+    in->pos++;
+  if (c == IN_EOF)
+    return IN_EOF;
+
+  /* `%u` takes a sign, too. */
+  int neg = c == '-';
+  if (c == '-' || c == '+') {
+    in->pos++;
+    c = in_peek(in);
+  }
+  if (!is_digit(c))
+    return IN_NOT_NUM;
+
+  unsigned int n = 0;
+  int sat = 0;
+  for (; is_digit(c); c = in_peek(in)) {
+    unsigned int d = (unsigned int) (c - '0');
+    if (n > (UINT_MAX - d) / 10)
+      sat = 1;
+    n = n * 10 + d;
+    in->pos++;
+  }
+
+  if (sat)
+    *num = UINT_MAX;
+  else
+    *num = neg ? 0u - n : n;
+  return IN_OK;
+}
+
+void in_skip_line(Input* in) {
+  assert(in != NULL);
+
+  int c;
+  do {
+    c = in_char(in);
+  } while (c != '\n' && c != IN_EOF);
+}
+
+size_t in_block(Input* in, const char** data, size_t max) {
+  assert(in != NULL);
+  assert(data != NULL);
+
+  if (in->pos == in->end && !in_fill(in))
+    return 0;
+  size_t len = in->end - in->pos;
+  if (len > max)
+    len = max;
+  *data = in->buf + in->pos;
+  in->pos += len;
+  return len;
+}
+
+ssize_t in_line(Input* in, const char** line) {
+  return in_line_max(in, line, SIZE_MAX);
+}
+
+ssize_t in_line_max(Input* in, const char** line, size_t max) {
+  assert(in != NULL);
+  assert(line != NULL);
+  assert(max > 0);
+
+  if (!in->ready)
+    in_setup(in);
+
+  /* Only search what's new after each fill. */
+  size_t searched = 0;
+  for (;;) {
+    size_t avail = in->end - in->pos;
+    if (avail > max)
+      avail = max;
+    const char* nl = (const char*) memchr(
+      in->buf + in->pos + searched, '\n', avail - searched);
+    if (nl != NULL) {
+      size_t len = (size_t) (nl - (in->buf + in->pos)) + 1;
+      *line = in->buf + in->pos;
+      in->pos += len;
+      return (ssize_t) len;
+    }
+    searched = avail;
+    if (searched == max || !in_fill(in))
+      break;
+  }
+
+  /* The last line may lack the newline. */
+  size_t len = in->end - in->pos;
+  if (len > max)
+    len = max;
+  if (len == 0)
+    return IN_EOF;
+  *line = in->buf + in->pos;
+  in->pos += len;
+  return (ssize_t) len;
+}
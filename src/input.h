@@ -0,0 +1,65 @@
+#pragma once
+
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Input of the running program. It's read in large blocks
+ * into a buffer of its own, or mapped at once if it's a
+ * regular file. Nothing else may read from its descriptor. */
+typedef struct {
+  int fd;
+  char* buf;  /* Unread input is `buf[pos..end)`. */
+  size_t cap;
+  size_t pos;
+  size_t end;
+  int eof;  /* Nothing more can be read. */
+  int ready;  /* `buf` is set up. */
+  int mapped;  /* `buf` maps all of the file. */
+  int borrowed;  /* `buf` belongs to someone else. */
+} Input;
+
+/* Input from `fd`. Nothing is read before it's needed. */
+Input new_input(int fd);
+
+/* Input of the `len` bytes at `buf`. They aren't copied,
+ * so they must stay around until the input is deleted. */
+Input new_mem_input(const char* buf, size_t len);
+
+void del_input(Input* in);
+
+/* The program's standard input. */
+Input* std_input(void);
+
+#define IN_OK 1
+#define IN_NOT_NUM 0
+#define IN_EOF -1
+
+/* Next character or `IN_EOF` (like `getchar`). */
+int in_char(Input* in);
+
+/* Read a decimal number like `scanf("%u")`: whitespace is skipped
+ * and the first character after the digits is left unread. Returns
+ * `IN_NOT_NUM` if something else comes first and `IN_EOF` if there's
+ * nothing left. Numbers too large for `unsigned int` saturate. */
+int in_num(Input* in, unsigned int* num);
+
+/* Skip everything up to and including the next newline. */
+void in_skip_line(Input* in);
+
+/* Read up to `max` characters. `*data` points to them until
+ * the next call. Returns how many there are or `0` at the end. */
+size_t in_block(Input* in, const char** data, size_t max);
+
+/* Read up to and including the next newline (like `getline`).
+ * `*line` points to the characters until the next call. Returns
+ * the number of characters or `IN_EOF` if there are none. */
+ssize_t in_line(Input* in, const char** line);
+
+/* Like `in_line`, but stop after `max` characters even if
+ * there's no newline among them. */
+ssize_t in_line_max(Input* in, const char** line, size_t max);
+
+#endif  // _INPUT_H_
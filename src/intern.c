@@ -0,0 +1,168 @@
+#include "intern.h"
+#include "arena.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef INTERN_INIT_SLOTS
+#  ifdef UNIT_TESTS
+#    define INTERN_INIT_SLOTS 4
+#  else
+#    define INTERN_INIT_SLOTS 0x1000
+#  endif  // UNIT_TESTS
+#endif  // INTERN_INIT_SLOTS
+
+/* Identifiers are stored in chunks which never move, so names can
+ * be looked up while others are added. Chunk `c` holds the IDs from
+ * `INTERN_INIT_SLOTS * (2^c - 1)` on and is twice as large as the
+ * chunk before it. That's enough chunks for every `SymId`. */
+#define INTERN_NCHUNKS 32
+
+typedef struct {
+  const char* name;
+  size_t len;
+  uint32_t hash;
+} Interned;
+
+struct SymPool {
+  pthread_mutex_t lock;  /* Held to add identifiers. */
+  Arena arena;  /* Chunks and null-terminated copies of the identifiers. */
+  Interned* chunks[INTERN_NCHUNKS];  /* Found with `sym_at`. `SYM_NONE`'s place is unused. */
+  atomic_size_t nsyms;  /* Set after each new identifier is complete. */
+  SymId* slots;  /* Open-addressed; power of two; `SYM_NONE` is free. */
+  size_t nslots;
+};
+
+SymPool* new_pool(void) {
+  SymPool* pool = (SymPool*) calloc (1, sizeof(SymPool));
+  assert(pool != NULL);
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pool->arena = new_arena();
+  atomic_init(&pool->nsyms, 1);  // Skip `SYM_NONE`.
+
+  return pool;
+}
+
+void del_pool(SymPool* pool) {
+  if (pool != NULL) {
+    pthread_mutex_destroy(&pool->lock);
+    del_arena(pool->arena);
+    free(pool->slots);
+    free(pool);
+  }
+}
+
+/* Return the place of `id` in its chunk. */
+static inline Interned* sym_at(Interned* const* chunks, SymId id) {
+  size_t n = id / INTERN_INIT_SLOTS + 1;
+  unsigned int c = 63 - __builtin_clzll(n);
+  return &chunks[c][id - INTERN_INIT_SLOTS * (((size_t) 1 << c) - 1)];
+}
+
+// FNV-1a
+static inline uint32_t hash_name(const char* str, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char) str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* Put `id` into the first free slot of its probe sequence. */
+static inline void place_slot(SymPool* pool, SymId* slots, size_t nslots, SymId id) {
+  size_t mask = nslots - 1;
+  size_t idx = sym_at(pool->chunks, id)->hash & mask;
+  while (slots[idx] != SYM_NONE)
+    idx = (idx + 1) & mask;
+  slots[idx] = id;
+}
+
+/* Double the number of slots once they're half full.
+ * Hashes are cached so nothing is hashed again. */
+static void grow_slots(SymPool* pool) {
+  size_t nslots = pool->nslots == 0 ? INTERN_INIT_SLOTS : pool->nslots * 2;
+  SymId* slots = (SymId*) calloc (nslots, sizeof(SymId));
+  assert(slots != NULL);
+
+  for (size_t i = 0; i < pool->nslots; i++) {
+    if (pool->slots[i] != SYM_NONE)
+      place_slot(pool, slots, nslots, pool->slots[i]);
+  }
+
+  free(pool->slots);
+  pool->slots = slots;
+  pool->nslots = nslots;
+}
+
+static SymId add_sym(SymPool* pool, const char* str, size_t len, uint32_t hash) {
+  size_t nsyms = atomic_load_explicit(&pool->nsyms, memory_order_relaxed);
+  assert(nsyms <= UINT32_MAX);
+  SymId id = (SymId) nsyms;
+
+  size_t n = id / INTERN_INIT_SLOTS + 1;
+  unsigned int c = 63 - __builtin_clzll(n);
+  if (pool->chunks[c] == NULL) {
+    pool->chunks[c] = (Interned*) arena_alloc(&pool->arena,
+      ((size_t) INTERN_INIT_SLOTS << c) * sizeof(Interned));
+  }
+
+  char* name = (char*) arena_alloc(&pool->arena, len + 1);
+  memcpy(name, str, len);
+  *sym_at(pool->chunks, id) = (Interned) { .name=name, .len=len, .hash=hash };
+
+  /* Publish the identifier to `sym_name`. */
+  atomic_store_explicit(&pool->nsyms, nsyms + 1, memory_order_release);
+  return id;
+}
+
+SymId intern(SymPool* pool, const char* str, size_t len) {
+  assert(pool != NULL);
+  assert(str != NULL);
+
+  uint32_t hash = hash_name(str, len);
+
+  pthread_mutex_lock(&pool->lock);
+
+  if (2 * atomic_load_explicit(&pool->nsyms, memory_order_relaxed) >= pool->nslots)
+    grow_slots(pool);
+
+  size_t mask = pool->nslots - 1;
+  size_t idx = hash & mask;
+  SymId id;
+  while ((id = pool->slots[idx]) != SYM_NONE) {
+    const Interned* sym = sym_at(pool->chunks, id);
+    if (sym->hash == hash && sym->len == len && memcmp(sym->name, str, len) == 0)
+      break;
+    idx = (idx + 1) & mask;
+  }
+
+  if (id == SYM_NONE) {
+    id = add_sym(pool, str, len, hash);
+    pool->slots[idx] = id;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return id;
+}
+
+SymId intern_str(SymPool* pool, const char* str) {
+  assert(str != NULL);
+
+  return intern(pool, str, strlen(str));
+}
+
+const char* sym_name(const SymPool* pool, SymId id) {
+  assert(pool != NULL);
+
+  size_t nsyms = atomic_load_explicit(&pool->nsyms, memory_order_acquire);
+  assert(id != SYM_NONE && id < nsyms);
+  (void) nsyms;
+
+  return sym_at(pool->chunks, id)->name;
+}
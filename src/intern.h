@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pool of identifiers. Every distinct identifier is stored once
+ * and named by a small integer ID from then on, so comparing
+ * identifiers is comparing IDs. Each program has a pool of its
+ * own (`ProgramImage.syms`), and IDs from different pools mean
+ * different things. IDs and names stay valid until the pool is
+ * deleted. Identifiers can be added from multiple threads at
+ * once; looking up a name doesn't take a lock. */
+
+typedef uint32_t SymId;
+
+// Not the ID of any identifier.
+#define SYM_NONE 0
+
+typedef struct SymPool SymPool;
+
+SymPool* new_pool(void);
+
+/* Free the pool and all its names. */
+void del_pool(SymPool* pool);
+
+// Return the ID of the `len` characters at `str`.
+SymId intern(SymPool* pool, const char* str, size_t len);
+
+// Return the ID of the null-terminated `str`.
+SymId intern_str(SymPool* pool, const char* str);
+
+// Return the null-terminated name of `id`.
+const char* sym_name(const SymPool* pool, SymId id);
+
+#endif  // _INTERN_H_
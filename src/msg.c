@@ -4,19 +4,241 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define NO_COLOR "NO_COLOR"
 
-static char last_stdout = '\0';
+/* If set, everything the current thread
+ * prints to stderr goes here instead. */
+static _Thread_local FILE* stderr_capture = NULL;
+
+static inline FILE* out_stream(FILE* stream) {
+  return stream == stderr && stderr_capture != NULL
+    ? stderr_capture
+    : stream;
+}
 
 #define PRINT_BUF_SIZE 1024
 
+static void init_output(Output* out, FILE* stream) {
+  out->stream = stream;
+  out->buf = out->bufs[0];
+  out->len = 0;
+  out->by_line = -1;
+  out->last = '\0';
+  out->threaded = 0;
+  pthread_mutex_init(&out->lock, NULL);
+  pthread_cond_init(&out->work, NULL);
+  pthread_cond_init(&out->done, NULL);
+  out->pending = NULL;
+  out->pending_len = 0;
+  out->stop = 0;
+}
+
+Output* new_output(FILE* stream) {
+  assert(stream != NULL);
+
+  Output* out = (Output*) malloc (sizeof(Output));
+  assert(out != NULL);
+  init_output(out, stream);
+  return out;
+}
+
+void del_output(Output* out) {
+  if (out != NULL) {
+    stop_out_thread(out);
+    flush_out(out);
+    pthread_cond_destroy(&out->done);
+    pthread_cond_destroy(&out->work);
+    pthread_mutex_destroy(&out->lock);
+    free(out);
+  }
+}
+
+static Output std_out;
+static pthread_once_t std_out_once = PTHREAD_ONCE_INIT;
+
+static void init_std_output(void) {
+  init_output(&std_out, stdout);
+}
+
+Output* std_output(void) {
+  pthread_once(&std_out_once, init_std_output);
+  return &std_out;
+}
+
+/* Output of the program the current thread runs. `NULL` means
+ * `std_output`. */
+static _Thread_local Output* active_out = NULL;
+
+Output* use_output(Output* out) {
+  Output* prev = active_out;
+  active_out = out;
+  return prev;
+}
+
+static inline Output* current_output(void) {
+  return active_out != NULL ? active_out : std_output();
+}
+
+static void* write_pending(void* arg) {
+  Output* out = (Output*) arg;
+
+  pthread_mutex_lock(&out->lock);
+  for (;;) {
+    while (out->pending_len == 0 && !out->stop)
+      pthread_cond_wait(&out->work, &out->lock);
+    if (out->pending_len == 0)
+      break;
+
+    const char* buf = out->pending;
+    size_t len = out->pending_len;
+    pthread_mutex_unlock(&out->lock);
+    fwrite(buf, 1, len, out->stream);
+    fflush(out->stream);
+    pthread_mutex_lock(&out->lock);
+
+    out->pending_len = 0;
+    pthread_cond_broadcast(&out->done);
+  }
+  pthread_mutex_unlock(&out->lock);
+
+  return NULL;
+}
+
+/* Wait until the writer thread has written everything. */
+static void wait_out(Output* out) {
+  if (!out->threaded)
+    return;
+  pthread_mutex_lock(&out->lock);
+  while (out->pending_len != 0)
+    pthread_cond_wait(&out->done, &out->lock);
+  pthread_mutex_unlock(&out->lock);
+}
+
+/* Hand the buffered output to the stream (or the writer thread). */
+static void write_out(Output* out) {
+  if (out->len == 0)
+    return;
+
+  if (!out->threaded) {
+    fwrite(out->buf, 1, out->len, out->stream);
+  } else {
+    /* The other buffer is free once it's written. */
+    pthread_mutex_lock(&out->lock);
+    while (out->pending_len != 0)
+      pthread_cond_wait(&out->done, &out->lock);
+    out->pending = out->buf;
+    out->pending_len = out->len;
+    pthread_cond_signal(&out->work);
+    pthread_mutex_unlock(&out->lock);
+    out->buf = out->buf == out->bufs[0] ? out->bufs[1] : out->bufs[0];
+  }
+  out->len = 0;
+}
+
+void start_out_thread(Output* out) {
+  assert(out != NULL);
+
+  if (out->threaded)
+    return;
+  write_out(out);
+  out->stop = 0;
+  out->threaded = pthread_create(&out->thread, NULL, write_pending, out) == 0;
+}
+
+void stop_out_thread(Output* out) {
+  assert(out != NULL);
+
+  if (!out->threaded)
+    return;
+  write_out(out);
+  pthread_mutex_lock(&out->lock);
+  out->stop = 1;
+  pthread_cond_signal(&out->work);
+  pthread_mutex_unlock(&out->lock);
+  pthread_join(out->thread, NULL);
+  out->threaded = 0;
+}
+
+static inline int out_by_line(Output* out) {
+  if (out->by_line == -1)
+    out->by_line = isatty(fileno(out->stream));
+  return out->by_line;
+}
+
+void out_char(Output* out, char c) {
+  if (out->len == OUT_BUF_SIZE)
+    write_out(out);
+  out->buf[out->len++] = c;
+  out->last = c;
+  if (c == '\n' && out_by_line(out))
+    flush_out(out);
+}
+
+char* out_space(Output* out, size_t* len) {
+  assert(len != NULL);
+
+  if (out->len == OUT_BUF_SIZE)
+    write_out(out);
+  if (*len > OUT_BUF_SIZE - out->len)
+    *len = OUT_BUF_SIZE - out->len;
+  return out->buf + out->len;
+}
+
+void out_commit(Output* out, size_t len) {
+  assert(out->len + len <= OUT_BUF_SIZE);
+
+  if (len == 0)
+    return;
+  const char* s = out->buf + out->len;
+  out->len += len;
+  out->last = s[len - 1];
+  if (out_by_line(out) && memchr(s, '\n', len) != NULL)
+    flush_out(out);
+}
+
+void out_bytes(Output* out, const char* s, size_t len) {
+  while (len > 0) {
+    size_t n = len;
+    char* dst = out_space(out, &n);
+    memcpy(dst, s, n);
+    out_commit(out, n);
+    s += n;
+    len -= n;
+  }
+}
+
+void out_num(Output* out, unsigned int n) {
+  char digits[16];
+  char* p = digits + sizeof(digits);
+  do {
+    *--p = (char) ('0' + n % 10);
+    n /= 10;
+  } while (n != 0);
+  out_bytes(out, p, (size_t) (digits + sizeof(digits) - p));
+}
+
+void flush_out(Output* out) {
+  assert(out != NULL);
+
+  write_out(out);
+  wait_out(out);
+  fflush(out->stream);
+}
+
 int hvme_fputs(const char *restrict s, FILE *restrict stream) {
   int len = strlen(s);
   if (stream == stdout) {
-    last_stdout = s[len > 0 ? len - 1 : '\0'];
+    Output* out = std_output();
+    write_out(out);
+    wait_out(out);
+    if (len > 0)
+      out->last = s[len - 1];
   }
-  return fputs(s, stream);  // <- Only time `fputs` is allowed.
+  return fputs(s, out_stream(stream));  // <- Only time `fputs` is allowed.
 }
 
 int hvme_fprintf(FILE *restrict stream, const char *restrict fmt, ...) {
@@ -47,14 +269,63 @@ int hvme_fprintf(FILE *restrict stream, const char *restrict fmt, ...) {
 }
 
 void clean_stdout(void) {
+  /* Messages which are captured will be printed
+   * later by another thread which cleans up then. */
+  if (stderr_capture != NULL)
+    return;
+  Output* out = current_output();
   /* Print a trailing newline if there's none. */
   #ifndef UNIT_TESTS
   /* Print a newline if the last character wasn't
-   * already a newline and stdout isn't empty. */
-  if (last_stdout != '\n' && last_stdout != '\0')
-    hvme_fprintf(stdout, "\n");
-  fflush(stdout);
+   * already a newline and the output isn't empty. */
+  if (out->last != '\n' && out->last != '\0')
+    out_char(out, '\n');
   #endif  // UNIT_TESTS
+  write_out(out);
+  wait_out(out);
+  #ifndef UNIT_TESTS
+  fflush(out->stream);
+  #endif  // UNIT_TESTS
+}
+
+void begin_capture(MsgCapture* capture) {
+  assert(capture != NULL);
+  assert(stderr_capture == NULL);
+
+  capture->buf = NULL;
+  capture->len = 0;
+  capture->stream = open_memstream(&capture->buf, &capture->len);
+  assert(capture->stream != NULL);
+  stderr_capture = capture->stream;
+}
+
+void end_capture(MsgCapture* capture) {
+  assert(capture != NULL);
+  assert(stderr_capture == capture->stream);
+
+  stderr_capture = NULL;
+  fclose(capture->stream);
+  capture->stream = NULL;
+}
+
+void replay_capture(MsgCapture* capture) {
+  assert(capture != NULL);
+  assert(capture->stream == NULL);
+
+  if (capture->buf != NULL && capture->len > 0) {
+    /* Keep the order with output printed since. */
+    flush_out(current_output());
+    hvme_fputs(capture->buf, stderr);
+  }
+  drop_capture(capture);
+}
+
+void drop_capture(MsgCapture* capture) {
+  assert(capture != NULL);
+
+  free(capture->buf);
+  capture->buf = NULL;
+  capture->len = 0;
 }
 
 static inline void init_perr(Pos pos) {
@@ -82,8 +353,8 @@ void perrf(Pos pos, const char* fmt, ...) {
   init_perr(pos);
   /* This is ok because it is internal; `clean_stdout`
    * will never be called before another `hvme_fprintf` 
-   * is called to correctly set `last_stdout`. */
-  vfprintf(stderr,  fmt, args);
+   * is called to correctly set the last character of stdout. */
+  vfprintf(out_stream(stderr),  fmt, args);
   hvme_fprintf(stderr, "\n");
   va_end(args);
 }
@@ -105,7 +376,42 @@ void err(const char* msg) {
   hvme_fprintf(stderr, "%s %s\n", err_init, msg);
 }
 
+void errf(const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  clean_stdout();
+  char* no_color = getenv(NO_COLOR);
+  char* err_init = "\033[31mError\033[0m";
+  if (no_color != NULL && no_color[0] != '\0') {
+    err_init= "Error";
+  }
+  hvme_fprintf(stderr, "%s ", err_init);
+  /* See `perrf`. */
+  vfprintf(out_stream(stderr), fmt, args);
+  hvme_fprintf(stderr, "\n");
+  va_end(args);
+}
+
+void err_multi_def_func(const char* ident, const char* first_fn, const char* second_fn) {
+  clean_stdout();
+  char* no_color = getenv(NO_COLOR);
+  char* err_init = "\033[31mError\033[0m";
+  if (no_color != NULL && no_color[0] != '\0') {
+    err_init= "Error";
+  }
+  hvme_fprintf(stderr, "%s function `%s` is defined in both `%s` and `%s`\n",
+    err_init, ident, first_fn, second_fn);
+}
+
+/* Warnings printed by this thread. */
+static _Thread_local unsigned int nwarnings = 0;
+
+unsigned int warn_count(void) {
+  return nwarnings;
+}
+
 static inline void init_warn(void) {
+  nwarnings++;
   char* no_color = getenv(NO_COLOR);
   if (no_color != NULL && no_color[0] != '\0') {
     hvme_fprintf(stderr, "Warn: ");
@@ -147,22 +453,7 @@ void warn_sat_uilit(int lit) {
   hvme_fprintf(stderr, "Saturating to maximum value 65535\n");
 }
 
-void warn_trunc_ident(const char* blk, size_t len, size_t max) {
-  char ident_buf[len + 1];
-  strncpy(ident_buf, blk, len);
-  ident_buf[len] = '\0';
-
-  char ident_trunc[max + 1];
-  strncpy(ident_trunc, blk, max);
-  ident_trunc[max] = '\0';
-
-  init_warn();
-  hvme_fprintf(stderr, "`%s` is too long to be an identifier.\n", ident_buf);
-  hint_indicator();
-  hvme_fprintf(stderr, "It's truncated to `%s` (%lu chars)\n", ident_trunc, max);
-}
-
-void warn_no_st(const SymKey* key, const SymVal* val) {
+void warn_no_st(const SymPool* syms, const SymKey* key, const SymVal* val) {
   assert(key != NULL);
   assert(val != NULL);
 
@@ -170,5 +461,5 @@ void warn_no_st(const SymKey* key, const SymVal* val) {
   hvme_fprintf(stderr, "symbol table doesn't exists.\n");
   hint_indicator();
   hvme_fprintf(stderr, "Can't enter %s `%s` starting at instruction %lu\n",
-    key_type_name(key->type), key->ident, val->inst_addr + 1);
+    key_type_name(key->type), sym_name(syms, key->ident), val->inst_addr + 1);
 }
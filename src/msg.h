@@ -6,6 +6,7 @@
 #include "scan.h"
 #include "st.h"
 #include <stdio.h>
+#include <pthread.h>
 
 /* Print a format string. Using this function makes
  * `clean_stdout` work. HVME internals should not use
@@ -15,7 +16,100 @@ int hvme_fprintf(FILE *restrict stream, const char *restrict fmt, ...);
 /* `hvme_fprintf` counter part for non-literal strings. */
 int hvme_fputs(const char *restrict s, FILE *restrict stream);
 
-/* Flush stdout and add a newline if it's missing. */
+#ifndef OUT_BUF_SIZE
+#  define OUT_BUF_SIZE 0x10000
+#endif  // OUT_BUF_SIZE
+
+/* Output of a running program. It's collected in a large
+ * buffer and written to `stream` when the buffer is full, at
+ * the end of each line if `stream` is a terminal, by `flush_out`
+ * and by `clean_stdout`. Anything else printed to stdout goes
+ * after the buffered output of `std_output`. */
+typedef struct {
+  FILE* stream;
+  char* buf;  /* One of `bufs` which isn't being written. */
+  size_t len;
+  int by_line;  /* Flush at each newline. `-1` until `stream` is checked. */
+  char last;  /* Last character of the output or `'\0'`. */
+  char bufs[2][OUT_BUF_SIZE];
+  /* Writer thread used after `start_out_thread`. It writes
+   * one buffer while the program fills the other one. */
+  int threaded;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* Signalled when there's something to write. */
+  pthread_cond_t done;  /* Signalled when `pending` is written. */
+  const char* pending;
+  size_t pending_len;  /* `0` if there's nothing to write. */
+  int stop;
+} Output;
+
+/* Output to `stream`. `stream` isn't closed by `del_output`. */
+Output* new_output(FILE* stream);
+
+/* Write what's left and free `out`. */
+void del_output(Output* out);
+
+/* Output to stdout. */
+Output* std_output(void);
+
+/* Make `out` the output of the program the calling thread runs
+ * (used by `clean_stdout`). Returns the output used before. */
+Output* use_output(Output* out);
+
+void out_char(Output* out, char c);
+
+/* Print `n` in decimal. */
+void out_num(Output* out, unsigned int n);
+
+void out_bytes(Output* out, const char* s, size_t len);
+
+/* Get room for up to `*len` bytes of output at the returned
+ * address. `*len` is set to the room there is. Only `out_commit`
+ * may be called before writing the bytes. */
+char* out_space(Output* out, size_t* len);
+
+/* Output the first `len` bytes of the room from `out_space`. */
+void out_commit(Output* out, size_t len);
+
+/* Write the buffered output and flush the stream. Must be
+ * called before reading input so that prompts show up. */
+void flush_out(Output* out);
+
+/* Write the output on a thread of its own from now on, so
+ * that the program doesn't wait for slow readers. The output
+ * is written in the same order and `flush_out` still waits
+ * until everything is written. */
+void start_out_thread(Output* out);
+
+/* Write what's left and stop the thread again. */
+void stop_out_thread(Output* out);
+
+/* Messages printed to stderr while loading files on
+ * other threads. They are held back and printed later
+ * so that the output is always in the same order. */
+typedef struct {
+  char* buf;
+  size_t len;
+  FILE* stream;
+} MsgCapture;
+
+/* Collect everything the calling thread prints to
+ * stderr in `capture` until `end_capture` is called. */
+void begin_capture(MsgCapture* capture);
+
+void end_capture(MsgCapture* capture);
+
+/* Print the messages in a finished `capture`
+ * to stderr and free them. */
+void replay_capture(MsgCapture* capture);
+
+/* Free the messages in a finished `capture`
+ * without printing them. */
+void drop_capture(MsgCapture* capture);
+
+/* Flush the output of the program the calling thread runs
+ * (stdout by default) and add a newline if it's missing. */
 void clean_stdout(void);
 
 /* Formatted error message with source position. */
@@ -24,9 +118,15 @@ void perrf(Pos pos, const char* fmt, ...);
 /* Unformatted error message. */
 void err(const char* msg);
 
+/* Formatted error message. */
+void errf(const char* fmt, ...);
+
 /* Unformatted error message with source position. */
 void perr(Pos pos, const char* msg);
 
+/* Number of warnings the calling thread has printed. */
+unsigned int warn_count(void);
+
 /* Print a warning if the file extension of the
  * given file is not `.vm`. */
 void warn_file_ext(const char* filename);
@@ -39,15 +139,12 @@ void warn_eof_nl(void);
  * allowed 16-bit number range. */
 void warn_sat_uilit(int lit);
 
-/* Print a warning that the identifer of
- * length `len` exceeds the maximum identifer
- * length `max`. It will therefore be truncated to
- * the first `MAX_IDENT_LEN` characters. */
-void warn_trunc_ident(const char* blk, size_t len, size_t max);
+/* Error: function `ident` is defined in both files. */
+void err_multi_def_func(const char* ident, const char* first_fn, const char* second_fn);
 
 /* Warn the user that `parse` didn't receive a
  * symbol table which means that any label-related
  * instruction doesn't work. */
-void warn_no_st(const SymKey* key, const SymVal* val);
+void warn_no_st(const SymPool* syms, const SymKey* key, const SymVal* val);
 
 #endif  // _MSG_H_
@@ -11,38 +11,70 @@ Insts new_insts(const char* filename) {
   Insts insts = {
     .idx=0,
     .len=INST_BLOCK_SIZE,
+    .filename=filename,
+    .arena=NULL,
   };
 
-  if (filename != NULL) {
-    insts.filename = (char*) calloc (strlen(filename) + 1, sizeof(char));
-    assert(filename != NULL);
-    strcpy(insts.filename, filename);
-  } else {
-    insts.filename = NULL;
-  }
-
   insts.cell = (Inst*) calloc (insts.len, sizeof(Inst));
   assert(insts.cell != NULL);
 
   return insts;
 }
 
+Insts new_arena_insts(Arena* arena, const char* filename) {
+  assert(arena != NULL);
+
+  /* Nothing is allocated up front. Parsing reserves
+   * room for the instructions as it goes. */
+  return (Insts) {
+    .idx=0,
+    .len=0,
+    .cell=NULL,
+    .filename=filename,
+    .arena=arena,
+  };
+}
+
 void del_insts(Insts insts) {
-  free(insts.cell);
-  free(insts.filename);
+  if (insts.arena == NULL)
+    free(insts.cell);
 }
 
-void cpy_insts(Insts* dest, Insts* src) {
-  assert(dest != NULL);
-  assert(src != NULL);
+void reserve_insts(Insts* insts, size_t len) {
+  assert(insts != NULL);
+
+  if (len <= insts->len)
+    return;
+
+  /* Grow geometrically so repeated small
+   * reservations stay amortized O(1). */
+  size_t new_len = insts->len * 2;
+  if (new_len < len)
+    new_len = len;
 
-  dest->len += src->len;
-  dest->cell = (Inst*) realloc (dest->cell, dest->len * sizeof(Inst));
-  memcpy(dest->cell + dest->idx, src->cell, src->idx * sizeof(Inst));
-  dest->idx += src->idx;
+  if (insts->arena != NULL) {
+    insts->cell = (Inst*) arena_grow(insts->arena, insts->cell,
+      insts->len * sizeof(Inst), new_len * sizeof(Inst));
+  } else {
+    insts->cell = (Inst*) realloc (insts->cell, new_len * sizeof(Inst));
+    assert(insts->cell != NULL);
+  }
+  insts->len = new_len;
 }
 
-void inst_str(const Inst* i, char* str) {
+void trim_insts(Insts* insts) {
+  assert(insts != NULL);
+
+  /* Only arena memory is trimmed. The tail of the most
+   * recent arena allocation is handed back to the arena. */
+  if (insts->arena != NULL) {
+    insts->cell = (Inst*) arena_grow(insts->arena, insts->cell,
+      insts->len * sizeof(Inst), insts->idx * sizeof(Inst));
+    insts->len = insts->idx;
+  }
+}
+
+void inst_str(const SymPool* syms, const Inst* i, char* str) {
   assert(i != NULL);
   assert(str != NULL);
 
@@ -58,10 +90,10 @@ void inst_str(const Inst* i, char* str) {
   } else if (i->code == GOTO || i->code == IF_GOTO) {
     static char* ctrlflow_insts[] = { [TK_GOTO]="goto", [TK_IF_GOTO]="if-goto" };
     snprintf(str, INST_STR_BUF, "%s %s",
-      ctrlflow_insts[i->code], i->ident);
+      ctrlflow_insts[i->code], sym_name(syms, i->ident));
   } else if (i->code == CALL) {
     snprintf(str, INST_STR_BUF, "call %s %d",
-      i->ident, i->nargs);
+      sym_name(syms, i->ident), i->nargs);
   } else {
     static char* insts[] = {
       [0]="IC_NONE",
@@ -75,6 +107,14 @@ void inst_str(const Inst* i, char* str) {
       [BUILTIN_READ_CHAR]="<builtin read char>",
       [BUILTIN_READ_NUM]="<builtin read num>",
       [BUILTIN_READ_STR]="<builtin read str>",
+      [BUILTIN_MEM_COPY]="<builtin mem copy>",
+      [BUILTIN_MEM_FILL]="<builtin mem fill>",
+      [BUILTIN_MEM_CMP]="<builtin mem cmp>",
+      [BUILTIN_FILE_OPEN]="<builtin file open>",
+      [BUILTIN_FILE_READ_BLOCK]="<builtin file read block>",
+      [BUILTIN_FILE_WRITE_BLOCK]="<builtin file write block>",
+      [BUILTIN_FILE_CLOSE]="<builtin file close>",
+      [FUNC_END]="<end of function>",
     };
     strncpy(str, insts[i->code], INST_STR_BUF);
   }
@@ -85,6 +125,7 @@ typedef struct {
   const Token* tokens;
   size_t idx;
   size_t len;
+  const SymPool* syms;  // Names of the identifiers.
 } TokenStream;
 
 
@@ -133,15 +174,16 @@ TokenStream its_slice(TokenStream* its, size_t ol, size_t or) {
     .len = or + its->idx <= its->len
       ? or + its->idx
       : its->len,
+    .syms=its->syms,
   };
 }
 
-void print_multi_def_err(SymKey* key, SymVal* val, Pos pos, const char* filename) {
+void print_multi_def_err(const SymPool* syms, SymKey* key, SymVal* val, Pos pos, const char* filename) {
   pos.filename = filename;
   perrf(pos,
     "multiple definitions of the same %s.\n"
     "  Won't enter `%s` starting at instruction %lu",
-    key_type_name(key->type), key->ident, val->inst_addr + 1);
+    key_type_name(key->type), sym_name(syms, key->ident), val->inst_addr + 1);
 }
 
 void print_expect3_err(TokenStream its, const char* expectation, const char* filename) {
@@ -149,19 +191,19 @@ void print_expect3_err(TokenStream its, const char* expectation, const char* fil
 
   // `calloc` will indirectly add the null-terminator
   // to both `spacer` and `pointer`.
-  TOKEN_STR(first, its_next(&its));
+  TOKEN_STR(first, its.syms, its_next(&its));
   char* first_spacer = (char*) calloc (strlen(first) + 1, sizeof(char));
   assert(first_spacer != NULL);
   memset(first_spacer, ' ', strlen(first));
 
   const Token* second_it = its_next(&its);
-  TOKEN_STR(second, second_it);
+  TOKEN_STR(second, its.syms, second_it);
   char* second_spacer = (char*) calloc (strlen(second) + 1, sizeof(char));
   assert(second_spacer != NULL);
   memset(second_spacer, ' ', strlen(second));
 
   const Token* it = its_next(&its);
-  TOKEN_STR(self, it);
+  TOKEN_STR(self, its.syms, it);
   char* pointer = (char*) calloc(strlen(self) + 1, sizeof(char));
   assert(pointer != NULL);
   memset(pointer, '^', strlen(self));
@@ -194,13 +236,13 @@ void print_expect2_err(TokenStream its, const char* expectation, const char* fil
   // `calloc` will indirectly add the null-terminator
   // to both `spacer` and `pointer`.
   const Token* prev_it = its_next(&its);
-  TOKEN_STR(prev, prev_it);
+  TOKEN_STR(prev, its.syms, prev_it);
   char* spacer = (char*) calloc (strlen(prev) + 1, sizeof(char));
   assert(spacer != NULL);
   memset(spacer, ' ', strlen(prev));
 
   const Token* it = its_next(&its);
-  TOKEN_STR(self, it);
+  TOKEN_STR(self, its.syms, it);
   char* pointer = (char*) calloc (strlen(self) + 1, sizeof(char));
   assert(pointer != NULL);
   memset(pointer, '^', strlen(self));
@@ -219,7 +261,7 @@ void print_expect2_err(TokenStream its, const char* expectation, const char* fil
   }
   display_pos.filename = filename;
 
-  TOKEN_STR(next, its_next(&its));
+  TOKEN_STR(next, its.syms, its_next(&its));
 
   perrf(display_pos,
     "wrong token, expected %s\n"
@@ -234,8 +276,8 @@ void print_expect2_err(TokenStream its, const char* expectation, const char* fil
   free(pointer);
 }
 
-void print_token_err(const Token* it, const char* filename) {
-  TOKEN_STR(it_str, it);
+void print_token_err(const SymPool* syms, const Token* it, const char* filename) {
+  TOKEN_STR(it_str, syms, it);
   Pos pos = it->pos;
   pos.filename = filename;
   perrf(pos, "wrong start of instruction\n | %s", it_str);
@@ -243,13 +285,13 @@ void print_token_err(const Token* it, const char* filename) {
 
 void print_ident_err(TokenStream its, const char* filename) {
   const Token* ctrlflow_it = its_next(&its);
-  TOKEN_STR(ctrlflow_str, ctrlflow_it);
+  TOKEN_STR(ctrlflow_str, its.syms, ctrlflow_it);
   char* ctrlflow_spacer = (char*) calloc (strlen(ctrlflow_str) + 1, sizeof(char));
   assert(ctrlflow_spacer != NULL);
   memset(ctrlflow_spacer, ' ', strlen(ctrlflow_str));  // Implicit `* sizeof(char)`.
 
   const Token* no_ident = its_next(&its);
-  TOKEN_STR(no_id_str, no_ident);
+  TOKEN_STR(no_id_str, its.syms, no_ident);
   char* pointer = (char*) calloc (strlen(no_id_str) + 1, sizeof(char));
   assert(pointer != NULL);
   memset(pointer, '^', strlen(no_id_str));
@@ -329,7 +371,7 @@ static inline int goto_inst(TokenStream* its, Inst* inst, const char* filename)
   inst->code = (enum InstCode) goto_it->t;
 
   if (its_lh(its)->t == TK_IDENT) {
-    strcpy(inst->ident, its_next(its)->ident);
+    inst->ident = its_next(its)->ident;
   } else {
     print_ident_err(its_slice(its, 1, 1), filename);
     return PARSE_ERR;
@@ -347,7 +389,7 @@ static inline int if_goto_inst(TokenStream* its, Inst* inst, const char* filenam
   inst->code = (enum InstCode) if_goto_it->t;
 
   if (its_lh(its)->t == TK_IDENT) {
-    strcpy(inst->ident, its_next(its)->ident);
+    inst->ident = its_next(its)->ident;
   } else {
     print_ident_err(its_slice(its, 1, 1), filename);
     return PARSE_ERR;
@@ -365,17 +407,16 @@ static inline int label_meta(TokenStream* its, SymbolTable* st, size_t num_inst,
   Pos pos = its_next(its)->pos;
 
   if (its_lh(its)->t == TK_IDENT) {
-    const char* ident = its_next(its)->ident;
-    SymKey key = mk_key(ident, SBT_LABEL);
+    SymKey key = mk_key(its_next(its)->ident, SBT_LABEL);
     SymVal val = mk_lbval(num_inst);
     if (st != NULL) {
       if (insert_st(st, key, val) == INRES_EXISTS)  {
-        print_multi_def_err(&key, &val, pos, filename);
+        print_multi_def_err(its->syms, &key, &val, pos, filename);
         return PARSE_ERR;
       }
     }
     else
-      warn_no_st(&key, &val);
+      warn_no_st(its->syms, &key, &val);
   } else {
     print_ident_err(its_slice(its, 1, 1), filename);
     return PARSE_ERR;
@@ -395,7 +436,7 @@ static inline int function_inst(
   /* Consume `TK_FUNC` only keeping the position. */
   Pos pos = its_next(its)->pos;
 
-  const char* ident = NULL;
+  SymId ident;
 
   if (its_lh(its)->t == TK_IDENT) {
     ident = its_next(its)->ident;
@@ -421,12 +462,12 @@ static inline int function_inst(
 
   if (st != NULL) {
     if (insert_st(st, key, val) == INRES_EXISTS)  {
-      print_multi_def_err(&key, &val, pos, filename);
+      print_multi_def_err(its->syms, &key, &val, pos, filename);
       return PARSE_ERR;
     }
   }
   else
-    warn_no_st(&key, &val);
+    warn_no_st(its->syms, &key, &val);
 
   return PARSE_OK;
 }
@@ -440,7 +481,7 @@ static inline int call_inst(TokenStream* its, Inst* inst, const char* filename)
   inst->code = (enum InstCode) call_it->t;
 
   if (its_lh(its)->t == TK_IDENT) {
-    strcpy(inst->ident, its_next(its)->ident);
+    inst->ident = its_next(its)->ident;
   } else {
     print_ident_err(its_slice(its, 1, 1), filename);
     return PARSE_ERR;
@@ -482,61 +523,58 @@ static inline int is_inst_token(const TokenCode t) {
     (TK_FUNC <= t && t <= TK_RET);  // <- range of all function calling instructions
 }
 
-int parse(const Tokens* tokens, Insts* insts, SymbolTable* st) {
-  assert(tokens != NULL);
+// Instructions are at most this many tokens long (`push local 0`,
+// `call Main.main 0`). Error messages don't look beyond them either.
+#define MAX_INST_TOKENS 3
+
+/* Parse instructions from `its` into `insts`. Unless `last` is set,
+ * the last few tokens are left over if they might be the beginning
+ * of an instruction whose remaining tokens are still missing.
+ * `st_num_inst` is the address of the first instruction in `insts`. */
+static int parse_its(
+  TokenStream* its,
+  Insts* insts,
+  SymbolTable* st,
+  size_t st_num_inst,
+  int last,
+  const char* filename
+) {
+  assert(its != NULL);
   assert(insts != NULL);
-  
-  TokenStream its = (TokenStream) {
-    .tokens=tokens->cell,
-    .idx=0,
-    .len=tokens->idx,
-  };
 
   int res;
-  /* Each time this parse function is called, a new `Insts`
-   * instance is created with its own local instruction count
-   * which starts at 0 every time `parse` runs. To keep track
-   * of the instruction count between `parse` calls, the global
-   * symbol table has a field which stores the number of the next
-   * instruction between calls (`num_inst`). It's used as an offset
-   * when calling `label` and it's updated at the end of each `parse` call.
-   */
-  size_t st_num_inst = st == NULL ? 0 : st->num_inst;
+
+  /* Every instruction consumes at least one token. Hence
+   * the number of tokens is enough room for all of them. */
+  reserve_insts(insts, insts->idx + its->len - its->idx);
   
   for (
-    const Token* it = its_lh(&its);
-    its.idx < its.len;
-    it = its_lh(&its)
+    const Token* it = its_lh(its);
+    its->idx < its->len && (last || its->len - its->idx >= MAX_INST_TOKENS);
+    it = its_lh(its)
   ) {
     // Error if the token can't be the beginning
     // of an instruction.
     if (!is_inst_token(it->t)) {
-      print_token_err(it, tokens->filename);
+      print_token_err(its->syms, it, filename);
       return PARSE_ERR;
     }
 
-    // Allocate more memory if current limit was reached.
-    if (insts->idx == insts->len) {
-      insts->len += INST_BLOCK_SIZE;
-      insts->cell = (Inst*) realloc (insts->cell, insts->len * sizeof(Inst));
-      assert(insts->cell != NULL);
-    }
-
     switch (it->t) {
       case TK_LABEL:
         res = label_meta(
-          &its,
+          its,
           st,
           insts->idx + st_num_inst,
-          tokens->filename
+          filename
         );
         break;
       case TK_FUNC:
         res = function_inst(
-          &its,
+          its,
           st,
           insts->idx + st_num_inst,
-          tokens->filename
+          filename
         );
         break;
       default:
@@ -545,7 +583,7 @@ int parse(const Tokens* tokens, Insts* insts, SymbolTable* st) {
         // advance by any number but has to stop
         // if it reaches the end of the input.
         res =
-          parse_fns[it->t](&its, &insts->cell[insts->idx], tokens->filename);
+          parse_fns[it->t](its, &insts->cell[insts->idx], filename);
         /* Set the a pointer to the filename of
          * the instruction's source file in the
          * position instance. This is only a copy
@@ -561,6 +599,96 @@ int parse(const Tokens* tokens, Insts* insts, SymbolTable* st) {
     }
   }
 
+  return PARSE_OK;
+}
+
+int parse(const Tokens* tokens, Insts* insts, SymbolTable* st) {
+  assert(tokens != NULL);
+  assert(insts != NULL);
+  
+  TokenStream its = (TokenStream) {
+    .tokens=tokens->cell,
+    .idx=0,
+    .len=tokens->idx,
+    .syms=tokens->syms,
+  };
+
+  /* Each time this parse function is called, a new `Insts`
+   * instance is created with its own local instruction count
+   * which starts at 0 every time `parse` runs. To keep track
+   * of the instruction count between `parse` calls, the global
+   * symbol table has a field which stores the number of the next
+   * instruction between calls (`num_inst`). It's used as an offset
+   * when calling `label` and it's updated at the end of each `parse` call.
+   */
+  size_t st_num_inst = st == NULL ? 0 : st->num_inst;
+
+  if (parse_its(&its, insts, st, st_num_inst, 1, tokens->filename) == PARSE_ERR)
+    return PARSE_ERR;
+
+  if (st != NULL)
+    st->num_inst +=  insts->idx;
+
+  return PARSE_OK;
+}
+
+// State of `scan_parse` between batches of tokens.
+typedef struct {
+  Insts* insts;
+  SymbolTable* st;
+  size_t st_num_inst;
+} ParseSink;
+
+static ssize_t parse_sink(const Tokens* tokens, int last, void* ctx) {
+  ParseSink* ps = (ParseSink*) ctx;
+
+  TokenStream its = (TokenStream) {
+    .tokens=tokens->cell,
+    .idx=0,
+    .len=tokens->idx,
+    .syms=tokens->syms,
+  };
+
+  if (parse_its(&its, ps->insts, ps->st, ps->st_num_inst, last, tokens->filename) == PARSE_ERR)
+    return -1;
+
+  return (ssize_t) its.idx;
+}
+
+int scan_parse(Tokens* tokens, Insts* insts, SymbolTable* st) {
+  assert(tokens != NULL);
+  assert(insts != NULL);
+
+  ParseSink ps = {
+    .insts=insts,
+    .st=st,
+    // See `parse`.
+    .st_num_inst= st == NULL ? 0 : st->num_inst,
+  };
+
+  if (scan_stream(tokens, parse_sink, &ps) == SCAN_ERR)
+    return PARSE_ERR;
+
+  if (st != NULL)
+    st->num_inst +=  insts->idx;
+
+  return PARSE_OK;
+}
+
+int scan_parse_src(Tokens* tokens, const char* src, size_t len,
+                   Insts* insts, SymbolTable* st) {
+  assert(tokens != NULL);
+  assert(insts != NULL);
+
+  ParseSink ps = {
+    .insts=insts,
+    .st=st,
+    .st_num_inst= st == NULL ? 0 : st->num_inst,
+  };
+
+  if (scan_stream_src(tokens, src, len, parse_sink, &ps) == SCAN_ERR)
+    return PARSE_ERR;
+
   if (st != NULL)
     st->num_inst +=  insts->idx;
 
@@ -7,6 +7,7 @@
 
 #include "scan.h"
 #include "st.h"
+#include "arena.h"
 
 typedef enum {
   ARG=TK_ARG,
@@ -46,6 +47,17 @@ typedef struct {
     BUILTIN_READ_CHAR,
     BUILTIN_READ_NUM,
     BUILTIN_READ_STR,
+    BUILTIN_MEM_COPY,
+    BUILTIN_MEM_FILL,
+    BUILTIN_MEM_CMP,
+    BUILTIN_FILE_OPEN,
+    BUILTIN_FILE_READ_BLOCK,
+    BUILTIN_FILE_WRITE_BLOCK,
+    BUILTIN_FILE_CLOSE,
+    // End of a lazily loaded function. Execution continues
+    // at the function after it in the source (`ident`) or
+    // ends if there is none (`SYM_NONE`).
+    FUNC_END,
   } code;
 
   union {
@@ -54,8 +66,8 @@ typedef struct {
       Segment seg;
       uint16_t offset;
     } mem;
-    // Identifier (set for `GOTO`, `IF_GOTO` and `CALL`).
-    char ident[MAX_IDENT_LEN + 1];
+    // Identifier (set for `GOTO`, `IF_GOTO`, `CALL` and `FUNC_END`).
+    SymId ident;
   };
 
   /* This field is separate from the above
@@ -73,32 +85,48 @@ typedef struct {
   size_t idx;
   size_t len;
   Inst* cell;
-  char* filename;
+  // Borrowed. Must outlive the instructions.
+  const char* filename;
+  // Owner of `cell` or `NULL` if it's on the heap.
+  Arena* arena;
 } Insts;
 
 // Initialize a new `Insts` instance.
 Insts new_insts(const char* filename);
 
-// Delete an `Insts` instance.
+// Initialize a new `Insts` instance whose
+// memory is owned by `arena`.
+Insts new_arena_insts(Arena* arena, const char* filename);
+
+// Delete an `Insts` instance. Does nothing
+// if the instructions live in an arena.
 void del_insts(Insts insts);
 
+// Make room for at least `len` instructions in total.
+void reserve_insts(Insts* insts, size_t len);
+
+// Release the capacity beyond `insts->idx`.
+void trim_insts(Insts* insts);
+
 #ifndef INST_STR_BUF
 // Size of `char` buf to pass to `inst_str`.
-#define INST_STR_BUF 40
+#define INST_STR_BUF 0x100
 #endif  // INST_STR_BUF
 
 // Write a string describing `i` to `str`.
 // `str` must be large enought to hold at
-// least `INST_STR_BUF` characters.
-void inst_str(const Inst* i, char* str);
+// least `INST_STR_BUF` characters. Identifiers
+// are looked up in `syms`, which may be `NULL`
+// if `i` doesn't have one.
+void inst_str(const SymPool* syms, const Inst* i, char* str);
 
 // Macro to handle the fixed-size string
 // buffer used to stringify an instruction.
 // This macro should be the only way
 // `token_str` is called.
-#define INST_STR(id, inst) \
+#define INST_STR(id, syms, inst) \
   char id[INST_STR_BUF]; \
-  inst_str(inst, id);
+  inst_str(syms, inst, id);
 
 
 #ifndef INST_BLOCK_SIZE
@@ -114,4 +142,15 @@ void inst_str(const Inst* i, char* str);
 // Parse the given array of token. Returns `NULL` on failure.
 int parse(const Tokens* tokens, Insts* insts, SymbolTable* st);
 
+/* Scan the file `tokens` was created for and parse it while it's
+ * being scanned. Only the tokens of the current block and the
+ * unfinished instruction at its end are kept in `tokens`. Returns
+ * `PARSE_ERR` if either scanning or parsing fails. */
+int scan_parse(Tokens* tokens, Insts* insts, SymbolTable* st);
+
+/* Like `scan_parse` but scan the `len` bytes at `src`, which
+ * end with a newline, instead of the file. */
+int scan_parse_src(Tokens* tokens, const char* src, size_t len,
+                   Insts* insts, SymbolTable* st);
+
 #endif  // _PARSE_H_
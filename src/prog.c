@@ -2,10 +2,30 @@
 
 #include "scan.h"
 #include "msg.h"
+#include "cache.h"
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+
+#ifndef HEAP_NO_SIMD
+#  if defined(__AVX2__)
+#    include <immintrin.h>
+#    define HEAP_VEC_LEN 32
+#  elif defined(__SSE2__)
+#    include <emmintrin.h>
+#    define HEAP_VEC_LEN 16
+#  endif
+#endif  // HEAP_NO_SIMD
 
 Stack new_stack(void) {
   Stack s = {
@@ -71,49 +91,121 @@ Heap new_heap(void) {
   };
   h.mem = (Word*) calloc (MEM_HEAP_SIZE, sizeof(Word));
   assert(h.mem != NULL);
+  h.dirty = (uint64_t*) calloc ((MEM_HEAP_PAGES + 63) / 64, sizeof(uint64_t));
+  assert(h.dirty != NULL);
   return h;
 }
 
 void del_heap(Heap h) {
+  free(h.dirty);
   free(h.mem);
 }
 
 Word heap_get(const Heap h, Addr addr) {
   assert(h.mem != NULL);
-  // No need to check out of range errors
-  // since `heap.mem` has 0xFFFF entries
-  // and `Addr` can't be larger than that.
-  // Rare case of C type-safety ...
+  // Callers check that `addr < MEM_HEAP_SIZE`.
+  assert(addr < MEM_HEAP_SIZE);
   return h.mem[addr];
 }
 
 void heap_set(Heap h, Addr addr, Word val) {
   assert(h.mem != NULL);
-  // See `heap_get` about further range checks.
+  // See `heap_get` about range checks.
+  assert(addr < MEM_HEAP_SIZE);
+  size_t page = addr >> MEM_PAGE_BITS;
+  h.dirty[page / 64] |= (uint64_t) 1 << (page % 64);
   h.mem[addr] = val;
 }
 
-Memory new_mem(void) {
-  Memory mem = {
-    ._static = (Word*) calloc (MEM_STAT_SIZE, sizeof(Word)),
-    .tmp = (Word*) calloc (MEM_TEMP_SIZE, sizeof(Word)),
-  };
-  assert(mem._static != NULL);
-  assert(mem.tmp != NULL);
-  return mem;
+void heap_touch(Heap h, size_t addr, size_t n) {
+  assert(addr + n <= MEM_HEAP_SIZE);
+
+  if (n == 0)
+    return;
+  size_t last = (addr + n - 1) >> MEM_PAGE_BITS;
+  for (size_t page = addr >> MEM_PAGE_BITS; page <= last; page++)
+    h.dirty[page / 64] |= (uint64_t) 1 << (page % 64);
+}
+
+void clear_heap(Heap* h) {
+  assert(h != NULL);
+
+  for (size_t i = 0; i < (MEM_HEAP_PAGES + 63) / 64; i++) {
+    uint64_t bits = h->dirty[i];
+    while (bits != 0) {
+      size_t page = i * 64 + __builtin_ctzll(bits);
+      memset(h->mem + (page << MEM_PAGE_BITS), 0, sizeof(Word) << MEM_PAGE_BITS);
+      bits &= bits - 1;
+    }
+    h->dirty[i] = 0;
+  }
+  h->_this = 0;
+  h->that = 0;
+}
+
+/* Both directions handle `HEAP_VEC_LEN` chars per step
+ * and leave the rest to a plain loop. */
+
+void narrow_words(char* dst, const Word* src, size_t n) {
+  size_t i = 0;
+#if HEAP_VEC_LEN == 32
+  const __m256i low = _mm256_set1_epi16(0xFF);
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) (src + i)), low);
+    __m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*) (src + i + 16)), low);
+    /* Packing works on each 128-bit lane. Put the
+     * four 64-bit parts back into order. */
+    __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+    _mm256_storeu_si256((__m256i*) (dst + i), bytes);
+  }
+#elif HEAP_VEC_LEN == 16
+  const __m128i low = _mm_set1_epi16(0xFF);
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*) (src + i)), low);
+    __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*) (src + i + 8)), low);
+    /* Nothing saturates after masking. */
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(a, b));
+  }
+#endif  // HEAP_VEC_LEN
+  for (; i < n; i++)
+    dst[i] = (char) src[i];
+}
+
+void widen_chars(Word* dst, const char* src, size_t n) {
+  size_t i = 0;
+#if HEAP_VEC_LEN == 32
+  for (; i + 16 <= n; i += 16) {
+    __m128i chars = _mm_loadu_si128((const __m128i*) (src + i));
+#  if CHAR_MIN < 0
+    __m256i words = _mm256_cvtepi8_epi16(chars);
+#  else
+    __m256i words = _mm256_cvtepu8_epi16(chars);
+#  endif
+    _mm256_storeu_si256((__m256i*) (dst + i), words);
+  }
+#elif HEAP_VEC_LEN == 16
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i chars = _mm_loadu_si128((const __m128i*) (src + i));
+    /* The high bytes extend the sign like the cast does. */
+#  if CHAR_MIN < 0
+    __m128i high = _mm_cmpgt_epi8(zero, chars);
+#  else
+    __m128i high = zero;
+#  endif
+    _mm_storeu_si128((__m128i*) (dst + i), _mm_unpacklo_epi8(chars, high));
+    _mm_storeu_si128((__m128i*) (dst + i + 8), _mm_unpackhi_epi8(chars, high));
+  }
+#endif  // HEAP_VEC_LEN
+  for (; i < n; i++)
+    dst[i] = (Word) src[i];
 }
 
 /* Add builtin instruction. */
 void add_bii(Insts* insts, Inst add) {
   assert(insts != NULL);
 
-  /* Realloc if full. */
-  if (insts->idx == insts->len) { 
-    insts->len += INST_BLOCK_SIZE;
-    insts->cell = (Inst*) realloc (insts->cell,
-      insts->len * sizeof(Inst));
-    assert(insts->cell != NULL);
-  }
+  reserve_insts(insts, insts->idx + 1);
 
   insts->cell[insts->idx] = add;
 
@@ -144,7 +236,7 @@ void add_bii(Insts* insts, Inst add) {
  *
  */
 
-void builtin_print_char(File* file) {
+void builtin_print_char(File* file, SymPool* syms) {
   assert(file != NULL);
 
   /*
@@ -153,7 +245,7 @@ void builtin_print_char(File* file) {
    */
 
   insert_st(&file->st,
-    mk_key("Sys.print_char", SBT_FUNC),
+    mk_key(intern_str(syms, "Sys.print_char"), SBT_FUNC),
     mk_fnval(file->insts.idx, 0));
 
   add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
@@ -162,7 +254,7 @@ void builtin_print_char(File* file) {
   add_bii(&file->insts, (Inst) { .code=RET });
 }
 
-void builtin_print_num(File* file) {
+void builtin_print_num(File* file, SymPool* syms) {
   assert(file != NULL);
 
   /*
@@ -171,7 +263,7 @@ void builtin_print_num(File* file) {
    */
 
   insert_st(&file->st,
-    mk_key("Sys.print_num", SBT_FUNC),
+    mk_key(intern_str(syms, "Sys.print_num"), SBT_FUNC),
     mk_fnval(file->insts.idx, 0));
 
   add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
@@ -180,7 +272,7 @@ void builtin_print_num(File* file) {
   add_bii(&file->insts, (Inst) { .code=RET });
 }
 
-void builtin_print_str(File* file) {
+void builtin_print_str(File* file, SymPool* syms) {
   assert(file != NULL);
 
   /*
@@ -190,7 +282,7 @@ void builtin_print_str(File* file) {
    */
 
   insert_st(&file->st,
-    mk_key("Sys.print_str", SBT_FUNC),
+    mk_key(intern_str(syms, "Sys.print_str"), SBT_FUNC),
     mk_fnval(file->insts.idx, 0));
 
   // Push `nchars` from the arguments onto stack.
@@ -202,7 +294,7 @@ void builtin_print_str(File* file) {
   add_bii(&file->insts, (Inst) { .code=RET });
 }
 
-void builtin_read_char(File* file) {
+void builtin_read_char(File* file, SymPool* syms) {
   assert(file != NULL);
 
   /*
@@ -211,7 +303,7 @@ void builtin_read_char(File* file) {
    */
 
   insert_st(&file->st,
-    mk_key("Sys.read_char", SBT_FUNC),
+    mk_key(intern_str(syms, "Sys.read_char"), SBT_FUNC),
     mk_fnval(file->insts.idx, 0));
 
   // Read a character.
@@ -220,7 +312,7 @@ void builtin_read_char(File* file) {
   add_bii(&file->insts, (Inst) { .code=RET });
 }
 
-void builtin_read_num(File* file) {
+void builtin_read_num(File* file, SymPool* syms) {
   assert(file != NULL);
 
   /*
@@ -229,14 +321,14 @@ void builtin_read_num(File* file) {
    */
 
   insert_st(&file->st,
-    mk_key("Sys.read_num", SBT_FUNC),
+    mk_key(intern_str(syms, "Sys.read_num"), SBT_FUNC),
     mk_fnval(file->insts.idx, 0));
 
   add_bii(&file->insts, (Inst) { .code=BUILTIN_READ_NUM });
   add_bii(&file->insts, (Inst) { .code=RET });
 }
 
-void builtin_read_str(File* file) {
+void builtin_read_str(File* file, SymPool* syms) {
   assert(file != NULL);
 
   /*
@@ -248,7 +340,7 @@ void builtin_read_str(File* file) {
    */
 
   insert_st(&file->st,
-    mk_key("Sys.read_str", SBT_FUNC),
+    mk_key(intern_str(syms, "Sys.read_str"), SBT_FUNC),
     mk_fnval(file->insts.idx, 1));
 
   // Push heap address to store the read string.
@@ -260,132 +352,1126 @@ void builtin_read_str(File* file) {
   add_bii(&file->insts, (Inst) { .code=RET });
 }
 
-void init_system_file(File* file) {
+void builtin_mem_copy(File* file, SymPool* syms) {
+  assert(file != NULL);
+
+  /*
+   * `Sys.mem_copy(dst, src, n) -> 0`
+   * copies `n` words on the heap from `src` to `dst`.
+   * The two ranges may overlap.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.mem_copy"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=1 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=2 }});
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_MEM_COPY });
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=CONST, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void builtin_mem_fill(File* file, SymPool* syms) {
+  assert(file != NULL);
+
+  /*
+   * `Sys.mem_fill(dst, val, n) -> 0`
+   * sets `n` words on the heap starting at `dst` to `val`.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.mem_fill"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=1 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=2 }});
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_MEM_FILL });
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=CONST, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void builtin_mem_cmp(File* file, SymPool* syms) {
+  assert(file != NULL);
+
+  /*
+   * `Sys.mem_cmp(a, b, n) -> ord`
+   * compares `n` words on the heap starting at `a` and `b`.
+   * Returns 0 if both ranges are equal. Otherwise the first
+   * differing word decides: -1 if the one in `a` is smaller
+   * and 1 if it's larger.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.mem_cmp"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=1 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=2 }});
+  // `BUILTIN_MEM_CMP` pushes the result of the comparison.
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_MEM_CMP });
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void builtin_file_open(File* file, SymPool* syms) {
+  assert(file != NULL);
+
+  /*
+   * `Sys.file_open(nchars, addr, mode) -> handle`
+   * opens the file whose name is the `nchars` characters
+   * on the heap at `addr`. `mode` is 0 to read, 1 to write
+   * (the file is truncated) and 2 to append. Returns -1 if
+   * the file can't be opened.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.file_open"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=1 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=2 }});
+  // `BUILTIN_FILE_OPEN` pushes the handle.
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_FILE_OPEN });
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void builtin_file_read_block(File* file, SymPool* syms) {
+  assert(file != NULL);
+
+  /*
+   * `Sys.file_read_block(handle, addr, n) -> nread`
+   * reads up to `n` characters from the file into the heap
+   * starting at `addr`. Fewer are only read at the end of
+   * the file. Returns the number of characters read.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.file_read_block"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=1 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=2 }});
+  // `BUILTIN_FILE_READ_BLOCK` pushes the number of characters read.
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_FILE_READ_BLOCK });
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void builtin_file_write_block(File* file, SymPool* syms) {
+  assert(file != NULL);
+
+  /*
+   * `Sys.file_write_block(handle, addr, n) -> 0`
+   * writes the `n` characters on the heap starting
+   * at `addr` to the file.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.file_write_block"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=1 }});
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=2 }});
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_FILE_WRITE_BLOCK });
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=CONST, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void builtin_file_close(File* file, SymPool* syms) {
   assert(file != NULL);
 
-  const char sc[] = "<system>";
-  file->filename = (char*) calloc (strlen(sc) + 1, sizeof(char));
-  assert(file->filename != NULL);
-  strcpy(file->filename, sc);
+  /*
+   * `Sys.file_close(handle) -> 0`
+   * closes the file. Files which are still open
+   * are closed when the program ends.
+   */
+
+  insert_st(&file->st,
+    mk_key(intern_str(syms, "Sys.file_close"), SBT_FUNC),
+    mk_fnval(file->insts.idx, 0));
+
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=ARG, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=BUILTIN_FILE_CLOSE });
+  add_bii(&file->insts, (Inst) { .code=PUSH, .mem={ .seg=CONST, .offset=0 }});
+  add_bii(&file->insts, (Inst) { .code=RET });
+}
+
+void init_system_file(File* file, Arena* arena, SymPool* syms) {
+  assert(file != NULL);
+  assert(arena != NULL);
+  assert(syms != NULL);
 
-  file->st = new_st();
-  file->insts = new_insts(sc);
-  file->mem = new_mem();
+  file->filename = arena_strdup(arena, "<system>");
+  file->st = new_arena_st(arena);
+  file->insts = new_arena_insts(arena, file->filename);
 
   /* Store builtin functions in system file. */
   
-  builtin_print_char(file);
-  builtin_print_num(file);
-  builtin_print_str(file);
-  builtin_read_char(file);
-  builtin_read_num(file);
-  builtin_read_str(file);
+  builtin_print_char(file, syms);
+  builtin_print_num(file, syms);
+  builtin_print_str(file, syms);
+  builtin_read_char(file, syms);
+  builtin_read_num(file, syms);
+  builtin_read_str(file, syms);
+  builtin_mem_copy(file, syms);
+  builtin_mem_fill(file, syms);
+  builtin_mem_cmp(file, syms);
+  builtin_file_open(file, syms);
+  builtin_file_read_block(file, syms);
+  builtin_file_write_block(file, syms);
+  builtin_file_close(file, syms);
 
   /* Add startup code (must be at the very end).
    * This first pushed the number of arguments `Sys.init`
    * will receive on stack and then calls `Sys.init`. */
   file->ei = file->insts.idx;
   add_bii(&file->insts, (Inst) {.code=PUSH, .mem={ .seg=CONST, .offset=0 }});
-  add_bii(&file->insts, (Inst) {.code=CALL, .ident="Sys.init", .nargs=1 });
+  add_bii(&file->insts, (Inst) {.code=CALL, .ident=intern_str(syms, "Sys.init"), .nargs=1 });
 }
 
 #define PROC_ERR 0
 #define PROC_OK 1
+// `proc_lazy_file` result if the file must be parsed eagerly.
+#define PROC_EAGER -1
+
+/* Free the source of a lazily loaded file. */
+static void del_lazy(File* file) {
+  if (file->lazy != NULL) {
+    free(file->lazy->src);
+    file->lazy = NULL;
+  }
+}
+
+/* Append the end of a lazily loaded function. It continues
+ * at `next` like the code would in the source file. */
+static void add_func_end(Insts* insts, SymId next, Pos pos) {
+  reserve_insts(insts, insts->idx + 1);
+  pos.filename = insts->filename;
+  insts->cell[insts->idx++] = (Inst) { .code=FUNC_END, .ident=next, .pos=pos };
+}
+
+/* Scan and parse the `len` bytes at `src` which start at `pos`
+ * and append them to the instructions in `file`. */
+static int parse_src(File* file, const char* src, size_t len, Pos pos, SymPool* syms) {
+  Tokens tokens = new_tokens(file->filename, syms);
+  tokens.cur = pos;
+  int res = scan_src(&tokens, src, len) == SCAN_OK;
+  if (res) {
+    /* Addresses continue after the instructions
+     * parsed so far (see `parse`). */
+    file->st.num_inst = 0;
+    res = parse(&tokens, &file->insts, &file->st) == PARSE_OK;
+  }
+  del_tokens(tokens);
+  return res ? PROC_OK : PROC_ERR;
+}
+
+/* Find the functions in the `len` bytes at `src` read from
+ * `file->filename` and parse only the code in front of the first
+ * one. The rest is left for `load_func`. `src` belongs to `file`
+ * from then on. Returns `PROC_EAGER`, leaving `src` to the caller,
+ * if it isn't worth it or the functions can't be found without
+ * parsing everything (e.g. to report an error). */
+static int proc_lazy_file(File* file, char* src, size_t len, Arena* arena, SymPool* syms) {
+  FuncStart* starts = NULL;
+  size_t nstarts = 0;
+  if (find_funcs(src, len, syms, &starts, &nstarts) == SCAN_ERR || nstarts == 0) {
+    free(starts);
+    return PROC_EAGER;
+  }
+
+  /* Let the parser report functions defined twice. */
+  SymbolTable names = new_st();
+  int has_dups = 0;
+  for (size_t i = 0; i < nstarts && !has_dups; i++) {
+    has_dups = insert_st(&names,
+      mk_key(starts[i].ident, SBT_FUNC), mk_fnval(i, 0)) == INRES_EXISTS;
+  }
+  del_st(names);
+  if (has_dups) {
+    free(starts);
+    return PROC_EAGER;
+  }
+
+  LazySrc* lazy = (LazySrc*) arena_alloc(arena, sizeof(LazySrc));
+  lazy->src = src;
+  lazy->nfuncs = nstarts;
+  lazy->funcs = (LazyFunc*) arena_alloc(arena, nstarts * sizeof(LazyFunc));
+  for (size_t i = 0; i < nstarts; i++) {
+    lazy->funcs[i] = (LazyFunc) {
+      .offset=starts[i].offset,
+      .end= i + 1 < nstarts ? starts[i + 1].offset : len,
+      .pos=starts[i].pos,
+      .ident=starts[i].ident,
+      .nlocals=starts[i].nlocals,
+      .parsed=0,
+    };
+  }
+  free(starts);
+  /* Freed by `del_prog` from now on. */
+  file->lazy = lazy;
+
+  file->st = new_arena_st(arena);
+  file->insts = new_arena_insts(arena, file->filename);
+  Pos start = { .ln=0, .cl=0 };
+  if (parse_src(file, src, lazy->funcs[0].offset, start, syms) == PROC_ERR) {
+    del_lazy(file);
+    return PROC_ERR;
+  }
+  add_func_end(&file->insts, lazy->funcs[0].ident, lazy->funcs[0].pos);
 
-int proc_file(File* file, const char* fn) {
+  file->ei = 0;
+
+  return PROC_OK;
+}
+
+int load_func(ProgramImage* prog, SymKey key, SymVal* val) {
+  assert(prog != NULL);
+  assert(val != NULL);
+  assert(val->inst_addr >= LAZY_ADDR);
+
+  unsigned int fi = val->fi;
+  File* file = &prog->files[fi];
+  size_t i = val->inst_addr - LAZY_ADDR;
+  LazyFunc* func = &file->lazy->funcs[i];
+  assert(!func->parsed);
+
+  if (parse_src(file, file->lazy->src + func->offset,
+      func->end - func->offset, func->pos, prog->syms) == PROC_ERR)
+    return PROC_ERR;
+  add_func_end(&file->insts,
+    i + 1 < file->lazy->nfuncs ? file->lazy->funcs[i + 1].ident : SYM_NONE,
+    func->pos);
+  func->parsed = 1;
+
+  /* The parser entered the function into the file's table. */
+  GetResult found = get_st(file->st, &key, val);
+  assert(found == GTRES_OK);
+  (void) found;
+  val->fi = fi;
+  set_st(&prog->funcs, key, *val);
+
+  return PROC_OK;
+}
+
+int proc_file(File* file, const char* fn, Arena* arena, SymPool* syms, int lazy) {
   assert(file != NULL);
   assert(fn != NULL);
+  assert(arena != NULL);
+  assert(syms != NULL);
+
+  /* The only copy of the filename. Tokens, instructions
+   * and positions all point to it. */
+  file->filename = arena_strdup(arena, fn);
+
+  /* Regular files are read once. The cache and the parser
+   * both use this copy, so an entry always holds the source
+   * its instructions were parsed from, even if the file is
+   * written while it's being loaded. */
+  size_t size = 0;
+  size_t len = 0;
+  char* src = NULL;
+  int fd = open(fn, O_RDONLY);
+  if (fd != -1) {
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+      size = (size_t) sb.st_size;
+      src = read_src(fd, size, &len);
+    }
+    close(fd);
+  }
 
-  /* 1. Scan */
-  Tokens tokens = new_tokens(fn);
-  int scan_res = scan(&tokens);
-  if (scan_res == SCAN_ERR) { 
-    del_tokens(tokens);
-    return PROC_ERR;
+  /* Files which haven't changed since they were
+   * last loaded are read from the cache. */
+  char* entry = src != NULL ? cache_entry(src, size) : NULL;
+  if (entry != NULL && cache_load(entry, src, size, file, arena, syms) == CACHE_HIT) {
+    free(entry);
+    free(src);
+    return PROC_OK;
   }
 
-  /* 2. Parse */
-  file->st = new_st();
-  file->insts = new_insts(fn);
-  int parse_res = parse(&tokens, &file->insts, &file->st);
+  unsigned int nwarnings = warn_count();
+  if (src != NULL && len != size)
+    warn_eof_nl();
+
+  if (lazy && src != NULL) {
+    int res = proc_lazy_file(file, src, len, arena, syms);
+    if (res != PROC_EAGER) {
+      // Partly parsed files aren't cached.
+      free(entry);
+      return res;
+    }
+  }
+
+  /* Scan and parse. The tokens of each block are
+   * parsed right after they were scanned. Files that
+   * couldn't be read at once (e.g. pipes) are read
+   * block by block. */
+  Tokens tokens = new_tokens(file->filename, syms);
+  file->st = new_arena_st(arena);
+  file->insts = new_arena_insts(arena, file->filename);
+  int parse_res = src != NULL
+    ? scan_parse_src(&tokens, src, len, &file->insts, &file->st)
+    : scan_parse(&tokens, &file->insts, &file->st);
   del_tokens(tokens);
   if (parse_res == PARSE_ERR) {
-    del_st(file->st);
-    del_insts(file->insts);
+    /* Everything allocated so far is freed with the arena. */
+    free(entry);
+    free(src);
     return PROC_ERR;
   }
+  /* Parsing reserved room for one instruction per
+   * token. Hand the unused part back to the arena. */
+  trim_insts(&file->insts);
 
   /* Now we know the source code in `fn` is a
    * valid source file. Next all other members
    * of the file instance are initialized. */
 
-  file->mem = new_mem();
-
-  file->filename =
-    (char*) calloc (strlen(fn) + 1, sizeof(char));
-  assert(file->filename != NULL);
-  strcpy(file->filename, fn);
-
   /* Should already be `0`. */
   file->ei = 0;
 
+  /* Files with warnings aren't cached so that
+   * the warnings are shown every time. */
+  if (entry != NULL && warn_count() == nwarnings)
+    cache_store(entry, src, size, file, syms);
+  free(entry);
+  free(src);
+
+  return PROC_OK;
+}
+
+// Files shared between the workers of `load_files`.
+typedef struct {
+  const char** fn;
+  File* files;  /* `files[i]` is loaded from `fn[i]`. */
+  int* res;  /* `proc_file` result for each file. */
+  MsgCapture* msgs;  /* Messages printed for each file. */
+  unsigned int nfn;
+  SymPool* syms;  /* The program's identifiers. */
+  int lazy;
+  atomic_uint next;  /* Index of the next file to load. */
+} LoadJobs;
+
+typedef struct {
+  LoadJobs* jobs;
+  Arena* arena;  /* Owned by the program. Only this worker uses it. */
+} LoadWorker;
+
+static void* load_worker(void* arg) {
+  LoadWorker* worker = (LoadWorker*) arg;
+  LoadJobs* jobs = worker->jobs;
+
+  unsigned int i;
+  while ((i = atomic_fetch_add(&jobs->next, 1)) < jobs->nfn) {
+    begin_capture(&jobs->msgs[i]);
+    jobs->res[i] = proc_file(&jobs->files[i], jobs->fn[i], worker->arena, jobs->syms, jobs->lazy);
+    end_capture(&jobs->msgs[i]);
+  }
+
+  return NULL;
+}
+
+/* Load the files `fn` into `prog` on `nworkers` threads. Each
+ * worker allocates from its own arena. Messages are printed in
+ * the same order as if the files were loaded one after another:
+ * up to and including those of the first file that fails. */
+static int load_files(
+  ProgramImage* prog,
+  unsigned int nfn,
+  const char* fn[],
+  unsigned int nworkers,
+  int lazy
+) {
+  prog->narenas = nworkers;
+  prog->arenas = (Arena*) arena_alloc(&prog->arena, nworkers * sizeof(Arena));
+  for (unsigned int w = 0; w < nworkers; w++)
+    prog->arenas[w] = new_arena();
+
+  LoadJobs jobs = {
+    .fn=fn,
+    .files=prog->files + 1,
+    .res=(int*) calloc (nfn, sizeof(int)),
+    .msgs=(MsgCapture*) calloc (nfn, sizeof(MsgCapture)),
+    .nfn=nfn,
+    .syms=prog->syms,
+    .lazy=lazy,
+  };
+  assert(jobs.res != NULL);
+  assert(jobs.msgs != NULL);
+  atomic_init(&jobs.next, 0);
+
+  LoadWorker* workers = (LoadWorker*) calloc (nworkers, sizeof(LoadWorker));
+  assert(workers != NULL);
+  pthread_t* threads = (pthread_t*) calloc (nworkers, sizeof(pthread_t));
+  assert(threads != NULL);
+
+  /* Worker 0 is the calling thread. If a thread can't be
+   * started, the others just get more files to load. */
+  unsigned int nthreads = 0;
+  for (unsigned int w = 0; w < nworkers; w++) {
+    workers[w] = (LoadWorker) { .jobs=&jobs, .arena=&prog->arenas[w] };
+    if (w > 0 && pthread_create(&threads[nthreads], NULL, load_worker, &workers[w]) == 0)
+      nthreads++;
+  }
+  load_worker(&workers[0]);
+  for (unsigned int t = 0; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+
+  int res = PROC_OK;
+  for (unsigned int i = 0; i < nfn; i++) {
+    if (res == PROC_OK) {
+      warn_file_ext(fn[i]);
+      replay_capture(&jobs.msgs[i]);
+      res = jobs.res[i];
+      prog->nfiles++;
+    } else {
+      drop_capture(&jobs.msgs[i]);
+      // Not part of the program.
+      del_lazy(&prog->files[i + 1]);
+    }
+  }
+
+  free(threads);
+  free(workers);
+  free(jobs.msgs);
+  free(jobs.res);
+
+  return res;
+}
+
+/* Enter the functions of the file `fi` into `prog->funcs`.
+ * A function defined in another file as well is an error. */
+static int index_file(ProgramImage* prog, unsigned int fi) {
+  const File* file = &prog->files[fi];
+  const SymbolTable* st = &file->st;
+  /* Report the duplicate defined first in the file
+   * (not the first one in the table's order). */
+  const Symbol* dup = NULL;
+  for (size_t i = 0; i < st->len; i++) {
+    const Symbol* sym = &st->cell[i];
+    if (sym->key.type != SBT_FUNC)
+      continue;
+
+    SymVal val = sym->val;
+    val.inst_addr += st->offset;
+    val.fi = fi;
+    if (insert_st(&prog->funcs, sym->key, val) == INRES_EXISTS) {
+      if (dup == NULL || sym->val.inst_addr < dup->val.inst_addr)
+        dup = sym;
+    }
+  }
+  SymKey dup_key = dup == NULL ? mk_key(SYM_NONE, SBT_UNUSED) : dup->key;
+
+  /* Functions which aren't parsed yet come after all others
+   * in the file. They're entered with their lazy address. */
+  for (size_t i = 0; file->lazy != NULL && i < file->lazy->nfuncs; i++) {
+    const LazyFunc* func = &file->lazy->funcs[i];
+    SymKey key = mk_key(func->ident, SBT_FUNC);
+    SymVal val = mk_fnval(LAZY_ADDR + i, func->nlocals);
+    val.fi = fi;
+    if (insert_st(&prog->funcs, key, val) == INRES_EXISTS && dup_key.ident == SYM_NONE)
+      dup_key = key;
+  }
+
+  if (dup_key.ident != SYM_NONE) {
+    SymVal first;
+    get_st(prog->funcs, &dup_key, &first);
+    /* Pipelined loads index files out of order. Always
+     * name the files in the order they were given in. */
+    unsigned int a = first.fi < fi ? first.fi : fi;
+    unsigned int b = first.fi < fi ? fi : first.fi;
+    err_multi_def_func(sym_name(prog->syms, dup_key.ident),
+      prog->files[a].filename, prog->files[b].filename);
+    return PROC_ERR;
+  }
+
+  return PROC_OK;
+}
+
+/* Enter the functions of all files into `prog->funcs`. Calls
+ * look them up there instead of asking every file. */
+static int index_funcs(ProgramImage* prog) {
+  assert(prog != NULL);
+
+  prog->funcs = new_arena_st(&prog->arena);
+
+  for (unsigned int fi = 0; fi < prog->nfiles; fi++) {
+    if (index_file(prog, fi) == PROC_ERR)
+      return PROC_ERR;
+  }
+
   return PROC_OK;
 }
 
-Program* make_prog(unsigned int nfn, const char* fn[]) {
+/* States of the files in a `Loader`. */
+#define FILE_QUEUED 0
+#define FILE_LOADING 1
+#define FILE_READY 2
+
+/* Files loaded on background threads while the program
+ * already runs. Workers load files in any order, and
+ * the executing thread helps once it runs out of code.
+ * Only the executing thread indexes loaded files, when
+ * it looks for a function it doesn't know yet. */
+struct Loader {
+  LoadJobs jobs;  /* `jobs.next` walks through `order`. */
+  unsigned int* order;  /* Files in the order the workers take them. */
+  atomic_int* state;  /* `FILE_*` state of each file. */
+  pthread_mutex_t lock;  /* Held to change a state to `FILE_READY`. */
+  pthread_cond_t ready;  /* Signalled when a file is ready. */
+  atomic_int stop;  /* Tells the workers to quit. */
+  pthread_t* threads;
+  unsigned int nthreads;
+  /* Only used by the executing thread: */
+  char* indexed;  /* Whether each file is in `prog->funcs`. */
+  unsigned int nindexed;
+  unsigned int first;  /* All files before this one are indexed. */
+  int failed;  /* A file had errors. */
+};
+
+typedef struct {
+  Loader* loader;
+  Arena* arena;  /* Owned by the program. Only this worker uses it. */
+} PipeWorker;
+
+/* Whether the file `fn` is named after the class of the
+ * function `func`. By convention, `Foo.bar` is in `Foo.vm`. */
+static int names_class(const char* fn, const char* func) {
+  const char* dot = strchr(func, '.');
+  if (dot == NULL)
+    return 0;
+  size_t len = (size_t) (dot - func);
+  const char* base = strrchr(fn, '/');
+  base = base == NULL ? fn : base + 1;
+  return strncmp(base, func, len) == 0 && strcmp(base + len, ".vm") == 0;
+}
+
+static int claim_file(Loader* loader, unsigned int i) {
+  int queued = FILE_QUEUED;
+  return atomic_compare_exchange_strong(&loader->state[i], &queued, FILE_LOADING);
+}
+
+/* Load the claimed file `i` and wake up anyone waiting for it. */
+static void load_claimed(Loader* loader, unsigned int i, Arena* arena) {
+  LoadJobs* jobs = &loader->jobs;
+  begin_capture(&jobs->msgs[i]);
+  jobs->res[i] = proc_file(&jobs->files[i], jobs->fn[i], arena, jobs->syms, 0);
+  end_capture(&jobs->msgs[i]);
+
+  pthread_mutex_lock(&loader->lock);
+  atomic_store(&loader->state[i], FILE_READY);
+  pthread_cond_broadcast(&loader->ready);
+  pthread_mutex_unlock(&loader->lock);
+}
+
+static void* pipe_worker(void* arg) {
+  PipeWorker* worker = (PipeWorker*) arg;
+  Loader* loader = worker->loader;
+
+  unsigned int k;
+  while (!atomic_load(&loader->stop)
+    && (k = atomic_fetch_add(&loader->jobs.next, 1)) < loader->jobs.nfn) {
+    unsigned int i = loader->order[k];
+    if (claim_file(loader, i))
+      load_claimed(loader, i, worker->arena);
+  }
+
+  free(worker);
+  return NULL;
+}
+
+/* Start loading the files `fn` into `prog` on up to `nworkers`
+ * threads. `prog->loader` is set and the files must not be used
+ * before they're indexed by `await_func`. */
+static void start_loader(ProgramImage* prog, unsigned int nfn, const char* fn[], unsigned int nworkers) {
+  Loader* loader = (Loader*) calloc (1, sizeof(Loader));
+  assert(loader != NULL);
+
+  /* The caller's filenames may be gone before the workers are. */
+  const char** fn_copy = (const char**) arena_alloc(&prog->arena, nfn * sizeof(char*));
+  for (unsigned int i = 0; i < nfn; i++)
+    fn_copy[i] = arena_strdup(&prog->arena, fn[i]);
+
+  loader->jobs = (LoadJobs) {
+    .fn=fn_copy,
+    .files=prog->files + 1,
+    .res=(int*) calloc (nfn, sizeof(int)),
+    .msgs=(MsgCapture*) calloc (nfn, sizeof(MsgCapture)),
+    .nfn=nfn,
+    .syms=prog->syms,
+    .lazy=0,
+  };
+  assert(loader->jobs.res != NULL);
+  assert(loader->jobs.msgs != NULL);
+  atomic_init(&loader->jobs.next, 0);
+
+  /* `Sys.init` is needed first. */
+  loader->order = (unsigned int*) calloc (nfn, sizeof(unsigned int));
+  assert(loader->order != NULL);
+  unsigned int norder = 0;
+  for (unsigned int i = 0; i < nfn; i++) {
+    if (names_class(fn[i], "Sys.init"))
+      loader->order[norder++] = i;
+  }
+  for (unsigned int i = 0; i < nfn; i++) {
+    if (!names_class(fn[i], "Sys.init"))
+      loader->order[norder++] = i;
+  }
+
+  loader->state = (atomic_int*) calloc (nfn, sizeof(atomic_int));
+  assert(loader->state != NULL);
+  for (unsigned int i = 0; i < nfn; i++)
+    atomic_init(&loader->state[i], FILE_QUEUED);
+  loader->indexed = (char*) calloc (nfn, sizeof(char));
+  assert(loader->indexed != NULL);
+  pthread_mutex_init(&loader->lock, NULL);
+  pthread_cond_init(&loader->ready, NULL);
+  atomic_init(&loader->stop, 0);
+
+  prog->narenas = nworkers;
+  prog->arenas = (Arena*) arena_alloc(&prog->arena, nworkers * sizeof(Arena));
+  for (unsigned int w = 0; w < nworkers; w++)
+    prog->arenas[w] = new_arena();
+
+  /* If no thread can be started, the executing
+   * thread loads all files by itself. */
+  loader->threads = (pthread_t*) calloc (nworkers, sizeof(pthread_t));
+  assert(loader->threads != NULL);
+  for (unsigned int w = 0; w < nworkers; w++) {
+    PipeWorker* worker = (PipeWorker*) malloc (sizeof(PipeWorker));
+    assert(worker != NULL);
+    *worker = (PipeWorker) { .loader=loader, .arena=&prog->arenas[w] };
+    if (pthread_create(&loader->threads[loader->nthreads], NULL, pipe_worker, worker) == 0)
+      loader->nthreads++;
+    else
+      free(worker);
+  }
+
+  prog->loader = loader;
+}
+
+/* Stop and join the workers of `prog->loader` and free it. */
+static void stop_loader(ProgramImage* prog) {
+  Loader* loader = prog->loader;
+  if (loader == NULL)
+    return;
+
+  atomic_store(&loader->stop, 1);
+  for (unsigned int t = 0; t < loader->nthreads; t++)
+    pthread_join(loader->threads[t], NULL);
+
+  for (unsigned int i = 0; i < loader->jobs.nfn; i++) {
+    if (!loader->indexed[i])
+      drop_capture(&loader->jobs.msgs[i]);
+  }
+
+  pthread_cond_destroy(&loader->ready);
+  pthread_mutex_destroy(&loader->lock);
+  free(loader->indexed);
+  free(loader->state);
+  free(loader->order);
+  free(loader->threads);
+  free(loader->jobs.msgs);
+  free(loader->jobs.res);
+  free(loader);
+  prog->loader = NULL;
+}
+
+/* Wait until file `i` is ready. */
+static void wait_file(Loader* loader, unsigned int i) {
+  pthread_mutex_lock(&loader->lock);
+  while (atomic_load(&loader->state[i]) != FILE_READY)
+    pthread_cond_wait(&loader->ready, &loader->lock);
+  pthread_mutex_unlock(&loader->lock);
+}
+
+/* Get a loaded file which isn't indexed yet. If none is ready,
+ * load one which no worker has started on yet, or else wait
+ * for one. Returns `nfn` once all files are indexed. */
+static unsigned int take_file(ProgramImage* prog) {
+  Loader* loader = prog->loader;
+  unsigned int nfn = loader->jobs.nfn;
+
+  while (loader->first < nfn && loader->indexed[loader->first])
+    loader->first++;
+  if (loader->first == nfn)
+    return nfn;
+
+  for (;;) {
+    pthread_mutex_lock(&loader->lock);
+    unsigned int queued = nfn;
+    for (unsigned int i = loader->first; i < nfn; i++) {
+      if (loader->indexed[i])
+        continue;
+      int state = atomic_load(&loader->state[i]);
+      if (state == FILE_READY) {
+        pthread_mutex_unlock(&loader->lock);
+        return i;
+      } else if (state == FILE_QUEUED && queued == nfn) {
+        queued = i;
+      }
+    }
+    if (queued == nfn) {
+      pthread_cond_wait(&loader->ready, &loader->lock);
+      pthread_mutex_unlock(&loader->lock);
+    } else {
+      pthread_mutex_unlock(&loader->lock);
+      if (claim_file(loader, queued))
+        load_claimed(loader, queued, &prog->arena);
+    }
+  }
+}
+
+/* Print the messages of the loaded file `i` and index it. */
+static int index_loaded(ProgramImage* prog, unsigned int i) {
+  Loader* loader = prog->loader;
+  assert(!loader->indexed[i]);
+
+  loader->indexed[i] = 1;
+  loader->nindexed++;
+  warn_file_ext(loader->jobs.fn[i]);
+  replay_capture(&loader->jobs.msgs[i]);
+  if (loader->jobs.res[i] == PROC_ERR || index_file(prog, i + 1) == PROC_ERR) {
+    loader->failed = 1;
+    return PROC_ERR;
+  }
+  return PROC_OK;
+}
+
+int await_func(ProgramImage* prog, SymKey key, SymVal* val) {
+  assert(prog != NULL);
+  assert(val != NULL);
+
+  Loader* loader = prog->loader;
+  if (loader == NULL)
+    return AWAIT_MISSING;
+  if (loader->failed)
+    return AWAIT_ERR;
+
+  /* Try the file named after the function's class first. */
+  const char* name = sym_name(prog->syms, key.ident);
+  unsigned int nfn = loader->jobs.nfn;
+  for (unsigned int i = 0; i < nfn; i++) {
+    if (loader->indexed[i] || !names_class(loader->jobs.fn[i], name))
+      continue;
+    if (claim_file(loader, i))
+      load_claimed(loader, i, &prog->arena);
+    else
+      wait_file(loader, i);
+    if (index_loaded(prog, i) == PROC_ERR)
+      return AWAIT_ERR;
+    if (get_st(prog->funcs, &key, val) == GTRES_OK)
+      return AWAIT_FOUND;
+  }
+
+  /* Otherwise it could be in any of the other files. */
+  unsigned int i;
+  while ((i = take_file(prog)) < nfn) {
+    if (index_loaded(prog, i) == PROC_ERR)
+      return AWAIT_ERR;
+    if (get_st(prog->funcs, &key, val) == GTRES_OK)
+      return AWAIT_FOUND;
+  }
+
+  return AWAIT_MISSING;
+}
+
+int finish_load(ProgramImage* prog) {
+  assert(prog != NULL);
+
+  Loader* loader = prog->loader;
+  if (loader == NULL)
+    return 1;
+  if (loader->failed)
+    return 0;
+
+  unsigned int i;
+  while ((i = take_file(prog)) < loader->jobs.nfn) {
+    if (index_loaded(prog, i) == PROC_ERR)
+      return 0;
+  }
+  return 1;
+}
+
+ProgramImage* make_prog(unsigned int nfn, const char* fn[]) {
+  return make_prog_jobs(nfn, fn, 1);
+}
+
+ProgramImage* make_prog_jobs(unsigned int nfn, const char* fn[], unsigned int njobs) {
+  return make_prog_opts(nfn, fn, (LoadOpts) { .njobs=njobs, .lazy=0, .pipeline=0 });
+}
+
+ProgramImage* make_prog_opts(unsigned int nfn, const char* fn[], LoadOpts opts) {
   assert(fn != NULL);
 
-  Program* prog =
-    (Program*) calloc (1, sizeof(Program));
+  unsigned int njobs = opts.njobs;
+
+  ProgramImage* prog =
+    (ProgramImage*) calloc (1, sizeof(ProgramImage));
   assert(prog != NULL);
 
-  prog->heap = new_heap();
-  prog->stack = new_stack();
+  prog->arena = new_arena();
+  prog->syms = new_pool();
 
   /* Allocate `nfn + 1` for the startup code. */
-  prog->files = (File*) calloc (nfn + 1, sizeof(File));
-  assert(prog->files != NULL);
+  prog->files = (File*) arena_alloc(&prog->arena, (nfn + 1) * sizeof(File));
 
   /* Store the system code (startup code, builtins etc.)
    * the first file. `fi` starts in this file. */
-  init_system_file(&prog->files[prog->nfiles ++]);
-  
-  for (; prog->nfiles <= nfn; prog->nfiles++) {
-    warn_file_ext(fn[prog->nfiles - 1]);
-    if (proc_file(
-      &prog->files[prog->nfiles],
-      fn[prog->nfiles - 1]
-    ) == PROC_ERR) {
+  init_system_file(&prog->files[prog->nfiles ++], &prog->arena, prog->syms);
+
+  if (opts.pipeline && nfn > 0) {
+    /* Only the system file is ready. The others
+     * are indexed when they're needed. */
+    assert(!opts.lazy);
+    prog->nfiles = nfn + 1;
+    start_loader(prog, nfn, fn, njobs < nfn ? njobs : nfn);
+    prog->funcs = new_arena_st(&prog->arena);
+    index_file(prog, 0);
+    return prog;
+  }
+
+  if (njobs > 1 && nfn > 1) {
+    if (load_files(prog, nfn, fn, njobs < nfn ? njobs : nfn, opts.lazy) == PROC_ERR) {
       del_prog(prog);
       return NULL;
     }
+  } else {
+    for (; prog->nfiles <= nfn; prog->nfiles++) {
+      warn_file_ext(fn[prog->nfiles - 1]);
+      if (proc_file(
+        &prog->files[prog->nfiles],
+        fn[prog->nfiles - 1],
+        &prog->arena,
+        prog->syms,
+        opts.lazy
+      ) == PROC_ERR) {
+        del_prog(prog);
+        return NULL;
+      }
+    }
+  }
+
+  if (index_funcs(prog) == PROC_ERR) {
+    del_prog(prog);
+    return NULL;
   }
 
   return prog;
 }
 
-void del_mem(Memory mem) {
-  free(mem._static);
-  free(mem.tmp);
+// Growing list of filenames for `find_sources`.
+typedef struct {
+  char** fn;
+  unsigned int len;
+  unsigned int cap;
+} Sources;
+
+static void add_source(Sources* srcs, char* fn) {
+  if (srcs->len == srcs->cap) {
+    srcs->cap = srcs->cap == 0 ? 16 : srcs->cap * 2;
+    srcs->fn = (char**) realloc (srcs->fn, srcs->cap * sizeof(char*));
+    assert(srcs->fn != NULL);
+  }
+  srcs->fn[srcs->len++] = fn;
 }
 
-void del_file(File* file) {
-  if (file != NULL) {
-    del_st(file->st);
-    del_insts(file->insts);
-    del_mem(file->mem);
-    free(file->filename);
+static int cmp_sources(const void* a, const void* b) {
+  return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* Add the `.vm` files in the directory `dir` to `srcs`, sorted
+ * by name. Only the names are read here; the files themselves
+ * are opened by the (possibly parallel) loader. */
+static int add_dir_sources(Sources* srcs, const char* dir) {
+  DIR* d = opendir(dir);
+  if (d == NULL) {
+    errf("can't read directory `%s`", dir);
+    return PROC_ERR;
   }
+
+  size_t dir_len = strlen(dir);
+  while (dir_len > 1 && dir[dir_len - 1] == '/')
+    dir_len--;
+
+  unsigned int first = srcs->len;
+  struct dirent* ent;
+  while ((ent = readdir(d)) != NULL) {
+    size_t name_len = strlen(ent->d_name);
+    if (name_len <= 3 || strcmp(ent->d_name + name_len - 3, ".vm") != 0)
+      continue;
+
+    char* fn = (char*) malloc (dir_len + name_len + 2);
+    assert(fn != NULL);
+    memcpy(fn, dir, dir_len);
+    fn[dir_len] = '/';
+    memcpy(fn + dir_len + 1, ent->d_name, name_len + 1);
+
+    /* Skip sub-directories and the like. Only entries
+     * whose type isn't known need to be looked up. */
+    struct stat sb;
+    int is_reg = ent->d_type == DT_REG
+      || ((ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+        && stat(fn, &sb) == 0 && S_ISREG(sb.st_mode));
+    if (is_reg)
+      add_source(srcs, fn);
+    else
+      free(fn);
+  }
+  closedir(d);
+
+  if (srcs->len == first) {
+    errf("directory `%s` doesn't contain any `.vm` files", dir);
+    return PROC_ERR;
+  }
+
+  qsort(srcs->fn + first, srcs->len - first, sizeof(char*), cmp_sources);
+  return PROC_OK;
 }
 
-void del_prog(Program* prog) {
-  if (prog != NULL) {
-    for (unsigned int i = 0; i < prog->nfiles; i++) {
-      del_file(&prog->files[i]);
+char** find_sources(unsigned int nargs, const char* args[], unsigned int* nfn) {
+  assert(args != NULL || nargs == 0);
+  assert(nfn != NULL);
+
+  Sources srcs = { .fn=NULL, .len=0, .cap=0 };
+  for (unsigned int i = 0; i < nargs; i++) {
+    struct stat sb;
+    if (stat(args[i], &sb) == 0 && S_ISDIR(sb.st_mode)) {
+      if (add_dir_sources(&srcs, args[i]) == PROC_ERR) {
+        del_sources(srcs.fn, srcs.len);
+        return NULL;
+      }
+    } else {
+      /* Missing files are reported when they're loaded. */
+      char* fn = strdup(args[i]);
+      assert(fn != NULL);
+      add_source(&srcs, fn);
     }
-    del_heap(prog->heap);
-    del_stack(prog->stack);
-    free(prog->files);
+  }
+
+  if (srcs.fn == NULL) {
+    /* No arguments: still return something to free. */
+    srcs.fn = (char**) malloc (sizeof(char*));
+    assert(srcs.fn != NULL);
+  }
+  *nfn = srcs.len;
+  return srcs.fn;
+}
+
+void del_sources(char** fn, unsigned int nfn) {
+  if (fn != NULL) {
+    for (unsigned int i = 0; i < nfn; i++)
+      free(fn[i]);
+    free(fn);
+  }
+}
+
+void del_prog(ProgramImage* prog) {
+  if (prog != NULL) {
+    /* Workers still write to the files and arenas. */
+    stop_loader(prog);
+    for (unsigned int i = 0; i < prog->nfiles; i++)
+      del_lazy(&prog->files[i]);
+    /* All files live in the arenas. */
+    for (unsigned int i = 0; i < prog->narenas; i++)
+      del_arena(prog->arenas[i]);
+    del_arena(prog->arena);
+    del_pool(prog->syms);
+    if (prog->image != NULL)
+      munmap(prog->image, prog->image_size);
     free(prog);
   }
 }
+
+VmState* new_vm(ProgramImage* prog) {
+  assert(prog != NULL);
+
+  VmState* vm =
+    (VmState*) calloc (1, sizeof(VmState));
+  assert(vm != NULL);
+
+  vm->prog = prog;
+  vm->heap = new_heap();
+  vm->stack = new_stack();
+
+  /* The segments of all files are in one block. */
+  size_t seg_size = MEM_STAT_SIZE + MEM_TEMP_SIZE;
+  vm->mem = (Memory*) calloc (prog->nfiles, sizeof(Memory));
+  assert(vm->mem != NULL);
+  Word* segs = (Word*) calloc (prog->nfiles * seg_size, sizeof(Word));
+  assert(segs != NULL);
+  for (unsigned int i = 0; i < prog->nfiles; i++) {
+    vm->mem[i]._static = segs + i * seg_size;
+    vm->mem[i].tmp = segs + i * seg_size + MEM_STAT_SIZE;
+  }
+
+  /* Execution starts with the startup code in the system file. */
+  vm->fi = 0;
+  vm->file = &prog->files[0];
+  vm->ei = prog->files[0].ei;
+
+  return vm;
+}
+
+void reset_vm(VmState* vm) {
+  assert(vm != NULL);
+
+  host_close_all(&vm->host);
+  clear_heap(&vm->heap);
+  /* The stack keeps the room it grew to. Nothing above
+   * `sp` is read before it's pushed (locals are pushed
+   * as zeros), so it doesn't have to be cleared. */
+  vm->stack.sp = 0;
+  vm->stack.arg = 0;
+  vm->stack.arg_len = 0;
+  vm->stack.lcl = 0;
+  vm->stack.lcl_len = 0;
+  /* Most programs only use the segments of a few files. */
+  for (unsigned int i = 0; i < vm->prog->nfiles; i++) {
+    if (vm->mem[i].dirty) {
+      memset(vm->mem[i]._static, 0, MEM_STAT_SIZE * sizeof(Word));
+      memset(vm->mem[i].tmp, 0, MEM_TEMP_SIZE * sizeof(Word));
+      vm->mem[i].dirty = 0;
+    }
+  }
+  vm->fi = 0;
+  vm->file = &vm->prog->files[0];
+  vm->ei = vm->prog->files[0].ei;
+  vm->steps = 0;
+  vm->granted = 0;
+}
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void limit_vm(VmState* vm, uint64_t budget, unsigned int timeout_ms) {
+  assert(vm != NULL);
+
+  vm->budget = budget;
+  vm->deadline = timeout_ms != 0
+    ? now_ns() + (uint64_t) timeout_ms * 1000000
+    : 0;
+  /* Check the new limits before the next instruction. */
+  vm->steps = 0;
+  vm->granted = 0;
+}
+
+void del_vm(VmState* vm) {
+  if (vm != NULL) {
+    host_close_all(&vm->host);
+    free(vm->mem[0]._static);
+    free(vm->mem);
+    del_heap(vm->heap);
+    del_stack(vm->stack);
+    free(vm);
+  }
+}
@@ -5,6 +5,11 @@
 
 #include "st.h"
 #include "parse.h"
+#include "arena.h"
+#include "host.h"
+#include "msg.h"
+
+#include <stdatomic.h>
 
 // Single RAM word.
 typedef uint16_t Word;
@@ -54,9 +59,16 @@ void del_stack(Stack s);
 // Machine address in 16-bit RAM.
 typedef uint16_t Addr;
 
-// Heap. Addressable range [0;0xFFFF].
+/* The heap is cleared in pages of `1 << MEM_PAGE_BITS` words.
+ * Only pages which were written since the last time are cleared
+ * again, so that short runs are reset quickly. */
+#define MEM_PAGE_BITS 6
+#define MEM_HEAP_PAGES (MEM_HEAP_SIZE >> MEM_PAGE_BITS)
+
+// Heap. Addressable range [0;MEM_HEAP_SIZE).
 typedef struct {
   Word* mem;
+  uint64_t* dirty;  /* One bit for each page of `mem` written since it was cleared. */
   size_t _this;
   size_t that;
 } Heap;
@@ -68,34 +80,184 @@ Word heap_get(const Heap h, Addr addr);
 
 void heap_set(Heap h, Addr addr, Word val);
 
+/* Mark the `n` words from `addr` on as written. Must be called
+ * for all writes to `mem` which don't go through `heap_set`. */
+void heap_touch(Heap h, size_t addr, size_t n);
+
+/* Zero all pages written since the last time. */
+void clear_heap(Heap* h);
+
 // Delete memory allocated by the given heap.
 void del_heap(Heap h);
 
+/* Store the low byte of each of the `n` words at
+ * `src` in `dst` (like casting them to `char`). */
+void narrow_words(char* dst, const Word* src, size_t n);
+
+/* Store each of the `n` chars at `src` as
+ * a word in `dst` (like casting them to `Word`). */
+void widen_chars(Word* dst, const char* src, size_t n);
+
 typedef struct {
   Word* _static;
   Word* tmp;
+  int dirty;  /* Written since it was cleared. */
 } Memory;
 
+/* Addresses from here on name functions which aren't
+ * parsed yet: `LAZY_ADDR + i` is `LazySrc.funcs[i]`. */
+#define LAZY_ADDR ((size_t) 1 << 62)
+
+// A function in a lazily loaded file.
+typedef struct {
+  size_t offset;  /* Byte offset of its `function` keyword. */
+  size_t end;  /* Offset of the next function or end of the source. */
+  Pos pos;  /* Position of its `function` keyword. */
+  SymId ident;
+  Uint nlocals;
+  int parsed;
+} LazyFunc;
+
+/* Source of a file whose functions are parsed
+ * when they are called for the first time. */
+typedef struct {
+  char* src;  /* Read by `read_src`. */
+  LazyFunc* funcs;  /* All functions in source order. */
+  size_t nfuncs;
+} LazySrc;
+
 typedef struct {
   char* filename;  /* guess what. */
   SymbolTable st;  /* file's symbols. */
   Insts insts;  /* files's instructions. */
-  Memory mem;  /* file's local memory segments (static and temp). */
-  unsigned int ei;  /* execution index into  `insts`. */
+  unsigned int ei;  /* index into `insts` where execution starts. */
+  LazySrc* lazy;  /* Functions which may not be parsed yet or `NULL`. */
 } File;
 
+/* Files which are still being loaded while the program runs. */
+typedef struct Loader Loader;
+
+/* A loaded program: its code, symbols and where they live.
+ * It isn't changed by running it, so any number of `VmState`s
+ * can run it at the same time. Only lazily loaded and pipelined
+ * programs are completed while they run; those must only be run
+ * by one state at a time. */
 typedef struct {
   File* files;  /* files for all sources. */
   unsigned int nfiles;  /* number of files in `files`. */
-  unsigned int fi;  /* file index into `files`. */
-  Heap heap;  /* Program heap memory. */
-  Stack stack;  /* Program stack memory. */
-} Program;
+  Arena arena;  /* Owner of everything loaded into the program. */
+  SymPool* syms;  /* Identifiers of all files. */
+  Arena* arenas;  /* Owners of files loaded by parallel workers. */
+  unsigned int narenas;  /* number of arenas in `arenas`. */
+  SymbolTable funcs;  /* Functions of all files. `SymVal.fi` is set. */
+  void* image;  /* Mapped image the instructions live in or `NULL`. */
+  size_t image_size;  /* Size of `image` in bytes. */
+  Loader* loader;  /* Set until all files are loaded if `LoadOpts.pipeline`. */
+} ProgramImage;
 
 /* Assemable the source code in all the given
  * files into an executable program. */
-Program* make_prog(unsigned int nfn, const char** fn);
+ProgramImage* make_prog(unsigned int nfn, const char** fn);
+
+typedef struct {
+  unsigned int njobs;  /* Files scanned and parsed at the same time. */
+  /* Only find the functions while loading. Each of them is
+   * parsed when it's called for the first time. Errors in a
+   * function aren't reported until then. */
+  int lazy;
+  /* Return as soon as loading has started. Files are loaded on
+   * `njobs` threads while the program runs. A call waits until
+   * the function's file is loaded, which is the file named after
+   * its class (`Foo.vm` for `Foo.bar`) if there is one. Errors in
+   * a file are reported when it's searched for a function, so files
+   * that are never needed may never be checked. Loading stops when
+   * the program is deleted. Can't be combined with `lazy`. */
+  int pipeline;
+} LoadOpts;
+
+ProgramImage* make_prog_opts(unsigned int nfn, const char** fn, LoadOpts opts);
+
+/* Same as `make_prog` but scan and parse up to `njobs`
+ * files at the same time. Errors and warnings are
+ * printed in the order of the files. */
+ProgramImage* make_prog_jobs(unsigned int nfn, const char** fn, unsigned int njobs);
+
+/* Expand the directories among the `nargs` program arguments
+ * `args` to the `.vm` files directly inside of them, in the
+ * order of their names. Other arguments are kept as they are.
+ * Returns the `*nfn` resulting filenames (free them with
+ * `del_sources`) or `NULL` and prints an error if a directory
+ * can't be read or contains no `.vm` files. */
+char** find_sources(unsigned int nargs, const char** args, unsigned int* nfn);
+
+void del_sources(char** fn, unsigned int nfn);
+
+/* Parse the function at `val` (found in `prog->funcs` at
+ * `LAZY_ADDR` or beyond) and update `val` and the index.
+ * Returns `0` if the function has errors. */
+int load_func(ProgramImage* prog, SymKey key, SymVal* val);
+
+/* Results of `await_func`. */
+#define AWAIT_FOUND 1
+#define AWAIT_MISSING 0
+#define AWAIT_ERR -1  /* A file has errors. They were printed. */
+
+/* Look for the function `key` in the files which haven't been
+ * indexed yet, waiting for them to be loaded if needed. On
+ * success, `val` is set like by a lookup in `prog->funcs`. */
+int await_func(ProgramImage* prog, SymKey key, SymVal* val);
+
+/* Index the files which haven't been yet, waiting for them to
+ * be loaded, so their errors are reported even if nothing in them
+ * was called. Returns `0` if a file has errors. They're printed. */
+int finish_load(ProgramImage* prog);
+
+void del_prog(ProgramImage* prog);
+
+/* State of one run of a program: where it is, its memory
+ * and its input and output. */
+typedef struct {
+  ProgramImage* prog;  /* The program which is run. */
+  unsigned int fi;  /* file index into `prog->files`. */
+  File* file;  /* `&prog->files[fi]`. */
+  unsigned int ei;  /* execution index into the active file's `insts`. */
+  Memory* mem;  /* Local memory segments (static and temp) of each file. */
+  Heap heap;  /* Program heap memory. */
+  Stack stack;  /* Program stack memory. */
+  HostFiles host;  /* Files opened by the program and which it may open. */
+  Input* in;  /* Input of the builtins or `NULL` for stdin. */
+  Output* out;  /* Output of the builtins or `NULL` for stdout. */
+  /* Limits of a run (`0` if there is none). They are set with
+   * `limit_vm` and kept by `reset_vm`. */
+  uint64_t budget;  /* Instructions the run may execute. */
+  uint64_t deadline;  /* `CLOCK_MONOTONIC` time in ns when the run is stopped. */
+  /* Instructions left before the limits are checked again and how
+   * many of the budget were handed out so far. */
+  uint64_t steps;
+  uint64_t granted;
+  /* Runs stop as soon as `*stop` is set (checked along with the
+   * deadline), e.g. by another thread. `NULL` if they can't be
+   * stopped. Kept by `reset_vm`. */
+  const atomic_int* stop;
+} VmState;
+
+/* A state to run `prog` from the start. `prog` must
+ * outlive the state. It's not copied. */
+VmState* new_vm(ProgramImage* prog);
+
+/* Return `vm` to where `new_vm` left it so that the program
+ * can be run again: all memory is zeroed and files the program
+ * opened are closed. `in`, `out`, which files it may open
+ * and the limits are kept. */
+void reset_vm(VmState* vm);
+
+/* Stop the runs of `vm` after `budget` instructions and once
+ * `timeout_ms` have passed since now. `0` leaves out a limit. */
+void limit_vm(VmState* vm, uint64_t budget, unsigned int timeout_ms);
+
+/* Current `CLOCK_MONOTONIC` time in ns. */
+uint64_t now_ns(void);
 
-void del_prog(Program* prog);
+void del_vm(VmState* vm);
 
 #endif // _PROG_H_
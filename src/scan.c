@@ -1,38 +1,43 @@
 #include "scan.h"
 #include "msg.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
 
-// Used by `T_KUINT` to store the scanned number.
-static Uint uilit = 0;
-// Used by `TK_IDENT` to store the scanned identifier.
-// The maximum identifier length is 24.
-static char ident_buf[MAX_IDENT_LEN + 1];
+#ifndef SCAN_NO_SIMD
+#  if defined(__AVX2__)
+#    include <immintrin.h>
+#    define SCAN_VEC_LEN 32
+#  elif defined(__SSE2__)
+#    include <emmintrin.h>
+#    define SCAN_VEC_LEN 16
+#  endif
+#endif  // SCAN_NO_SIMD
 
-#define TOKEN_COMPLETED -1
 #define INTERNAL_SCAN_ERR -1
 
-Tokens new_tokens(const char* filename) {
+Tokens new_tokens(const char* filename, SymPool* syms) {
+  assert(syms != NULL);
+
   Tokens tokens = {
     .idx = 0,
     .len = TOKEN_BLOCK_SIZE,
     .cur.ln = 0,
     .cur.cl = 0,
+    .inside_comment = 0,
+    .filename = filename,
+    .syms = syms,
+    .sink = NULL,
+    .sink_ctx = NULL,
   };
 
-  if (filename != NULL) {
-    tokens.filename = (char*) calloc (strlen(filename) + 1, sizeof(char));
-    assert(tokens.filename != NULL);
-    strcpy(tokens.filename, filename);
-  } else {
-    tokens.filename = NULL;
-  }
-
   tokens.cell = (Token*) calloc (tokens.len, sizeof(Token));
   assert(tokens.cell != NULL);
 
@@ -41,7 +46,12 @@ Tokens new_tokens(const char* filename) {
 
 void del_tokens(Tokens tokens) {
   free(tokens.cell);
-  free(tokens.filename);
+}
+
+// Same characters as `isspace` in the "C" locale
+// but without the function call and locale lookup.
+static inline int is_ws(char c) {
+  return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
 }
 
 static inline void inc(size_t *restrict offset, Pos *restrict pos) {
@@ -64,7 +74,7 @@ static inline void incl(size_t *restrict offset, Pos *restrict pos) {
   pos->cl = 0;
 }
 
-void token_str(const Token* it, char* str) {
+void token_str(const SymPool* syms, const Token* it, char* str) {
   assert(it != NULL);
   assert(str != NULL);
   assert(TK_NONE <= it->t && it->t <= TK_IDENT);
@@ -105,7 +115,7 @@ void token_str(const Token* it, char* str) {
     // means it will never be more that 5 digits long.
     snprintf(str, TOKEN_STR_BUF, "%d", it->uilit);
   } else if (it->t == TK_IDENT) {
-    snprintf(str, TOKEN_STR_BUF, "%s (ident)", it->ident);
+    snprintf(str, TOKEN_STR_BUF, "%s (ident)", sym_name(syms, it->ident));
   } else {
     snprintf(str, TOKEN_STR_BUF, "%s", strs[it->t]);
   }
@@ -119,316 +129,273 @@ void scan_err(const char* blk, const char* filename, Pos pos) {
 }
 
 
-static inline int static_scan(const char* search, const char* blk, size_t len, size_t* offset, Pos* pos) {
-  assert(search != NULL);
-  assert(blk != NULL);
-  assert(offset != NULL);
-
-  size_t slen = strlen(search);
-  if ((*offset + slen) > len) {
-    // The rest of the block isn't long  enough.
-    return 0;
-  }
+// Keyword lookup table. Each keyword sits at the index of
+// its `kw_hash` which is a perfect hash over all keywords.
+// The constants were found by trying all small multipliers
+// until no two keywords collided in 64 slots.
+typedef struct {
+  const char* lit;
+  size_t len;
+  TokenCode t;
+} Keyword;
+
+#define KW_TABLE_SIZE 64
+#define MAX_KW_LEN 8
+
+static const Keyword kw_table[KW_TABLE_SIZE] = {
+  [0] = { "static", 6, TK_STAT },
+  [3] = { "eq", 2, TK_EQ },
+  [4] = { "that", 4, TK_THAT },
+  [10] = { "local", 5, TK_LOC },
+  [11] = { "function", 8, TK_FUNC },
+  [12] = { "constant", 8, TK_CONST },
+  [15] = { "goto", 4, TK_GOTO },
+  [18] = { "not", 3, TK_NOT },
+  [19] = { "argument", 8, TK_ARG },
+  [20] = { "add", 3, TK_ADD },
+  [22] = { "call", 4, TK_CALL },
+  [23] = { "temp", 4, TK_TMP },
+  [25] = { "gt", 2, TK_GT },
+  [30] = { "lt", 2, TK_LT },
+  [32] = { "label", 5, TK_LABEL },
+  [37] = { "return", 6, TK_RET },
+  [38] = { "pointer", 7, TK_PTR },
+  [39] = { "sub", 3, TK_SUB },
+  [41] = { "or", 2, TK_OR },
+  [43] = { "this", 4, TK_THIS },
+  [47] = { "neg", 3, TK_NEG },
+  [48] = { "pop", 3, TK_POP },
+  [50] = { "and", 3, TK_AND },
+  [57] = { "if-goto", 7, TK_IF_GOTO },
+  [59] = { "push", 4, TK_PUSH },
+};
 
-  if (strncmp(blk + *offset, search, slen) == 0) {
-    incby(slen, offset, pos);
-    return TOKEN_COMPLETED;
-  } else {
-    // TODO: Temporaty until finding the exact character is implemented.
-    return 0;  
-  }
+static inline size_t kw_hash(const char* word, size_t len) {
+  assert(len >= 2);
+  const unsigned char* w = (const unsigned char*) word;
+  return (w[0] + 3 * w[1] + 25 * w[len - 1] + len) & (KW_TABLE_SIZE - 1);
 }
 
-static inline int push(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("push", blk, len, offset, pos);
-}
+// Return the keyword token for `word` or `TK_NONE`.
+static inline TokenCode keyword(const char* word, size_t len) {
+  if (len < 2 || len > MAX_KW_LEN)
+    return TK_NONE;
 
-static inline int pop(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("pop", blk, len, offset, pos);
+  const Keyword* kw = &kw_table[kw_hash(word, len)];
+  if (kw->len == len && memcmp(kw->lit, word, len) == 0)
+    return kw->t;
+  else
+    return TK_NONE;
 }
 
-static inline int argument(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("argument", blk, len, offset, pos);
+static inline int is_ident_char(char c) {
+  return isalnum(c) || c == '_' || c == '.' || c == ':';
 }
 
-static inline int local(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("local", blk, len, offset, pos);
+static inline int is_comment_start(const char* blk, size_t len, size_t offset) {
+  return offset + 1 < len && blk[offset] == '/' && blk[offset + 1] == '/';
 }
 
-static inline int _static(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("static", blk, len, offset, pos);
-}
+// Outcome of `scan_word`.
+#define WORD_TOKEN 1  // `token` was scanned.
+#define WORD_COMMENT 2  // Start of a comment.
+#define WORD_NONE 0  // Invalid or unfinished word.
 
-static inline int constant(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("constant", blk, len, offset, pos);
-}
+// Scan the word (everything up to the next whitespace
+// or comment) at `*offset` in a single pass and classify
+// it as a keyword, a number or an identifier.
+// A word reaching the end of the block might continue in
+// the next one, so it's left for the next block even if
+// it's a keyword (e.g. `lt` followed by `_x` later).
+// Identifiers are interned into `syms`.
+static inline int scan_word(
+  const char* blk,
+  size_t len,
+  size_t* offset,
+  Pos* pos,
+  SymPool* syms,
+  Token* token
+) {
+  assert(blk != NULL);
+  assert(offset != NULL);
+  assert(token != NULL);
 
-static inline int this(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("this", blk, len, offset, pos);
-}
+  const char* word = blk + *offset;
 
-static inline int that(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("that", blk, len, offset, pos);
-}
+  if (is_comment_start(blk, len, *offset)) {
+    incby(2, offset, pos);
+    return WORD_COMMENT;
+  }
 
-static inline int pointer(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("pointer", blk, len, offset, pos);
-}
+  size_t end = *offset;
+  int all_digits = 1;
+  int all_ident = 1;
+  while (end < len && !is_ws(blk[end]) && !is_comment_start(blk, len, end)) {
+    all_digits &= isdigit(blk[end]) != 0;
+    all_ident &= is_ident_char(blk[end]);
+    end++;
+  }
+  size_t wlen = end - *offset;
 
-static inline int temp(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("temp", blk, len, offset, pos);
-}
+  *token = (Token) { .t=TK_NONE, .pos=*pos };
 
-static inline int _uint(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  assert(blk != NULL);
-  assert(offset != NULL);
-  
-  size_t digit_offset = *offset;
-  size_t ndigits = 0;
-  uint16_t nums[5] = { 0, 0, 0, 0, 0 };
-  while (
-    digit_offset < len &&
-    ndigits < 5 &&
-    isdigit(blk[digit_offset])
-  ) {
-    nums[ndigits] = blk[digit_offset] - '0';
-    digit_offset++;
-    ndigits++;
+  if (end >= len || wlen == 0) {
+    // Might be continued in the next block.
+    return WORD_NONE;
   }
 
-  // The numbers doesn't just have to contian enought digits
-  // but it also has to end  with another space character.
-  // This conditional rejects something like `87935234` too,
-  // because it's too long.
-  // If `digit_offset >= len` is true this means that there
-  // are no more characters left to check. This obviously
-  // means that there is no trailing whitespace either.
-  if (digit_offset >= len || !isspace(blk[digit_offset]))
-    return ndigits;
-
-  int uilit_buf = 0;
-
-  switch (ndigits) {
-    case 0:
-      return 0;
-    case 1:
-      uilit_buf =
-        nums[0];
-      break;
-    case 2:
-      uilit_buf =
-        nums[1] + nums[0] * 10;
-      break;
-    case 3:
-      uilit_buf =
-        nums[2] + nums[1] * 10 + nums[0] * 100;
-      break;
-    case 4:
-      uilit_buf =
-        nums[3] + nums[2] * 10 + nums[1] * 100 + nums[0] * 1000;
-      break;
-    case 5:
-      uilit_buf =
-        nums[4] + nums[3] * 10 + nums[2] * 100 + nums[1] * 1000 + nums[0] * 10000;
-      break;
-  }
+  TokenCode kw = keyword(word, wlen);
+  if (kw != TK_NONE) {
+    token->t = kw;
+  } else if (all_digits) {
+    // The largest possible 16-bit number has five digits.
+    if (wlen > 5)
+      return WORD_NONE;
+
+    int uilit_buf = 0;
+    for (size_t i = 0; i < wlen; i++)
+      uilit_buf = uilit_buf * 10 + (word[i] - '0');
+
+    // Using five decimal digits, we could represent numbers
+    // larger than the 16-bit limit (65535) up to 99999.
+    // Therefore, we buffer to an `int` which will not overflow
+    // from any number between 65535 and  99999 and then limit
+    // the number we store at 65536. This means that any input
+    // above 65535 is simply saturated to 65535. A warning is
+    // emitted.
+    if (uilit_buf > 65535) {
+      warn_sat_uilit(uilit_buf);
+      uilit_buf = 65535;
+    }
+
+    token->t = TK_UINT;
+    token->uilit = (Uint) uilit_buf;
+  } else if (all_ident) {
+    // `[0-9A-Za-z_\.:]*` without a leading digit
+    // (all-digit words are handled above).
+    if (isdigit(word[0]))
+      return WORD_NONE;
 
-  // Using five decimal digits, we could represent numbers
-  // larger than the 16-bit limit (65535) up to 99999.
-  // Therefore, we buffer to an `int` which will not overflow
-  // from any number between 65535 and  99999 and then limit
-  // the number we store at 65536. This means that any input
-  // above 65535 is simply saturated to 65535. A warning is
-  // emitted.
-  if (uilit_buf > 65535) {
-    warn_sat_uilit(uilit_buf);
-    uilit = 65535;
+    token->t = TK_IDENT;
+    token->ident = intern(syms, word, wlen);
   } else {
-    // `uilit` fits the scanned number.
-    uilit = uilit_buf;
+    return WORD_NONE;
   }
 
-  incby(ndigits, offset, pos);
+  incby(wlen, offset, pos);
 
-  return TOKEN_COMPLETED;
+  return WORD_TOKEN;
 }
 
-static inline int label(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("label", blk, len, offset, pos);
-}
+#ifdef SCAN_VEC_LEN
 
-static inline int _goto(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("goto", blk, len, offset, pos);
-}
-
-static inline int if_goto(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("if-goto", blk, len, offset, pos);
-}
+// Bit `i` of a mask is set if byte `i` of
+// a `SCAN_VEC_LEN` bytes chunk matched.
+typedef uint32_t VecMask;
+#define VEC_FULL ((VecMask) ((1llu << SCAN_VEC_LEN) - 1))
 
-static inline int function(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("function", blk, len, offset, pos);
-}
-
-static inline int call(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("call", blk, len, offset, pos);
-}
+#  if SCAN_VEC_LEN == 32
 
-static inline int _return(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("return", blk, len, offset, pos);
+static inline VecMask ws_mask(const char* p) {
+  __m256i v = _mm256_loadu_si256((const __m256i*) p);
+  // `\t` to `\r` is a range of five: `v - '\t' <= 4` (unsigned).
+  __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+  __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(4)), x);
+  __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  return (VecMask) _mm256_movemask_epi8(_mm256_or_si256(ctrl, sp));
 }
 
-static inline int add(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("add", blk, len, offset, pos);
+static inline VecMask nl_mask(const char* p) {
+  __m256i v = _mm256_loadu_si256((const __m256i*) p);
+  return (VecMask) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
 }
 
-static inline int sub(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("sub", blk, len, offset, pos);
-}
+#  else
 
-static inline int neg(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("neg", blk, len, offset, pos);
+static inline VecMask ws_mask(const char* p) {
+  __m128i v = _mm_loadu_si128((const __m128i*) p);
+  __m128i x = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(4)), x);
+  __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  return (VecMask) _mm_movemask_epi8(_mm_or_si128(ctrl, sp));
 }
 
-static inline int eq(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("eq", blk, len, offset, pos);
+static inline VecMask nl_mask(const char* p) {
+  __m128i v = _mm_loadu_si128((const __m128i*) p);
+  return (VecMask) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
 }
 
-static inline int gt(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("gt", blk, len, offset, pos);
-}
+#  endif
 
-static inline int lt(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("lt", blk, len, offset, pos);
+// Advance over `n` bytes of a chunk whose
+// newlines are marked in `nl` (low `n` bits).
+static inline void skip_chunk(size_t n, VecMask nl, size_t* offset, Pos* pos) {
+  if (nl != 0) {
+    pos->ln += __builtin_popcount(nl);
+    // Column counts from the byte after the last newline.
+    size_t last_nl = 31 - __builtin_clz(nl);
+    pos->cl = n - last_nl - 1;
+  } else {
+    pos->cl += n;
+  }
+  *offset += n;
 }
 
-static inline int and(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("and", blk, len, offset, pos);
-}
+#endif  // SCAN_VEC_LEN
 
-static inline int or(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("or", blk, len, offset, pos);
-}
+#ifdef SCAN_VEC_LEN
 
-static inline int not(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("not", blk, len, offset, pos);
-}
+// Skip a run of whitespace a whole chunk at a time.
+static int eat_ws_chunks(const char* blk, size_t len, size_t* offset, Pos* pos) {
+  int found_nl = 0;
 
-static inline int ident(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  assert(blk != NULL);
-  assert(offset != NULL);
+  while (*offset + SCAN_VEC_LEN <= len) {
+    const char* p = blk + *offset;
+    VecMask ws = ws_mask(p);
+    VecMask nl = nl_mask(p);
+    if (ws != VEC_FULL) {
+      // Only the leading whitespace belongs to this run.
+      size_t n = __builtin_ctz(~ws);
+      nl &= ((VecMask) 1 << n) - 1;
+      found_nl |= nl != 0;
+      skip_chunk(n, nl, offset, pos);
+      return found_nl;
+    }
 
-  size_t ident_offset = *offset;
-  size_t nchars = 0;
-
-  // [A-Za-z_\.:]
-  if (ident_offset < len &&
-    (isalpha(blk[ident_offset]) ||
-    blk[ident_offset] == '_' ||
-    blk[ident_offset] == '.' ||
-    blk[ident_offset] == ':')
-  ) {
-    nchars ++;
-    ident_offset ++;
-  } else {
-    return 0;
+    found_nl |= nl != 0;
+    skip_chunk(SCAN_VEC_LEN, nl, offset, pos);
   }
 
-  // [0-9A-Za-z_\.:]*
-  char next;
-  while(ident_offset < len) {
-    next = blk[ident_offset];
-    if (isalnum(next) || next == '_' || next == '.' || next == ':') {
-      // Go to the next character.
-      nchars ++;
-      ident_offset ++;
-    } else {
-      // We ended up at a character which isn't
-      // part of the identifier anymore.
-      break;
-    }
-  }
+  return found_nl;
+}
 
-  // `ident_offset >= len` is the unhappy path
-  // of the while loop above: it's true if the
-  // loop ends because the block's length is
-  // exceeded before the ident ends.
-  // The character after the end of the ident
-  // must be a whitespace.
-  if (ident_offset >= len || !isspace(blk[ident_offset]))
-    return nchars;
-
-  if (nchars > MAX_IDENT_LEN)
-    warn_trunc_ident(blk + *offset, nchars, MAX_IDENT_LEN);
-
-  size_t nleft = len - *offset;  /* Number of chars left in buffer after offset */
-  strncpy(ident_buf, blk + *offset, MAX_IDENT_LEN > nleft ? nleft : MAX_IDENT_LEN);
-  /* `nchars` might be larger than `MAX_IDENT_LEN`. Place
-   * the NULL-terminator so it doesn't exceed the buffer. */
-  ident_buf[nchars >= MAX_IDENT_LEN ? MAX_IDENT_LEN : nchars] = '\0';
-
-  incby(nchars, offset, pos);
-
-  return TOKEN_COMPLETED;
-}
-
-static inline int comment(const char* blk, size_t len, size_t* offset, Pos* pos) {
-  return static_scan("//", blk, len, offset, pos);
-}
-
-typedef int(*ScanFnPtr)(const char*, size_t, size_t*, Pos*);
-static ScanFnPtr match_fns[] = {
-  push,
-  pop,
-  argument,
-  local,
-  _static,
-  constant,
-  this,
-  that,
-  pointer,
-  temp,
-  _uint,
-  label,
-  _goto,
-  if_goto,
-  function,
-  call,
-  _return,
-  add,
-  sub,
-  neg,
-  eq,
-  gt,
-  lt,
-  and,
-  or,
-  not,
-  ident,
-  comment,
-  NULL,
-};
+#endif  // SCAN_VEC_LEN
 
-Token token_from_fn(size_t fn_idx, Pos pos) {
-  // IMPORTANT: It has to be ensured, that
-  // `TokenCode(fn_idx) = fn_idx + 1` remains true.
-  Token token = {
-    .t=fn_idx + 1,
-    .uilit=uilit,
-    .pos=pos,
-  };
-  strcpy(token.ident, ident_buf);
-  memset(ident_buf, ' ', MAX_IDENT_LEN);
-  uilit = 0;
-  return token;
-}
+// Whitespace between tokens is mostly one or two bytes (a space
+// or a newline and an indent). Runs shorter than this are cheaper
+// to walk byte by byte than to load as a chunk.
+#define SHORT_WS_RUN 4
 
+// Skip whitespace. Long runs are checked a whole chunk at once.
 static inline int eat_ws(const char* blk, size_t len, size_t* offset, Pos* pos) {
   assert(blk != NULL);
   assert(offset != NULL);
   
   int found_nl = 0;
+#ifdef SCAN_VEC_LEN
+  size_t run = 0;
+#endif  // SCAN_VEC_LEN
+
+  while (*offset < len && is_ws(blk[*offset])) {
+#ifdef SCAN_VEC_LEN
+    if (++run == SHORT_WS_RUN) {
+      // Long run. What's left after this is at
+      // most the last chunk of the block.
+      found_nl |= eat_ws_chunks(blk, len, offset, pos);
+      continue;
+    }
+#endif  // SCAN_VEC_LEN
 
-  while (*offset < len && isspace(blk[*offset])) {
     if (blk[*offset] == '\n') {
       found_nl = 1;
       incl(offset, pos);
@@ -440,13 +407,35 @@ static inline int eat_ws(const char* blk, size_t len, size_t* offset, Pos* pos)
   return found_nl;
 }
 
+// Skip to the next newline (or the end of the block)
+// without consuming it. Used to skip over comments.
+static inline void skip_line(const char* blk, size_t len, size_t* offset, Pos* pos) {
+  assert(blk != NULL);
+  assert(offset != NULL);
+
+#ifdef SCAN_VEC_LEN
+  while (*offset + SCAN_VEC_LEN <= len) {
+    VecMask nl = nl_mask(blk + *offset);
+    if (nl == 0) {
+      incby(SCAN_VEC_LEN, offset, pos);
+    } else {
+      incby(__builtin_ctz(nl), offset, pos);
+      return;
+    }
+  }
+#endif  // SCAN_VEC_LEN
+
+  while (*offset < len && blk[*offset] != '\n')
+    inc(offset, pos);
+}
+
 static inline ssize_t num_trailing(const char* blk, size_t len) {
   assert(blk != NULL);
   
   size_t offset = 0;
 
   while (offset < len) {
-    if (isspace(blk[offset])) {
+    if (is_ws(blk[offset])) {
       // Error: there is whitespace left in this block
       // which means that the scanner failed to scan
       // all fully available tokens.
@@ -465,8 +454,6 @@ ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len) {
   assert(blk != NULL);
   
   size_t offset = 0;
-  // Remember whether we left inside a comment.
-  static int inside_comment = 0;
 
   while (offset < len) {
     // `offset` now points to the first
@@ -474,12 +461,12 @@ ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len) {
 
     // Eat comments. Newline check must happen
     // before starting whitespace is consumed.
-    if (inside_comment) {
-      if (blk[offset] == '\n') {
-        inside_comment = 0;
+    if (tokens->inside_comment) {
+      skip_line(blk, len, &offset, &tokens->cur);
+      if (offset < len) {
+        // `offset` is at the newline ending the comment.
+        tokens->inside_comment = 0;
         incl(&offset, &tokens->cur);
-      } else {
-        inc(&offset, &tokens->cur);
       }
 
       continue;
@@ -487,27 +474,18 @@ ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len) {
 
     // Eat up initial whitespace.
     eat_ws(blk, len, &offset, &tokens->cur);
+    if (offset >= len)
+      break;
 
-    int num_matched = 0;
-    size_t fn_idx = 0;
     Pos cur_start = tokens->cur;
-    while (
-      num_matched != TOKEN_COMPLETED
-      && match_fns[fn_idx] != NULL
-    ) {
-      num_matched = match_fns[fn_idx](blk, len, &offset, &tokens->cur);
-      if (num_matched != TOKEN_COMPLETED)
-        fn_idx++;
-    }
-
-    if (num_matched == TOKEN_COMPLETED && match_fns[fn_idx] == comment) {
-      // Comment scan function as completed successfully.
-      // This means that we set `inside_comment` to true and
-      // continue until the comment is terminated by a newline.
-      inside_comment = 1;
-    } else if (num_matched == TOKEN_COMPLETED && match_fns[fn_idx] != NULL) {
-      // The scan function `fn_idx`
-      // completed successfully.
+    Token token;
+    int res = scan_word(blk, len, &offset, &tokens->cur, tokens->syms, &token);
+
+    if (res == WORD_COMMENT) {
+      // Set `inside_comment` to true and continue
+      // until the comment is terminated by a newline.
+      tokens->inside_comment = 1;
+    } else if (res == WORD_TOKEN) {
       if (tokens->idx >= tokens->len) {
         // Increase size and reallocate in case the array is full.
         tokens->len += TOKEN_BLOCK_SIZE;
@@ -515,10 +493,10 @@ ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len) {
         assert(tokens->cell != NULL);
       }
 
-      tokens->cell[tokens->idx] = token_from_fn(fn_idx, cur_start);
+      tokens->cell[tokens->idx] = token;
       tokens->idx ++;
     } else {
-      // No scan function completed. This must
+      // No token could be scanned. This must
       // raise and error only if there are
       // whitespace characters or the EOF after
       // the current set of characters. Otherwise
@@ -530,16 +508,22 @@ ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len) {
       ssize_t ret = num_trailing(blk + offset, len - offset);
 
       if (ret == INTERNAL_SCAN_ERR) {
-        // Remove the trailing newline character
-        // from the string to print it.
-        char* pblk = (char*) calloc (len - offset, sizeof(char));
-        assert(pblk != NULL);
-        strncpy(pblk, blk + offset, len - offset - 1);
-        // pblk[len - 1] is NULL already because calloc
-        // was used to allocate it. No need to add it.
+        // Print the rest of the line (at most
+        // `MAX_ERR_BLK_LEN` characters) without
+        // the trailing newline.
+        size_t nerr = 0;
+        while (
+          offset + nerr < len &&
+          nerr < MAX_ERR_BLK_LEN &&
+          blk[offset + nerr] != '\n'
+        ) {
+          nerr++;
+        }
+        char pblk[MAX_ERR_BLK_LEN + 1];
+        memcpy(pblk, blk + offset, nerr);
+        pblk[nerr] = '\0';
 
         scan_err(pblk, tokens->filename, cur_start);
-        free(pblk);
       }
 
       return ret;
@@ -554,17 +538,49 @@ ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len) {
   return 0;
 }
 
-int scan(Tokens* tokens) {
+/* Pass the tokens scanned so far to the sink and move those
+ * it didn't consume to the front. Does nothing without a sink. */
+static int flush_tokens(Tokens* tokens, int last) {
   assert(tokens != NULL);
-  assert(tokens->filename != NULL);
-  assert(SCAN_BLOCK_SIZE >= MAX_TOKEN_LEN);
-  
-  int fd = open(tokens->filename, O_RDONLY);
-  if (fd == -1)  {
+
+  if (tokens->sink == NULL)
+    return SCAN_OK;
+
+  ssize_t used = tokens->sink(tokens, last, tokens->sink_ctx);
+  if (used < 0)
     return SCAN_ERR;
+
+  assert((size_t) used <= tokens->idx);
+  size_t rest = tokens->idx - (size_t) used;
+  memmove(tokens->cell, tokens->cell + used, rest * sizeof(Token));
+  tokens->idx = rest;
+
+  return SCAN_OK;
+}
+
+/* Read until `buf` is full or the end of the file is reached.
+ * A single `read` may return less than that (e.g. on pipes). */
+static ssize_t read_full(int fd, char* buf, size_t len) {
+  size_t total = 0;
+  while (total < len) {
+    ssize_t n = read(fd, buf + total, len - total);
+    if (n == -1)
+      return -1;
+    if (n == 0)
+      break;
+    total += (size_t) n;
   }
+  return (ssize_t) total;
+}
+
+/* Read a file which can't be mapped block by block.
+ * Words crossing the end of a block are copied to
+ * the start of the next one. */
+int scan_blocks(Tokens* tokens, int fd) {
+  assert(tokens != NULL);
 
-  char* blk = (char*) malloc (SCAN_BLOCK_SIZE * sizeof(char));
+  size_t blk_len = SCAN_BLOCK_SIZE;
+  char* blk = (char*) malloc (blk_len * sizeof(char));
   assert(blk != NULL);
 
   ssize_t bytes_read;
@@ -575,24 +591,25 @@ int scan(Tokens* tokens) {
                    // newline is inserted. Then `len` will be
                    // increased by one but `orig_len` can be used
                    // to check how much original data the block contains.
+  int full;
 
   do {
-    bytes_read = read(fd, blk + bytes_copied, SCAN_BLOCK_SIZE - bytes_copied);
+    bytes_read = read_full(fd, blk + bytes_copied, blk_len - bytes_copied);
     if (bytes_read == -1) {
       // Error: `-1` means read error and if
       // `bytes_read > SIZE_MAX` we cannot continue
       // since we cannot cast it into a `size_t`.
       free(blk);
-      close(fd);
       return SCAN_ERR;
     }
 
     len = (size_t) bytes_read;
     len += bytes_copied;
     orig_len = len;
+    full = orig_len == blk_len;
 
     // Check if this block is the end of the file.
-    if (0 < len && len < SCAN_BLOCK_SIZE && blk[len - 1] != '\n') {
+    if (0 < len && !full && blk[len - 1] != '\n') {
       // The user should provide the newline by themselves.
       warn_eof_nl();
       // The newline (or any other whitespace) is required so
@@ -616,15 +633,317 @@ int scan(Tokens* tokens) {
     bytes_copied = (size_t) res;
     if (res == INTERNAL_SCAN_ERR) {
       free(blk);
-      close(fd);
       return SCAN_ERR;
+    } else if (bytes_copied == len) {
+      // A single word fills the whole block. It's
+      // already at the start; make room for its rest.
+      blk_len *= 2;
+      blk = (char*) realloc (blk, blk_len * sizeof(char));
+      assert(blk != NULL);
     } else if (res > 0) {
-      memcpy(blk, blk + SCAN_BLOCK_SIZE - bytes_copied, bytes_copied);
+      memmove(blk, blk + len - bytes_copied, bytes_copied);
+    }
+
+    if (flush_tokens(tokens, 0) == SCAN_ERR) {
+      free(blk);
+      return SCAN_ERR;
     }
-  } while (orig_len == SCAN_BLOCK_SIZE);
+  } while (full);
   
   free(blk);
-  close(fd);
 
   return SCAN_OK;
 }
+
+// `scan_mapped` result if the file couldn't be mapped.
+#define SCAN_NO_MAP -1
+
+char* map_src(int fd, size_t size, size_t* len) {
+  assert(size > 0);
+  assert(len != NULL);
+
+  /* Reserve `size + 1` bytes of zero pages and map the file
+   * over their start. The extra byte is either in the file's
+   * last page or in an anonymous page after it. */
+  size_t map_len = size + 1;
+  char* src = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (src == MAP_FAILED)
+    return NULL;
+  if (mmap(src, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(src, map_len);
+    return NULL;
+  }
+
+  *len = size;
+  if (src[size - 1] != '\n') {
+    // Private mapping: this doesn't change the file.
+    src[size] = '\n';
+    *len = size + 1;
+  }
+
+  return src;
+}
+
+void unmap_src(char* src, size_t size) {
+  munmap(src, size + 1);
+}
+
+char* read_src(int fd, size_t size, size_t* len) {
+  assert(size > 0);
+  assert(len != NULL);
+
+  char* src = (char*) malloc (size + 1);
+  assert(src != NULL);
+  size_t nread = 0;
+  while (nread < size) {
+    ssize_t n = read(fd, src + nread, size - nread);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      // The file shrank or can't be read.
+      free(src);
+      return NULL;
+    }
+    nread += (size_t) n;
+  }
+
+  *len = size;
+  if (src[size - 1] != '\n') {
+    src[size] = '\n';
+    *len = size + 1;
+  }
+
+  return src;
+}
+
+/* Scan the `len` bytes at `src`, which end with a newline,
+ * block by block. */
+static int scan_view(Tokens* tokens, const char* src, size_t len) {
+  /* The blocks are views into `src`, so an unfinished
+   * word at the end of one block is simply where the next
+   * block starts. `scan_word` never accepts a word touching
+   * the end of a block, so no token is cut at a view's end. */
+  int res = SCAN_OK;
+  size_t offset = 0;
+  size_t blk_len = SCAN_BLOCK_SIZE;
+  while (offset < len) {
+    size_t n = len - offset < blk_len ? len - offset : blk_len;
+    ssize_t nleft = scan_blk(tokens, src + offset, n);
+    if (nleft == INTERNAL_SCAN_ERR) {
+      res = SCAN_ERR;
+      break;
+    }
+
+    if ((size_t) nleft == n) {
+      /* A single word fills the whole block. Scan the rest
+       * of the file at once. Because of the newline at the
+       * end there can't be any unfinished word left then. */
+      blk_len = len - offset;
+      continue;
+    }
+
+    offset += n - (size_t) nleft;
+    if (flush_tokens(tokens, 0) == SCAN_ERR) {
+      res = SCAN_ERR;
+      break;
+    }
+  }
+
+  return res;
+}
+
+/* Map the whole file and scan it block by block.
+ * Returns `SCAN_NO_MAP` if the file can't be mapped. */
+static int scan_mapped(Tokens* tokens, int fd, size_t size) {
+  assert(tokens != NULL);
+  assert(size > 0);
+
+  size_t len;
+  char* src = map_src(fd, size, &len);
+  if (src == NULL)
+    return SCAN_NO_MAP;
+  if (len != size)
+    warn_eof_nl();
+  madvise(src, size, MADV_SEQUENTIAL);
+
+  int res = scan_view(tokens, src, len);
+
+  // Identifiers are interned, so no token points into `src`.
+  unmap_src(src, size);
+
+  return res;
+}
+
+int scan_src(Tokens* tokens, const char* src, size_t len) {
+  assert(tokens != NULL);
+  assert(src != NULL);
+
+  ssize_t nleft = scan_blk(tokens, src, len);
+  if (nleft != 0) {
+    if (nleft > 0) {
+      // The range ended in the middle of a word.
+      scan_err(src + len - nleft, tokens->filename, tokens->cur);
+    }
+    return SCAN_ERR;
+  }
+  return flush_tokens(tokens, 1);
+}
+
+/* Skip whitespace and comments in a pre-scan. */
+static size_t skip_ws_comments(const char* src, size_t len, size_t i, Pos* pos, size_t* line) {
+  while (i < len) {
+    if (src[i] == '\n') {
+      i++;
+      pos->ln++;
+      *line = i;
+    } else if (is_ws(src[i])) {
+      i++;
+    } else if (is_comment_start(src, len, i)) {
+      const char* nl = memchr(src + i, '\n', len - i);
+      i = nl == NULL ? len : (size_t) (nl - src);
+    } else {
+      break;
+    }
+  }
+  return i;
+}
+
+static inline size_t word_end(const char* src, size_t len, size_t i) {
+  while (i < len && !is_ws(src[i]) && !is_comment_start(src, len, i))
+    i++;
+  return i;
+}
+
+int find_funcs(const char* src, size_t len, SymPool* syms,
+               FuncStart** starts, size_t* nstarts) {
+  assert(src != NULL);
+  assert(starts != NULL);
+  assert(nstarts != NULL);
+
+  size_t n = 0;
+  size_t cap = 0;
+  FuncStart* found = NULL;
+  int res = SCAN_OK;
+
+  Pos pos = { .ln=0, .cl=0 };
+  size_t line = 0;  // Offset of the current line.
+  size_t i = 0;
+  while (res == SCAN_OK && (i = skip_ws_comments(src, len, i, &pos, &line)) < len) {
+    size_t end = word_end(src, len, i);
+    if (end - i != 8 || memcmp(src + i, "function", 8) != 0) {
+      i = end;
+      continue;
+    }
+
+    FuncStart start = { .offset=i, .pos={ .ln=pos.ln, .cl=(unsigned int) (i - line) } };
+
+    /* The name and the number of locals must follow. If they
+     * don't, the pre-scan gives up and the file has to be
+     * parsed properly to report the error. */
+    i = skip_ws_comments(src, len, end, &pos, &line);
+    end = word_end(src, len, i);
+    int is_name = i < end && !isdigit(src[i]);
+    for (size_t j = i; j < end; j++)
+      is_name &= is_ident_char(src[j]);
+    if (!is_name || keyword(src + i, end - i) != TK_NONE) {
+      res = SCAN_ERR;
+      break;
+    }
+    start.ident = intern(syms, src + i, end - i);
+
+    i = skip_ws_comments(src, len, end, &pos, &line);
+    end = word_end(src, len, i);
+    unsigned long nlocals = 0;
+    for (size_t j = i; j < end && nlocals <= 65535; j++)
+      nlocals = isdigit(src[j]) ? nlocals * 10 + (src[j] - '0') : 65536;
+    if (i == end || nlocals > 65535) {
+      res = SCAN_ERR;
+      break;
+    }
+    start.nlocals = (Uint) nlocals;
+    i = end;
+
+    if (n == cap) {
+      cap = cap == 0 ? 0x40 : cap * 2;
+      found = (FuncStart*) realloc (found, cap * sizeof(FuncStart));
+      assert(found != NULL);
+    }
+    found[n++] = start;
+  }
+
+  if (res == SCAN_ERR) {
+    free(found);
+    return SCAN_ERR;
+  }
+
+  *starts = found;
+  *nstarts = n;
+  return SCAN_OK;
+}
+
+int scan(Tokens* tokens) {
+  assert(tokens != NULL);
+  assert(tokens->filename != NULL);
+  
+  int fd = open(tokens->filename, O_RDONLY);
+  if (fd == -1)  {
+    return SCAN_ERR;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return SCAN_ERR;
+  }
+
+  int res;
+  if (S_ISREG(st.st_mode) && st.st_size == 0) {
+    res = SCAN_OK;  // Nothing to scan.
+  } else if (S_ISREG(st.st_mode)) {
+    res = scan_mapped(tokens, fd, (size_t) st.st_size);
+    if (res == SCAN_NO_MAP)
+      res = scan_blocks(tokens, fd);
+  } else {
+    res = scan_blocks(tokens, fd);
+  }
+
+  close(fd);
+
+  if (res == SCAN_OK)
+    res = flush_tokens(tokens, 1);
+
+  return res;
+}
+
+int scan_stream(Tokens* tokens, TokenSink sink, void* ctx) {
+  assert(tokens != NULL);
+  assert(sink != NULL);
+
+  tokens->sink = sink;
+  tokens->sink_ctx = ctx;
+  int res = scan(tokens);
+  tokens->sink = NULL;
+  tokens->sink_ctx = NULL;
+
+  return res;
+}
+
+int scan_stream_src(Tokens* tokens, const char* src, size_t len,
+                    TokenSink sink, void* ctx) {
+  assert(tokens != NULL);
+  assert(src != NULL);
+  assert(len > 0 && src[len - 1] == '\n');
+  assert(sink != NULL);
+
+  tokens->sink = sink;
+  tokens->sink_ctx = ctx;
+  int res = scan_view(tokens, src, len);
+  if (res == SCAN_OK)
+    res = flush_tokens(tokens, 1);
+  tokens->sink = NULL;
+  tokens->sink_ctx = NULL;
+
+  return res;
+}
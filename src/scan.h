@@ -6,6 +6,8 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include "intern.h"
+
 // NOTE: The marked beginnings and end of
 // the ranges of different token types must
 // remain unchanged so that all range check
@@ -45,21 +47,10 @@ typedef enum {
                 // Must be at the end so it has to lowest precedence when scaning.
 } TokenCode;
 
-# ifndef MAX_IDENT_LEN
-# define MAX_IDENT_LEN 24
-# endif  // MAX_IDENT_LEN
-
-# ifndef MAX_TOKEN_LEN
-// Length of longest possible token is 8 (`argument`/`constant`).
-// The largest possible 16-bit number only has
-// floor(log10(65535)) + 1 = 5 digits.
-// This length is therefore dicated by `MAX_IDENT_LEN`
-# define MAX_TOKEN_LEN MAX_IDENT_LEN
-# endif
-
 # ifndef TOKEN_STR_BUF
-// Size of char buffer for `token_str`.
-# define TOKEN_STR_BUF (MAX_TOKEN_LEN  + 9)
+// Size of char buffer for `token_str`. Longer
+// identifiers are cut off in the string.
+# define TOKEN_STR_BUF 0x100
 # endif
 
 typedef uint16_t Uint;
@@ -78,15 +69,29 @@ typedef struct {
   TokenCode t;
   Pos pos;
   Uint uilit;
-  char ident[MAX_IDENT_LEN + 1];
+  SymId ident;  // Identifier (set for `TK_IDENT`).
 } Token;
 
-typedef struct {
+struct Tokens;
+
+/* Consumer of tokens for `scan_stream`. It's called with each
+ * batch of newly scanned tokens following those it didn't consume
+ * last time. `last` is set once the whole input was scanned.
+ * Returns how many tokens from the start of `tokens->cell` it
+ * consumed or -1 on error. */
+typedef ssize_t (*TokenSink)(const struct Tokens* tokens, int last, void* ctx);
+
+typedef struct Tokens {
   size_t idx;
   size_t len;
   Token* cell;
-  char* filename;
+  const char* filename;  // Borrowed. Must outlive the tokens.
+  SymPool* syms;  // Borrowed. Identifiers are interned here.
   Pos cur;   // Used only while scanning to track where we are.
+  int inside_comment;  // Whether the last block ended inside a comment.
+  // Set by `scan_stream`. `NULL` to keep all tokens.
+  TokenSink sink;
+  void* sink_ctx;
 } Tokens;
 
 # ifndef TOKEN_BLOCK_SIZE
@@ -94,27 +99,30 @@ typedef struct {
 # endif
 
 // Initialize a new `Tokens` instance.
-Tokens new_tokens(const char* filename);
+Tokens new_tokens(const char* filename, SymPool* syms);
 // Delete an `Items` instance.
 void del_tokens(Tokens tokens);
 
 // Writes `it` to `str`. `str` must be able
 // to hold  at least `TOKEN_STR_BUF` characters
 // or else this function might segfault.
-void token_str(const Token* it, char* str);
+// Identifiers are looked up in `syms`.
+void token_str(const SymPool* syms, const Token* it, char* str);
 
 // Macro to handle the fixed-size string
 // buffer used to stringify a token. This
 // macro should be the only way `token_str`
 // is called.
-# define TOKEN_STR(id, token) \
-  char id[TOKEN_STR_BUF];    \
-  token_str(token, id);
+# define TOKEN_STR(id, syms, token) \
+  char id[TOKEN_STR_BUF];          \
+  token_str(syms, token, id);
 
 
 # ifndef SCAN_BLOCK_SIZE
 #  ifdef UNIT_TESTS
-#    define SCAN_BLOCK_SIZE MAX_TOKEN_LEN
+// Small enough that most tokens in the tests cross
+// the border of a block at some point.
+#    define SCAN_BLOCK_SIZE 24
 #  else
 #    define SCAN_BLOCK_SIZE 0x10000
 #  endif  // UNIT_TESTS
@@ -123,7 +131,56 @@ void token_str(const Token* it, char* str);
 #define SCAN_ERR 0
 #define SCAN_OK 1
 
-/* Scan input and store the tokens in `tokens`. */
+/* Scan input and store the tokens in `tokens`. Regular files
+ * are mapped into memory and other files (e.g. pipes) are read.
+ * Either way the input is scanned `SCAN_BLOCK_SIZE` bytes at a
+ * time. */
 int scan(Tokens* tokens);
 
+/* Like `scan` but pass the tokens to `sink` after each block
+ * instead of collecting all of them. `tokens` only holds those
+ * which `sink` didn't consume yet. Returns `SCAN_ERR` if `sink`
+ * fails, too. */
+int scan_stream(Tokens* tokens, TokenSink sink, void* ctx);
+
+/* Like `scan_stream` but scan the `len` bytes at `src` (see
+ * `read_src`) instead of the file. They must end with a newline. */
+int scan_stream_src(Tokens* tokens, const char* src, size_t len,
+                    TokenSink sink, void* ctx);
+
+/* Map the regular file `fd` of `size > 0` bytes into private
+ * memory. A newline is added after the end if the file doesn't
+ * end with one. `len` is set to the length including this
+ * newline. Returns `NULL` on failure. */
+char* map_src(int fd, size_t size, size_t* len);
+
+// Unmap a source mapped by `map_src`.
+void unmap_src(char* src, size_t size);
+
+/* Like `map_src`, but read the file into a new buffer. Unlike a
+ * mapping, it doesn't change if the file does. Returns `NULL`
+ * if fewer than `size` bytes can be read. Free it with `free`. */
+char* read_src(int fd, size_t size, size_t* len);
+
+/* Scan the `len` bytes at `src` which begin at `tokens->cur`.
+ * The range must not end in the middle of a word. */
+int scan_src(Tokens* tokens, const char* src, size_t len);
+
+// A `function` keyword found by `find_funcs`.
+typedef struct {
+  size_t offset;  // Byte offset of the keyword in the source.
+  Pos pos;
+  SymId ident;  // Name of the function.
+  Uint nlocals;
+} FuncStart;
+
+/* Find all functions in the `len` bytes at `src` without
+ * scanning their bodies. Their names are interned into
+ * `syms`. `starts` is set to an array of
+ * `nstarts` functions in source order which must be freed.
+ * Returns `SCAN_ERR` (and prints nothing) if a function's
+ * name or number of locals is missing or invalid. */
+int find_funcs(const char* src, size_t len, SymPool* syms,
+               FuncStart** starts, size_t* nstarts);
+
 #endif  // _SCAN_H_
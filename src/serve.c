@@ -0,0 +1,544 @@
+/* For `fopencookie`. */
+#define _GNU_SOURCE
+
+#include "serve.h"
+#include "exec.h"
+#include "input.h"
+#include "msg.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Longest request or response header line. */
+#define SERVE_MAX_HEADER 512
+
+/* Most input a request may carry. */
+#ifndef SERVE_MAX_INPUT
+#  define SERVE_MAX_INPUT (64 << 20)
+#endif  // SERVE_MAX_INPUT
+
+/* `STATUS` words of the responses, indexed by `RUN_*`. */
+static const char* const status_words[] = {
+  [RUN_OK] = "ok",
+  [RUN_ERR] = "error",
+  [RUN_BUDGET] = "budget",
+  [RUN_TIMEOUT] = "timeout",
+  [RUN_UNKNOWN] = "unknown",
+  [RUN_BAD] = "bad",
+};
+#define NSTATUS (sizeof(status_words) / sizeof(status_words[0]))
+
+struct Server {
+  int fd;  /* Listening socket. */
+  char* path;
+  const ServeProg* progs;
+  unsigned int nprogs;
+  unsigned int njobs;
+  atomic_int stop;
+  pthread_mutex_t lock;  /* Guards `conns`. */
+  int* conns;  /* Connection each worker serves or `-1`. */
+  int files_root;  /* Directory runs may open files in or `-1`. */
+};
+
+// Thread serving one connection at a time.
+typedef struct {
+  Server* srv;
+  unsigned int idx;  /* Index into `srv->conns`. */
+  VmState** vms;  /* State for each program, made on first use. */
+} Worker;
+
+/* Send all `len` bytes at `buf`. Returns `0` if the
+ * other end is gone. No `SIGPIPE` is raised. */
+static int send_all(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t nsent = send(fd, buf, len, MSG_NOSIGNAL);
+    if (nsent == -1 && errno == EINTR)
+      continue;
+    if (nsent <= 0)
+      return 0;
+    buf += nsent;
+    len -= (size_t) nsent;
+  }
+  return 1;
+}
+
+/* Read exactly `len` bytes from `in` into `dst`.
+ * Returns `0` if the input ends before. */
+static int read_all(Input* in, char* dst, size_t len) {
+  while (len > 0) {
+    const char* data;
+    size_t nread = in_block(in, &data, len);
+    if (nread == 0)
+      return 0;
+    memcpy(dst, data, nread);
+    dst += nread;
+    len -= nread;
+  }
+  return 1;
+}
+
+/* Read a header line into `hdr` without the newline. Returns
+ * `0` if it's too long or the input ends before the newline
+ * and `-1` if the input ended before the line. */
+static int read_header(Input* in, char hdr[SERVE_MAX_HEADER]) {
+  const char* line;
+  ssize_t len = in_line_max(in, &line, SERVE_MAX_HEADER);
+  if (len == IN_EOF)
+    return -1;
+  if (len >= SERVE_MAX_HEADER || line[len - 1] != '\n')
+    return 0;
+  memcpy(hdr, line, (size_t) len - 1);
+  hdr[len - 1] = '\0';
+  return 1;
+}
+
+static int send_response(int fd, int status, const char* out, size_t out_len,
+                         const char* err, size_t err_len) {
+  char hdr[SERVE_MAX_HEADER];
+  int hdr_len = snprintf(hdr, sizeof(hdr), "%s %zu %zu\n",
+                         status_words[status], out_len, err_len);
+  return send_all(fd, hdr, (size_t) hdr_len)
+    && send_all(fd, out, out_len)
+    && send_all(fd, err, err_len);
+}
+
+static int send_message(int fd, int status, const char* msg) {
+  return send_response(fd, status, NULL, 0, msg, strlen(msg));
+}
+
+/* Output of a run. Everything past `SERVE_MAX_OUTPUT`
+ * bytes is dropped and only counted. */
+typedef struct {
+  char* buf;
+  size_t len;
+  size_t cap;
+  size_t ndropped;
+} RunOutput;
+
+static ssize_t write_run_output(void* cookie, const char* data, size_t len) {
+  RunOutput* ro = (RunOutput*) cookie;
+  size_t nkept = SERVE_MAX_OUTPUT - ro->len;
+  if (nkept > len)
+    nkept = len;
+  if (ro->len + nkept + 1 > ro->cap) {
+    ro->cap = ro->cap == 0 ? 4096 : ro->cap;
+    while (ro->len + nkept + 1 > ro->cap)
+      ro->cap *= 2;
+    ro->buf = (char*) realloc (ro->buf, ro->cap);
+    assert(ro->buf != NULL);
+  }
+  memcpy(ro->buf + ro->len, data, nkept);
+  ro->len += nkept;
+  ro->buf[ro->len] = '\0';
+  ro->ndropped += len - nkept;
+  /* Dropped bytes count as written. */
+  return (ssize_t) len;
+}
+
+/* `limit` lowered to `max`, or `def` if it isn't set. */
+static inline uint64_t clamp_limit(uint64_t limit, uint64_t def, uint64_t max) {
+  if (limit == 0)
+    return def;
+  return limit < max ? limit : max;
+}
+
+/* Run the program `pi` as `req` says. */
+static void run_prog(Worker* w, unsigned int pi, const RunRequest* req,
+                     RunResult* res) {
+  if (w->vms[pi] == NULL) {
+    w->vms[pi] = new_vm(w->srv->progs[pi].prog);
+    /* Clients must not reach the server's files. */
+    int root = w->srv->files_root;
+    w->vms[pi]->host.access = root != -1 ? HOST_BENEATH : HOST_NOWHERE;
+    w->vms[pi]->host.root = root;
+    /* `stop_server` ends runs that are in progress. */
+    w->vms[pi]->stop = &w->srv->stop;
+  }
+  VmState* vm = w->vms[pi];
+
+  MsgCapture errors;
+  begin_capture(&errors);
+
+  *res = (RunResult) { .status=RUN_ERR };
+  RunOutput ro = {0};
+  FILE* stream = fopencookie(&ro, "w", (cookie_io_functions_t) {
+    .write=write_run_output,
+  });
+  assert(stream != NULL);
+  Input in = new_mem_input(req->in, req->in_len);
+  Output* out = new_output(stream);
+  vm->in = &in;
+  vm->out = out;
+
+  limit_vm(vm,
+    clamp_limit(req->budget, SERVE_DEFAULT_BUDGET, SERVE_MAX_BUDGET),
+    (unsigned int) clamp_limit(req->timeout_ms, SERVE_DEFAULT_TIMEOUT_MS,
+                               SERVE_MAX_TIMEOUT_MS));
+  int ret = exec_prog(vm);
+  if (ret == 0)
+    res->status = RUN_OK;
+  else if (ret == EXEC_BUDGET)
+    res->status = RUN_BUDGET;
+  else if (ret == EXEC_TIMEOUT)
+    res->status = RUN_TIMEOUT;
+  /* End the output with a newline like a single run would. */
+  if (out->last != '\n' && out->last != '\0')
+    out_char(out, '\n');
+
+  reset_vm(vm);
+  del_output(out);
+  del_input(&in);
+  fclose(stream);
+  if (ro.ndropped > 0) {
+    errf("%zu bytes of output past the first %zu were dropped",
+         ro.ndropped, (size_t) SERVE_MAX_OUTPUT);
+  }
+  res->out = ro.buf != NULL ? ro.buf : strdup("");
+  assert(res->out != NULL);
+  res->out_len = ro.len;
+
+  end_capture(&errors);
+  res->err = errors.buf;
+  res->err_len = errors.len;
+}
+
+/* Find the program called `id`. Returns `-1` if there's none. */
+static int find_prog(const Server* srv, const char* id) {
+  for (unsigned int i = 0; i < srv->nprogs; i++) {
+    if (strcmp(srv->progs[i].id, id) == 0)
+      return (int) i;
+  }
+  return -1;
+}
+
+/* Answer the requests on `conn` until the client
+ * closes it or sends a malformed request. */
+static void serve_conn(Worker* w, int conn) {
+  Input in = new_input(conn);
+  char hdr[SERVE_MAX_HEADER];
+  char id[SERVE_MAX_HEADER];
+  char* in_buf = NULL;
+
+  for (;;) {
+    int got = read_header(&in, hdr);
+    if (got == -1)
+      break;
+
+    uintmax_t budget;
+    unsigned int timeout_ms;
+    size_t in_len;
+    int end = -1;
+    if (got == 0
+        || sscanf(hdr, "run %s %" SCNuMAX " %u %zu%n",
+                  id, &budget, &timeout_ms, &in_len, &end) != 4
+        || hdr[end] != '\0') {
+      send_message(conn, RUN_BAD, "malformed request\n");
+      break;
+    }
+    if (in_len > SERVE_MAX_INPUT) {
+      send_message(conn, RUN_BAD, "input is too large\n");
+      break;
+    }
+
+    in_buf = (char*) realloc (in_buf, in_len + 1);
+    assert(in_buf != NULL);
+    if (!read_all(&in, in_buf, in_len))
+      break;
+
+    int pi = find_prog(w->srv, id);
+    if (pi == -1) {
+      char msg[SERVE_MAX_HEADER + 32];
+      snprintf(msg, sizeof(msg), "no program `%s`\n", id);
+      if (!send_message(conn, RUN_UNKNOWN, msg))
+        break;
+      continue;
+    }
+
+    RunRequest req = {
+      .id=id, .budget=(uint64_t) budget, .timeout_ms=timeout_ms,
+      .in=in_buf, .in_len=in_len,
+    };
+    RunResult res;
+    run_prog(w, (unsigned int) pi, &req, &res);
+    int sent = send_response(conn, res.status, res.out, res.out_len,
+                             res.err, res.err_len);
+    del_result(&res);
+    if (!sent)
+      break;
+  }
+
+  free(in_buf);
+  del_input(&in);
+}
+
+static void* serve_worker(void* arg) {
+  Worker* w = (Worker*) arg;
+  Server* srv = w->srv;
+
+  while (!atomic_load(&srv->stop)) {
+    int conn = accept(srv->fd, NULL, NULL);
+    if (conn == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (!atomic_load(&srv->stop))
+        errf("can't accept connections on `%s`", srv->path);
+      break;
+    }
+
+    /* `stop_server` closes the connections it finds here. */
+    pthread_mutex_lock(&srv->lock);
+    int stopped = atomic_load(&srv->stop);
+    if (!stopped)
+      srv->conns[w->idx] = conn;
+    pthread_mutex_unlock(&srv->lock);
+    if (stopped) {
+      close(conn);
+      break;
+    }
+
+    serve_conn(w, conn);
+
+    pthread_mutex_lock(&srv->lock);
+    srv->conns[w->idx] = -1;
+    pthread_mutex_unlock(&srv->lock);
+    close(conn);
+  }
+
+  for (unsigned int i = 0; i < srv->nprogs; i++)
+    del_vm(w->vms[i]);
+  free(w->vms);
+  return NULL;
+}
+
+/* Set up the address of the socket at `path`. Returns
+ * `0` and prints an error if `path` is too long. */
+static int socket_addr(const char* path, struct sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    errf("socket path `%s` is too long", path);
+    return 0;
+  }
+  strcpy(addr->sun_path, path);
+  return 1;
+}
+
+Server* new_server(const char* path, const ServeProg* progs,
+                   unsigned int nprogs, unsigned int njobs,
+                   const char* files_dir) {
+  assert(path != NULL);
+  assert(progs != NULL);
+  assert(njobs > 0);
+
+  struct sockaddr_un addr;
+  if (!socket_addr(path, &addr))
+    return NULL;
+
+  /* Replace the socket of a server that's gone,
+   * but nothing else and no running server. */
+  struct stat sb;
+  if (lstat(path, &sb) == 0) {
+    int fd = S_ISSOCK(sb.st_mode) ? connect_server(path) : -1;
+    if (!S_ISSOCK(sb.st_mode) || fd != -1) {
+      if (fd != -1)
+        close(fd);
+      errf("`%s` is already in use", path);
+      return NULL;
+    }
+    unlink(path);
+  }
+
+  int files_root = -1;
+  if (files_dir != NULL) {
+    files_root = open(files_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (files_root == -1) {
+      errf("can't open directory `%s`", files_dir);
+      return NULL;
+    }
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1
+      || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0
+      || listen(fd, SOMAXCONN) != 0) {
+    errf("can't listen on `%s`", path);
+    if (fd != -1)
+      close(fd);
+    if (files_root != -1)
+      close(files_root);
+    return NULL;
+  }
+
+  Server* srv = (Server*) calloc (1, sizeof(Server));
+  assert(srv != NULL);
+  srv->fd = fd;
+  srv->path = strdup(path);
+  assert(srv->path != NULL);
+  srv->progs = progs;
+  srv->nprogs = nprogs;
+  srv->njobs = njobs;
+  srv->files_root = files_root;
+  atomic_init(&srv->stop, 0);
+  pthread_mutex_init(&srv->lock, NULL);
+  srv->conns = (int*) malloc (njobs * sizeof(int));
+  assert(srv->conns != NULL);
+  for (unsigned int i = 0; i < njobs; i++)
+    srv->conns[i] = -1;
+  return srv;
+}
+
+void run_server(Server* srv) {
+  assert(srv != NULL);
+
+  Worker* workers = (Worker*) calloc (srv->njobs, sizeof(Worker));
+  assert(workers != NULL);
+  pthread_t* threads = (pthread_t*) calloc (srv->njobs, sizeof(pthread_t));
+  assert(threads != NULL);
+  for (unsigned int w = 0; w < srv->njobs; w++) {
+    workers[w] = (Worker) { .srv=srv, .idx=w };
+    workers[w].vms = (VmState**) calloc (srv->nprogs, sizeof(VmState*));
+    assert(workers[w].vms != NULL);
+  }
+
+  /* The calling thread is a worker as well. If a thread can't
+   * be started, fewer connections are served at once. */
+  unsigned int nthreads = 0;
+  for (unsigned int w = 1; w < srv->njobs; w++) {
+    if (pthread_create(&threads[nthreads], NULL, serve_worker, &workers[w]) == 0)
+      nthreads++;
+    else
+      free(workers[w].vms);
+  }
+  serve_worker(&workers[0]);
+  for (unsigned int t = 0; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+
+  free(threads);
+  free(workers);
+}
+
+void stop_server(Server* srv) {
+  assert(srv != NULL);
+
+  /* Shutting the sockets down wakes up the workers waiting
+   * for connections or requests. Running VMs see `stop`
+   * within `DEADLINE_STEPS` instructions. */
+  pthread_mutex_lock(&srv->lock);
+  atomic_store(&srv->stop, 1);
+  shutdown(srv->fd, SHUT_RDWR);
+  for (unsigned int i = 0; i < srv->njobs; i++) {
+    if (srv->conns[i] != -1)
+      shutdown(srv->conns[i], SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&srv->lock);
+}
+
+void del_server(Server* srv) {
+  if (srv != NULL) {
+    close(srv->fd);
+    unlink(srv->path);
+    if (srv->files_root != -1)
+      close(srv->files_root);
+    pthread_mutex_destroy(&srv->lock);
+    free(srv->conns);
+    free(srv->path);
+    free(srv);
+  }
+}
+
+int connect_server(const char* path) {
+  assert(path != NULL);
+
+  struct sockaddr_un addr;
+  if (!socket_addr(path, &addr))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Read `len` bytes of a response into a new string. */
+static char* read_part(Input* in, size_t len) {
+  char* part = (char*) malloc (len + 1);
+  assert(part != NULL);
+  if (!read_all(in, part, len)) {
+    free(part);
+    return NULL;
+  }
+  part[len] = '\0';
+  return part;
+}
+
+int request_run(int fd, const RunRequest* req, RunResult* res) {
+  assert(req != NULL);
+  assert(req->id != NULL);
+  assert(res != NULL);
+
+  *res = (RunResult) { .status=RUN_ERR };
+  if (req->id[0] == '\0' || strpbrk(req->id, " \t\n\r\v\f") != NULL
+      || strlen(req->id) > SERVE_MAX_HEADER / 2) {
+    errf("invalid program ID `%s`", req->id);
+    return 0;
+  }
+
+  char hdr[SERVE_MAX_HEADER];
+  int hdr_len = snprintf(hdr, sizeof(hdr), "run %s %" PRIu64 " %u %zu\n",
+                         req->id, req->budget, req->timeout_ms, req->in_len);
+  if (!send_all(fd, hdr, (size_t) hdr_len)
+      || !send_all(fd, req->in, req->in_len)) {
+    err("can't send the request to the server");
+    return 0;
+  }
+
+  /* Each response is read completely before the next request is
+   * sent, so nothing of the connection is left in `in` after it. */
+  Input in = new_input(fd);
+  char status[SERVE_MAX_HEADER];
+  int end = -1;
+  int ok = read_header(&in, hdr) == 1
+    && sscanf(hdr, "%s %zu %zu%n", status, &res->out_len, &res->err_len, &end) == 3
+    && hdr[end] == '\0';
+  if (ok) {
+    res->status = -1;
+    for (unsigned int i = 0; i < NSTATUS; i++) {
+      if (strcmp(status, status_words[i]) == 0)
+        res->status = (int) i;
+    }
+    ok = res->status != -1
+      && (res->out = read_part(&in, res->out_len)) != NULL
+      && (res->err = read_part(&in, res->err_len)) != NULL;
+  }
+  del_input(&in);
+
+  if (!ok) {
+    err("invalid response from the server");
+    del_result(res);
+    return 0;
+  }
+  return 1;
+}
+
+void del_result(RunResult* res) {
+  assert(res != NULL);
+
+  free(res->out);
+  free(res->err);
+  *res = (RunResult) { .status=res->status };
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include "prog.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Running loaded programs for clients on a Unix socket (`--serve`).
+ * The programs are loaded once and each request runs one of them
+ * with memory, input and output of its own, so short runs don't pay
+ * for starting hvme and loading the program again.
+ *
+ * A client sends any number of requests over one connection and
+ * gets a response to each before the next one is read:
+ *
+ *     run ID BUDGET TIMEOUT LEN\n   followed by LEN bytes of input
+ *     STATUS OUT_LEN ERR_LEN\n      followed by the output and errors
+ *
+ * `ID` names the program to run, `BUDGET` is the number of
+ * instructions and `TIMEOUT` the number of milliseconds the run may
+ * take. `0` asks for the server's default and larger limits than
+ * its maximum are lowered to it, so every run ends. `STATUS` is one
+ * of the words below. After `bad`, the server closes the connection.
+ * Output past `SERVE_MAX_OUTPUT` bytes is dropped. */
+
+#ifndef SERVE_DEFAULT_BUDGET
+#  define SERVE_DEFAULT_BUDGET 1000000000ull
+#endif  // SERVE_DEFAULT_BUDGET
+#ifndef SERVE_MAX_BUDGET
+#  define SERVE_MAX_BUDGET 100000000000ull
+#endif  // SERVE_MAX_BUDGET
+#ifndef SERVE_DEFAULT_TIMEOUT_MS
+#  define SERVE_DEFAULT_TIMEOUT_MS 10000u
+#endif  // SERVE_DEFAULT_TIMEOUT_MS
+#ifndef SERVE_MAX_TIMEOUT_MS
+#  define SERVE_MAX_TIMEOUT_MS 60000u
+#endif  // SERVE_MAX_TIMEOUT_MS
+#ifndef SERVE_MAX_OUTPUT
+#  define SERVE_MAX_OUTPUT (16 << 20)
+#endif  // SERVE_MAX_OUTPUT
+
+#define RUN_OK 0  /* `ok`: The program ran to the end. */
+#define RUN_ERR 1  /* `error`: The program failed. */
+#define RUN_BUDGET 2  /* `budget`: The instruction budget was used up. */
+#define RUN_TIMEOUT 3  /* `timeout`: The run took too long. */
+#define RUN_UNKNOWN 4  /* `unknown`: There's no program with the ID. */
+#define RUN_BAD 5  /* `bad`: The request is malformed. */
+
+typedef struct {
+  const char* id;  /* Name clients use for the program. */
+  ProgramImage* prog;  /* Loaded completely (not lazily or pipelined). */
+} ServeProg;
+
+typedef struct Server Server;
+
+/* Listen on a new socket at `path`. A stale socket left there by
+ * an earlier server is replaced. `progs` must outlive the server.
+ * Up to `njobs` connections are served at the same time. Runs may
+ * only open files in the directory `files_dir` (see `HostFiles`),
+ * or none at all if it's `NULL`. Returns `NULL` and prints an error
+ * if the socket can't be set up. */
+Server* new_server(const char* path, const ServeProg* progs,
+                   unsigned int nprogs, unsigned int njobs,
+                   const char* files_dir);
+
+/* Serve connections until `stop_server` is called. */
+void run_server(Server* srv);
+
+/* Make `run_server` return. Connections being served are closed
+ * and runs in progress are stopped. It may be called from any
+ * thread. */
+void stop_server(Server* srv);
+
+/* Close the socket and remove it. */
+void del_server(Server* srv);
+
+typedef struct {
+  const char* id;
+  uint64_t budget;
+  unsigned int timeout_ms;
+  const char* in;  /* Input of the run. */
+  size_t in_len;
+} RunRequest;
+
+typedef struct {
+  int status;  /* One of `RUN_*`. */
+  char* out;  /* Output of the run. */
+  size_t out_len;
+  char* err;  /* Error messages of the run. */
+  size_t err_len;
+} RunResult;
+
+/* Connect to the server at `path`. Returns the
+ * socket or `-1` if no server is listening there. */
+int connect_server(const char* path);
+
+/* Send `req` over the connection `fd` and wait for the result.
+ * Returns `0` and prints an error if the connection failed.
+ * Free `res` with `del_result`. */
+int request_run(int fd, const RunRequest* req, RunResult* res);
+
+void del_result(RunResult* res);
+
+#endif  // _SERVE_H_
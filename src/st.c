@@ -1,6 +1,5 @@
 #include "st.h"
 
-#include <math.h>
 #include <string.h>
 
 const char* key_type_name(SymKeyType type) {
@@ -13,32 +12,46 @@ const char* key_type_name(SymKeyType type) {
 
 SymbolTable new_st(void) {
   SymbolTable st = {
-    .len = ST_BLOCK_SIZE + 1,  // Adding `1` is required so that
-    .used = 0,                 // `len` is a multiple of two in `delim_hash`.
-    .offset = 0,               // Offset must only be set to a non-zero if
-                               // `offset` other instructions were put infront
-                               // of the instructions this symbol table points to.
+    .len = ST_INIT_LEN,
+    .used = 0,
+    .offset = 0,  // Offset must only be set to a non-zero if
+                  // `offset` other instructions were put infront
+                  // of the instructions this symbol table points to.
+    .arena = NULL,
   };
-  st.cell = (Symbol*) calloc (sizeof(Symbol), st.len);
+  st.cell = (Symbol*) calloc (st.len, sizeof(Symbol));
   assert(st.cell != NULL);
   return st;
 }
 
+SymbolTable new_arena_st(Arena* arena) {
+  assert(arena != NULL);
+
+  SymbolTable st = {
+    .len = ST_INIT_LEN,
+    .used = 0,
+    .offset = 0,  // See `new_st`.
+    .arena = arena,
+  };
+  // Arena memory is already zeroed.
+  st.cell = (Symbol*) arena_alloc(arena, st.len * sizeof(Symbol));
+  return st;
+}
+
 void del_st(SymbolTable st) {
-  free(st.cell);
+  if (st.arena == NULL)
+    free(st.cell);
 }
 
-SymKey mk_key(const char* ident, SymKeyType type) {
-  SymKey key = { .type = type };
-  strncpy(key.ident, ident, MAX_IDENT_LEN);
-  key.ident[strlen(ident)] = '\0';
-  return key;
+SymKey mk_key(SymId ident, SymKeyType type) {
+  return (SymKey) { .type = type, .ident = ident };
 }
 
 SymVal mk_lbval(size_t inst_addr) {
   return (SymVal) {
     .inst_addr = inst_addr,
     .nlocals = 0,
+    .fi = 0,
   };
 }
 
@@ -46,6 +59,7 @@ SymVal mk_fnval(size_t inst_addr, uint16_t nlocals) {
   return (SymVal) {
     .inst_addr = inst_addr,
     .nlocals = nlocals,
+    .fi = 0,
   };
 }
 
@@ -53,39 +67,98 @@ static inline int keys_are_eq(const SymKey* a, const SymKey* b) {
   if (a == NULL || b == NULL)
     return 0;
 
-  return (strcmp(a->ident, b->ident) == 0) &&
-         (a->type == b->type);
+  return a->ident == b->ident && a->type == b->type;
 }
 
 static inline int vals_are_eq(const SymVal* a, const SymVal* b) {
   if (a == NULL || b == NULL)
     return 0;
 
-  return a->inst_addr == b->inst_addr && a->nlocals == b->nlocals;
+  return a->inst_addr == b->inst_addr && a->nlocals == b->nlocals && a->fi == b->fi;
 }
 
-static inline unsigned long djb2hash_key(const SymKey* key) {
+static inline uint32_t hash_key(const SymKey* key) {
   assert(key != NULL);
 
-  const char* identp = key->ident;
+  // IDs are dense small integers. Mix them (and the
+  // type) so that the low bits used as the index are
+  // spread over the whole table (murmur3 finalizer).
+  uint32_t h = key->ident * 4 + (uint32_t) key->type;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+// Distance of the entry with `hash` at `idx` from its home slot.
+static inline size_t probe_dist(uint32_t hash, size_t idx, size_t len) {
+  return (idx - (hash & (len - 1))) & (len - 1);
+}
+
+/* Put `sym` into `cell`, which mustn't contain its key yet
+ * and must have a free entry. Entries further from home
+ * take the places of those that are closer. */
+static void place_sym(Symbol* cell, size_t len, Symbol sym) {
+  size_t idx = sym.hash & (len - 1);
+  size_t dist = 0;
+
+  while (cell[idx].key.type != SBT_UNUSED) {
+    size_t cur_dist = probe_dist(cell[idx].hash, idx, len);
+    if (cur_dist < dist) {
+      Symbol tmp = cell[idx];
+      cell[idx] = sym;
+      sym = tmp;
+      dist = cur_dist;
+    }
+    idx = (idx + 1) & (len - 1);
+    dist++;
+  }
 
-  unsigned long hash = 5381;
-  int c;
+  cell[idx] = sym;
+}
 
-  while ((c = *identp++))
-    hash = ((hash << 5) + hash) + c;  // hash * 33 + c
+/* Double the size of the table and rehash all entries. */
+static void grow_st(SymbolTable* st) {
+  size_t len = st->len * 2;
+  Symbol* cell;
+  if (st->arena != NULL) {
+    cell = (Symbol*) arena_alloc(st->arena, len * sizeof(Symbol));
+  } else {
+    cell = (Symbol*) calloc (len, sizeof(Symbol));
+    assert(cell != NULL);
+  }
 
-  // Treat `type` as another character.
-  hash = ((hash << 5) + hash) + (int) key->type;
+  for (size_t i = 0; i < st->len; i++) {
+    if (st->cell[i].key.type != SBT_UNUSED)
+      place_sym(cell, len, st->cell[i]);
+  }
 
-  return hash;
+  // Arena memory is released with the arena.
+  if (st->arena == NULL)
+    free(st->cell);
+  st->cell = cell;
+  st->len = len;
 }
 
-// Returns an index in the interval [0;len].
-// `len` must be a power of two.
-static inline size_t delim_hash(unsigned long hash, size_t len) {
-  // 2^64 / 𝜙 ≈ 11400714819323198485 (closest approximation which is not a multiple of 2)
-  return (hash * 11400714819323198485llu) >> (64 - ((int)log2(len) - 1));  
+/* Return the entry of `key` or `NULL` if there is none. */
+static inline Symbol* find_sym(const SymbolTable* st, const SymKey* key, uint32_t hash) {
+  size_t idx = hash & (st->len - 1);
+  size_t dist = 0;
+
+  while (st->cell[idx].key.type != SBT_UNUSED) {
+    Symbol* sym = &st->cell[idx];
+    if (sym->hash == hash && keys_are_eq(&sym->key, key))
+      return sym;
+    // Robin Hood: `key` would have taken this entry's place.
+    if (probe_dist(sym->hash, idx, st->len) < dist)
+      return NULL;
+    idx = (idx + 1) & (st->len - 1);
+    dist++;
+  }
+
+  return NULL;
 }
 
 InsertResult insert_st(
@@ -94,91 +167,46 @@ InsertResult insert_st(
   SymVal val
 ) {
   assert(st != NULL);
+  assert(key.type != SBT_UNUSED);
 
-  if (st->used >= st->len) {
-    // Realloc `cell` if the symbol table is full.
-    st->len += ST_BLOCK_SIZE;
-    st->cell = (Symbol*) realloc (st->cell, st->len * sizeof(Symbol));
-    memset(st->cell + st->len - ST_BLOCK_SIZE, 0, ST_BLOCK_SIZE * sizeof(Symbol));
-  }
-
-  unsigned long hash = djb2hash_key(&key);
-  size_t idx = delim_hash(hash, st->len - 1);
-
-  // Use linear probing to find an unused entry in `cell`.
-  size_t sd_len = idx;
-
-  // Check entries [idx;len - 1]
-  while (idx < st->len && st->cell[idx].key.type != SBT_UNUSED) {
-    // Does a symbol with the same ident and type exist?
-    if (keys_are_eq(&st->cell[idx].key, &key)) {
-      // Does this symbol have the same content we want to enter?
-      if (vals_are_eq(&st->cell[idx].val, &val)) {
-        break;  // Yes, do nothing. The content exists.
-      } else {
-        return INRES_EXISTS;  // No, bad. There is different data for the same key.
-      }
-    } else {
-      idx ++;
-    }
-  }
+  uint32_t hash = hash_key(&key);
 
-  // Check entries [0;idx - 1]
-  if (idx >= st->len) {
-    idx = 0;
-    while (idx < sd_len && st->cell[idx].key.type != SBT_UNUSED) {
-      // Does a symbol with the same ident and type exist?
-      if (keys_are_eq(&st->cell[idx].key, &key)) {
-        // Does this symbol have the same content we want to enter?
-        if (vals_are_eq(&st->cell[idx].val, &val)) {
-          break;  // Yes, do nothing. The content exists.
-        } else {
-          return INRES_EXISTS;  // No, bad. There is different data for the same key.
-        }
-      } else {
-        idx ++;
-      }
-    }
+  Symbol* sym = find_sym(st, &key, hash);
+  if (sym != NULL) {
+    // Does this symbol have the same content we want to enter?
+    return vals_are_eq(&sym->val, &val)
+      ? INRES_OK  // Yes, do nothing. The content exists.
+      : INRES_EXISTS;  // No, bad. There is different data for the same key.
   }
 
-  /* This condition must always be true, because `insert_st`
-   * allocated enough memory for the symbol table to have
-   * at least a single free entry during the insertion.
-   * The above two loops must find this entry, since they
-   * check each entry in the cell.
-   */
-  assert(st->cell[idx].key.type == SBT_UNUSED);
-
-  memcpy(&st->cell[idx].key, &key, sizeof(SymKey));
-  memcpy(&st->cell[idx].val, &val, sizeof(SymVal));
+  if ((st->used + 1) * 100 > st->len * ST_MAX_LOAD)
+    grow_st(st);
 
+  place_sym(st->cell, st->len, (Symbol) { .key=key, .val=val, .hash=hash });
   st->used ++;
 
   return INRES_OK;
 }
 
+void set_st(SymbolTable* st, SymKey key, SymVal val) {
+  assert(st != NULL);
+
+  Symbol* sym = find_sym(st, &key, hash_key(&key));
+  if (sym != NULL)
+    sym->val = val;
+  else
+    insert_st(st, key, val);
+}
+
 GetResult get_st(SymbolTable st, const SymKey* key, SymVal* val) {
   assert(key != NULL);
   assert(val != NULL);
 
-  unsigned long hash = djb2hash_key(key);
-  size_t idx = delim_hash(hash, st.len - 1);
-  size_t sd_len = idx;
-
-  while (idx < st.len && !keys_are_eq(&st.cell[idx].key, key))
-    idx ++;
-
-  if (idx == st.len) {
-    idx = 0;
-    while (idx < sd_len && !keys_are_eq(&st.cell[idx].key, key))
-      idx ++;
-
-    if (idx == sd_len)
-    // Every index was checked and none contains the given key.
-      return GTRES_ERR;
-  }
+  Symbol* sym = find_sym(&st, key, hash_key(key));
+  if (sym == NULL)
+    return GTRES_ERR;
 
-  *val = st.cell[idx].val;
+  *val = sym->val;
   // Offset the retrieved address.
   val->inst_addr += st.offset;
   return GTRES_OK;
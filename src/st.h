@@ -7,6 +7,8 @@
 #include <assert.h>
 
 #include "scan.h"
+#include "arena.h"
+#include "intern.h"
 
 typedef enum {
     SBT_UNUSED = 0,
@@ -16,7 +18,7 @@ typedef enum {
 
 typedef struct {
   SymKeyType type;
-  char ident[MAX_IDENT_LEN + 1];
+  SymId ident;
 } SymKey;
 
 /* Return the name of the given key type. */
@@ -26,40 +28,54 @@ typedef struct {
   // Instruction address in `Insts`.
   size_t inst_addr;
   uint16_t nlocals;  // Used only in functions.
+  unsigned int fi;  // Index of the defining file. Used only in
+                    // the program's index of all functions.
 } SymVal;
 
 typedef struct {
   SymKey key;
   SymVal val;
+  uint32_t hash;  // Cached hash of `key`.
 } Symbol;
 
-// Open-addressed symbol table.
+/* Open-addressed symbol table with Robin Hood probing. Every
+ * entry is at most as far from its home slot as the entries
+ * before it, so a lookup stops as soon as it passes an entry
+ * closer to home than it is. */
 typedef struct {
   Symbol* cell;
-  size_t len;  // Number of entries in `cell`.
+  size_t len;  // Number of entries in `cell`. Always a power of two.
   size_t used;  // Number of used entries.
   size_t num_inst;  // Number of next instruction.
   size_t offset;  // Address offset for retrieval.
+  Arena* arena;  // Owner of `cell` or `NULL` if it's on the heap.
 } SymbolTable;
 
-# ifndef ST_BLOCK_SIZE
+# ifndef ST_INIT_LEN
+// Initial number of entries. Must be a power of two.
 #   ifdef UNIT_TESTS
-// Make `ST_BLOCK_SIZE` so small that allocation
-// edge cases will be tested. It can't be smaller
-// than four, however, because this breaks the
-// function to delimit the hashes.
-#     define ST_BLOCK_SIZE 4
+// Make `ST_INIT_LEN` so small that growing
+// the table will be tested.
+#     define ST_INIT_LEN 4
 #   else
-#     define ST_BLOCK_SIZE 0x1000
+#     define ST_INIT_LEN 0x40
 #   endif  // UNIT_TESTS
-# endif  // ST_BLOCK_SIZE
+# endif  // ST_INIT_LEN
+
+// The table grows (to twice its size) before
+// more than `ST_MAX_LOAD` percent of it are used.
+# define ST_MAX_LOAD 75
 
 SymbolTable new_st(void);
 
+// Symbol table whose memory is owned by `arena`.
+SymbolTable new_arena_st(Arena* arena);
+
+// Does nothing if the table lives in an arena.
 void del_st(SymbolTable st);
 
 // Instantiate keys and values.
-SymKey mk_key(const char* ident, SymKeyType type);
+SymKey mk_key(SymId ident, SymKeyType type);
 SymVal mk_lbval(size_t inst_addr);
 SymVal mk_fnval(size_t inst_addr, uint16_t nlocals);
 
@@ -74,6 +90,9 @@ InsertResult insert_st(
   SymVal val
 );
 
+// Insert `key` or overwrite its value if it exists.
+void set_st(SymbolTable* st, SymKey key, SymVal val);
+
 typedef enum {
   GTRES_ERR = 0,
   GTRES_OK = 1,
@@ -0,0 +1,75 @@
+#define MUNIT_ENABLE_ASSERT_ALIASES
+#include "munit.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../src/arena.h"
+#include "utils.h"
+
+TEST(alloc_is_zeroed_and_aligned) {
+  Arena arena = new_arena();
+  for (size_t size = 1; size < 3 * ARENA_BLOCK_SIZE; size += 37) {
+    unsigned char* p = (unsigned char*) arena_alloc(&arena, size);
+    assert_ptr_not_null(p);
+    assert_int((uintptr_t) p % _Alignof(max_align_t), ==, 0);
+    for (size_t i = 0; i < size; i++)
+      assert_int(p[i], ==, 0);
+    memset(p, 0xAB, size);
+  }
+  del_arena(arena);
+
+  return MUNIT_OK;
+}
+
+TEST(grow_last_alloc_in_place) {
+  Arena arena = new_arena();
+  char* a = (char*) arena_alloc(&arena, 16);
+  char* b = (char*) arena_grow(&arena, a, 16, 64);
+  assert_ptr_equal(a, b);
+  /* Shrinking hands the tail back and the
+   * next allocation reuses zeroed memory. */
+  memset(b, 0xCD, 64);
+  b = (char*) arena_grow(&arena, b, 64, 16);
+  assert_ptr_equal(a, b);
+  char* c = (char*) arena_alloc(&arena, 48);
+  assert_ptr_equal(c, a + 16);
+  for (size_t i = 0; i < 48; i++)
+    assert_int(c[i], ==, 0);
+  del_arena(arena);
+
+  return MUNIT_OK;
+}
+
+TEST(grow_older_alloc_copies) {
+  Arena arena = new_arena();
+  char* a = (char*) arena_alloc(&arena, 16);
+  strcpy(a, "arena");
+  arena_alloc(&arena, 16);
+  char* b = (char*) arena_grow(&arena, a, 16, 4 * ARENA_BLOCK_SIZE);
+  assert_ptr_not_equal(a, b);
+  assert_string_equal(b, "arena");
+  assert_int(b[4 * ARENA_BLOCK_SIZE - 1], ==, 0);
+  del_arena(arena);
+
+  return MUNIT_OK;
+}
+
+TEST(strdup_copies) {
+  Arena arena = new_arena();
+  const char* s = "/tmp/some/file.vm";
+  char* copy = arena_strdup(&arena, s);
+  assert_ptr_not_equal(copy, s);
+  assert_string_equal(copy, s);
+  del_arena(arena);
+
+  return MUNIT_OK;
+}
+
+MunitTest arena_tests[] = {
+  REG_TEST(alloc_is_zeroed_and_aligned),
+  REG_TEST(grow_last_alloc_in_place),
+  REG_TEST(grow_older_alloc_copies),
+  REG_TEST(strdup_copies),
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,178 @@
+#define MUNIT_ENABLE_ASSERT_ALIASES
+#include "munit.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/batch.h"
+#include "utils.h"
+
+/* Write `cnt` to `dir/name`. */
+static void write_case(const char* dir, const char* name, const char* cnt) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE* f = fopen(path, "w");
+  assert_ptr_not_null(f);
+  fputs(cnt, f);
+  fclose(f);
+}
+
+/* Check that `dir/name` contains `expect`. */
+static void check_case(const char* dir, const char* name, const char* expect) {
+  char path[64];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE* f = fopen(path, "r");
+  assert_ptr_not_null(f);
+  char buf[256] = {0};
+  size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  assert_ptr_not_null(strstr(buf, expect));
+  assert_size(len, >=, strlen(expect));
+  unlink(path);
+}
+
+TEST(batch_runs_each_input) {
+  /* Adds the input to a static, which is `0` at the start of each run. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "call Sys.read_num 0\n"
+    "push static 0\n"
+    "add\n"
+    "pop static 0\n"
+    "push static 0\n"
+    "call Sys.print_num 1\n"
+    "return\n");
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+
+  char in_dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(in_dir));
+  char out_dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(out_dir));
+  const char* names[] = { "a", "b", "c", "d", "e" };
+  write_case(in_dir, "a", "1\n");
+  write_case(in_dir, "b", "22\n");
+  write_case(in_dir, "c", "333\n");
+  write_case(in_dir, "d", "4444\n");
+  write_case(in_dir, "e", "oops\n");
+  /* Hidden files aren't inputs. */
+  write_case(in_dir, ".hidden", "5\n");
+
+  BatchOpts opts = { .in_dir=in_dir, .out_dir=out_dir, .njobs=3 };
+  assert_int(run_batch(prog, opts), ==, 1);
+
+  check_case(out_dir, "a.out", "1");
+  check_case(out_dir, "b.out", "22");
+  check_case(out_dir, "c.out", "333");
+  check_case(out_dir, "d.out", "4444");
+  check_case(out_dir, "e.out", "");
+  check_case(out_dir, "e.err", "only accepts digits");
+  /* Only failed runs have errors. */
+  char path[64];
+  snprintf(path, sizeof(path), "%s/a.err", out_dir);
+  assert_int(access(path, F_OK), ==, -1);
+
+  /* Without failing inputs, the batch succeeds. */
+  snprintf(path, sizeof(path), "%s/e", in_dir);
+  unlink(path);
+  assert_int(run_batch(prog, opts), ==, 0);
+  for (int i = 0; i < 4; i++) {
+    snprintf(path, sizeof(path), "%s.out", names[i]);
+    check_case(out_dir, path, "");
+  }
+
+  for (int i = 0; i < 4; i++) {
+    snprintf(path, sizeof(path), "%s/%s", in_dir, names[i]);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/.hidden", in_dir);
+  unlink(path);
+
+  /* Empty directories have no inputs. */
+  assert_int(run_batch(prog, opts), ==, 1);
+  assert_int(check_stream("doesn't contain any inputs", 512, stderr), ==, 1);
+  del_prog(prog);
+
+  rmdir(in_dir);
+  rmdir(out_dir);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+TEST(batch_runs_only_open_allowed_files) {
+  /* Opens the file named in the first line of the input
+   * in the mode in the second line and prints the handle. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "push constant 100\n"
+    "call Sys.read_str 1\n"
+    "pop temp 0\n"
+    "call Sys.read_num 0\n"
+    "pop temp 1\n"
+    "push temp 0\n"
+    "push constant 100\n"
+    "push temp 1\n"
+    "call Sys.file_open 3\n"
+    "call Sys.print_num 1\n"
+    "return\n");
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+
+  char in_dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(in_dir));
+  char out_dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(out_dir));
+  char files_dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(files_dir));
+  write_case(in_dir, "a", "/etc/passwd\n0\n");
+  write_case(in_dir, "b", "../escaped\n1\n");
+  write_case(in_dir, "c", "inside\n1\n");
+
+  /* `-1` (65535) is the handle of files that can't be opened. */
+  BatchOpts opts = {
+    .in_dir=in_dir, .out_dir=out_dir, .njobs=2, .files_dir=files_dir,
+  };
+  assert_int(run_batch(prog, opts), ==, 0);
+  check_case(out_dir, "a.out", "65535");
+  check_case(out_dir, "b.out", "65535");
+  check_case(out_dir, "c.out", "0\n");
+  char path[64];
+  snprintf(path, sizeof(path), "%s/../escaped", files_dir);
+  assert_int(access(path, F_OK), ==, -1);
+  snprintf(path, sizeof(path), "%s/inside", files_dir);
+  assert_int(access(path, F_OK), ==, 0);
+  unlink(path);
+
+  /* Without a directory, no files can be opened at all. */
+  opts.files_dir = NULL;
+  assert_int(run_batch(prog, opts), ==, 0);
+  check_case(out_dir, "a.out", "65535");
+  check_case(out_dir, "b.out", "65535");
+  check_case(out_dir, "c.out", "65535");
+  assert_int(access("inside", F_OK), ==, -1);
+
+  const char* names[] = { "a", "b", "c" };
+  for (int i = 0; i < 3; i++) {
+    snprintf(path, sizeof(path), "%s/%s", in_dir, names[i]);
+    unlink(path);
+  }
+  del_prog(prog);
+  rmdir(in_dir);
+  rmdir(out_dir);
+  rmdir(files_dir);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+MunitTest batch_tests[] = {
+  REG_TEST(batch_runs_each_input),
+  REG_TEST(batch_runs_only_open_allowed_files),
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
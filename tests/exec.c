@@ -7,37 +7,38 @@
 
 #include <stdio.h>
 #include <string.h>
-
-/* From `src/prog.c`. */
-extern Memory new_mem(void);
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #define TEST_PROG_NAME "test_internal"
 
-static Program* setup_prog(Inst* arr, size_t len) {
-  File* file = (File*) calloc (1, sizeof(File));
-  file->filename =
-    (char*) calloc (strlen(TEST_PROG_NAME) + 1, sizeof(char));
-  assert(file->filename != NULL);
-  strcpy(file->filename, TEST_PROG_NAME);
-  file->st = new_st();
-  file->insts = new_insts(TEST_PROG_NAME);
-  file->insts.cell =
-    (Inst*) realloc (file->insts.cell, len * sizeof(Inst));
+static VmState* setup_vm(Inst* arr, size_t len) {
+  ProgramImage* prog = (ProgramImage*) calloc (1, sizeof(ProgramImage));
+  assert(prog != NULL);
+  prog->arena = new_arena();
+
+  File* file = (File*) arena_alloc(&prog->arena, sizeof(File));
+  file->filename = arena_strdup(&prog->arena, TEST_PROG_NAME);
+  file->st = new_arena_st(&prog->arena);
+  file->insts = new_arena_insts(&prog->arena, file->filename);
+  reserve_insts(&file->insts, len);
   memcpy(file->insts.cell, arr, len * sizeof(Inst));
-  file->insts.len = len;
   file->insts.idx = len;
-  file->mem = new_mem();
   file->ei = 0;
 
-  Program* prog = (Program*) calloc (1, sizeof(Program));
-  assert(prog != NULL);
   prog->files = file;
   prog->nfiles = 1;
-  prog->fi = 0;
-  prog->heap = new_heap();
-  prog->stack = new_stack();
+  prog->funcs = new_arena_st(&prog->arena);
 
-  return prog;
+  return new_vm(prog);
+}
+
+/* Delete `vm` and its program. */
+static void teardown_vm(VmState* vm) {
+  ProgramImage* prog = vm->prog;
+  del_vm(vm);
+  del_prog(prog);
 }
 
 TEST(correct_stack_errors) {
@@ -45,11 +46,13 @@ TEST(correct_stack_errors) {
     Inst inst_arr[] = {
       {.code=POP, .mem={.seg=TMP, .offset=0}},
     };
-    Program* prog = setup_prog(inst_arr, 1);
-    int res = exec_prog(prog);
-    del_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 1);
+    int res = exec_prog(vm);
+    teardown_vm(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(check_stream("stack underflow", 30, stderr), ==, 1);
+    assert_int(check_stream("stack underflow", 64, stderr), ==, 1);
+    /* Errors name the file that's running. */
+    assert_int(check_stream("(" TEST_PROG_NAME ":1:1)", 64, stderr), ==, 1);
   }
 
   return MUNIT_OK;
@@ -60,11 +63,11 @@ TEST(correct_memory_errors) {
     Inst inst_arr[] = {
       { .code=PUSH, .mem={ .seg=PTR, .offset=2 }},
     };
-    Program* prog = setup_prog(inst_arr, 1);
-    int res = exec_prog(prog);
-    del_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 1);
+    int res = exec_prog(vm);
+    teardown_vm(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(check_stream("can't access pointer segment at `2` (max. index is 1)", 30, stderr), ==, 1);
+    assert_int(check_stream("can't access pointer segment at `2` (max. index is 1)", 64, stderr), ==, 1);
   }
   {  // Raise error if combined address exceeds bounds
     Inst inst_arr[] = {
@@ -73,12 +76,12 @@ TEST(correct_memory_errors) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},  // Push another value on stack.
       { .code=POP, .mem={ .seg=THIS, .offset=1 }},  // Pop this value to address 0xFFFF + 1 -> overflow
     };
-    Program* prog = setup_prog(inst_arr, 4);
-    int res = exec_prog(prog);
-    del_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 4);
+    int res = exec_prog(vm);
+    teardown_vm(vm);
     assert_int(res, ==, EXEC_ERR);
     assert_int(check_stream("address overflow: "
-      "`pop this 1` tries to access heap at 65536", 30, stderr), ==, 1);
+      "`pop this 1` tries to access heap at 65536", 64, stderr), ==, 1);
   }
 
   return MUNIT_OK;
@@ -91,11 +94,11 @@ TEST(arithmetic_errors) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
       { .code=ADD },
     };
-    Program* prog = setup_prog(inst_arr, 3);
-    int res = exec_prog(prog);
-    del_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 3);
+    int res = exec_prog(vm);
+    teardown_vm(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(check_stream("addition overflow: 65535 + 1 = 65536 > 65535", 30, stderr), ==, 1);
+    assert_int(check_stream("addition overflow: 65535 + 1 = 65536 > 65535", 64, stderr), ==, 1);
   }
   {
     Inst inst_arr[] = {
@@ -103,11 +106,11 @@ TEST(arithmetic_errors) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
       { .code=SUB },
     };
-    Program* prog = setup_prog(inst_arr, 3);
-    int res = exec_prog(prog);
-    del_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 3);
+    int res = exec_prog(vm);
+    teardown_vm(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(check_stream("subtraction underflow: 0 - 1 = -1 < 0", 30, stderr), ==, 1);
+    assert_int(check_stream("subtraction underflow: 0 - 1 = -1 < 0", 64, stderr), ==, 1);
   }
 
   return MUNIT_OK;
@@ -125,11 +128,11 @@ TEST(arithmetic_instructions) {
     { .code=PUSH, .mem={ .seg=CONST, .offset=2 }},
     { .code=ADD },
   };
-  Program* prog = setup_prog(inst_arr, 9);
-  int res = exec_prog(prog);
+  VmState* vm = setup_vm(inst_arr, 9);
+  int res = exec_prog(vm);
   assert_int(res, ==, 0);
-  assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 3);
-  del_prog(prog);
+  assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 3);
+  teardown_vm(vm);
   return MUNIT_OK;
 }
 
@@ -146,20 +149,20 @@ TEST(stack_buildup_works) {
     { .code=POP, .mem={ .seg=CONST, .offset=0 }},
     { .code=ADD },
   };
-  Program* prog = setup_prog(inst_arr1, 9);
-  int res = exec_prog(prog);
+  VmState* vm = setup_vm(inst_arr1, 9);
+  int res = exec_prog(vm);
   assert_int(res, ==, 0);
-  // `prog->stack.len` might be the usual 4096
+  // `vm->stack.len` might be the usual 4096
   // if parts of the binary were compiled without
   // `UNIT_TEST` defined.
-  if (prog->stack.len != 2) {
+  if (vm->stack.len != 2) {
     printf("Stack buffer length isn't 2. "
       "Run again with `make clean test`");
   }
-  assert_int(prog->stack.sp, ==, 1);
-  assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 18);
+  assert_int(vm->stack.sp, ==, 1);
+  assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 18);
 
-  del_prog(prog);
+  teardown_vm(vm);
 
   return MUNIT_OK;
 }
@@ -173,12 +176,12 @@ TEST(stack_doesnt_change_on_error) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=9 }},
       { .code=ADD },
     };
-    Program* prog = setup_prog(inst_arr, 3);
-    int res = exec_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 3);
+    int res = exec_prog(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 9);
-    assert_int(prog->stack.ops[prog->stack.sp - 2], ==, 65535);
-    del_prog(prog);
+    assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 9);
+    assert_int(vm->stack.ops[vm->stack.sp - 2], ==, 65535);
+    teardown_vm(vm);
   } {
     // Stack should not change if a pop's
     // address would have overflowed.
@@ -188,12 +191,12 @@ TEST(stack_doesnt_change_on_error) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
       { .code=POP, .mem={ .seg=THIS, .offset=1 }},
     };
-    Program* prog = setup_prog(inst_arr, 4);
-    int res = exec_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 4);
+    int res = exec_prog(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(prog->stack.sp, ==, 1);
-    assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 1);
-    del_prog(prog);
+    assert_int(vm->stack.sp, ==, 1);
+    assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 1);
+    teardown_vm(vm);
   } {
     // Stack should not change if a push's
     // address would have overflowed.
@@ -203,12 +206,12 @@ TEST(stack_doesnt_change_on_error) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
       { .code=PUSH, .mem={ .seg=THIS, .offset=1 }},
     };
-    Program* prog = setup_prog(inst_arr, 4);
-    int res = exec_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 4);
+    int res = exec_prog(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(prog->stack.sp, ==, 1);
-    assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 1);
-    del_prog(prog);
+    assert_int(vm->stack.sp, ==, 1);
+    assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 1);
+    teardown_vm(vm);
   } {
     // Stack should not change if a pop
     // tried to access an invald pointer
@@ -217,12 +220,12 @@ TEST(stack_doesnt_change_on_error) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
       { .code=POP, .mem={ .seg=PTR, .offset=2 }},
     };
-    Program* prog = setup_prog(inst_arr, 2);
-    int res = exec_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 2);
+    int res = exec_prog(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(prog->stack.sp, ==, 1);
-    assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 1);
-    del_prog(prog);
+    assert_int(vm->stack.sp, ==, 1);
+    assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 1);
+    teardown_vm(vm);
   } {
     // The stack should not change if the
     // subtraction would have overflowed.
@@ -231,12 +234,326 @@ TEST(stack_doesnt_change_on_error) {
       { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
       { .code=SUB },
     };
-    Program* prog = setup_prog(inst_arr, 3);
-    int res = exec_prog(prog);
+    VmState* vm = setup_vm(inst_arr, 3);
+    int res = exec_prog(vm);
     assert_int(res, ==, EXEC_ERR);
-    assert_int(prog->stack.ops[prog->stack.sp - 1], ==, 1);
-    assert_int(prog->stack.ops[prog->stack.sp - 2], ==, 0);
-    del_prog(prog);
+    assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 1);
+    assert_int(vm->stack.ops[vm->stack.sp - 2], ==, 0);
+    teardown_vm(vm);
+  }
+
+  return MUNIT_OK;
+}
+
+TEST(bulk_memory_builtins) {
+  {  // Fill, copy and compare a range.
+    Inst inst_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=7 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=40 }},
+      { .code=BUILTIN_MEM_FILL },
+      { .code=PUSH, .mem={ .seg=CONST, .offset=200 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=40 }},
+      { .code=BUILTIN_MEM_COPY },
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=200 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=40 }},
+      { .code=BUILTIN_MEM_CMP },
+    };
+    VmState* vm = setup_vm(inst_arr, 12);
+    int res = exec_prog(vm);
+    assert_int(res, ==, 0);
+    for (Addr i = 0; i < 40; i++) {
+      assert_int(vm->heap.mem[100 + i], ==, 7);
+      assert_int(vm->heap.mem[200 + i], ==, 7);
+    }
+    assert_int(vm->heap.mem[99], ==, 0);
+    assert_int(vm->heap.mem[240], ==, 0);
+    assert_int(vm->stack.sp, ==, 1);
+    assert_int(vm->stack.ops[0], ==, 0);
+    /* Both ranges are tracked for resets. */
+    assert_int(vm->heap.dirty[0], ==, 0xe);
+
+    /* Differences past the first chunk are found. */
+    vm->heap.mem[233] = 8;
+    Inst cmp_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=200 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=40 }},
+      { .code=BUILTIN_MEM_CMP },
+      { .code=PUSH, .mem={ .seg=CONST, .offset=200 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=40 }},
+      { .code=BUILTIN_MEM_CMP },
+    };
+    memcpy(vm->prog->files[0].insts.cell, cmp_arr, sizeof(cmp_arr));
+    vm->prog->files[0].insts.idx = 8;
+    vm->ei = 0;
+    vm->stack.sp = 0;
+    res = exec_prog(vm);
+    assert_int(res, ==, 0);
+    assert_int(vm->stack.ops[0], ==, 0xFFFF);
+    assert_int(vm->stack.ops[1], ==, 1);
+
+    reset_vm(vm);
+    assert_int(vm->heap.mem[100], ==, 0);
+    assert_int(vm->heap.mem[233], ==, 0);
+    assert_int(vm->heap.dirty[0], ==, 0);
+    teardown_vm(vm);
+  }
+  {  // Ranges past the end of the heap are rejected.
+    Inst inst_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=MEM_HEAP_SIZE - 2 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=3 }},
+      { .code=BUILTIN_MEM_FILL },
+    };
+    VmState* vm = setup_vm(inst_arr, 4);
+    int res = exec_prog(vm);
+    assert_int(res, ==, EXEC_ERR);
+    assert_int(vm->heap.mem[MEM_HEAP_SIZE - 1], ==, 0);
+    teardown_vm(vm);
+    assert_int(check_stream("address overflow: "
+      "`<builtin mem fill>` tries to access heap at 4097", 64, stderr), ==, 1);
+  }
+
+  return MUNIT_OK;
+}
+
+TEST(print_str_checks_heap_range) {
+  Inst inst_arr[] = {
+    { .code=PUSH, .mem={ .seg=CONST, .offset=4 }},
+    { .code=PUSH, .mem={ .seg=CONST, .offset=MEM_HEAP_SIZE - 3 }},
+    { .code=BUILTIN_PRINT_STR },
+  };
+  VmState* vm = setup_vm(inst_arr, 3);
+  assert_int(exec_prog(vm), ==, EXEC_ERR);
+  teardown_vm(vm);
+  assert_int(check_stream("address overflow: "
+    "`<builtin print str>` tries to access heap at 4097", 64, stderr), ==, 1);
+
+  return MUNIT_OK;
+}
+
+/* Store `str` on the heap at `addr`, one character per word. */
+static void heap_str(VmState* vm, Addr addr, const char* str) {
+  for (size_t i = 0; str[i] != '\0'; i++)
+    vm->heap.mem[addr + i] = (Word) str[i];
+}
+
+TEST(file_builtins) {
+  char in_fn[] = "/tmp/XXXXXX";
+  setup_tmp(in_fn, "hello, world");
+  char out_fn[] = "/tmp/XXXXXX";
+  setup_tmp(out_fn, "old contents");
+  Word len = (Word) strlen(in_fn);
+
+  {  // Copy a block from one file to another.
+    Inst inst_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=len }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=BUILTIN_FILE_OPEN },
+      { .code=POP, .mem={ .seg=TMP, .offset=0 }},
+      { .code=PUSH, .mem={ .seg=TMP, .offset=0 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=200 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=BUILTIN_FILE_READ_BLOCK },
+      { .code=PUSH, .mem={ .seg=CONST, .offset=len }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=100 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
+      { .code=BUILTIN_FILE_OPEN },
+      { .code=POP, .mem={ .seg=TMP, .offset=1 }},
+      { .code=PUSH, .mem={ .seg=TMP, .offset=1 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=200 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=5 }},
+      { .code=BUILTIN_FILE_WRITE_BLOCK },
+      { .code=PUSH, .mem={ .seg=TMP, .offset=1 }},
+      { .code=BUILTIN_FILE_CLOSE },
+    };
+    VmState* vm = setup_vm(inst_arr, 20);
+    heap_str(vm, 0, in_fn);
+    heap_str(vm, 100, out_fn);
+    assert_int(exec_prog(vm), ==, 0);
+    /* Only the characters in the file are read. */
+    assert_int(vm->stack.sp, ==, 1);
+    assert_int(vm->stack.ops[0], ==, 12);
+    assert_int(vm->heap.mem[200], ==, 'h');
+    assert_int(vm->heap.mem[211], ==, 'd');
+    assert_int(vm->heap.mem[212], ==, 0);
+    /* Handles are reused once they're closed. */
+    assert_int(vm->mem[0].tmp[0], ==, 0);
+    assert_int(vm->mem[0].tmp[1], ==, 1);
+    assert_ptr_not_null(host_file(&vm->host, 0));
+    assert_ptr_equal(host_file(&vm->host, 1), NULL);
+    teardown_vm(vm);
+
+    FILE* f = fopen(out_fn, "r");
+    char buf[16] = {0};
+    assert_size(fread(buf, 1, sizeof(buf) - 1, f), ==, 5);
+    fclose(f);
+    assert_string_equal(buf, "hello");
+  }
+  {  // Files that can't be opened give -1.
+    Inst inst_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=len + 1 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=BUILTIN_FILE_OPEN },
+    };
+    VmState* vm = setup_vm(inst_arr, 4);
+    heap_str(vm, 0, in_fn);
+    vm->heap.mem[len] = 'x';
+    assert_int(exec_prog(vm), ==, 0);
+    assert_int(vm->stack.ops[0], ==, 0xFFFF);
+    teardown_vm(vm);
+  }
+  {  // Files are only written if they're open for writing.
+    Inst inst_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=len }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=BUILTIN_FILE_OPEN },
+      { .code=PUSH, .mem={ .seg=CONST, .offset=0 }},
+      { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
+      { .code=BUILTIN_FILE_WRITE_BLOCK },
+    };
+    VmState* vm = setup_vm(inst_arr, 7);
+    heap_str(vm, 0, in_fn);
+    assert_int(exec_prog(vm), ==, EXEC_ERR);
+    teardown_vm(vm);
+    assert_int(check_stream("the file with handle 0 isn't open for writing",
+      64, stderr), ==, 1);
+  }
+  {  // Unknown handles are errors.
+    Inst inst_arr[] = {
+      { .code=PUSH, .mem={ .seg=CONST, .offset=3 }},
+      { .code=BUILTIN_FILE_CLOSE },
+    };
+    VmState* vm = setup_vm(inst_arr, 2);
+    assert_int(exec_prog(vm), ==, EXEC_ERR);
+    teardown_vm(vm);
+    assert_int(check_stream("no file is open with handle 3", 64, stderr), ==, 1);
+  }
+
+  unlink(in_fn);
+  unlink(out_fn);
+
+  return MUNIT_OK;
+}
+
+#define NRUNNERS 4
+
+/* A program with its own input and output for `run_prog`. */
+typedef struct {
+  VmState* vm;
+  Input in;
+  Output* out;
+  MsgCapture errors;
+  int ret;
+} Runner;
+
+static void* run_prog(void* arg) {
+  Runner* r = (Runner*) arg;
+  r->vm->in = &r->in;
+  r->vm->out = r->out;
+  begin_capture(&r->errors);
+  r->ret = exec_prog(r->vm);
+  end_capture(&r->errors);
+  flush_out(r->out);
+  return NULL;
+}
+
+TEST(host_files_stay_beneath_root) {
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+  int root = open(dir, O_RDONLY | O_DIRECTORY);
+  assert_int(root, !=, -1);
+  char path[64];
+  snprintf(path, sizeof(path), "%s/link", dir);
+  assert_int(symlink("/etc", path), ==, 0);
+
+  HostFiles files = { .access=HOST_BENEATH, .root=root };
+  int handle = host_open(&files, "new.txt", HOST_WRITE);
+  assert_int(handle, !=, HOST_ERR);
+  assert_int(host_close(&files, (unsigned int) handle), ==, HOST_OK);
+  handle = host_open(&files, "new.txt", HOST_READ);
+  assert_int(handle, !=, HOST_ERR);
+  host_close_all(&files);
+  /* Nothing outside of the directory can be opened or created. */
+  assert_int(host_open(&files, "/etc/passwd", HOST_READ), ==, HOST_ERR);
+  assert_int(host_open(&files, "../outside.txt", HOST_WRITE), ==, HOST_ERR);
+  assert_int(host_open(&files, "link/passwd", HOST_READ), ==, HOST_ERR);
+  snprintf(path, sizeof(path), "%s/../outside.txt", dir);
+  assert_int(access(path, F_OK), ==, -1);
+
+  /* Without access, not even files in the directory are opened. */
+  files.access = HOST_NOWHERE;
+  snprintf(path, sizeof(path), "%s/new.txt", dir);
+  assert_int(host_open(&files, path, HOST_READ), ==, HOST_ERR);
+  files.access = HOST_ANYWHERE;
+  handle = host_open(&files, path, HOST_READ);
+  assert_int(handle, !=, HOST_ERR);
+  host_close_all(&files);
+
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/link", dir);
+  unlink(path);
+  close(root);
+  rmdir(dir);
+
+  return MUNIT_OK;
+}
+
+TEST(programs_run_on_threads) {
+  Inst inst_arr[] = {
+    { .code=BUILTIN_READ_NUM },
+    { .code=PUSH, .mem={ .seg=CONST, .offset=1 }},
+    { .code=ADD },
+    { .code=BUILTIN_PRINT_NUM },
+    { .code=PUSH, .mem={ .seg=CONST, .offset='\n' }},
+    { .code=BUILTIN_PRINT_CHAR },
+  };
+  const char* inputs[NRUNNERS] = { "1\n", "22\n", "oops\n", "333\n" };
+  const char* outputs[NRUNNERS] = { "2\n", "23\n", "", "334\n" };
+
+  Runner runners[NRUNNERS];
+  pthread_t threads[NRUNNERS];
+  char in_fns[NRUNNERS][12];
+  for (int i = 0; i < NRUNNERS; i++) {
+    strcpy(in_fns[i], "/tmp/XXXXXX");
+    setup_tmp(in_fns[i], inputs[i]);
+    runners[i].vm = setup_vm(inst_arr, 6);
+    runners[i].in = new_input(open(in_fns[i], O_RDONLY));
+    runners[i].out = new_output(tmpfile());
+    assert_int(pthread_create(&threads[i], NULL, run_prog, &runners[i]), ==, 0);
+  }
+
+  for (int i = 0; i < NRUNNERS; i++) {
+    Runner* r = &runners[i];
+    pthread_join(threads[i], NULL);
+    assert_int(r->ret, ==, i == 2 ? EXEC_ERR : 0);
+
+    /* Each program only sees its own input and output. */
+    FILE* out = r->out->stream;
+    char buf[16] = {0};
+    rewind(out);
+    assert_size(fread(buf, 1, sizeof(buf) - 1, out), ==, strlen(outputs[i]));
+    assert_string_equal(buf, outputs[i]);
+    if (i == 2) {
+      assert_ptr_not_null(strstr(r->errors.buf, "only accepts digits"));
+    } else {
+      assert_size(r->errors.len, ==, 0);
+    }
+
+    drop_capture(&r->errors);
+    del_output(r->out);
+    fclose(out);
+    close(r->in.fd);
+    del_input(&r->in);
+    teardown_vm(r->vm);
+    unlink(in_fns[i]);
   }
 
   return MUNIT_OK;
@@ -249,6 +566,11 @@ MunitTest exec_tests[] = {
   REG_TEST(arithmetic_instructions),
   REG_TEST(stack_doesnt_change_on_error),
   REG_TEST(stack_buildup_works),
+  REG_TEST(bulk_memory_builtins),
+  REG_TEST(print_str_checks_heap_range),
+  REG_TEST(file_builtins),
+  REG_TEST(host_files_stay_beneath_root),
+  REG_TEST(programs_run_on_threads),
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
@@ -0,0 +1,248 @@
+#define MUNIT_ENABLE_ASSERT_ALIASES
+#include "munit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/image.h"
+#include "../src/exec.h"
+#include "utils.h"
+
+// Overwrite the byte at `off` in the file `fn`.
+static void patch_byte(const char* fn, long off, unsigned char byte) {
+  FILE* f = fopen(fn, "r+b");
+  assert_ptr_not_null(f);
+  fseek(f, off, SEEK_SET);
+  fputc(byte, f);
+  fclose(f);
+}
+
+TEST(image_round_trip) {
+  char fn1[] = "/tmp/XXXXXX";
+  setup_tmp(fn1,
+    "function Sys.init 0\n"
+    "push constant 20\n"
+    "call Util.twice 1\n"
+    "return\n");
+  char fn2[] = "/tmp/XXXXXX";
+  setup_tmp(fn2,
+    "function Util.twice 1\n"
+    "push argument 0\n"
+    "pop local 0\n"
+    "goto done\n"
+    "push constant 0\n"
+    "label done\n"
+    "push local 0\n"
+    "push local 0\n"
+    "add\n"
+    "return\n");
+  const char* argv[] = { fn1, fn2 };
+  ProgramImage* src = make_prog(2, argv);
+  assert_ptr_not_null(src);
+
+  char img_fn[] = "/tmp/XXXXXX";
+  setup_tmp(img_fn, "");
+  assert_int(write_image(src, img_fn), ==, IMAGE_OK);
+  ProgramImage* img = load_image(img_fn);
+  assert_ptr_not_null(img);
+
+  assert_int(img->nfiles, ==, src->nfiles);
+  for (unsigned int fi = 0; fi < src->nfiles; fi++) {
+    const File* a = &src->files[fi];
+    const File* b = &img->files[fi];
+    assert_string_equal(b->filename, a->filename);
+    assert_int(b->ei, ==, a->ei);
+    assert_int(b->insts.idx, ==, a->insts.idx);
+    /* The instructions are run from the image itself. */
+    assert_true((const char*) b->insts.cell > (const char*) img->image);
+    assert_true((const char*) b->insts.cell < (const char*) img->image + img->image_size);
+    for (size_t i = 0; i < a->insts.idx; i++) {
+      const Inst* x = &a->insts.cell[i];
+      const Inst* y = &b->insts.cell[i];
+      assert_int(y->code, ==, x->code);
+      assert_int(y->nargs, ==, x->nargs);
+      assert_int(y->pos.ln, ==, x->pos.ln);
+      assert_int(y->pos.cl, ==, x->pos.cl);
+      assert_null(y->pos.filename);
+      if (x->code == GOTO || x->code == IF_GOTO || x->code == CALL) {
+        assert_string_equal(sym_name(img->syms, y->ident), sym_name(src->syms, x->ident));
+      } else {
+        assert_int(y->mem.seg, ==, x->mem.seg);
+        assert_int(y->mem.offset, ==, x->mem.offset);
+      }
+    }
+  }
+
+  SymVal val;
+  SymKey key = mk_key(intern_str(img->syms, "Util.twice"), SBT_FUNC);
+  assert_int(get_st(img->funcs, &key, &val), ==, GTRES_OK);
+  assert_int(val.fi, ==, 2);
+  assert_int(val.nlocals, ==, 1);
+  key = mk_key(intern_str(img->syms, "done"), SBT_LABEL);
+  assert_int(get_st(img->files[2].st, &key, &val), ==, GTRES_OK);
+
+  /* Running the image gives the same result. */
+  VmState* vm = new_vm(img);
+  assert_int(exec_prog(vm), ==, 0);
+  assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 40);
+  del_vm(vm);
+
+  del_prog(img);
+  del_prog(src);
+  unlink(img_fn);
+
+  return MUNIT_OK;
+}
+
+TEST(stale_images_are_rejected) {
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn, "function Sys.init 0\npush constant 1\nreturn\n");
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+
+  char img_fn[] = "/tmp/XXXXXX";
+  setup_tmp(img_fn, "");
+  assert_int(write_image(prog, img_fn), ==, IMAGE_OK);
+  del_prog(prog);
+
+  /* Any change after the header breaks the checksum. */
+  patch_byte(img_fn, 100, 0xff);
+  assert_ptr_equal(load_image(img_fn), NULL);
+  assert_int(check_stream("checksum mismatch", 512, stderr), ==, 1);
+
+  /* The version is the first word after the magic. */
+  patch_byte(img_fn, 4, IMAGE_VERSION + 1);
+  assert_ptr_equal(load_image(img_fn), NULL);
+  assert_int(check_stream("different version of hvme", 512, stderr), ==, 1);
+
+  /* Source files aren't images. */
+  assert_ptr_equal(load_image(fn), NULL);
+  assert_int(check_stream("is not an hvme image", 512, stderr), ==, 1);
+
+  unlink(img_fn);
+
+  return MUNIT_OK;
+}
+
+/* Write `size` bytes of `image` to `fn` after patching them with
+ * `patch` and check that the result is rejected. */
+static void check_corrupt(const char* fn, const unsigned char* image, size_t size,
+                          void (*patch)(unsigned char*)) {
+  unsigned char* buf = (unsigned char*) malloc(size);
+  assert_ptr_not_null(buf);
+  memcpy(buf, image, size);
+  patch(buf);
+  seal_image(buf, size);
+
+  FILE* f = fopen(fn, "wb");
+  assert_ptr_not_null(f);
+  assert_size(fwrite(buf, 1, size, f), ==, size);
+  fclose(f);
+  free(buf);
+
+  assert_null(load_image(fn));
+  assert_int(check_stream("is corrupt", 512, stderr), ==, 1);
+}
+
+/* The source file comes after the builtin ones. */
+static ImageFile* src_file(unsigned char* buf) {
+  ImageHeader* hdr = (ImageHeader*) buf;
+  ImageFile* files = (ImageFile*) (buf + sizeof(ImageHeader)
+    + (hdr->nnames + 1) * sizeof(ImageName));
+  return &files[hdr->nfiles - 1];
+}
+
+static Inst* first_inst(unsigned char* buf) {
+  return (Inst*) (buf + src_file(buf)->insts);
+}
+
+static void patch_sym_addr(unsigned char* buf) {
+  ImageFile* file = src_file(buf);
+  ((ImageSym*) (buf + file->syms))->inst_addr = file->ninsts + 1;
+}
+
+static void patch_code(unsigned char* buf) {
+  first_inst(buf)->code = (enum InstCode) 200;
+}
+
+static void patch_seg(unsigned char* buf) {
+  first_inst(buf)->mem.seg = (Segment) 99;
+}
+
+static void patch_ident(unsigned char* buf) {
+  ImageHeader* hdr = (ImageHeader*) buf;
+  Inst* inst = first_inst(buf);
+  inst[1].ident = hdr->nnames + 1;
+}
+
+static void patch_filename(unsigned char* buf) {
+  first_inst(buf)->pos.filename = (const char*) buf;
+}
+
+static void patch_dup_name(unsigned char* buf) {
+  ImageName* names = (ImageName*) (buf + sizeof(ImageHeader));
+  names[2] = names[1];
+}
+
+TEST(corrupt_images_are_rejected) {
+  /* The first instruction is a `push` and the second a `call`. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "push constant 1\n"
+    "call Sys.print_num 1\n"
+    "label end\n"
+    "return\n");
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+
+  char img_fn[] = "/tmp/XXXXXX";
+  setup_tmp(img_fn, "");
+  assert_int(write_image(prog, img_fn), ==, IMAGE_OK);
+  del_prog(prog);
+
+  FILE* f = fopen(img_fn, "rb");
+  assert_ptr_not_null(f);
+  fseek(f, 0, SEEK_END);
+  size_t size = (size_t) ftell(f);
+  rewind(f);
+  unsigned char* image = (unsigned char*) malloc(size);
+  assert_ptr_not_null(image);
+  assert_size(fread(image, 1, size, f), ==, size);
+  fclose(f);
+
+  assert_int(((ImageHeader*) image)->nnames, >=, 2);
+
+  /* Resealing the unchanged image gives a valid one. */
+  FILE* g = fopen(img_fn, "wb");
+  assert_ptr_not_null(g);
+  seal_image(image, size);
+  assert_size(fwrite(image, 1, size, g), ==, size);
+  fclose(g);
+  prog = load_image(img_fn);
+  assert_ptr_not_null(prog);
+  del_prog(prog);
+
+  check_corrupt(img_fn, image, size, patch_sym_addr);
+  check_corrupt(img_fn, image, size, patch_code);
+  check_corrupt(img_fn, image, size, patch_seg);
+  check_corrupt(img_fn, image, size, patch_ident);
+  check_corrupt(img_fn, image, size, patch_filename);
+  check_corrupt(img_fn, image, size, patch_dup_name);
+
+  free(image);
+  unlink(img_fn);
+
+  return MUNIT_OK;
+}
+
+MunitTest image_tests[] = {
+  REG_TEST(image_round_trip),
+  REG_TEST(stale_images_are_rejected),
+  REG_TEST(corrupt_images_are_rejected),
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
@@ -0,0 +1,104 @@
+#define MUNIT_ENABLE_ASSERT_ALIASES
+#include "munit.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/input.h"
+#include "utils.h"
+
+/* Input that reads `cnt` through a pipe. */
+static Input pipe_input(const char* cnt) {
+  int fds[2];
+  assert_int(pipe(fds), ==, 0);
+  size_t len = strlen(cnt);
+  assert_int(write(fds[1], cnt, len), ==, (ssize_t) len);
+  close(fds[1]);
+  return new_input(fds[0]);
+}
+
+/* Input that maps the file `fn` containing `cnt`. */
+static Input file_input(char* fn, const char* cnt) {
+  setup_tmp(fn, cnt);
+  int fd = open(fn, O_RDONLY);
+  assert_int(fd, !=, -1);
+  return new_input(fd);
+}
+
+static void close_input(Input* in) {
+  close(in->fd);
+  del_input(in);
+}
+
+/* The same reads work on both kinds of input. */
+static void check_reads(Input* in) {
+  unsigned int num;
+  assert_int(in_num(in, &num), ==, IN_OK);
+  assert_int(num, ==, 42);
+  /* The newline after the number is left unread. */
+  assert_int(in_char(in), ==, '\n');
+  assert_int(in_num(in, &num), ==, IN_OK);
+  assert_int(num, ==, 65536);
+  assert_int(in_num(in, &num), ==, IN_OK);
+  assert_int(num, ==, UINT_MAX);
+  assert_int(in_num(in, &num), ==, IN_NOT_NUM);
+  in_skip_line(in);
+
+  /* Lines are longer than the buffer used in tests. */
+  const char* line;
+  const char* expect = "a line that doesn't fit at once\n";
+  assert_int(in_line(in, &line), ==, (ssize_t) strlen(expect));
+  assert_memory_equal(strlen(expect), line, expect);
+  assert_int(in_line(in, &line), ==, 1);
+  assert_char(line[0], ==, '\n');
+  assert_int(in_char(in), ==, 0xe4);
+  assert_int(in_line(in, &line), ==, 4);
+  assert_memory_equal(4, line, "last");
+  assert_int(in_line(in, &line), ==, IN_EOF);
+  assert_int(in_char(in), ==, IN_EOF);
+  assert_int(in_num(in, &num), ==, IN_EOF);
+}
+
+#define READS_INPUT \
+  "  42\n+65536 99999999999\n" \
+  "x1 rest of the line\n" \
+  "a line that doesn't fit at once\n\n\xe4last"
+
+TEST(piped_input_is_read) {
+  Input in = pipe_input(READS_INPUT);
+  check_reads(&in);
+  close_input(&in);
+
+  return MUNIT_OK;
+}
+
+TEST(file_input_is_mapped) {
+  char fn[] = "/tmp/XXXXXX";
+  Input in = file_input(fn, READS_INPUT);
+  check_reads(&in);
+  assert_true(in.mapped);
+  close_input(&in);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+TEST(memory_input_is_read) {
+  const char cnt[] = READS_INPUT;
+  Input in = new_mem_input(cnt, sizeof(cnt) - 1);
+  check_reads(&in);
+  /* The bytes are read where they are. */
+  assert_true(in.buf == cnt);
+  del_input(&in);
+
+  return MUNIT_OK;
+}
+
+MunitTest input_tests[] = {
+  REG_TEST(piped_input_is_read),
+  REG_TEST(file_input_is_mapped),
+  REG_TEST(memory_input_is_read),
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
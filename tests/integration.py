@@ -2,6 +2,7 @@ from subprocess import Popen, PIPE, STDOUT, run
 import sys
 import os
 import re
+import tempfile
 
 # A single file in `examples/` is executed as a
 # single program. Any directories in `examples/`
@@ -15,6 +16,10 @@ if len(sys.argv) <= 1:
 COMMAND = sys.argv[1]
 BASE_PATH = 'examples/'
 
+# Keep the entries the runs add out of the user's cache.
+CACHE_DIR = tempfile.TemporaryDirectory()
+os.environ['XDG_CACHE_HOME'] = CACHE_DIR.name
+
 def run_test(files):
     line = ''
 
@@ -76,6 +81,9 @@ with os.scandir(BASE_PATH) as entries:
         if entry.is_file():
             run_test([entry.path])
         else:
-            with os.scandir(entry.path) as sub:
-                files = [s.path for s in sub]
-                run_test(files)
+            # hvme loads the `.vm` files in the directory itself.
+            result = os.path.join(entry.path, 'test_result.txt')
+            if not os.path.isfile(result):
+                print(f'You must place a `test_result.txt` file in each test directory.')
+                continue
+            run_test([entry.path, result])
@@ -2,11 +2,18 @@
 #define MUNIT_ENABLE_ASSERT_ALIASES
 #include "munit.h"
 
+#include <stdlib.h>
+
 extern MunitTest scan_tests[];
 extern MunitTest parse_tests[];
 extern MunitTest exec_tests[];
 extern MunitTest st_tests[];
 extern MunitTest prog_tests[];
+extern MunitTest arena_tests[];
+extern MunitTest image_tests[];
+extern MunitTest input_tests[];
+extern MunitTest batch_tests[];
+extern MunitTest serve_tests[];
 
 static MunitSuite suites[] = {
   {
@@ -44,6 +51,41 @@ static MunitSuite suites[] = {
     1,
     MUNIT_SUITE_OPTION_NONE
   },
+  {
+    "/arena",
+    arena_tests,
+    NULL,
+    1,
+    MUNIT_SUITE_OPTION_NONE
+  },
+  {
+    "/image",
+    image_tests,
+    NULL,
+    1,
+    MUNIT_SUITE_OPTION_NONE
+  },
+  {
+    "/input",
+    input_tests,
+    NULL,
+    1,
+    MUNIT_SUITE_OPTION_NONE
+  },
+  {
+    "/batch",
+    batch_tests,
+    NULL,
+    1,
+    MUNIT_SUITE_OPTION_NONE
+  },
+  {
+    "/serve",
+    serve_tests,
+    NULL,
+    1,
+    MUNIT_SUITE_OPTION_NONE
+  },
   { NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE }
 };
 
@@ -56,5 +98,8 @@ static const MunitSuite suite = {
 };
 
 int main(int argc, char* const* argv) {
+  /* Tests must not depend on (or fill) the user's
+   * cache. Those for the cache turn it back on. */
+  setenv("HVME_NO_CACHE", "1", 1);
   return munit_suite_main(&suite, NULL, argc, argv);
 }
@@ -2,12 +2,17 @@
 #include "munit.h"
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "../src/parse.h"
 #include "utils.h"
 
+/* Internal scan functions */
+extern int scan_blocks(Tokens* tokens, int fd);
+
 static inline Tokens setup_tokens(Token* token_arr, size_t len) {
-  Tokens tokens = new_tokens(NULL);
+  Tokens tokens = new_tokens(NULL, test_syms());
   free(tokens.cell);
   tokens.cell = token_arr;
   tokens.idx = len, tokens.len = len;
@@ -71,7 +76,7 @@ TEST(correct_parse_errors) {
  " | push pop ???\n"
  " |      ^^^",  36, stderr), ==, 1);
   } {
-    Token tk_arr[] = {{.t=TK_IDENT, .ident="blah"}, {.t=TK_ARG}};
+    Token tk_arr[] = {{.t=TK_IDENT, IDENT("blah")}, {.t=TK_ARG}};
     Tokens tokens = setup_tokens(tk_arr, 2);
     Insts insts = new_insts(NULL);
     int parse_res = parse(&tokens, &insts, NULL);
@@ -260,25 +265,25 @@ TEST(parse_fills_st) {
     {.t=TK_CONST},
     {.t=TK_UINT, .uilit=RAND_OFFSET()},
     {.t=TK_LABEL},
-    {.t=TK_IDENT, .ident="random_ident"},
+    {.t=TK_IDENT, IDENT("random_ident")},
     {.t=TK_POP},
     {.t=TK_LOC},
     {.t=TK_UINT, .uilit=0},
     {.t=TK_LABEL},
-    {.t=TK_IDENT, .ident="another_ident"},
+    {.t=TK_IDENT, IDENT("another_ident")},
   };
   Tokens tokens = setup_tokens(tk_arr, 10);
   Insts insts = new_insts(NULL);
   int parse_res = parse(&tokens, &insts, &st);
   assert_int(parse_res, ==, PARSE_OK);
   {
-    SymKey key = mk_key("random_ident", SBT_LABEL);
+    SymKey key = mk_key(intern_str(test_syms(), "random_ident"), SBT_LABEL);
     SymVal val;
     assert_int(get_st(st, &key, &val), ==, GTRES_OK);
     assert_int(val.inst_addr, ==, 1);
   }
   {
-    SymKey key = mk_key("another_ident", SBT_LABEL);
+    SymKey key = mk_key(intern_str(test_syms(), "another_ident"), SBT_LABEL);
     SymVal val;
     assert_int(get_st(st, &key, &val), ==, GTRES_OK);
     assert_int(val.inst_addr, ==, 2);
@@ -296,7 +301,7 @@ TEST(parse_function) {
     { .t=TK_CONST },
     { .t=TK_UINT, .uilit=RAND_OFFSET() },
     { .t=TK_FUNC },
-    { .t=TK_IDENT, .ident="blah_function" },
+    { .t=TK_IDENT, IDENT("blah_function") },
     { .t=TK_UINT, .uilit=nlocals },
   };
   Tokens tokens = setup_tokens(token_arr, 6);
@@ -304,7 +309,7 @@ TEST(parse_function) {
   int parse_res = parse(&tokens, &insts, &st);
   assert_int(parse_res, ==, PARSE_OK);
   {
-    SymKey key = mk_key("blah_function", SBT_FUNC);
+    SymKey key = mk_key(intern_str(test_syms(), "blah_function"), SBT_FUNC);
     SymVal val;
     assert_int(get_st(st, &key, &val), ==, GTRES_OK);
     assert_int(val.inst_addr, ==, 1);
@@ -316,6 +321,66 @@ TEST(parse_function) {
   return MUNIT_OK;
 }
 
+static const char* stream_src =
+  "function Main.main 2\n"
+  "  push constant 1234   // Spans more than one block.\n"
+  "  pop local 1\n"
+  "label LOOP_START\n"
+  "  push local 1\n  push constant 1\n  sub\n"
+  "  if-goto LOOP_START\n"
+  "  call Output.printInt 1\n"
+  "  goto LOOP_END\n"
+  "label LOOP_END\n"
+  "  return\n";
+
+static void assert_insts_equal(const Insts* a, const Insts* b) {
+  assert_int(a->idx, ==, b->idx);
+  for (size_t i = 0; i < a->idx; i++) {
+    INST_STR(a_str, test_syms(), &a->cell[i]);
+    INST_STR(b_str, test_syms(), &b->cell[i]);
+    assert_string_equal(a_str, b_str);
+    assert_int(a->cell[i].pos.ln, ==, b->cell[i].pos.ln);
+    assert_int(a->cell[i].pos.cl, ==, b->cell[i].pos.cl);
+    if (a->cell[i].code == CALL)
+      assert_int(a->cell[i].nargs, ==, b->cell[i].nargs);
+  }
+}
+
+TEST(scan_parse_matches_parse) {
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn, stream_src);
+
+  Tokens tokens = new_tokens(fn, test_syms());
+  assert_int(scan(&tokens), ==, SCAN_OK);
+  SymbolTable st = new_st();
+  Insts insts = new_insts(fn);
+  assert_int(parse(&tokens, &insts, &st), ==, PARSE_OK);
+  del_tokens(tokens);
+
+  // `SCAN_BLOCK_SIZE` is tiny in the unit tests so instructions
+  // and tokens are split between many blocks.
+  Tokens stream_tokens = new_tokens(fn, test_syms());
+  SymbolTable stream_st = new_st();
+  Insts stream_insts = new_insts(fn);
+  assert_int(scan_parse(&stream_tokens, &stream_insts, &stream_st), ==, PARSE_OK);
+  // At most the start of one instruction is left over.
+  assert_int(stream_tokens.idx, <, 3);
+  del_tokens(stream_tokens);
+
+  assert_insts_equal(&insts, &stream_insts);
+  assert_int(stream_st.num_inst, ==, st.num_inst);
+  SymKey key = mk_key(intern_str(test_syms(), "LOOP_END"), SBT_LABEL);
+  SymVal val;
+  assert_int(get_st(stream_st, &key, &val), ==, GTRES_OK);
+  assert_int(val.inst_addr, ==, 8);
+
+  del_st(st);
+  del_st(stream_st);
+  del_insts(insts);
+  del_insts(stream_insts);
+  return MUNIT_OK;
+}
+
 MunitTest parse_tests[] = {
   REG_TEST(parse_valid_insts),
   REG_TEST(reject_segments_start),
@@ -325,5 +390,6 @@ MunitTest parse_tests[] = {
   REG_TEST(correct_parse_errors),
   REG_TEST(parse_fills_st),
   REG_TEST(parse_function),
+  REG_TEST(scan_parse_matches_parse),
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
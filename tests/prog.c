@@ -1,17 +1,32 @@
 #define MUNIT_ENABLE_ASSERT_ALIASES
 #include "munit.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../src/prog.h"
+#include "../src/cache.h"
+#include "../src/image.h"
+#include "../src/exec.h"
+#include "../src/input.h"
 #include "utils.h"
 
 TEST(system_is_initialized) {
   const char* argv[] = {""};
-  Program* prog = make_prog(0, argv);
+  ProgramImage* prog = make_prog(0, argv);
   assert_int(prog->nfiles, ==, 1);
-  assert_int(prog->fi, ==, 0);
   assert_string_equal(prog->files[0].filename, "<system>");
+  /* Execution starts with the startup code. */
+  VmState* vm = new_vm(prog);
+  assert_int(vm->fi, ==, 0);
+  assert_int(vm->ei, ==, prog->files[0].ei);
+  assert_int(prog->files[0].insts.cell[vm->ei].code, ==, PUSH);
+  del_vm(vm);
   del_prog(prog);
 
   return MUNIT_OK;
@@ -26,10 +41,9 @@ TEST(single_file_prog_is_correct) {
       "add\n"
       "return\n");
   const char* argv[] = {fn};
-  Program* prog = make_prog(1, argv);
+  ProgramImage* prog = make_prog(1, argv);
   assert_ptr_not_null(prog);
   assert_int(prog->nfiles, ==, 2);
-  assert_int(prog->fi, ==, 0);
   assert_string_equal(prog->files[0].filename, "<system>");
   /* Check instructions of the given file */
   assert_int(prog->files[1].insts.cell[0].code, ==, PUSH);
@@ -42,7 +56,7 @@ TEST(single_file_prog_is_correct) {
   assert_int(prog->files[1].insts.cell[3].code, ==, RET);
   /* Check symbol table content */
   SymVal val;
-  SymKey key = mk_key("Sys.init", SBT_FUNC);
+  SymKey key = mk_key(intern_str(prog->syms, "Sys.init"), SBT_FUNC);
   assert_int(get_st(prog->files[1].st, &key, &val), ==, GTRES_OK);
   /* Check filename */
   assert_string_equal(prog->files[1].filename, fn);
@@ -59,17 +73,16 @@ TEST(multi_file_prog_is_correct) {
   char fn3[] = "/tmp/XXXXXX";
   setup_tmp(fn3,"push constant 2\nlabel cool\n");
   const char* argv[] = { fn1, fn2, fn3 };
-  Program* prog = make_prog(3, argv);
+  ProgramImage* prog = make_prog(3, argv);
   assert_ptr_not_null(prog);
   assert_int(prog->nfiles, ==, 4);
-  assert_int(prog->fi, ==, 0);
   assert_string_equal(prog->files[0].filename, "<system>");
   /* First file */
   assert_int(prog->files[1].insts.cell[0].code, ==, PUSH);
   assert_int(prog->files[1].insts.cell[0].mem.seg, ==, CONST);
   assert_int(prog->files[1].insts.cell[0].mem.offset, ==, 0);
   SymVal val1;
-  SymKey key1 = mk_key("wow", SBT_LABEL);
+  SymKey key1 = mk_key(intern_str(prog->syms, "wow"), SBT_LABEL);
   assert_int(get_st(prog->files[1].st, &key1, &val1), ==, GTRES_OK);
   assert_string_equal(prog->files[1].filename, fn1);
   /* Second file */
@@ -82,7 +95,7 @@ TEST(multi_file_prog_is_correct) {
   assert_int(prog->files[3].insts.cell[0].mem.seg, ==, CONST);
   assert_int(prog->files[3].insts.cell[0].mem.offset, ==, 2);
   SymVal val3;
-  SymKey key3 = mk_key("cool", SBT_LABEL);
+  SymKey key3 = mk_key(intern_str(prog->syms, "cool"), SBT_LABEL);
   assert_int(get_st(prog->files[3].st, &key3, &val3), ==, GTRES_OK);
   assert_string_equal(prog->files[3].filename, fn3);
 
@@ -99,17 +112,643 @@ TEST(abort_all_on_error) {
   char fn3[] = "/tmp/XXXXXX"; // Syntax error:
   setup_tmp(fn3,"push constant 2\nlabll cool\n");
   const char* argv[] = { fn1, fn2, fn3 };
-  Program* prog = make_prog(3, argv);
+  ProgramImage* prog = make_prog(3, argv);
   assert_ptr_equal(prog, NULL);
   /* Use Asan here to verify there
    * isn't a memory leak happening. */
   return MUNIT_OK;
 }
 
+TEST(parallel_prog_is_correct) {
+  enum { NFN = 6 };
+  char fn[NFN][12];
+  const char* argv[NFN];
+  for (int i = 0; i < NFN; i++) {
+    strcpy(fn[i], "/tmp/XXXXXX");
+    char src[64];
+    snprintf(src, sizeof(src), "label l%d\npush constant %d\n", i, i);
+    setup_tmp(fn[i], src);
+    argv[i] = fn[i];
+  }
+  ProgramImage* prog = make_prog_jobs(NFN, argv, 4);
+  assert_ptr_not_null(prog);
+  assert_int(prog->nfiles, ==, NFN + 1);
+  assert_string_equal(prog->files[0].filename, "<system>");
+  for (int i = 0; i < NFN; i++) {
+    File* file = &prog->files[i + 1];
+    assert_string_equal(file->filename, fn[i]);
+    assert_int(file->insts.idx, ==, 1);
+    assert_int(file->insts.cell[0].mem.offset, ==, i);
+    char label[8];
+    snprintf(label, sizeof(label), "l%d", i);
+    SymVal val;
+    SymKey key = mk_key(intern_str(prog->syms, label), SBT_LABEL);
+    assert_int(get_st(file->st, &key, &val), ==, GTRES_OK);
+  }
+
+  del_prog(prog);
+
+  return MUNIT_OK;
+}
+
+TEST(parallel_errors_are_ordered) {
+  char fn1[] = "/tmp/XXXXXX";
+  setup_tmp(fn1,"push constant 1\n");
+  char fn2[] = "/tmp/XXXXXX";
+  setup_tmp(fn2,"push constant 2\nlabll first\n");
+  char fn3[] = "/tmp/XXXXXX";
+  setup_tmp(fn3,"push constant 3\n");
+  char fn4[] = "/tmp/XXXXXX";
+  setup_tmp(fn4,"push constant 4\ngota second\n");
+  const char* argv[] = { fn1, fn2, fn3, fn4 };
+  ProgramImage* prog = make_prog_jobs(4, argv, 4);
+  assert_ptr_equal(prog, NULL);
+  /* Just like when loading one file after another,
+   * only the first error is reported. */
+  assert_int(check_stream("labll", 512, stderr), ==, 1);
+  assert_int(check_stream("gota", 512, stderr), ==, 0);
+  return MUNIT_OK;
+}
+
+TEST(functions_are_indexed) {
+  char fn1[] = "/tmp/XXXXXX";
+  setup_tmp(fn1,"function Main.main 0\nlabel loop\npush constant 0\nreturn\n");
+  char fn2[] = "/tmp/XXXXXX";
+  setup_tmp(fn2,"push constant 1\nfunction Util.id 2\nlabel loop\nreturn\n");
+  const char* argv[] = { fn1, fn2 };
+  ProgramImage* prog = make_prog(2, argv);
+  assert_ptr_not_null(prog);
+
+  SymVal val;
+  SymKey key = mk_key(intern_str(prog->syms, "Util.id"), SBT_FUNC);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_OK);
+  assert_int(val.fi, ==, 2);
+  assert_int(val.inst_addr, ==, 1);
+  assert_int(val.nlocals, ==, 2);
+  key = mk_key(intern_str(prog->syms, "Main.main"), SBT_FUNC);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_OK);
+  assert_int(val.fi, ==, 1);
+  key = mk_key(intern_str(prog->syms, "Sys.print_num"), SBT_FUNC);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_OK);
+  assert_int(val.fi, ==, 0);
+  /* Labels stay local to their file. */
+  key = mk_key(intern_str(prog->syms, "loop"), SBT_LABEL);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_ERR);
+
+  del_prog(prog);
+
+  return MUNIT_OK;
+}
+
+TEST(duplicate_functions_are_rejected) {
+  char fn1[] = "/tmp/XXXXXX";
+  setup_tmp(fn1,"function Main.main 0\nreturn\n");
+  char fn2[] = "/tmp/XXXXXX";
+  setup_tmp(fn2,"function Main.main 0\nreturn\n");
+  const char* argv[] = { fn1, fn2 };
+  ProgramImage* prog = make_prog(2, argv);
+  assert_ptr_equal(prog, NULL);
+  assert_int(check_stream("`Main.main` is defined in both", 512, stderr), ==, 1);
+
+  /* Builtins can't be redefined either. */
+  char fn3[] = "/tmp/XXXXXX";
+  setup_tmp(fn3,"function Sys.print_num 0\nreturn\n");
+  const char* argv2[] = { fn3 };
+  prog = make_prog_jobs(1, argv2, 2);
+  assert_ptr_equal(prog, NULL);
+  assert_int(check_stream("`Sys.print_num` is defined in both `<system>`", 512, stderr), ==, 1);
+
+  return MUNIT_OK;
+}
+
+/* Cache entry of what's in `fn` now. */
+static char* entry_of(const char* fn) {
+  char src[256];
+  FILE* f = fopen(fn, "rb");
+  assert_ptr_not_null(f);
+  size_t len = fread(src, 1, sizeof(src), f);
+  fclose(f);
+  return cache_entry(src, len);
+}
+
+TEST(unchanged_files_are_cached) {
+  char cache[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(cache));
+  setenv("XDG_CACHE_HOME", cache, 1);
+  unsetenv(CACHE_DISABLE);
+
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn, "push constant 1\npush constant 2\n");
+  char* entry = entry_of(fn);
+  assert_ptr_not_null(entry);
+  assert_ptr_equal(strstr(entry, cache), entry);
+  assert_int(access(entry, F_OK), ==, -1);
+
+  /* The first load fills the cache. */
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+  assert_int(access(entry, F_OK), ==, 0);
+  del_prog(prog);
+
+  /* Later loads read the entry instead of the source. Replace
+   * it to see that the source isn't scanned again. */
+  const char src[] = "push constant 1\npush constant 2\n";
+  char other_fn[] = "/tmp/XXXXXX";
+  setup_tmp(other_fn, "add\n");
+  const char* other_argv[] = { other_fn };
+  prog = make_prog(1, other_argv);
+  assert_ptr_not_null(prog);
+  assert_int(write_file_image(&prog->files[1], prog->syms,
+    src, sizeof(src) - 1, entry), ==, IMAGE_OK);
+  del_prog(prog);
+
+  prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+  assert_int(prog->files[1].insts.idx, ==, 1);
+  assert_int(prog->files[1].insts.cell[0].code, ==, ADD);
+  assert_string_equal(prog->files[1].insts.cell[0].pos.filename, fn);
+  del_prog(prog);
+
+  /* Entries made from another source with the same hash
+   * aren't used; the source is scanned again. */
+  prog = make_prog(1, other_argv);
+  assert_ptr_not_null(prog);
+  assert_int(write_file_image(&prog->files[1], prog->syms,
+    "add\n", 4, entry), ==, IMAGE_OK);
+  del_prog(prog);
+
+  prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+  assert_int(prog->files[1].insts.idx, ==, 2);
+  assert_int(prog->files[1].insts.cell[0].code, ==, PUSH);
+  del_prog(prog);
+
+  /* Edited files get a new entry. */
+  FILE* f = fopen(fn, "w");
+  assert_ptr_not_null(f);
+  fputs("push constant 3\n", f);
+  fclose(f);
+  char* new_entry = entry_of(fn);
+  assert_ptr_not_null(new_entry);
+  assert_string_not_equal(new_entry, entry);
+  prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+  assert_int(prog->files[1].insts.idx, ==, 1);
+  assert_int(prog->files[1].insts.cell[0].mem.offset, ==, 3);
+  del_prog(prog);
+
+  unlink(entry);
+  unlink(new_entry);
+  free(entry);
+  free(new_entry);
+  setenv(CACHE_DISABLE, "1", 1);
+
+  return MUNIT_OK;
+}
+
+extern void prune_cache(const char* dir, uint64_t max_size);
+
+/* Create `name` in `dir` with `size` bytes, last used at `mtime`. */
+static void setup_cached(const char* dir, const char* name, size_t size, time_t mtime) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE* f = fopen(path, "wb");
+  assert_ptr_not_null(f);
+  for (size_t i = 0; i < size; i++)
+    fputc('x', f);
+  fclose(f);
+  struct timespec times[2] = { { .tv_sec=mtime }, { .tv_sec=mtime } };
+  assert_int(utimensat(AT_FDCWD, path, times, 0), ==, 0);
+}
+
+static int is_cached(const char* dir, const char* name) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return access(path, F_OK) == 0;
+}
+
+TEST(cache_is_pruned) {
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+
+  char old[64];
+  char mid[64];
+  char new[64];
+  snprintf(old, sizeof(old), "1-4-v%d-%zu" IMAGE_EXT, IMAGE_VERSION, sizeof(Inst));
+  snprintf(mid, sizeof(mid), "2-4-v%d-%zu" IMAGE_EXT, IMAGE_VERSION, sizeof(Inst));
+  snprintf(new, sizeof(new), "3-4-v%d-%zu" IMAGE_EXT, IMAGE_VERSION, sizeof(Inst));
+  setup_cached(dir, old, 100, 1000);
+  setup_cached(dir, mid, 100, 2000);
+  setup_cached(dir, new, 100, 3000);
+  /* Entries of other versions go however recently they were used. */
+  setup_cached(dir, "4-4-v1-32" IMAGE_EXT, 10, 4000);
+  /* Half-written entries are left alone. */
+  setup_cached(dir, "5-4-v1-32" IMAGE_EXT ".abcdef", 10, 0);
+
+  /* The least recently used entries go until the rest fit. */
+  prune_cache(dir, 250);
+  assert_false(is_cached(dir, old));
+  assert_true(is_cached(dir, mid));
+  assert_true(is_cached(dir, new));
+  assert_false(is_cached(dir, "4-4-v1-32" IMAGE_EXT));
+  assert_true(is_cached(dir, "5-4-v1-32" IMAGE_EXT ".abcdef"));
+
+  prune_cache(dir, 1000);
+  assert_true(is_cached(dir, mid));
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, mid);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/%s", dir, new);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/5-4-v1-32" IMAGE_EXT ".abcdef", dir);
+  unlink(path);
+  assert_int(rmdir(dir), ==, 0);
+
+  return MUNIT_OK;
+}
+
+TEST(lazy_functions_are_parsed_on_call) {
+  const char* src =
+    "function Sys.init 0\n"
+    "push constant 4\n"
+    "call Lib.sq 1\n"
+    "return\n"
+    "function Lib.unused 0\n"
+    "this is not valid code\n"
+    "function Lib.sq 0\n"
+    "push argument 0\n"
+    "push argument 0\n"
+    "add\n"
+    "push argument 0\n"
+    "push argument 0\n"
+    "add\n"
+    "add\n"
+    "function Lib.end 0\n"
+    "return\n";
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn, src);
+  const char* argv[] = { fn };
+
+  /* Eagerly the error is found while loading. */
+  assert_ptr_equal(make_prog(1, argv), NULL);
+
+  ProgramImage* prog = make_prog_opts(1, argv, (LoadOpts) { .njobs=1, .lazy=1 });
+  assert_ptr_not_null(prog);
+  File* file = &prog->files[1];
+  assert_ptr_not_null(file->lazy);
+  assert_int(file->lazy->nfuncs, ==, 4);
+  SymVal val;
+  SymKey key = mk_key(intern_str(prog->syms, "Lib.sq"), SBT_FUNC);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_OK);
+  assert_size(val.inst_addr, ==, LAZY_ADDR + 2);
+  assert_int(val.fi, ==, 1);
+  assert_int(get_st(file->st, &key, &val), ==, GTRES_ERR);
+
+  /* `Lib.sq` falls through into `Lib.end` just like it would
+   * if everything was parsed. `Lib.unused` is never parsed. */
+  VmState* vm = new_vm(prog);
+  assert_int(exec_prog(vm), ==, 0);
+  assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 16);
+  del_vm(vm);
+  assert_true(file->lazy->funcs[2].parsed);
+  assert_true(file->lazy->funcs[3].parsed);
+  assert_false(file->lazy->funcs[1].parsed);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_OK);
+  assert_size(val.inst_addr, <, LAZY_ADDR);
+  assert_int(file->insts.cell[val.inst_addr].code, ==, PUSH);
+  assert_int(file->insts.cell[val.inst_addr].pos.ln, ==, 7);
+
+  /* Errors show up once the function is called. */
+  key = mk_key(intern_str(prog->syms, "Lib.unused"), SBT_FUNC);
+  assert_int(get_st(prog->funcs, &key, &val), ==, GTRES_OK);
+  assert_int(load_func(prog, key, &val), ==, 0);
+  assert_int(check_stream("wrong start of instruction", 512, stderr), ==, 1);
+  del_prog(prog);
+
+  /* Functions defined in two files are still found while loading. */
+  char fn2[] = "/tmp/XXXXXX";
+  setup_tmp(fn2, "function Lib.sq 0\nreturn\n");
+  const char* argv2[] = { fn, fn2 };
+  assert_ptr_equal(make_prog_opts(2, argv2, (LoadOpts) { .njobs=2, .lazy=1 }), NULL);
+  assert_int(check_stream("`Lib.sq` is defined in both", 1024, stderr), ==, 1);
+
+  return MUNIT_OK;
+}
+
+TEST(directories_are_expanded) {
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+  char path[64];
+  const char* names[] = { "b.vm", "a.vm", "test_result.txt" };
+  for (int i = 0; i < 3; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    FILE* f = fopen(path, "w");
+    assert_ptr_not_null(f);
+    fputs("push constant 1\n", f);
+    fclose(f);
+  }
+  /* Not a file even though the name ends in `.vm`. */
+  snprintf(path, sizeof(path), "%s/sub.vm", dir);
+  assert_int(mkdir(path, 0700), ==, 0);
+
+  char slash_dir[24];
+  snprintf(slash_dir, sizeof(slash_dir), "%s/", dir);
+  const char* args[] = { "first.vm", slash_dir };
+  unsigned int nfn;
+  char** fn = find_sources(2, args, &nfn);
+  assert_ptr_not_null(fn);
+  assert_int(nfn, ==, 3);
+  assert_string_equal(fn[0], "first.vm");
+  snprintf(path, sizeof(path), "%s/a.vm", dir);
+  assert_string_equal(fn[1], path);
+  snprintf(path, sizeof(path), "%s/b.vm", dir);
+  assert_string_equal(fn[2], path);
+  del_sources(fn, nfn);
+
+  /* Loading the directory loads its files. */
+  const char* dir_arg[] = { dir };
+  fn = find_sources(1, dir_arg, &nfn);
+  assert_ptr_not_null(fn);
+  ProgramImage* prog = make_prog(nfn, (const char**) fn);
+  del_sources(fn, nfn);
+  assert_ptr_not_null(prog);
+  assert_int(prog->nfiles, ==, 3);
+  del_prog(prog);
+
+  for (int i = 0; i < 3; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/sub.vm", dir);
+  rmdir(path);
+
+  /* Empty directories aren't programs. */
+  assert_ptr_equal(find_sources(1, dir_arg, &nfn), NULL);
+  assert_int(check_stream("doesn't contain any `.vm` files", 512, stderr), ==, 1);
+  rmdir(dir);
+
+  return MUNIT_OK;
+}
+
+/* Write `src` to `dir/name` and return the path in `fn`. */
+static void write_named(char* fn, size_t len, const char* dir, const char* name, const char* src) {
+  snprintf(fn, len, "%s/%s", dir, name);
+  FILE* f = fopen(fn, "w");
+  assert_ptr_not_null(f);
+  fputs(src, f);
+  fclose(f);
+}
+
+TEST(pipelined_prog_runs_while_loading) {
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+  char fn[4][32];
+  write_named(fn[0], sizeof(fn[0]), dir, "Broken.vm", "push constant 1\nlabll x\n");
+  write_named(fn[1], sizeof(fn[1]), dir, "Lib.vm",
+    "function Lib.twice 0\n"
+    "push argument 0\n"
+    "push argument 0\n"
+    "add\n"
+    "return\n");
+  write_named(fn[2], sizeof(fn[2]), dir, "Main.vm",
+    "function Main.main 0\n"
+    "push constant 20\n"
+    "call Lib.twice 1\n"
+    "return\n");
+  write_named(fn[3], sizeof(fn[3]), dir, "Sys.vm",
+    "function Sys.init 0\n"
+    "call Main.main 0\n"
+    "return\n");
+  const char* argv[] = { fn[0], fn[1], fn[2], fn[3] };
+  LoadOpts opts = { .njobs=2, .lazy=0, .pipeline=1 };
+
+  ProgramImage* prog = make_prog_opts(3, argv + 1, opts);
+  assert_ptr_not_null(prog);
+  VmState* vm = new_vm(prog);
+  assert_int(exec_prog(vm), ==, 0);
+  assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 40);
+  del_vm(vm);
+  del_prog(prog);
+
+  /* The broken file isn't needed to run the program,
+   * but it still fails once it's done. */
+  prog = make_prog_opts(4, argv, opts);
+  assert_ptr_not_null(prog);
+  vm = new_vm(prog);
+  assert_int(exec_prog(vm), ==, EXEC_LOAD_ERR);
+  assert_int(vm->stack.ops[vm->stack.sp - 1], ==, 40);
+  assert_int(check_stream("labll", 512, stderr), ==, 1);
+  del_vm(vm);
+  del_prog(prog);
+
+  /* So does a function defined twice in files it didn't search. */
+  write_named(fn[0], sizeof(fn[0]), dir, "Broken.vm",
+    "function Lib.twice 0\n"
+    "push constant 0\n"
+    "return\n");
+  prog = make_prog_opts(4, argv, opts);
+  assert_ptr_not_null(prog);
+  vm = new_vm(prog);
+  assert_int(exec_prog(vm), ==, EXEC_LOAD_ERR);
+  assert_int(check_stream("Lib.twice", 512, stderr), ==, 1);
+  del_vm(vm);
+  del_prog(prog);
+  write_named(fn[0], sizeof(fn[0]), dir, "Broken.vm", "push constant 1\nlabll x\n");
+
+  /* Programs can be deleted while they're still loading. */
+  prog = make_prog_opts(4, argv, opts);
+  assert_ptr_not_null(prog);
+  del_prog(prog);
+
+  /* A function that's nowhere to be found is an error once
+   * every file is loaded. Here the broken file is found first. */
+  write_named(fn[3], sizeof(fn[3]), dir, "Sys.vm",
+    "function Sys.init 0\n"
+    "call Nowhere.func 0\n"
+    "return\n");
+  prog = make_prog_opts(4, argv, opts);
+  assert_ptr_not_null(prog);
+  vm = new_vm(prog);
+  assert_int(exec_prog(vm), ==, EXEC_LOAD_ERR);
+  assert_int(check_stream("labll", 512, stderr), ==, 1);
+  del_vm(vm);
+  del_prog(prog);
+
+  /* Without it, the function is reported missing. */
+  prog = make_prog_opts(3, argv + 1, opts);
+  assert_ptr_not_null(prog);
+  vm = new_vm(prog);
+  assert_int(exec_prog(vm), ==, EXEC_ERR);
+  assert_int(check_stream("Nowhere.func", 512, stderr), ==, 1);
+  del_vm(vm);
+  del_prog(prog);
+
+  for (int i = 0; i < 4; i++)
+    unlink(fn[i]);
+  rmdir(dir);
+
+  return MUNIT_OK;
+}
+
+TEST(states_run_again_after_reset) {
+  /* Counts its runs in a static and on the heap. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "push static 3\n"
+    "push constant 1\n"
+    "add\n"
+    "pop static 3\n"
+    "push constant 500\n"
+    "pop pointer 0\n"
+    "push this 2\n"
+    "push static 3\n"
+    "add\n"
+    "pop this 2\n"
+    "push this 2\n"
+    "return\n");
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+
+  VmState* a = new_vm(prog);
+  VmState* b = new_vm(prog);
+  assert_int(exec_prog(a), ==, 0);
+  assert_int(a->stack.ops[a->stack.sp - 1], ==, 1);
+  /* The run leaves its memory as it was. */
+  assert_int(a->mem[1]._static[3], ==, 1);
+  assert_int(a->heap.mem[502], ==, 1);
+
+  /* The other state has memory of its own. */
+  assert_int(exec_prog(b), ==, 0);
+  assert_int(b->stack.ops[b->stack.sp - 1], ==, 1);
+
+  /* Only the written page of the heap is cleared. The word
+   * written past the tracking here survives the reset. */
+  assert_int(a->heap.dirty[0], ==, (uint64_t) 1 << (502 >> MEM_PAGE_BITS));
+  a->heap.mem[MEM_HEAP_SIZE - 1] = 7;
+  reset_vm(a);
+  assert_int(a->heap.dirty[0], ==, 0);
+  assert_int(a->heap.mem[MEM_HEAP_SIZE - 1], ==, 7);
+  a->heap.mem[MEM_HEAP_SIZE - 1] = 0;
+
+  for (int i = 0; i < 3; i++) {
+    reset_vm(a);
+    assert_int(a->stack.sp, ==, 0);
+    assert_int(a->mem[1]._static[3], ==, 0);
+    assert_int(a->heap.mem[502], ==, 0);
+    assert_int(a->heap._this, ==, 0);
+    assert_int(exec_prog(a), ==, 0);
+    assert_int(a->stack.ops[a->stack.sp - 1], ==, 1);
+  }
+
+  del_vm(a);
+  del_vm(b);
+  del_prog(prog);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+TEST(runs_stop_at_limits) {
+  /* Counts to 100 in a static, or spins forever after
+   * counting to 1 with input `1`. Spinning doesn't overflow
+   * however fast the instructions run. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "call Sys.read_num 0\n"
+    "pop static 1\n"
+    "label LOOP\n"
+    "push static 0\n"
+    "push constant 1\n"
+    "add\n"
+    "pop static 0\n"
+    "push static 1\n"
+    "if-goto SPIN\n"
+    "push static 0\n"
+    "push constant 100\n"
+    "lt\n"
+    "if-goto LOOP\n"
+    "push constant 0\n"
+    "return\n"
+    "label SPIN\n"
+    "goto SPIN\n");
+  const char* argv[] = { fn };
+  ProgramImage* prog = make_prog(1, argv);
+  assert_ptr_not_null(prog);
+
+  VmState* vm = new_vm(prog);
+  Input in = new_mem_input("0", 1);
+  vm->in = &in;
+  limit_vm(vm, 100000, 0);
+  assert_int(exec_prog(vm), ==, 0);
+  assert_int(vm->mem[1]._static[0], ==, 100);
+
+  /* The budget starts over with each run. */
+  for (int i = 0; i < 2; i++) {
+    reset_vm(vm);
+    in = new_mem_input("0", 1);
+    limit_vm(vm, 300, 0);
+    assert_int(exec_prog(vm), ==, EXEC_BUDGET);
+    assert_int(check_stream("instruction budget of 300 is used up", 512, stderr), ==, 1);
+    assert_int(vm->mem[1]._static[0], ==, 30);
+  }
+
+  reset_vm(vm);
+  in = new_mem_input("1", 1);
+  limit_vm(vm, 0, 20);
+  assert_int(exec_prog(vm), ==, EXEC_TIMEOUT);
+  assert_int(check_stream("time limit exceeded", 512, stderr), ==, 1);
+  assert_int(vm->mem[1]._static[0], ==, 1);
+
+  del_vm(vm);
+  del_prog(prog);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+TEST(words_are_narrowed_and_widened) {
+  /* Lengths around the vector sizes test the tails. */
+  Word words[80];
+  char chars[80];
+  Word back[80];
+  for (size_t n = 0; n <= 80; n += 7) {
+    for (size_t i = 0; i < n; i++)
+      words[i] = (Word) (i * 0x1234 + 0x41);
+    memset(chars, 0, sizeof(chars));
+    narrow_words(chars, words, n);
+    for (size_t i = 0; i < n; i++)
+      assert_char(chars[i], ==, (char) words[i]);
+    assert_char(chars[n < 80 ? n : 79], ==, n < 80 ? 0 : (char) words[79]);
+
+    widen_chars(back, chars, n);
+    for (size_t i = 0; i < n; i++)
+      assert_int(back[i], ==, (Word) chars[i]);
+  }
+
+  return MUNIT_OK;
+}
+
 MunitTest prog_tests[] = {
   REG_TEST(system_is_initialized),
   REG_TEST(single_file_prog_is_correct),
   REG_TEST(multi_file_prog_is_correct),
   REG_TEST(abort_all_on_error),
+  REG_TEST(parallel_prog_is_correct),
+  REG_TEST(parallel_errors_are_ordered),
+  REG_TEST(functions_are_indexed),
+  REG_TEST(duplicate_functions_are_rejected),
+  REG_TEST(unchanged_files_are_cached),
+  REG_TEST(cache_is_pruned),
+  REG_TEST(lazy_functions_are_parsed_on_call),
+  REG_TEST(directories_are_expanded),
+  REG_TEST(pipelined_prog_runs_while_loading),
+  REG_TEST(states_run_again_after_reset),
+  REG_TEST(runs_stop_at_limits),
+  REG_TEST(words_are_narrowed_and_widened),
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
@@ -2,24 +2,29 @@
 #include "munit.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "../src/scan.h"
 #include "utils.h"
 
-/* Internal scan function */
+/* Internal scan functions */
 extern ssize_t scan_blk(Tokens* tokens, const char* blk, size_t len);
+extern int scan_blocks(Tokens* tokens, int fd);
 
-#define TEST_SCAN_TOKEN(name, lit, token)           \
-TEST(name) {                                        \
-  Tokens tokens = new_tokens(NULL);                    \
-  char* blk = lit;                                  \
+#define TEST_SCAN_TOKEN(name, lit, token)            \
+TEST(name) {                                         \
+  Tokens tokens = new_tokens(NULL, test_syms());     \
+  char* blk = lit "\n";                              \
   ssize_t res = scan_blk(&tokens, blk, strlen(blk)); \
-  assert_int(res, ==, 0);                           \
+  assert_int(res, ==, 0);                            \
   assert_int(tokens.cell[0].t, ==, token);           \
-  TOKEN_STR(str, &tokens.cell[0]);                    \
-  assert_string_equal(str, blk);                    \
-  del_tokens(tokens);                                 \
-  return MUNIT_OK;                                  \
+  TOKEN_STR(str, test_syms(), &tokens.cell[0]);      \
+  assert_string_equal(str, lit);                     \
+  del_tokens(tokens);                                \
+  return MUNIT_OK;                                   \
 }
 
 TEST_SCAN_TOKEN(scan_push, "push", TK_PUSH)
@@ -52,7 +57,7 @@ TEST(scan_each_num) {
   // Accept all 65536 valid numbers  (0 - 65535).
   char blk[7];
   for (uint16_t i = 0; i < 65535; i++) {
-    Tokens tokens = new_tokens(NULL);
+    Tokens tokens = new_tokens(NULL, test_syms());
     strncpy(blk, "      ", 7);  // Reset to whitespace.
     snprintf(blk, 7, "%d ", i);  // Write the current number to the string.
     ssize_t res = scan_blk(&tokens, blk, strlen(blk));
@@ -65,22 +70,33 @@ TEST(scan_each_num) {
   return MUNIT_OK;
 }
 
-TEST(truncate_idents) {
-  //        This 25th character should be truncated.
-  //                                               |
-  char* label_blk = "label abstractachievedaccuracy1\n";
-  Tokens tokens = new_tokens(NULL);
+TEST(long_idents_are_kept) {
+  char* label_blk = "label Keyboard.abstractachievedaccuracyOfKeyPresses\n";
+  Tokens tokens = new_tokens(NULL, test_syms());
   ssize_t res =  scan_blk(&tokens, label_blk, strlen(label_blk));
-  assert_int(res, ==, 0);  // Input should still be accepted.
-  assert_string_equal(tokens.cell[1].ident, "abstractachievedaccuracy");
-  assert_int(check_stream("`abstractachievedaccuracy1` is too long to be an identifier", 20, stderr), ==, 1);
+  assert_int(res, ==, 0);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[1].ident), "Keyboard.abstractachievedaccuracyOfKeyPresses");
+  del_tokens(tokens);
+
+  return MUNIT_OK;
+}
+
+TEST(equal_idents_share_an_id) {
+  char* blk = "label loop\ngoto loop\ngoto loop_end\n";
+  Tokens tokens = new_tokens(NULL, test_syms());
+  ssize_t res =  scan_blk(&tokens, blk, strlen(blk));
+  assert_int(res, ==, 0);
+  assert_int(tokens.cell[1].ident, ==, tokens.cell[3].ident);
+  assert_int(tokens.cell[1].ident, !=, tokens.cell[5].ident);
+  assert_int(tokens.cell[1].ident, ==, intern_str(test_syms(), "loop"));
+  assert_int(intern(test_syms(), "loop_end_", 8), ==, tokens.cell[5].ident);
   del_tokens(tokens);
 
   return MUNIT_OK;
 }
 
 TEST(eat_ws) {
-  Tokens tokens = new_tokens(NULL);
+  Tokens tokens = new_tokens(NULL, test_syms());
   char* blk = " \t\n push \t \n pop  \n";
   ssize_t res = scan_blk(&tokens, blk, strlen(blk));
   assert_int(res, ==, 0);
@@ -98,7 +114,7 @@ TEST(eat_comments) {
     "// More comments ...\n"
     "push constant 2 // <- More code.\n";
 
-  Tokens tokens = new_tokens(NULL);
+  Tokens tokens = new_tokens(NULL, test_syms());
   ssize_t res = scan_blk(&tokens, blk, strlen(blk));
   assert_int(res, ==, 0);
   assert_int(tokens.cell[0].t, ==, TK_PUSH);
@@ -113,7 +129,7 @@ TEST(eat_comments) {
 }
 
 TEST(find_num_remaining) {
-  Tokens tokens = new_tokens(NULL);
+  Tokens tokens = new_tokens(NULL, test_syms());
   // `scan` should return `2` to signal that the last
   // two characters need to be copied to the start of the next block.
   char* blk = "push\npop\npop\npu";
@@ -128,13 +144,12 @@ TEST(find_num_remaining) {
 }
 
 TEST(scan_along_block_borders) {
-  assert_int(SCAN_BLOCK_SIZE, ==, MAX_TOKEN_LEN);
   {  // Scanning normal tokens over borders works.
     char fn[] = "/tmp/XXXXXX";
     // Start of next block (`TK_SCAN_BLOCK_SIZE` is 8 for unit tests).
     //                           |
     setup_tmp(fn, "pop  \npush\npush\npop\n");
-    Tokens tokens = new_tokens(fn);
+    Tokens tokens = new_tokens(fn, test_syms());
     int scan_res = scan(&tokens);
     assert_int(scan_res, ==, SCAN_OK);
     assert_int(tokens.cell[0].t, ==, TK_POP);
@@ -146,7 +161,7 @@ TEST(scan_along_block_borders) {
      // the content ends with a newline.
     char fn[] = "/tmp/XXXXXX";
     setup_tmp(fn, "pop\n");
-    Tokens tokens = new_tokens(fn);
+    Tokens tokens = new_tokens(fn, test_syms());
     int scan_res = scan(&tokens);
     assert_int(scan_res, ==, SCAN_OK);
     del_tokens(tokens);
@@ -156,7 +171,7 @@ TEST(scan_along_block_borders) {
   {  // Scanning numbers over borders works.
     char fn[] = "/tmp/XXXXXX";
     setup_tmp(fn, "pop  \n48907\npush");
-    Tokens tokens = new_tokens(fn);
+    Tokens tokens = new_tokens(fn, test_syms());
     int scan_res = scan(&tokens);
     assert_int(scan_res, ==, SCAN_OK);
     assert_int(tokens.cell[0].t, ==, TK_POP);
@@ -169,7 +184,7 @@ TEST(scan_along_block_borders) {
   {
     char fn[] = "/tmp/XXXXXX";
     setup_tmp(fn, "pop  \npush\n48907");
-    Tokens tokens = new_tokens(fn);
+    Tokens tokens = new_tokens(fn, test_syms());
     int scan_res = scan(&tokens);
     assert_int(scan_res, ==, SCAN_OK);
     assert_int(tokens.cell[0].t, ==, TK_POP);
@@ -186,7 +201,7 @@ TEST(scan_along_block_borders) {
     // scanner should still exit successfully.
     char fn[] = "/tmp/XXXXXX";
     setup_tmp(fn, "pop  \npush\n48");
-    Tokens tokens = new_tokens(fn);
+    Tokens tokens = new_tokens(fn, test_syms());
     int scan_res = scan(&tokens);
     assert_int(scan_res, ==, SCAN_OK);
     assert_int(tokens.cell[0].t, ==, TK_POP);
@@ -208,7 +223,7 @@ TEST(eat_comments_with_blocks) {
     "// More comments ...\n"
     "push constant 2 // <- More code.\n");
 
-  Tokens tokens = new_tokens(fn);
+  Tokens tokens = new_tokens(fn, test_syms());
   int scan_res = scan(&tokens);
   assert_int(scan_res, ==, SCAN_OK);
   assert_int(tokens.cell[0].t, ==, TK_PUSH);
@@ -224,13 +239,13 @@ TEST(eat_comments_with_blocks) {
 
 TEST(realloc_tokens_array) {
   {  // Reallocate array of insufficient size.
-    Tokens tokens = new_tokens(NULL);
+    Tokens tokens = new_tokens(NULL, test_syms());
     // Shrink the cell size.
     tokens.len = 2;
     tokens.cell = (Token*) realloc (tokens.cell, tokens.len * sizeof(Token));
     assert(tokens.cell != NULL);
 
-    char* blk = "pop\npop\npop\npop";
+    char* blk = "pop\npop\npop\npop\n";
     ssize_t res = scan_blk(&tokens, blk, strlen(blk));
     assert_int(res, ==, 0);
     // `ididx` is four instead of three (which would be
@@ -244,12 +259,12 @@ TEST(realloc_tokens_array) {
     del_tokens(tokens);
   }
   {  // Reallocate empty array
-    Tokens tokens = new_tokens(NULL);
+    Tokens tokens = new_tokens(NULL, test_syms());
     tokens.len = 0;
     tokens.cell = (Token*) realloc (tokens.cell, tokens.len * sizeof(Token));
     assert(tokens.cell == NULL);  // `NULL` since array is empty.
 
-    char* blk = "pop\npop\npop\npop";
+    char* blk = "pop\npop\npop\npop\n";
     ssize_t res = scan_blk(&tokens, blk, strlen(blk));
     assert_int(res, ==, 0);
     assert_int(tokens.idx, ==, 4);
@@ -263,6 +278,256 @@ TEST(realloc_tokens_array) {
   return MUNIT_OK;
 }
 
+TEST(keyword_prefixed_idents) {
+  // Whole words are classified. Identifiers which start
+  // with a keyword aren't split into two tokens.
+  char* blk = "call thisCall 0\nlabel andy\npop//no space\n";
+  Tokens tokens = new_tokens(NULL, test_syms());
+  ssize_t res = scan_blk(&tokens, blk, strlen(blk));
+  assert_int(res, ==, 0);
+  assert_int(tokens.idx, ==, 6);
+  assert_int(tokens.cell[0].t, ==, TK_CALL);
+  assert_int(tokens.cell[1].t, ==, TK_IDENT);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[1].ident), "thisCall");
+  assert_int(tokens.cell[2].t, ==, TK_UINT);
+  assert_int(tokens.cell[3].t, ==, TK_LABEL);
+  assert_int(tokens.cell[4].t, ==, TK_IDENT);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[4].ident), "andy");
+  assert_int(tokens.cell[5].t, ==, TK_POP);
+  del_tokens(tokens);
+
+  return MUNIT_OK;
+}
+
+TEST(keyword_prefixed_idents_across_blocks) {
+  {  // The first block ends right after the keyword `lt`.
+    Tokens tokens = new_tokens(NULL, test_syms());
+    char* blk = "label lt";
+    ssize_t res = scan_blk(&tokens, blk, strlen(blk));
+    assert_int(res, ==, 2);
+    assert_int(tokens.idx, ==, 1);
+    blk = "lt_x\n";
+    res = scan_blk(&tokens, blk, strlen(blk));
+    assert_int(res, ==, 0);
+    assert_int(tokens.idx, ==, 2);
+    assert_int(tokens.cell[1].t, ==, TK_IDENT);
+    assert_string_equal(sym_name(test_syms(), tokens.cell[1].ident), "lt_x");
+    del_tokens(tokens);
+  }
+  {  // `lt` ends at the end of the first 24 character block.
+    char fn[] = "/tmp/XXXXXX";
+    setup_tmp(fn, "label abcdefghijklmno lt_x\n");
+    int fd = open(fn, O_RDONLY);
+    assert_int(fd, !=, -1);
+    Tokens tokens = new_tokens(fn, test_syms());
+    int scan_res = scan_blocks(&tokens, fd);
+    close(fd);
+    assert_int(scan_res, ==, SCAN_OK);
+    assert_int(tokens.idx, ==, 3);
+    assert_int(tokens.cell[2].t, ==, TK_IDENT);
+    assert_string_equal(sym_name(test_syms(), tokens.cell[2].ident), "lt_x");
+    del_tokens(tokens);
+    unlink(fn);
+  }
+
+  return MUNIT_OK;
+}
+
+TEST(reject_invalid_words) {
+  char* inputs[] = { "push 123456\n", "push 12ab\n", "pu$h\n", NULL };
+  for (int i = 0; inputs[i] != NULL; i++) {
+    Tokens tokens = new_tokens(NULL, test_syms());
+    ssize_t res = scan_blk(&tokens, inputs[i], strlen(inputs[i]));
+    assert_int(res, ==, -1);
+    del_tokens(tokens);
+  }
+  assert_int(check_stream("couldn't scan input", 40, stderr), ==, 1);
+
+  return MUNIT_OK;
+}
+
+TEST(mapped_idents_are_interned) {
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn, "call Main.main 0\ngoto end\n");
+  Tokens tokens = new_tokens(fn, test_syms());
+  int scan_res = scan(&tokens);
+  assert_int(scan_res, ==, SCAN_OK);
+  assert_int(tokens.idx, ==, 5);
+  assert_int(tokens.cell[1].t, ==, TK_IDENT);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[1].ident), "Main.main");
+  assert_int(tokens.cell[4].t, ==, TK_IDENT);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[4].ident), "end");
+  del_tokens(tokens);
+
+  return MUNIT_OK;
+}
+
+/* Scan `cnt` from a file: mapped with `scan` if `mapped`,
+ * otherwise read with `scan_blocks`. */
+static Tokens scan_file(const char* cnt, int mapped) {
+  static char fn[] = "/tmp/XXXXXX";
+  strcpy(fn, "/tmp/XXXXXX");
+  setup_tmp(fn, cnt);
+  Tokens tokens = new_tokens(fn, test_syms());
+  int scan_res;
+  if (mapped) {
+    scan_res = scan(&tokens);
+  } else {
+    int fd = open(fn, O_RDONLY);
+    assert_int(fd, !=, -1);
+    scan_res = scan_blocks(&tokens, fd);
+    close(fd);
+  }
+  assert_int(scan_res, ==, SCAN_OK);
+  unlink(fn);
+  return tokens;
+}
+
+TEST(block_ends_dont_cut_tokens) {
+  // Shifting the words by up to a block puts every word and
+  // every split point within it at the end of a block (or
+  // view into the mapping) once. The tokens must always be
+  // the ones of scanning everything at once.
+  const char* body =
+    "label lt_x\ngoto ltx // lt comment\npush constant 12345\n"
+    "call this.that 2\nlabel pushpop\nif-goto not_eq\nreturn\n";
+  char cnt[256];
+  for (size_t pad = 0; pad <= SCAN_BLOCK_SIZE; pad++) {
+    memset(cnt, ' ', pad);
+    strcpy(cnt + pad, body);
+
+    Tokens expect = new_tokens(NULL, test_syms());
+    assert_int(scan_src(&expect, cnt, strlen(cnt)), ==, SCAN_OK);
+
+    for (int mapped = 0; mapped <= 1; mapped++) {
+      Tokens tokens = scan_file(cnt, mapped);
+      assert_int(tokens.idx, ==, expect.idx);
+      for (size_t i = 0; i < tokens.idx; i++) {
+        assert_int(tokens.cell[i].t, ==, expect.cell[i].t);
+        assert_int(tokens.cell[i].ident, ==, expect.cell[i].ident);
+        assert_int(tokens.cell[i].uilit, ==, expect.cell[i].uilit);
+        assert_int(tokens.cell[i].pos.ln, ==, expect.cell[i].pos.ln);
+        assert_int(tokens.cell[i].pos.cl, ==, expect.cell[i].pos.cl);
+      }
+      del_tokens(tokens);
+    }
+    del_tokens(expect);
+  }
+
+  return MUNIT_OK;
+}
+
+TEST(mapped_page_sized_file_without_nl) {
+  // The synthesized newline lands on a page of its own.
+  size_t size = sysconf(_SC_PAGESIZE);
+  char* cnt = (char*) malloc (size + 1);
+  memset(cnt, ' ', size);
+  memcpy(cnt, "push\n", 5);
+  memcpy(cnt + size - 3, "end", 3);
+  cnt[size] = '\0';
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn, cnt);
+  free(cnt);
+
+  Tokens tokens = new_tokens(fn, test_syms());
+  int scan_res = scan(&tokens);
+  assert_int(scan_res, ==, SCAN_OK);
+  assert_int(tokens.idx, ==, 2);
+  assert_int(tokens.cell[0].t, ==, TK_PUSH);
+  assert_int(tokens.cell[1].t, ==, TK_IDENT);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[1].ident), "end");
+  del_tokens(tokens);
+
+  return MUNIT_OK;
+}
+
+TEST(scan_blocks_interns_idents) {
+  char fn[] = "/tmp/XXXXXX";
+  // Identifiers cross the borders of the 24 character blocks
+  // and the last one doesn't even fit into a single block.
+  setup_tmp(fn, "label some_long_label\ngoto some_long_label\n"
+    "call Keyboard.readLineAndWaitForEnter 0\n");
+  int fd = open(fn, O_RDONLY);
+  assert_int(fd, !=, -1);
+  Tokens tokens = new_tokens(fn, test_syms());
+  int scan_res = scan_blocks(&tokens, fd);
+  close(fd);
+  assert_int(scan_res, ==, SCAN_OK);
+  assert_int(tokens.idx, ==, 7);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[1].ident), "some_long_label");
+  assert_int(tokens.cell[3].ident, ==, tokens.cell[1].ident);
+  assert_string_equal(sym_name(test_syms(), tokens.cell[5].ident), "Keyboard.readLineAndWaitForEnter");
+  assert_int(tokens.cell[6].t, ==, TK_UINT);
+  del_tokens(tokens);
+
+  return MUNIT_OK;
+}
+
+TEST(long_ws_and_comment_runs) {
+  // Runs of whitespace and comments longer than a vector
+  // chunk, with newlines at and around chunk boundaries.
+  char blk[512] = "";
+  strcat(blk, "  \t                                           \n");
+  strcat(blk, "\n\r\n   \v\f                                  push");
+  strcat(blk, "                                                        \n");
+  strcat(blk, "// a comment that is longer than any vector register used\n");
+  strcat(blk, "                               //and another one\n\n");
+  strcat(blk, "\t\tadd\n");
+  Tokens tokens = new_tokens(NULL, test_syms());
+  ssize_t res = scan_blk(&tokens, blk, strlen(blk));
+  assert_int(res, ==, 0);
+  assert_int(tokens.idx, ==, 2);
+  assert_int(tokens.cell[0].t, ==, TK_PUSH);
+  assert_int(tokens.cell[0].pos.ln, ==, 3);
+  assert_int(tokens.cell[0].pos.cl, ==, 39);
+  assert_int(tokens.cell[1].t, ==, TK_ADD);
+  assert_int(tokens.cell[1].pos.ln, ==, 7);
+  assert_int(tokens.cell[1].pos.cl, ==, 2);
+  del_tokens(tokens);
+
+  return MUNIT_OK;
+}
+
+TEST(find_funcs_skips_bodies_and_comments) {
+  const char src[] =
+    "push constant 1\n"
+    "function A.a 2 // function B.b 1\n"
+    "  label function_end\n"
+    "\tfunction\n"
+    "  A.b // name\n"
+    "  0\n"
+    "call A.a 0\n";
+  FuncStart* starts = NULL;
+  size_t n = 0;
+  assert_int(find_funcs(src, sizeof(src) - 1, test_syms(), &starts, &n), ==, SCAN_OK);
+  assert_int(n, ==, 2);
+  assert_int(starts[0].offset, ==, 16);
+  assert_int(starts[0].pos.ln, ==, 1);
+  assert_int(starts[0].pos.cl, ==, 0);
+  assert_int(starts[0].ident, ==, intern_str(test_syms(), "A.a"));
+  assert_int(starts[0].nlocals, ==, 2);
+  assert_int(starts[1].pos.ln, ==, 3);
+  assert_int(starts[1].pos.cl, ==, 1);
+  assert_int(starts[1].ident, ==, intern_str(test_syms(), "A.b"));
+  assert_int(starts[1].nlocals, ==, 0);
+  free(starts);
+
+  /* Broken headers are left to the parser. */
+  const char* broken[] = {
+    "function 2 A.a\n",
+    "function A.a\n",
+    "function A.a 70000\n",
+    "function push 0\n",
+  };
+  for (size_t i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+    starts = NULL;
+    assert_int(find_funcs(broken[i], strlen(broken[i]), test_syms(), &starts, &n), ==, SCAN_ERR);
+    assert_ptr_equal(starts, NULL);
+  }
+
+  return MUNIT_OK;
+}
+
 MunitTest scan_tests[] = {
   REG_TEST(scan_push),
   REG_TEST(scan_pop),
@@ -289,7 +554,8 @@ MunitTest scan_tests[] = {
   REG_TEST(scan_call),
   REG_TEST(scan_return),
   REG_TEST(scan_if_goto),
-  REG_TEST(truncate_idents),
+  REG_TEST(long_idents_are_kept),
+  REG_TEST(equal_idents_share_an_id),
   REG_TEST(scan_each_num),
   REG_TEST(eat_ws),
   REG_TEST(eat_comments),
@@ -297,5 +563,14 @@ MunitTest scan_tests[] = {
   REG_TEST(scan_along_block_borders),
   REG_TEST(eat_comments_with_blocks),
   REG_TEST(realloc_tokens_array),
+  REG_TEST(keyword_prefixed_idents),
+  REG_TEST(keyword_prefixed_idents_across_blocks),
+  REG_TEST(reject_invalid_words),
+  REG_TEST(mapped_idents_are_interned),
+  REG_TEST(mapped_page_sized_file_without_nl),
+  REG_TEST(block_ends_dont_cut_tokens),
+  REG_TEST(scan_blocks_interns_idents),
+  REG_TEST(long_ws_and_comment_runs),
+  REG_TEST(find_funcs_skips_bodies_and_comments),
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
@@ -0,0 +1,254 @@
+#define MUNIT_ENABLE_ASSERT_ALIASES
+#include "munit.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/serve.h"
+#include "utils.h"
+
+static void* server_thread(void* arg) {
+  run_server((Server*) arg);
+  return NULL;
+}
+
+/* Run `id` with `in` over `fd` and check the result. */
+static void check_run(int fd, const char* id, uint64_t budget, const char* in,
+                      int status, const char* out, const char* err) {
+  RunRequest req = {
+    .id=id, .budget=budget, .timeout_ms=0, .in=in, .in_len=strlen(in),
+  };
+  RunResult res;
+  assert_int(request_run(fd, &req, &res), ==, 1);
+  assert_int(res.status, ==, status);
+  assert_string_equal(res.out, out);
+  assert_ptr_not_null(strstr(res.err, err));
+  del_result(&res);
+}
+
+TEST(server_runs_requests) {
+  /* Adds the input to a static, which is `0` at the start of each run. */
+  char sum_fn[] = "/tmp/XXXXXX";
+  setup_tmp(sum_fn,
+    "function Sys.init 0\n"
+    "call Sys.read_num 0\n"
+    "push static 0\n"
+    "add\n"
+    "pop static 0\n"
+    "push static 0\n"
+    "call Sys.print_num 1\n"
+    "return\n");
+  char loop_fn[] = "/tmp/XXXXXX";
+  setup_tmp(loop_fn,
+    "function Sys.init 0\n"
+    "label LOOP\n"
+    "goto LOOP\n");
+  const char* sum_argv[] = { sum_fn };
+  const char* loop_argv[] = { loop_fn };
+  ServeProg progs[] = {
+    { .id="sum", .prog=make_prog(1, sum_argv) },
+    { .id="loop", .prog=make_prog(1, loop_argv) },
+  };
+  assert_ptr_not_null(progs[0].prog);
+  assert_ptr_not_null(progs[1].prog);
+
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+  char path[64];
+  snprintf(path, sizeof(path), "%s/sock", dir);
+  assert_int(connect_server(path), ==, -1);
+
+  Server* srv = new_server(path, progs, 2, 2, NULL);
+  assert_ptr_not_null(srv);
+  /* Another server can't take over the socket. */
+  assert_null(new_server(path, progs, 2, 1, NULL));
+  pthread_t thread;
+  assert_int(pthread_create(&thread, NULL, server_thread, srv), ==, 0);
+
+  /* Any number of requests are sent over one connection. */
+  int a = connect_server(path);
+  assert_int(a, !=, -1);
+  check_run(a, "sum", 0, "12\n", RUN_OK, "12\n", "");
+  check_run(a, "sum", 0, "30", RUN_OK, "30\n", "");
+  check_run(a, "sum", 0, "oops\n", RUN_ERR, "", "only accepts digits");
+  check_run(a, "sum", 3, "1\n", RUN_BUDGET, "", "budget of 3 is used up");
+  check_run(a, "nope", 0, "", RUN_UNKNOWN, "", "no program `nope`");
+
+  /* Connections are served at the same time. */
+  int b = connect_server(path);
+  assert_int(b, !=, -1);
+  RunRequest req = { .id="loop", .timeout_ms=20, .in="" };
+  RunResult res;
+  assert_int(request_run(b, &req, &res), ==, 1);
+  assert_int(res.status, ==, RUN_TIMEOUT);
+  assert_ptr_not_null(strstr(res.err, "time limit exceeded"));
+  del_result(&res);
+  check_run(a, "sum", 0, "7\n", RUN_OK, "7\n", "");
+
+  /* Malformed requests end the connection. */
+  assert_int(write(b, "walk\n", 5), ==, 5);
+  char buf[64] = {0};
+  assert_int(read(b, buf, sizeof(buf) - 1), >, 0);
+  assert_ptr_not_null(strstr(buf, "bad 0"));
+  close(b);
+
+  /* So do headers without an end. */
+  b = connect_server(path);
+  assert_int(b, !=, -1);
+  char junk[1024];
+  memset(junk, 'x', sizeof(junk));
+  assert_int(write(b, junk, sizeof(junk)), ==, sizeof(junk));
+  memset(buf, 0, sizeof(buf));
+  assert_int(read(b, buf, sizeof(buf) - 1), >, 0);
+  assert_ptr_not_null(strstr(buf, "bad 0"));
+  close(b);
+
+  /* Stopping the server closes the connections that are left. */
+  stop_server(srv);
+  pthread_join(thread, NULL);
+  assert_int(read(a, buf, sizeof(buf)), ==, 0);
+  close(a);
+  del_server(srv);
+  assert_int(access(path, F_OK), ==, -1);
+
+  del_prog(progs[0].prog);
+  del_prog(progs[1].prog);
+  rmdir(dir);
+  unlink(sum_fn);
+  unlink(loop_fn);
+
+  return MUNIT_OK;
+}
+
+TEST(served_runs_only_open_allowed_files) {
+  /* Opens the file named in the first line of the input
+   * in the mode in the second line and prints the handle. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "push constant 100\n"
+    "call Sys.read_str 1\n"
+    "pop temp 0\n"
+    "call Sys.read_num 0\n"
+    "pop temp 1\n"
+    "push temp 0\n"
+    "push constant 100\n"
+    "push temp 1\n"
+    "call Sys.file_open 3\n"
+    "call Sys.print_num 1\n"
+    "return\n");
+  const char* argv[] = { fn };
+  ServeProg progs[] = { { .id="open", .prog=make_prog(1, argv) } };
+  assert_ptr_not_null(progs[0].prog);
+
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+  char files_dir[64];
+  snprintf(files_dir, sizeof(files_dir), "%s/files", dir);
+  assert_int(mkdir(files_dir, 0755), ==, 0);
+  char path[64];
+  snprintf(path, sizeof(path), "%s/sock", dir);
+  char escaped[64];
+  snprintf(escaped, sizeof(escaped), "%s/escaped", dir);
+  char inside[128];
+  snprintf(inside, sizeof(inside), "%s/inside", files_dir);
+  char escaped_in[128];
+  snprintf(escaped_in, sizeof(escaped_in), "%s\n1\n", escaped);
+
+  /* `-1` (65535) is the handle of files that can't be opened. */
+  for (int confined = 1; confined >= 0; confined--) {
+    Server* srv = new_server(path, progs, 1, 1, confined ? files_dir : NULL);
+    assert_ptr_not_null(srv);
+    pthread_t thread;
+    assert_int(pthread_create(&thread, NULL, server_thread, srv), ==, 0);
+
+    int fd = connect_server(path);
+    assert_int(fd, !=, -1);
+    check_run(fd, "open", 0, "/etc/passwd\n0\n", RUN_OK, "65535\n", "");
+    check_run(fd, "open", 0, "../escaped\n1\n", RUN_OK, "65535\n", "");
+    check_run(fd, "open", 0, escaped_in, RUN_OK, "65535\n", "");
+    assert_int(access(escaped, F_OK), ==, -1);
+    check_run(fd, "open", 0, "inside\n1\n", RUN_OK, confined ? "0\n" : "65535\n", "");
+    assert_int(access(inside, F_OK), ==, confined ? 0 : -1);
+    unlink(inside);
+    close(fd);
+
+    stop_server(srv);
+    pthread_join(thread, NULL);
+    del_server(srv);
+  }
+
+  del_prog(progs[0].prog);
+  rmdir(files_dir);
+  rmdir(dir);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+typedef struct {
+  int fd;
+  int ok;
+  RunResult res;
+} Client;
+
+static void* client_thread(void* arg) {
+  Client* c = (Client*) arg;
+  RunRequest req = { .id="loop", .in="" };
+  c->ok = request_run(c->fd, &req, &c->res);
+  return NULL;
+}
+
+TEST(stopping_ends_runs_in_progress) {
+  /* Without limits in the request, only the server's
+   * default timeout would end this run. */
+  char fn[] = "/tmp/XXXXXX";
+  setup_tmp(fn,
+    "function Sys.init 0\n"
+    "label LOOP\n"
+    "goto LOOP\n");
+  const char* argv[] = { fn };
+  ServeProg progs[] = { { .id="loop", .prog=make_prog(1, argv) } };
+  assert_ptr_not_null(progs[0].prog);
+
+  char dir[] = "/tmp/XXXXXX";
+  assert_ptr_not_null(mkdtemp(dir));
+  char path[64];
+  snprintf(path, sizeof(path), "%s/sock", dir);
+  Server* srv = new_server(path, progs, 1, 1, NULL);
+  assert_ptr_not_null(srv);
+  pthread_t thread;
+  assert_int(pthread_create(&thread, NULL, server_thread, srv), ==, 0);
+
+  Client c = { .fd=connect_server(path) };
+  assert_int(c.fd, !=, -1);
+  pthread_t client;
+  assert_int(pthread_create(&client, NULL, client_thread, &c), ==, 0);
+  usleep(50 * 1000);
+
+  uint64_t start = now_ns();
+  stop_server(srv);
+  pthread_join(thread, NULL);
+  pthread_join(client, NULL);
+  assert_int(now_ns() - start, <, (uint64_t) 2000 * 1000000);
+  /* The run ended before it could time out. */
+  assert_int(c.ok, ==, 0);
+
+  close(c.fd);
+  del_server(srv);
+  del_prog(progs[0].prog);
+  rmdir(dir);
+  unlink(fn);
+
+  return MUNIT_OK;
+}
+
+MunitTest serve_tests[] = {
+  REG_TEST(server_runs_requests),
+  REG_TEST(served_runs_only_open_allowed_files),
+  REG_TEST(stopping_ends_runs_in_progress),
+  { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
+};
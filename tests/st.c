@@ -1,6 +1,10 @@
 #define MUNIT_ENABLE_ASSERT_ALIASES
 #include "munit.h"
 
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "../src/st.h"
 #include "utils.h"
 
@@ -10,21 +14,21 @@ TEST(st_io_works) {
   char* functions[] = {"This", "function", "is", "very", "important", NULL};
 
   for (int i = 0; labels[i] != NULL; i++)
-    insert_st(&s, mk_key(labels[i], SBT_LABEL), mk_lbval(i));
+    insert_st(&s, mk_key(intern_str(test_syms(), labels[i]), SBT_LABEL), mk_lbval(i));
 
   for (int j = 0; functions[j] != NULL; j++)
-    insert_st(&s, mk_key(functions[4 - j], SBT_FUNC), mk_lbval(j));
+    insert_st(&s, mk_key(intern_str(test_syms(), functions[4 - j]), SBT_FUNC), mk_lbval(j));
   
   SymVal val;
   SymKey key;
   for (int i = 0; labels[i] != NULL; i++) {
-    key = mk_key(labels[i], SBT_LABEL);
+    key = mk_key(intern_str(test_syms(), labels[i]), SBT_LABEL);
     assert_int(get_st(s, &key, &val), ==, GTRES_OK);
     assert_int(val.inst_addr, ==, i);
   }
   
   for (int j = 0; functions[j] != NULL; j++) {
-    key = mk_key(functions[4 - j], SBT_FUNC);
+    key = mk_key(intern_str(test_syms(), functions[4 - j]), SBT_FUNC);
     assert_int(get_st(s, &key, &val), ==, GTRES_OK);
     assert_int(val.inst_addr, ==, j);
   }
@@ -39,7 +43,7 @@ TEST(data_collisions_are_rejected) {
   size_t num_inst_a =  324;  // Any number.
   size_t num_inst_b =  7806;  // Any number not equal to `num_inst_a`.
 
-  SymKey key = mk_key("someIdent", SBT_LABEL);
+  SymKey key = mk_key(intern_str(test_syms(), "someIdent"), SBT_LABEL);
   assert_int(insert_st(&s, key, mk_lbval(num_inst_a)), ==, INRES_OK);
   assert_int(insert_st(&s, key, mk_lbval(num_inst_b)), ==, INRES_EXISTS);
   SymVal val;
@@ -51,8 +55,100 @@ TEST(data_collisions_are_rejected) {
   return MUNIT_OK;
 }
 
+TEST(grown_st_keeps_all_symbols) {
+  // Insert enough symbols to grow the table many times. Labels
+  // and functions share the IDs so their keys only differ in type.
+  enum { NSYMS = 20000 };
+  SymbolTable s = new_st();
+  Arena arena = new_arena();
+  SymbolTable as = new_arena_st(&arena);
+  SymId* ids = (SymId*) calloc (NSYMS, sizeof(SymId));
+  assert_ptr_not_null(ids);
+  for (size_t i = 0; i < NSYMS; i++) {
+    char ident[32];
+    snprintf(ident, sizeof(ident), "Class%zu.method", i);
+    ids[i] = intern_str(test_syms(), ident);
+    assert_int(insert_st(&s, mk_key(ids[i], SBT_LABEL), mk_lbval(i)), ==, INRES_OK);
+    assert_int(insert_st(&s, mk_key(ids[i], SBT_FUNC), mk_fnval(i + 1, i)), ==, INRES_OK);
+    assert_int(insert_st(&as, mk_key(ids[i], SBT_FUNC), mk_fnval(i, i)), ==, INRES_OK);
+  }
+  assert_int(s.used, ==, 2 * NSYMS);
+  assert_int(s.len & (s.len - 1), ==, 0);
+  assert_int(s.used * 100, <=, s.len * ST_MAX_LOAD);
+
+  for (size_t i = 0; i < NSYMS; i++) {
+    SymVal val;
+    SymKey key = mk_key(ids[i], SBT_LABEL);
+    assert_int(get_st(s, &key, &val), ==, GTRES_OK);
+    assert_int(val.inst_addr, ==, i);
+    key = mk_key(ids[i], SBT_FUNC);
+    assert_int(get_st(s, &key, &val), ==, GTRES_OK);
+    assert_int(val.inst_addr, ==, i + 1);
+    assert_int(val.nlocals, ==, (uint16_t) i);
+    assert_int(get_st(as, &key, &val), ==, GTRES_OK);
+    assert_int(val.inst_addr, ==, i);
+    // Inserting the same symbol again changes nothing.
+    assert_int(insert_st(&as, key, mk_fnval(i, i)), ==, INRES_OK);
+  }
+  assert_int(as.used, ==, NSYMS);
+
+  SymVal val;
+  SymKey missing = mk_key(intern_str(test_syms(), "NotInserted.anywhere"), SBT_FUNC);
+  assert_int(get_st(s, &missing, &val), ==, GTRES_ERR);
+
+  free(ids);
+  del_st(s);
+  del_st(as);
+  del_arena(arena);
+
+  return MUNIT_OK;
+}
+
+enum { NPOOL_SYMS = 5000 };
+
+static void* intern_many(void* arg) {
+  SymPool* syms = (SymPool*) arg;
+  for (size_t i = 0; i < NPOOL_SYMS; i++) {
+    char ident[32];
+    snprintf(ident, sizeof(ident), "Other%zu.f", i);
+    intern_str(syms, ident);
+  }
+  return NULL;
+}
+
+TEST(pools_keep_names_while_growing) {
+  SymPool* syms = new_pool();
+  SymId first = intern_str(syms, "Main.main");
+  assert_int(first, !=, SYM_NONE);
+
+  /* Names are looked up while another thread adds to the pool. */
+  pthread_t thread;
+  assert_int(pthread_create(&thread, NULL, intern_many, syms), ==, 0);
+  for (size_t i = 0; i < NPOOL_SYMS; i++) {
+    char ident[32];
+    snprintf(ident, sizeof(ident), "Own%zu.f", i);
+    SymId id = intern_str(syms, ident);
+    assert_string_equal(sym_name(syms, id), ident);
+    assert_string_equal(sym_name(syms, first), "Main.main");
+  }
+  pthread_join(thread, NULL);
+  assert_int(intern_str(syms, "Other0.f"), ==, intern(syms, "Other0.fx", 8));
+
+  /* Another pool numbers its identifiers on its own. */
+  SymPool* other = new_pool();
+  assert_int(intern_str(other, "Main.main"), ==, first);
+  assert_string_equal(sym_name(other, intern_str(other, "Own1.f")), "Own1.f");
+  del_pool(other);
+
+  del_pool(syms);
+
+  return MUNIT_OK;
+}
+
 MunitTest st_tests[] = {
   REG_TEST(st_io_works),
   REG_TEST(data_collisions_are_rejected),
+  REG_TEST(grown_st_keeps_all_symbols),
+  REG_TEST(pools_keep_names_while_growing),
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }  
 };
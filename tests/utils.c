@@ -38,3 +38,10 @@ const char* setup_tmp(char* fn, const char* cnt) {
   close(fd);
   return fn;
 }
+
+SymPool* test_syms(void) {
+  static SymPool* syms = NULL;
+  if (syms == NULL)
+    syms = new_pool();
+  return syms;
+}
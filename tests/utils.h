@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "../src/intern.h"
+
 #define TEST(name) \
   static MunitResult name(MUNIT_UNUSED const MunitParameter p[], MUNIT_UNUSED void* fixture)
 
@@ -15,8 +17,16 @@
 #define RAND_OFFSET() \
   munit_rand_int_range(0, 65535)
 
+// Designated initializer for the identifier of a
+// `TK_IDENT` token from a string literal.
+#define IDENT(lit) \
+  .ident=intern_str(test_syms(), lit)
+
 int check_stream(const char* expect, size_t nnoise, FILE* stream);
 
 const char* setup_tmp(char* fn, const char* cnt);
 
+// Pool for identifiers which don't belong to a program.
+SymPool* test_syms(void);
+
 #endif  // _UTILS_H_